@@ -0,0 +1,447 @@
+/**
+ * Microbenchmarks of the hot parts of the simulator, the results are one JSON document so they can be
+ * compared across commits:
+ * - scan: ScanSimulator2D::scan() on every map yaml in maps/, from poses spread over the free space, with another car
+ *   2m in front, at several beam counts, packet and scalar ray marching, in ns per beam
+ * - distance_transform: DistanceTransform::distance_2d() of random maps of several sizes, in ns per cell
+ * - vehicle_model: STKinematics::update() in the dynamic and the kinematic regime, update_rk4() and
+ *   BatchVehicleModel::step(), in steps per second, and RolloutService::linearize() of an MPC horizon on all threads
+ *
+ * usage: benchmarks [--maps dir] [--only scan|distance_transform|vehicle_model] [--min-time seconds]
+ *                   [--label text] [--output file]
+ * e.g. --label $(git rev-parse --short HEAD) to know later which commit a result belongs to.
+ * Every case is repeated until it ran for at least min-time seconds, the default is 0.2.
+ */
+
+#include "f1tenth_simulator/scan_simulator_2d.hpp"
+#include "f1tenth_simulator/distance_transform.hpp"
+#include "f1tenth_simulator/vehicle_model.hpp"
+#include "f1tenth_simulator/batch_vehicle_model.hpp"
+#include "f1tenth_simulator/rollout_service.hpp"
+#include "f1tenth_simulator/map_loader.hpp"
+#include "f1tenth_simulator/thread_pool.hpp"
+
+#include <dirent.h>
+
+#include <cmath>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+using namespace racecar_simulator;
+
+namespace {
+
+struct Options {
+    std::string maps_dir = F1TENTH_MAPS_DIR;
+    std::string only;
+    double min_time = 0.2;
+    std::string label;
+    std::string output;
+};
+
+// one object of the "results" array, the fields in the order they were added
+class Result {
+public:
+    explicit Result(const std::string & benchmark) {add("benchmark", benchmark);}
+
+    Result & add(const std::string & key, const std::string & value) {
+        fields.push_back("\"" + key + "\": \"" + escape(value) + "\"");
+        return *this;
+    }
+    Result & add(const std::string & key, const char * value) {return add(key, std::string(value));}
+    Result & add(const std::string & key, double value) {
+        std::ostringstream text;
+        text.precision(6);
+        text << value;
+        fields.push_back("\"" + key + "\": " + text.str());
+        return *this;
+    }
+    Result & add(const std::string & key, int value) {return add(key, (double) value);}
+    Result & add(const std::string & key, size_t value) {return add(key, (double) value);}
+    Result & add(const std::string & key, bool value) {
+        fields.push_back("\"" + key + "\": " + (value ? "true" : "false"));
+        return *this;
+    }
+
+    std::string json() const {
+        std::string text = "{";
+        for (size_t i = 0; i < fields.size(); i++) text += (i ? ", " : "") + fields[i];
+        return text + "}";
+    }
+
+    static std::string escape(const std::string & value) {
+        std::string text;
+        for (char c : value) {
+            if (c == '"' or c == '\\') text += '\\';
+            text += c;
+        }
+        return text;
+    }
+
+private:
+    std::vector<std::string> fields;
+};
+
+// seconds per call of run, called until it took min_time seconds in total
+template <typename Function>
+double seconds_per_call(Function run, double min_time) {
+    typedef std::chrono::steady_clock Clock;
+    // once to warm up the caches
+    run();
+    size_t calls = 1;
+    while (true) {
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < calls; i++) run();
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (seconds >= min_time) return seconds / calls;
+        // aim a bit above min_time with the next try
+        calls = seconds <= 0 ? calls * 10 : std::max(calls + 1, size_t(calls * 1.2 * min_time / seconds));
+    }
+}
+
+// a fixed sequence of numbers in [0, 1), the same poses and maps for every run
+class Random {
+public:
+    explicit Random(uint64_t seed) : state(seed) {}
+    double next() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return (state >> 11) / 9007199254740992.0;
+    }
+private:
+    uint64_t state;
+};
+
+std::vector<std::string> map_yamls(const std::string & directory) {
+    std::vector<std::string> files;
+    DIR * dir = opendir(directory.c_str());
+    if (dir == nullptr) return files;
+    while (dirent * entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.size() > 5 and name.compare(name.size() - 5, 5, ".yaml") == 0) files.push_back(directory + "/" + name);
+    }
+    closedir(dir);
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+// poses at least clearance meters away from any wall, spread over the free cells of the map
+std::vector<Pose2D> free_poses(const OccupancyMap & map, const ScanSimulator2D & scanner, size_t count, double clearance) {
+    std::vector<Pose2D> poses;
+    Random random(42);
+    double c = std::cos(map.origin.theta);
+    double s = std::sin(map.origin.theta);
+    for (size_t attempt = 0; attempt < 100000 and poses.size() < count; attempt++) {
+        size_t cell = std::min(size_t(random.next() * map.data.size()), map.data.size() - 1);
+        if (map.data[cell] != 0) continue;
+        double cell_x = (cell % map.width + 0.5) * map.resolution;
+        double cell_y = (cell / map.width + 0.5) * map.resolution;
+        Pose2D pose;
+        pose.x = map.origin.x + c * cell_x - s * cell_y;
+        pose.y = map.origin.y + s * cell_x + c * cell_y;
+        pose.theta = 2 * M_PI * random.next();
+        if (scanner.distance_transform(pose.x, pose.y) >= clearance) poses.push_back(pose);
+    }
+    return poses;
+}
+
+std::string base_name(const std::string & path) {
+    size_t slash = path.rfind('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    return name.substr(0, name.rfind('.'));
+}
+
+void benchmark_scan(const Options & options, std::vector<Result> & results) {
+    const double field_of_view = 4.71238898038469;
+    const double scan_max_range = 10;
+    const double cube_width = 0.2;
+    const size_t num_poses = 16;
+
+    for (const std::string & yaml : map_yamls(options.maps_dir)) {
+        OccupancyMap map;
+        std::string error;
+        if (not MapLoader::load(yaml, map, &error)) {
+            std::cerr << "skipping " << yaml << ": " << error << std::endl;
+            continue;
+        }
+        std::vector<double> values = MapLoader::to_scan_map(map);
+
+        for (int beams : {270, 1081, 2160}) {
+            // without noise, only the ray marching is timed
+            ScanSimulator2D scanner(beams, field_of_view, 0.0, scan_max_range, cube_width);
+            scanner.set_map(values, map.height, map.width, map.resolution, map.origin, 0.5);
+
+            std::vector<Pose2D> poses = free_poses(map, scanner, num_poses, 0.3);
+            if (poses.empty()) {
+                std::cerr << "no free poses in " << yaml << std::endl;
+                break;
+            }
+            // the other car 2m in front
+            std::vector<Pose2D> opponents;
+            for (const Pose2D & pose : poses) {
+                opponents.push_back({pose.x + 2 * std::cos(pose.theta), pose.y + 2 * std::sin(pose.theta), pose.theta});
+            }
+
+            ScanContext context(1);
+            std::vector<float> ranges(beams);
+            // the settings of params.yaml, the original marcher that marches to the wall and backs off
+            // (the defaults of MarchSettings), and params.yaml with a distance pyramid
+            MarchSettings legacy;
+            MarchSettings tuned;
+            tuned.stop_at_max_range = true;
+            tuned.bisect = true;
+            struct Variant {
+                bool vectorized;
+                bool original;
+                int pyramid_levels;
+            };
+            for (const Variant & variant : {Variant{true, false, 0}, Variant{true, true, 0}, Variant{true, false, 4},
+                                            Variant{false, false, 0}, Variant{false, true, 0}, Variant{false, false, 4}}) {
+                scanner.set_vectorized(variant.vectorized);
+                scanner.set_march_settings(variant.original ? legacy : tuned);
+                scanner.set_distance_pyramid(variant.pyramid_levels);
+                double seconds = seconds_per_call([&]() {
+                    for (size_t i = 0; i < poses.size(); i++) {
+                        scanner.scan(poses[i], &opponents[i], 1, ranges.data(), false, context);
+                    }
+                }, options.min_time);
+
+                results.push_back(Result("scan")
+                    .add("map", base_name(yaml))
+                    .add("width", map.width)
+                    .add("height", map.height)
+                    .add("beams", beams)
+                    .add("vectorized", variant.vectorized)
+                    .add("march", variant.original ? "back_off" : "bisection")
+                    .add("pyramid_levels", variant.pyramid_levels)
+                    .add("poses", poses.size())
+                    .add("ns_per_beam", seconds / (poses.size() * beams) * 1e9)
+                    .add("scans_per_sec", poses.size() / seconds));
+            }
+        }
+    }
+}
+
+void benchmark_distance_transform(const Options & options, std::vector<Result> & results) {
+    ThreadPool single_thread(1);
+    for (size_t size : {256, 512, 1024, 2048}) {
+        // walls around the border and random obstacles, 0 is occupied like in ScanSimulator2D
+        Random random(size);
+        std::vector<double> grid(size * size);
+        for (size_t row = 0; row < size; row++) {
+            for (size_t col = 0; col < size; col++) {
+                bool wall = row == 0 or col == 0 or row == size - 1 or col == size - 1 or random.next() < 0.01;
+                grid[row * size + col] = wall ? 0 : 1e10;
+            }
+        }
+
+        for (ThreadPool * pool : {&single_thread, &ThreadPool::shared()}) {
+            // distance_2d() works in place, copying the input back is part of every call
+            std::vector<double> input(grid.size());
+            double seconds = seconds_per_call([&]() {
+                std::copy(grid.begin(), grid.end(), input.begin());
+                DistanceTransform::distance_2d(input, size, size, 0.05, 0, pool);
+            }, options.min_time);
+
+            results.push_back(Result("distance_transform")
+                .add("width", size)
+                .add("height", size)
+                .add("threads", pool->size())
+                .add("ns_per_cell", seconds / grid.size() * 1e9)
+                .add("ms_per_map", seconds * 1e3));
+        }
+    }
+}
+
+// the values of params.yaml
+CarParams car_params() {
+    CarParams p;
+    p.wheelbase = 0.3302;
+    p.friction_coeff = 5.923;
+    p.h_cg = 0.074;
+    p.l_r = 0.139;
+    p.l_f = 0.1912;
+    p.cs_f = 4.718;
+    p.cs_r = 5.4562;
+    p.mass = 3.958;
+    p.Iz = 0.15712;
+    p.Cm1 = 6.097;
+    p.Cm2 = 0.237;
+    p.Cm3 = 0.392;
+    p.B_f = 0.201;
+    p.C_f = 2.114;
+    p.D_f = 28.892;
+    p.B_r = 0.201;
+    p.C_r = 2.114;
+    p.D_r = 28.892;
+    p.max_speed = 27.;
+    p.max_steering_angle = 0.192;
+    p.max_steering_vel = 1.9;
+    p.max_accel = 7.51;
+    p.max_decel = 8.26;
+    return p;
+}
+
+void benchmark_vehicle_model(const Options & options, std::vector<Result> & results) {
+    const CarParams p = car_params();
+    const double dt = 0.005;
+    const size_t steps = 1000;
+
+    struct Regime {
+        const char * name;
+        double speed;
+    };
+    for (const Regime & regime : {Regime{"dynamic", 5.0}, Regime{"kinematic", 0.2}}) {
+        for (bool rk4 : {false, true}) {
+            CarState start = {.x=0, .y=0, .theta=0, .velocity_x=regime.speed, .velocity_y=0, .steer_angle=0,
+                              .angular_velocity=0, .slip_angle=0, .st_dyn=regime.speed > 0.5};
+            // the steps can't be optimized away when their result is stored
+            volatile double sink = 0;
+            double seconds = seconds_per_call([&]() {
+                CarState state = start;
+                for (size_t i = 0; i < steps; i++) {
+                    // a slow weave, so the steering is never at rest
+                    double steer = (i & 256) ? 0.1 : -0.1;
+                    state = rk4 ? STKinematics::update_rk4(state, regime.speed, steer, p, dt)
+                                : STKinematics::update(state, regime.speed, steer, p, dt);
+                    STKinematics::limit_state(state, p);
+                }
+                sink = state.x;
+            }, options.min_time);
+
+            results.push_back(Result("vehicle_model")
+                .add("model", rk4 ? "update_rk4" : "update")
+                .add("regime", regime.name)
+                .add("steps_per_sec", steps / seconds)
+                .add("ns_per_step", seconds / steps * 1e9));
+        }
+    }
+
+    // many cars at once, one thread
+    const size_t num_cars = 1024;
+    for (BatchVehicleModel::Math math : {BatchVehicleModel::EXACT, BatchVehicleModel::FAST}) {
+        CarStateBatch states(num_cars);
+        for (size_t i = 0; i < num_cars; i++) {
+            states.set(i, {.x=0, .y=0, .theta=0, .velocity_x=5.0 * i / num_cars, .velocity_y=0, .steer_angle=0,
+                           .angular_velocity=0, .slip_angle=0, .st_dyn=false});
+        }
+        std::vector<double> speeds(num_cars, 5.0);
+        std::vector<double> steers(num_cars, 0.1);
+        double seconds = seconds_per_call([&]() {
+            BatchVehicleModel::step(states, speeds.data(), steers.data(), p, dt, math);
+        }, options.min_time);
+
+        results.push_back(Result("vehicle_model")
+            .add("model", math == BatchVehicleModel::EXACT ? "batch_exact" : "batch_fast")
+            .add("regime", "mixed")
+            .add("cars", num_cars)
+            .add("steps_per_sec", num_cars / seconds)
+            .add("ns_per_step", seconds / num_cars * 1e9));
+    }
+
+    // candidate command sequences of an MPC, trajectories and Jacobians of every step
+    const size_t num_candidates = 64;
+    const size_t horizon = 50;
+    RolloutService service(p, dt);
+    std::vector<CarState> starts(num_candidates);
+    std::vector<double> controls(num_candidates * horizon * RolloutService::control_size);
+    for (size_t i = 0; i < num_candidates; i++) {
+        starts[i] = {.x=0, .y=0, .theta=0, .velocity_x=5.0, .velocity_y=0, .steer_angle=0,
+                     .angular_velocity=0, .slip_angle=0, .st_dyn=true};
+        for (size_t k = 0; k < horizon; k++) {
+            controls[(i * horizon + k) * 2] = 5.0;
+            controls[(i * horizon + k) * 2 + 1] = 0.2 * (double(i) / num_candidates - 0.5);
+        }
+    }
+    std::vector<CarState> trajectories(num_candidates * (horizon + 1));
+    std::vector<double> state_jacobians(num_candidates * horizon * RolloutService::state_size * RolloutService::state_size);
+    std::vector<double> control_jacobians(num_candidates * horizon * RolloutService::state_size * RolloutService::control_size);
+    double seconds = seconds_per_call([&]() {
+        service.linearize(starts.data(), num_candidates, controls.data(), horizon, trajectories.data(),
+                          state_jacobians.data(), control_jacobians.data());
+    }, options.min_time);
+
+    results.push_back(Result("vehicle_model")
+        .add("model", "rollout_linearize")
+        .add("regime", "dynamic")
+        .add("cars", num_candidates)
+        .add("horizon", horizon)
+        .add("threads", service.get_num_threads())
+        .add("steps_per_sec", num_candidates * horizon / seconds)
+        .add("ns_per_step", seconds / (num_candidates * horizon) * 1e9));
+}
+
+bool parse_options(int argc, char ** argv, Options & options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 == argc) {
+            std::cerr << arg << " needs a value" << std::endl;
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--maps") {
+            options.maps_dir = value;
+        } else if (arg == "--only") {
+            options.only = value;
+        } else if (arg == "--min-time") {
+            options.min_time = std::atof(value.c_str());
+        } else if (arg == "--label") {
+            options.label = value;
+        } else if (arg == "--output") {
+            options.output = value;
+        } else {
+            std::cerr << "unknown option " << arg << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+
+int main(int argc, char ** argv) {
+    Options options;
+    if (not parse_options(argc, argv, options)) return 1;
+
+    std::vector<Result> results;
+    if (options.only.empty() or options.only == "scan") benchmark_scan(options, results);
+    if (options.only.empty() or options.only == "distance_transform") benchmark_distance_transform(options, results);
+    if (options.only.empty() or options.only == "vehicle_model") benchmark_vehicle_model(options, results);
+
+    std::ostringstream json;
+    json << "{\n  \"label\": \"" << Result::escape(options.label) << "\",\n"
+         << "  \"compiler\": \"" << Result::escape(__VERSION__) << "\",\n"
+#if defined(__AVX512F__)
+         << "  \"simd\": \"avx512\",\n"
+#elif defined(__AVX2__)
+         << "  \"simd\": \"avx2\",\n"
+#elif defined(__ARM_NEON)
+         << "  \"simd\": \"neon\",\n"
+#else
+         << "  \"simd\": \"none\",\n"
+#endif
+         << "  \"threads\": " << ThreadPool::shared().size() << ",\n"
+         << "  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+        json << "    " << results[i].json() << (i + 1 < results.size() ? ",\n" : "\n");
+    }
+    json << "  ]\n}\n";
+
+    if (options.output.empty()) {
+        std::cout << json.str();
+    } else {
+        std::ofstream file(options.output);
+        file << json.str();
+        if (not file) {
+            std::cerr << "can't write " << options.output << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,229 @@
+#include "f1tenth_simulator/gpu_scan_simulator.hpp"
+
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <shared_mutex>
+
+#include <cuda_runtime.h>
+
+#include "scan_beam.hpp"
+
+using namespace racecar_simulator;
+
+namespace {
+
+const int threads_per_block = 128;
+
+// every thread is one beam of one scan, the beams of a scan are next to each other like in the output
+__global__ void scan_kernel(gpu::DeviceMap map, gpu::DeviceScanner scanner, const gpu::DeviceScan * scans,
+                            int num_scans, const int * theta_indices, const OpponentFootprint * footprints,
+                            float * ranges, int * saw_opponent) {
+    long long index = (long long) blockIdx.x * blockDim.x + threadIdx.x;
+    if (index >= (long long) num_scans * scanner.num_beams) return;
+    int scan = index / scanner.num_beams;
+    int beam = index % scanner.num_beams;
+
+    bool saw = false;
+    ranges[index] = gpu::scan_beam(map, scanner, scans[scan], theta_indices + (size_t) scan * scanner.num_beams,
+                                   footprints, beam, &saw);
+    // every beam that saw it writes the same value, no atomics needed
+    if (saw) saw_opponent[scan] = 1;
+}
+
+bool check(cudaError_t result, const char * what, std::string * error) {
+    if (result == cudaSuccess) return true;
+    if (error) *error = std::string(what) + ": " + cudaGetErrorString(result);
+    return false;
+}
+
+// a device buffer that only grows, so the buffers of a batch are allocated once for the largest batch
+template <typename T>
+struct DeviceBuffer {
+    T * data = nullptr;
+    size_t capacity = 0;
+
+    bool reserve(size_t size, std::string * error) {
+        if (size <= capacity) return true;
+        cudaFree(data);
+        data = nullptr;
+        capacity = 0;
+        if (not check(cudaMalloc(&data, size * sizeof(T)), "cudaMalloc", error)) return false;
+        capacity = size;
+        return true;
+    }
+    ~DeviceBuffer() {cudaFree(data);}
+};
+
+// page locked host memory, the copies of a stream are only asynchronous from and to it
+template <typename T>
+struct HostBuffer {
+    T * data = nullptr;
+    size_t capacity = 0;
+
+    bool reserve(size_t size, std::string * error) {
+        if (size <= capacity) return true;
+        cudaFreeHost(data);
+        data = nullptr;
+        capacity = 0;
+        if (not check(cudaMallocHost(&data, size * sizeof(T)), "cudaMallocHost", error)) return false;
+        capacity = size;
+        return true;
+    }
+    ~HostBuffer() {cudaFreeHost(data);}
+};
+
+}
+
+struct GpuScanSimulator::Impl {
+    const ScanSimulator2D & scanner;
+    cudaStream_t stream = nullptr;
+    // upload_map() and scan_batch() may be called by different threads, e.g. the map callback and the simulation loop
+    std::mutex mutex;
+
+    // resident until the next upload_map()
+    DeviceBuffer<double> dt;
+    DeviceBuffer<double> tables;
+    gpu::DeviceMap map = {};
+    bool map_uploaded = false;
+
+    // per batch
+    HostBuffer<gpu::DeviceScan> host_scans;
+    HostBuffer<int> host_theta_indices;
+    HostBuffer<OpponentFootprint> host_footprints;
+    HostBuffer<float> host_ranges;
+    HostBuffer<int> host_saw_opponent;
+    DeviceBuffer<gpu::DeviceScan> scans;
+    DeviceBuffer<int> theta_indices;
+    DeviceBuffer<OpponentFootprint> footprints;
+    DeviceBuffer<float> ranges;
+    DeviceBuffer<int> saw_opponent;
+
+    explicit Impl(const ScanSimulator2D & scanner_) : scanner(scanner_) {}
+    ~Impl() {if (stream) cudaStreamDestroy(stream);}
+};
+
+bool GpuScanSimulator::available(std::string * error) {
+    int devices = 0;
+    if (not check(cudaGetDeviceCount(&devices), "cudaGetDeviceCount", error)) return false;
+    if (devices == 0) {
+        if (error) *error = "no CUDA device";
+        return false;
+    }
+    return true;
+}
+
+GpuScanSimulator::GpuScanSimulator(const ScanSimulator2D & scanner) : impl(new Impl(scanner)) {}
+
+GpuScanSimulator::~GpuScanSimulator() = default;
+
+bool GpuScanSimulator::upload_map(std::string * error) {
+    Impl & d = *impl;
+    std::lock_guard<std::mutex> guard(d.mutex);
+    if (d.stream == nullptr and not check(cudaStreamCreate(&d.stream), "cudaStreamCreate", error)) return false;
+
+    const ScanSimulator2D & scanner = d.scanner;
+    std::shared_lock<std::shared_timed_mutex> lock(scanner.scan_map->mutex);
+    const ScanMap & scan_map = *scanner.scan_map;
+    d.map_uploaded = false;
+    if (scan_map.dt.empty()) {
+        if (error) *error = "the scanner has no map";
+        return false;
+    }
+
+    // sines, cosines and arctanes of the scanner, already after each other, they only change with the scanner
+    const std::vector<double> & tables = scanner.angle_tables->values;
+
+    if (not d.dt.reserve(scan_map.dt.size(), error) or not d.tables.reserve(tables.size(), error)) return false;
+    // synchronous, the map only changes now and then
+    if (not check(cudaMemcpy(d.dt.data, scan_map.dt.data(), scan_map.dt.size() * sizeof(double),
+                             cudaMemcpyHostToDevice), "cudaMemcpy", error)) return false;
+    if (not check(cudaMemcpy(d.tables.data, tables.data(), tables.size() * sizeof(double), cudaMemcpyHostToDevice),
+                  "cudaMemcpy", error)) return false;
+
+    d.map = gpu::HostScanner::device_map(scan_map, d.dt.data);
+    d.map_uploaded = true;
+    return true;
+}
+
+bool GpuScanSimulator::scan_batch(ScanRequest * requests, size_t num_requests, std::string * error) {
+    Impl & d = *impl;
+    std::lock_guard<std::mutex> guard(d.mutex);
+    const ScanSimulator2D & scanner = d.scanner;
+    if (not d.map_uploaded) {
+        if (error) *error = "upload_map() has not been called";
+        return false;
+    }
+    if (num_requests == 0) return true;
+
+    // the per scan stage of the CPU, so the footprints, the theta indices and the noise are the same
+    size_t num_beams = scanner.num_beams;
+    size_t num_footprints = 0;
+    for (size_t r = 0; r < num_requests; r++) {
+        ScanContext & context = *requests[r].context;
+        scanner.prepare_scan(requests[r].pose, requests[r].opponent_poses, requests[r].num_opponents, context);
+        num_footprints += context.num_footprints;
+    }
+
+    size_t total_beams = num_requests * num_beams;
+    if (not d.host_scans.reserve(num_requests, error) or not d.scans.reserve(num_requests, error) or
+        not d.host_theta_indices.reserve(total_beams, error) or not d.theta_indices.reserve(total_beams, error) or
+        not d.host_footprints.reserve(std::max<size_t>(num_footprints, 1), error) or
+        not d.footprints.reserve(std::max<size_t>(num_footprints, 1), error) or
+        not d.host_ranges.reserve(total_beams, error) or not d.ranges.reserve(total_beams, error) or
+        not d.host_saw_opponent.reserve(num_requests, error) or not d.saw_opponent.reserve(num_requests, error)) {
+        return false;
+    }
+
+    size_t first_footprint = 0;
+    for (size_t r = 0; r < num_requests; r++) {
+        const ScanContext & context = *requests[r].context;
+        d.host_scans.data[r] = gpu::HostScanner::device_scan(requests[r], first_footprint);
+        std::copy(context.theta_indices.begin(), context.theta_indices.end(), d.host_theta_indices.data + r * num_beams);
+        std::copy(context.footprints.begin(), context.footprints.begin() + context.num_footprints,
+                  d.host_footprints.data + first_footprint);
+        first_footprint += context.num_footprints;
+    }
+
+    size_t table_size = scanner.angle_tables->size();
+    gpu::DeviceScanner device_scanner = gpu::HostScanner::device_scanner(
+        scanner, d.tables.data, d.tables.data + table_size, d.tables.data + 2 * table_size);
+
+    // everything of the batch is copied, computed and copied back in order on the stream, then waited for once
+    cudaStream_t stream = d.stream;
+    cudaMemcpyAsync(d.scans.data, d.host_scans.data, num_requests * sizeof(gpu::DeviceScan), cudaMemcpyHostToDevice,
+                    stream);
+    cudaMemcpyAsync(d.theta_indices.data, d.host_theta_indices.data, total_beams * sizeof(int), cudaMemcpyHostToDevice,
+                    stream);
+    if (num_footprints > 0) {
+        cudaMemcpyAsync(d.footprints.data, d.host_footprints.data, num_footprints * sizeof(OpponentFootprint),
+                        cudaMemcpyHostToDevice, stream);
+    }
+    cudaMemsetAsync(d.saw_opponent.data, 0, num_requests * sizeof(int), stream);
+
+    int blocks = (total_beams + threads_per_block - 1) / threads_per_block;
+    scan_kernel<<<blocks, threads_per_block, 0, stream>>>(d.map, device_scanner, d.scans.data, num_requests,
+                                                          d.theta_indices.data, d.footprints.data, d.ranges.data,
+                                                          d.saw_opponent.data);
+    if (not check(cudaGetLastError(), "scan_kernel", error)) return false;
+
+    cudaMemcpyAsync(d.host_ranges.data, d.ranges.data, total_beams * sizeof(float), cudaMemcpyDeviceToHost, stream);
+    cudaMemcpyAsync(d.host_saw_opponent.data, d.saw_opponent.data, num_requests * sizeof(int), cudaMemcpyDeviceToHost,
+                    stream);
+    if (not check(cudaStreamSynchronize(stream), "cudaStreamSynchronize", error)) return false;
+
+    // the same layout as the CPU path, num_beams floats into the scan_data of each request
+    for (size_t r = 0; r < num_requests; r++) {
+        std::copy(d.host_ranges.data + r * num_beams, d.host_ranges.data + (r + 1) * num_beams, requests[r].scan_data);
+        requests[r].context->can_see_opponent = d.host_saw_opponent.data[r] != 0;
+    }
+    return true;
+}
+
+size_t GpuScanSimulator::device_bytes() const {
+    const Impl & d = *impl;
+    return d.dt.capacity * sizeof(double) + d.tables.capacity * sizeof(double) +
+           d.scans.capacity * sizeof(gpu::DeviceScan) + d.theta_indices.capacity * sizeof(int) +
+           d.footprints.capacity * sizeof(OpponentFootprint) + d.ranges.capacity * sizeof(float) +
+           d.saw_opponent.capacity * sizeof(int);
+}
@@ -0,0 +1,323 @@
+#pragma once
+
+// One beam of ScanSimulator2D, written once for the CUDA kernel of GpuScanSimulator and the host.
+// Everything here mirrors the CPU code in src/scan_simulator_2d.cpp operation by operation
+// (march_ray(), intersect_opponent(), beam_noise()), so the ranges are the same as the CPU path as long as
+// neither compiler contracts a * b + c into FMA instructions, see CMakeLists.txt.
+
+#include <math.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <shared_mutex>
+
+#include "f1tenth_simulator/scan_simulator_2d.hpp"
+
+#ifdef __CUDACC__
+#define F1TENTH_HD __host__ __device__
+#else
+#define F1TENTH_HD
+#endif
+
+namespace racecar_simulator {
+namespace gpu {
+
+// the distance transform on the device, float64 in row major order like ScanMap::dt
+struct DeviceMap {
+    const double * dt;
+    int width;
+    int height;
+    double resolution;
+    double origin_x;
+    double origin_y;
+    double origin_c;
+    double origin_s;
+};
+
+// everything of the scanner that is the same for all scans
+struct DeviceScanner {
+    const double * sines;
+    const double * cosines;
+    const double * arctanes;
+    int num_beams;
+    int theta_discretization;
+    double scan_std_dev;
+    double scan_max_range;
+    double cube_width;
+    double ray_tracing_epsilon;
+    double threshold;
+    MarchSettings march;
+};
+
+// one scan of a batch, the theta indices of its beams and its footprints are in the arrays of the batch
+struct DeviceScan {
+    double x;
+    double y;
+    uint64_t noise_seed;
+    int first_footprint;
+    int num_footprints;
+    int flag;
+};
+
+F1TENTH_HD inline double minimum(double a, double b) {return b < a ? b : a;}
+F1TENTH_HD inline double maximum(double a, double b) {return a < b ? b : a;}
+
+// ScanMap::distance_transform()
+F1TENTH_HD inline double distance_transform(const DeviceMap & map, double x, double y) {
+    double x_trans = x - map.origin_x;
+    double y_trans = y - map.origin_y;
+    double x_rot =   x_trans * map.origin_c + y_trans * map.origin_s;
+    double y_rot = - x_trans * map.origin_s + y_trans * map.origin_c;
+    if (x_rot < 0 or x_rot >= map.width * map.resolution or y_rot < 0 or y_rot >= map.height * map.resolution) return 0;
+    int col = floor(x_rot / map.resolution);
+    int row = floor(y_rot / map.resolution);
+    return map.dt[row * map.width + col];
+}
+
+// ScanSimulator2D::march_ray() without the distance pyramid
+F1TENTH_HD inline double march_ray(const DeviceMap & map, const DeviceScanner & scanner, double x, double y,
+                                   int theta_index, double * hit_x, double * hit_y) {
+    double s = scanner.sines[theta_index];
+    double c = scanner.cosines[theta_index];
+    const MarchSettings & march = scanner.march;
+
+    double distance_to_nearest = distance_transform(map, x, y);
+    double total_distance = 0;
+    double step = 0;
+    double free_x = x, free_y = y, free_distance = 0;
+
+    while (distance_to_nearest != 0) {
+        if (march.stop_at_max_range and total_distance >= scanner.scan_max_range) break;
+        step = maximum(distance_to_nearest, march.min_step);
+        free_x = x;
+        free_y = y;
+        free_distance = total_distance;
+        x += step * c;
+        y += step * s;
+        total_distance += step;
+        distance_to_nearest = distance_transform(map, x, y);
+    }
+
+    if (distance_to_nearest == 0 and step > 0) {
+        if (march.bisect) {
+            while (step > march.refine_epsilon) {
+                step *= 0.5;
+                double middle_x = free_x + step * c;
+                double middle_y = free_y + step * s;
+                if (distance_transform(map, middle_x, middle_y) != 0) {
+                    free_x = middle_x;
+                    free_y = middle_y;
+                    free_distance += step;
+                }
+            }
+            x = free_x;
+            y = free_y;
+            total_distance = free_distance;
+        } else {
+            double error = 0;
+            while (distance_to_nearest == 0) {
+                error += 0.01;
+                x -= 0.01 * c;
+                y -= 0.01 * s;
+                distance_to_nearest = distance_transform(map, x, y);
+            }
+            total_distance -= error;
+        }
+    }
+    *hit_x = x;
+    *hit_y = y;
+    return total_distance;
+}
+
+F1TENTH_HD inline bool may_hit_opponent(const OpponentFootprint & opponent, int beam) {
+    for (int i = 0; i < opponent.num_intervals; i++) {
+        if (opponent.first_beam[i] <= beam and beam <= opponent.last_beam[i]) return true;
+    }
+    return false;
+}
+
+// ScanSimulator2D::intersect_opponent(), see there for how it works
+F1TENTH_HD inline double intersect_opponent(const DeviceScanner & scanner, double original_x, double original_y,
+                                            int theta_index, double x, double y, double total_distance,
+                                            const OpponentFootprint & opponent, bool * saw_opponent) {
+    double k = scanner.arctanes[theta_index];
+    double b = x - k * y;
+    double max_range = scanner.scan_max_range;
+    double epsilon = scanner.ray_tracing_epsilon;
+
+    double x1 = opponent.corner_x[0], y1 = opponent.corner_y[0];
+    double x2 = opponent.corner_x[1], y2 = opponent.corner_y[1];
+    double x3 = opponent.corner_x[2], y3 = opponent.corner_y[2];
+    double x4 = opponent.corner_x[3], y4 = opponent.corner_y[3];
+
+    const double points[4][4] = {{y1, y2, x1, x2},
+                                 {y2, y3, x2, x3},
+                                 {y3, y4, x3, x4},
+                                 {y4, y1, x4, x1}};
+
+    bool vertical = theta_index == 0 or theta_index == scanner.theta_discretization / 2 or
+                    theta_index == scanner.theta_discretization;
+    if (vertical) {
+        if (((y1 > original_y) and (y2 > original_y) and (y3 > original_y) and (y4 > original_y)) or
+            ((y1 < original_y) and (y2 < original_y) and (y3 < original_y) and (y4 < original_y))) {
+            return minimum(total_distance, max_range);
+        }
+    } else {
+        if (((k * y1 + b > x1) and (k * y2 + b > x2) and (k * y3 + b > x3) and (k * y4 + b > x4)) or
+            ((k * y1 + b < x1) and (k * y2 + b < x2) and (k * y3 + b < x3) and (k * y4 + b < x4))) {
+            return minimum(total_distance, max_range);
+        }
+    }
+
+    double this_to_opponent = opponent.this_to_opponent;
+    if (this_to_opponent < total_distance) {
+        double obstacle_to_opponent = sqrt((x - opponent.x) * (x - opponent.x) + (y - opponent.y) * (y - opponent.y));
+        if (obstacle_to_opponent < total_distance) {
+            if (saw_opponent and this_to_opponent < scanner.threshold) *saw_opponent = true;
+
+            if (vertical) return minimum(this_to_opponent - scanner.cube_width / 2, max_range);
+
+            double intersection_point1_y = (y2 * x1 - y2 * b + y1 * b - y1 * x2) / (k * y2 - k * y1 - x2 + x1);
+            double intersection_point1_x = k * intersection_point1_y + b;
+
+            double intersection_point2_y = (y3 * x2 - y3 * b + y2 * b - y2 * x3) / (k * y3 - k * y2 - x3 + x2);
+            double intersection_point2_x = k * intersection_point2_y + b;
+
+            double intersection_point3_y = (y4 * x3 - y4 * b + y3 * b - y3 * x4) / (k * y4 - k * y3 - x4 + x3);
+            double intersection_point3_x = k * intersection_point3_y + b;
+
+            double intersection_point4_y = (y1 * x4 - y1 * b + y4 * b - y4 * x1) / (k * y1 - k * y4 - x1 + x4);
+            double intersection_point4_x = k * intersection_point4_y + b;
+
+            const double array[4][2] = {{intersection_point1_y, intersection_point1_x},
+                                        {intersection_point2_y, intersection_point2_x},
+                                        {intersection_point3_y, intersection_point3_x},
+                                        {intersection_point4_y, intersection_point4_x}};
+            double scan_to_square = max_range;
+            for (int i = 0; i < 4; i++) {
+                if ((points[i][0] + epsilon >= array[i][0] and array[i][0] >= points[i][1] - epsilon) or
+                    (points[i][0] - epsilon <= array[i][0] and array[i][0] <= points[i][1] + epsilon)) {
+                    if ((points[i][2] + epsilon >= array[i][1] and array[i][1] >= points[i][3] - epsilon) or
+                        (points[i][2] - epsilon <= array[i][1] and array[i][1] <= points[i][3] + epsilon)) {
+                        double dx = original_x - array[i][1];
+                        double dy = original_y - array[i][0];
+                        scan_to_square = minimum(scan_to_square, sqrt(dx * dx + dy * dy));
+                    }
+                }
+            }
+            return scan_to_square;
+        }
+    }
+    return minimum(total_distance, max_range);
+}
+
+// beam_noise() of src/scan_simulator_2d.cpp, the device log and cos may differ from the host ones in the last bit
+F1TENTH_HD inline uint64_t mix_bits(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+F1TENTH_HD inline double beam_noise(uint64_t seed, int beam, double std_dev) {
+    uint64_t counter = seed + 2 * static_cast<uint64_t>(beam) * 0x9e3779b97f4a7c15ULL;
+    double u1 = ((mix_bits(counter) >> 11) + 1) / 9007199254740992.0;
+    double u2 = (mix_bits(counter + 0x9e3779b97f4a7c15ULL) >> 11) / 9007199254740992.0;
+    return std_dev * sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+}
+
+// the range of one beam of scan, what ScanSimulator2D::scan_beams() computes,
+// saw_opponent is set if the scan has its flag set and the beam hit an opponent closer than the threshold
+F1TENTH_HD inline double scan_beam(const DeviceMap & map, const DeviceScanner & scanner, const DeviceScan & scan,
+                                   const int * theta_indices, const OpponentFootprint * footprints, int beam,
+                                   bool * saw_opponent) {
+    int theta_index = theta_indices[beam];
+    double hit_x, hit_y;
+    double total_distance = march_ray(map, scanner, scan.x, scan.y, theta_index, &hit_x, &hit_y);
+
+    bool hit_checked = false;
+    double range = 0;
+    for (int j = 0; j < scan.num_footprints; j++) {
+        const OpponentFootprint & footprint = footprints[scan.first_footprint + j];
+        if (not may_hit_opponent(footprint, beam)) continue;
+        double opponent_range = intersect_opponent(scanner, scan.x, scan.y, theta_index, hit_x, hit_y, total_distance,
+                                                   footprint, scan.flag ? saw_opponent : nullptr);
+        range = hit_checked ? minimum(range, opponent_range) : opponent_range;
+        hit_checked = true;
+    }
+    double output = hit_checked ? range : minimum(total_distance, scanner.scan_max_range);
+
+    if (scanner.scan_std_dev > 0) output += beam_noise(scan.noise_seed, beam, scanner.scan_std_dev);
+    return output;
+}
+
+// The host side of the kernel: the structs above filled from a ScanSimulator2D, for GpuScanSimulator,
+// and scan_batch(), the kernel's beams computed one after the other on the CPU. It is what the GPU gives
+// for a batch, without a GPU, tests/test_scan_beam.cpp compares it with ScanSimulator2D::scan_batch()
+struct HostScanner {
+    // dt is the distance transform of scan_map, on the device or the host
+    static DeviceMap device_map(const ScanMap & scan_map, const double * dt) {
+        DeviceMap map;
+        map.dt = dt;
+        map.width = scan_map.width;
+        map.height = scan_map.height;
+        map.resolution = scan_map.resolution;
+        map.origin_x = scan_map.origin.x;
+        map.origin_y = scan_map.origin.y;
+        map.origin_c = scan_map.origin_c;
+        map.origin_s = scan_map.origin_s;
+        return map;
+    }
+
+    // the angle tables of scanner, on the device or the host
+    static DeviceScanner device_scanner(const ScanSimulator2D & scanner, const double * sines, const double * cosines,
+                                        const double * arctanes) {
+        DeviceScanner device_scanner;
+        device_scanner.sines = sines;
+        device_scanner.cosines = cosines;
+        device_scanner.arctanes = arctanes;
+        device_scanner.num_beams = scanner.num_beams;
+        device_scanner.theta_discretization = scanner.theta_discretization;
+        device_scanner.scan_std_dev = scanner.scan_std_dev;
+        device_scanner.scan_max_range = scanner.scan_max_range;
+        device_scanner.cube_width = scanner.cube_width;
+        device_scanner.ray_tracing_epsilon = scanner.ray_tracing_epsilon;
+        device_scanner.threshold = scanner.threshold;
+        device_scanner.march = scanner.march;
+        return device_scanner;
+    }
+
+    // a request after prepare_scan(), its footprints start at first_footprint in the footprints of the batch
+    static DeviceScan device_scan(const ScanRequest & request, int first_footprint) {
+        DeviceScan scan;
+        scan.x = request.pose.x;
+        scan.y = request.pose.y;
+        scan.noise_seed = request.context->noise_seed;
+        scan.first_footprint = first_footprint;
+        scan.num_footprints = request.context->num_footprints;
+        scan.flag = request.flag;
+        return scan;
+    }
+
+    // GpuScanSimulator::scan_batch() on the CPU, one scan and one beam after the other.
+    // Like the kernel it reads dt and ignores the distance pyramid, the DistanceField copy and the range table
+    static void scan_batch(const ScanSimulator2D & scanner, ScanRequest * requests, size_t num_requests) {
+        std::shared_lock<std::shared_timed_mutex> lock(scanner.scan_map->mutex);
+        const ScanMap & scan_map = *scanner.scan_map;
+        DeviceMap map = device_map(scan_map, scan_map.dt.data());
+        DeviceScanner device = device_scanner(scanner, scanner.sines, scanner.cosines, scanner.arctanes);
+
+        for (size_t r = 0; r < num_requests; r++) {
+            ScanContext & context = *requests[r].context;
+            scanner.prepare_scan(requests[r].pose, requests[r].opponent_poses, requests[r].num_opponents, context);
+            DeviceScan scan = device_scan(requests[r], 0);
+            bool saw = false;
+            for (int beam = 0; beam < device.num_beams; beam++) {
+                requests[r].scan_data[beam] = scan_beam(map, device, scan, context.theta_indices.data(),
+                                                        context.footprints.data(), beam, &saw);
+            }
+            context.can_see_opponent = saw;
+        }
+    }
+};
+
+}
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "f1tenth_simulator/car_state.hpp"
+#include "f1tenth_simulator/car_params.hpp"
+#include "f1tenth_simulator/thread_pool.hpp"
+
+namespace racecar_simulator {
+
+/**
+ * The states of many cars, structure of arrays: every field of CarState is its own vector,
+ * so the same field of neighbouring cars is next to each other in memory and a loop over the cars vectorizes.
+ */
+struct CarStateBatch {
+    std::vector<double> x;
+    std::vector<double> y;
+    std::vector<double> theta;
+    std::vector<double> velocity_x;
+    std::vector<double> velocity_y;
+    std::vector<double> steer_angle;
+    std::vector<double> angular_velocity;
+    std::vector<double> slip_angle;
+    // 1 if the last step used the dynamic model
+    std::vector<uint8_t> st_dyn;
+
+    CarStateBatch() {}
+    explicit CarStateBatch(size_t size) {resize(size);}
+
+    void resize(size_t size);
+    size_t size() const {return x.size();}
+
+    void set(size_t i, const CarState & state);
+    CarState get(size_t i) const;
+};
+
+/**
+ * STKinematics for many cars at once, e.g. thousands of candidate control sequences of an MPC or
+ * a sampling based planner rolled out against the dynamics of the simulator.
+ * A step is STKinematics::update() followed by STKinematics::limit_state() (an Euler step of the simulator),
+ * for every car in the batch. Instead of branching between the dynamic and the kinematic model,
+ * both are computed and the result is selected per car, so the loop over the cars has no branches and vectorizes.
+ *
+ * EXACT uses the functions of <cmath> and gives the same states as the simulator, bit for bit
+ * (NATIVE_ARCH builds with -ffp-contract=off, so the compiler can't fuse multiplications and additions differently in the two).
+ * FAST uses polynomial atan, sin and cos which the compiler can vectorize as well, they are within a few ulp of <cmath>,
+ * after 100 steps of 10ms the positions differ by about 1e-14m, tests/test_batch_vehicle_model.cpp checks both.
+ * Build with -DNATIVE_ARCH=ON to get AVX2/AVX-512, it is about 4 times faster than STKinematics then.
+ */
+class BatchVehicleModel {
+
+public:
+    enum Math {EXACT, FAST};
+
+    // step every car once, desired_speeds and desired_steer_angs have one command per car
+    static void step(
+            CarStateBatch & states,
+            const double * desired_speeds,
+            const double * desired_steer_angs,
+            const CarParams & p,
+            double dt,
+            Math math = FAST);
+
+    // step every car num_steps times. The commands are row major [num_steps][states.size()], command k of car i
+    // is at k * states.size() + i. If trajectory is not null it gets the state after every step in the same order,
+    // states ends as the state after the last step. The cars are split across the threads of pool,
+    // ThreadPool::shared() if it is null, every thread runs all steps of its cars
+    static void rollout(
+            CarStateBatch & states,
+            const double * desired_speeds,
+            const double * desired_steer_angs,
+            size_t num_steps,
+            const CarParams & p,
+            double dt,
+            Math math = FAST,
+            CarStateBatch * trajectory = nullptr,
+            ThreadPool * pool = nullptr);
+};
+
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <memory>
+#include <cstddef>
+
+#include "f1tenth_simulator/car_state.hpp"
+#include "f1tenth_simulator/sensor_geometry.hpp"
+
+namespace racecar_simulator {
+
+// The body of a car as a rectangle in the map frame
+struct OrientedBox {
+    double center_x;
+    double center_y;
+    // unit vector along the car, the sideways axis is (-axis_y, axis_x)
+    double axis_x;
+    double axis_y;
+    double half_length;
+    double half_width;
+};
+
+/**
+ * The collision checks the simulator runs after every scan, shared by all cars.
+ * - time to collision: every beam gives (range - distance from the LiDAR to the edge of the car) / projected velocity,
+ *   the smallest non negative one is what matters, so the beams are reduced to that minimum in one pass
+ *   (4 beams at a time with AVX2) over the distances and cosines precomputed for the scan angles.
+ * - box collider: two cars collide when their rectangles overlap, which is a separating axis test of two boxes.
+ */
+class CollisionChecker {
+
+public:
+    CollisionChecker() {}
+
+    // the distances from the LiDAR to the edge of the car and the cosines of scan_beams beams,
+    // starting at angle_min, see Precompute, shared with every checker of the same car and LiDAR, see SensorGeometry
+    CollisionChecker(
+        int scan_beams,
+        double wheelbase,
+        double width,
+        double scan_distance_to_base_link,
+        double angle_min,
+        double scan_ang_incr);
+
+    // smallest time to collision of all beams when the car drives straight at velocity_x,
+    // ranges has one range per beam, INFINITY if no beam gives a non negative time (or the car stands still)
+    double min_ttc(const float * ranges, double velocity_x) const;
+
+    size_t get_num_beams() const {return beams ? beams->cosines.size() : 0;}
+
+    // the rectangle of a car, from base link (the center of the rear axle) to length in front of it
+    static OrientedBox car_box(const CarState & state, double length, double width);
+    // true if the two rectangles overlap (touching counts)
+    static bool overlap(const OrientedBox & a, const OrientedBox & b);
+
+private:
+    // per beam: distance from the LiDAR to the edge of the car and cosine of the beam angle, null if default constructed
+    std::shared_ptr<const SensorGeometry::BeamTables> beams;
+};
+
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+
+namespace racecar_simulator {
+
+// one controller of a CommandMux, it drives car while mux_index is on
+struct CommandChannel {
+    size_t car;
+    int mux_index;
+};
+
+/**
+ * The mux of node/mux.cpp inside the simulator: the controllers write their drive commands into a slot per channel,
+ * and the physics loop takes the newest command of every car from the slots of the channels that are on,
+ * instead of every command going through the mux node as one more ROS message.
+ *
+ * Everything is allocated by the constructor. write(), set_enabled() and halt() can be called from any thread
+ * at any time and never block on the physics loop: a slot is a sequence lock, a writer makes its version odd, stores
+ * the command and makes it even again, a reader copies the slot and tries again if the version changed meanwhile.
+ * Writers of the same slot (two controllers on one channel, or two halt() at once) do exclude each other: the second
+ * one spins on a compare and swap of the version until the first made it even again, a few stores later.
+ * Writers of different channels never wait for each other. read() and pending() are called by one thread at a time,
+ * the physics loop.
+ */
+class CommandMux {
+
+public:
+    struct Command {
+        double speed;
+        double steer_angle;
+        // when the controller sent the command, as the clock the writer used (e.g. Profiler::now_ns())
+        uint64_t origin_ns;
+    };
+
+    // mux_size mux indices, all off, channels with a car or mux index out of range never get a command through
+    CommandMux(size_t num_cars, size_t mux_size, const std::vector<CommandChannel> & channels);
+
+    CommandMux(const CommandMux &) = delete;
+    CommandMux & operator=(const CommandMux &) = delete;
+
+    // a command of a controller, dropped (false) while the mux index of its channel is off, like in mux.cpp
+    bool write(size_t channel, double speed, double steer_angle, uint64_t origin_ns);
+
+    void set_enabled(int mux_index, bool enabled);
+    bool is_enabled(int mux_index) const;
+
+    // every car stops, what mux.cpp does when a mux message turns everything off
+    void halt(uint64_t origin_ns);
+
+    // the newest command for car since the last read() of car, false if there is none
+    bool read(size_t car, Command & command);
+    // whether read() would return a command
+    bool pending(size_t car) const;
+
+    size_t get_num_channels() const {return channels.size();}
+    size_t get_mux_size() const {return mux_size;}
+
+private:
+    // as large as a cache line, so writers of different channels hardly slow each other down
+    struct Slot {
+        // odd while a writer is in the slot
+        std::atomic<uint64_t> version{0};
+        // the order of the commands across slots, 0 for no command yet
+        std::atomic<uint64_t> sequence{0};
+        std::atomic<uint64_t> speed{0};
+        std::atomic<uint64_t> steer_angle{0};
+        std::atomic<uint64_t> origin_ns{0};
+        char padding[64 - 5 * sizeof(uint64_t)];
+    };
+
+    void store(Slot & slot, double speed, double steer_angle, uint64_t origin_ns);
+    // a consistent copy of slot, returns its sequence
+    uint64_t load(const Slot & slot, Command & command) const;
+
+    size_t num_cars;
+    size_t mux_size;
+    std::vector<CommandChannel> channels;
+    // the slots of the channels, then one halt slot per car
+    std::unique_ptr<Slot[]> slots;
+    std::unique_ptr<std::atomic<uint8_t>[]> enabled;
+    // the slots a car reads, its channels and its halt slot
+    std::vector<std::vector<size_t>> car_slots;
+    std::atomic<uint64_t> next_sequence{1};
+    // per car, the sequence of the last command read()
+    std::vector<uint64_t> last_read;
+};
+
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+
+#include "f1tenth_simulator/car_state.hpp"
+
+namespace racecar_simulator {
+
+/**
+ * Records the state, the commands and optionally the LiDAR scan of one car into a binary file.
+ * log() only copies the record into a preallocated ring buffer, a background thread writes the buffer to the file,
+ * so the physics loop never formats strings or waits for the disk, and the memory doesn't grow with the length
+ * of the recording. If the writer can't keep up, records are dropped (and counted) instead of blocking.
+ *
+ * File layout (little endian, as in memory):
+ * LogHeader, then one record after another: LogRecord followed by num_beams float32 ranges.
+ * node/log_to_csv.py converts a file to the csv files the machine learning scripts read.
+ */
+struct LogHeader {
+    // "F1THLOG1", change the version whenever the layout changes
+    char magic[8];
+    uint32_t num_beams;
+    // bytes per record including the ranges
+    uint32_t record_size;
+    // name of the car, zero terminated
+    char name[32];
+};
+
+struct LogRecord {
+    // simulated time in seconds
+    double time;
+    double desired_speed;
+    double desired_steer_angle;
+    // x, y, theta, velocity_x, velocity_y, steer_angle, angular_velocity, slip_angle
+    double state[8];
+};
+
+class DataLogger {
+
+public:
+    // capacity is the number of records the ring buffer holds
+    explicit DataLogger(size_t capacity = 1024);
+    ~DataLogger();
+
+    DataLogger(const DataLogger &) = delete;
+    DataLogger & operator=(const DataLogger &) = delete;
+
+    // start a new file, num_beams = 0 records no scans, returns false if the file can't be created
+    bool open(const std::string & path, const std::string & name, int num_beams);
+    // write everything that is still buffered and close the file
+    void close();
+    bool is_open() const {return file != nullptr;}
+
+    // called from the physics loop, scan must have num_beams ranges (or can be nullptr if num_beams is 0),
+    // returns false if the buffer is full and the record was dropped
+    bool log(double time, double desired_speed, double desired_steer_angle, const CarState & state, const float * scan);
+
+    // records written and dropped since open()
+    size_t get_written() const {return written.load();}
+    size_t get_dropped() const {return dropped;}
+    // true if writing to the file failed, the rest of the recording is lost
+    bool failed() const {return write_failed.load();}
+
+private:
+    void write_loop();
+
+    size_t capacity;
+    size_t record_size;
+    int num_beams;
+    std::vector<char> buffer;
+
+    // head is only changed by log(), tail only by the writer, both count records since open() and never wrap
+    std::atomic<size_t> head;
+    std::atomic<size_t> tail;
+
+    FILE * file;
+    std::thread writer;
+    std::atomic<bool> stopping;
+    std::atomic<bool> write_failed;
+    std::atomic<size_t> written;
+    size_t dropped;
+};
+
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+namespace racecar_simulator {
+
+/**
+ * A copy of the distance transform in a more compact format and/or a more cache friendly layout,
+ * this is what the ray marcher reads while it scans.
+ *
+ * Formats:
+ * float64: the exact values
+ * float32: half the memory, rounded towards 0
+ * uint16: a quarter of the memory, millimetres rounded down (values above 65.535m are clamped)
+ * All values are never bigger than the exact ones, so a ray never steps over an obstacle, and occupied cells stay exactly 0.
+ *
+ * Layouts:
+ * row_major: same as the distance transform, row * width + col
+ * tiled: tiles of tile_size x tile_size cells, each tile is contiguous, so a ray going up or down stays in the same
+ * few cache lines for a while instead of jumping a whole row every cell
+ * morton: Z-order curve, cells close to each other in any direction are close in memory
+ */
+class DistanceField {
+
+public:
+    enum Format {FLOAT64, FLOAT32, UINT16};
+    enum Layout {ROW_MAJOR, TILED, MORTON};
+
+    static constexpr int tile_bits = 4;
+    static constexpr size_t tile_size = 1 << tile_bits;
+    // 1mm
+    static constexpr double uint16_scale = 0.001;
+
+    DistanceField() : DistanceField(FLOAT64, ROW_MAJOR) {}
+    DistanceField(Format format, Layout layout);
+
+    // parse "float64", "float32", "uint16" and "row_major", "tiled", "morton", returns false if the name is unknown
+    static bool parse_format(const std::string & name, Format & format);
+    static bool parse_layout(const std::string & name, Layout & layout);
+    static std::string format_name(Format format);
+    static std::string layout_name(Layout layout);
+
+    Format get_format() const {return format;}
+    Layout get_layout() const {return layout;}
+
+    // float64 in row major order is the distance transform itself, the scanner reads that directly instead of a copy
+    bool is_copy() const {return format != FLOAT64 or layout != ROW_MAJOR;}
+
+    // convert the whole distance transform
+    void assign(const std::vector<double> & dt, size_t width, size_t height);
+    // convert the rectangle [row_min, row_max] x [col_min, col_max] again after those cells of dt changed
+    void update(const std::vector<double> & dt, size_t row_min, size_t col_min, size_t row_max, size_t col_max);
+
+    size_t memory_usage() const;
+
+    // row and col must be inside the map
+    inline size_t index(size_t row, size_t col) const {
+        switch (layout) {
+            case TILED:
+                return (((row >> tile_bits) * tiles_per_row + (col >> tile_bits)) << (2 * tile_bits)) +
+                       ((row & (tile_size - 1)) << tile_bits) + (col & (tile_size - 1));
+            case MORTON:
+                return morton(row, col);
+            default:
+                return row * width + col;
+        }
+    }
+
+    inline double value(size_t index) const {
+        switch (format) {
+            case FLOAT32:
+                return values32[index];
+            case UINT16:
+                return values16[index] * uint16_scale;
+            default:
+                return values64[index];
+        }
+    }
+
+    inline double at(size_t row, size_t col) const {return value(index(row, col));}
+
+private:
+    // spread the lower 32 bits of x to the even bits of the result
+    static inline uint64_t spread_bits(uint64_t x) {
+        x &= 0xFFFFFFFFull;
+        x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+        x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+        x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+        x = (x | (x << 2)) & 0x3333333333333333ull;
+        x = (x | (x << 1)) & 0x5555555555555555ull;
+        return x;
+    }
+
+    // interleave the bits of row and col, the dimension with more bits keeps its extra high bits on top
+    inline size_t morton(size_t row, size_t col) const {
+        uint64_t mask = (1ull << common_bits) - 1;
+        uint64_t result = spread_bits(col & mask) | (spread_bits(row & mask) << 1);
+        return result | (uint64_t) ((row_bits > col_bits ? row : col) >> common_bits) << (2 * common_bits);
+    }
+
+    size_t storage_size() const;
+    void store(size_t index, double value);
+
+    Format format;
+    Layout layout;
+    size_t width, height;
+    size_t tiles_per_row;
+    int row_bits, col_bits, common_bits;
+    // only the vector of the format is used
+    std::vector<double> values64;
+    std::vector<float> values32;
+    std::vector<uint16_t> values16;
+};
+
+}
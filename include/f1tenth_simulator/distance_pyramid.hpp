@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <algorithm>
+
+namespace racecar_simulator {
+
+/**
+ * A min-pyramid (mip map) of the distance transform for the ray marcher.
+ * Level l has one value per block of 2^(l + 1) x 2^(l + 1) cells, the smallest distance of the block.
+ * A block with a value above 0 has no obstacle in it, and every point of it is at least that far from one,
+ * so a ray can go through the rest of the block and then on by about the value without reading the full resolution map.
+ * That is often further than the distance of the cell itself, e.g. along a wall just outside of the block.
+ * The coarse levels are a small fraction of the map and mostly stay in the cache, while on a large map most steps in
+ * the full distance transform are cache misses. A level is only used where its step is long compared to its blocks,
+ * close to the walls the marcher reads the full resolution cell as before.
+ * This pays off on maps with large open areas like levine, on narrow racetracks almost every step is close to a wall
+ * and looking at the levels first only costs time, see the scan benchmark.
+ */
+class DistancePyramid {
+
+public:
+    // a level is used when its step is at least this many of its blocks
+    static constexpr double min_blocks = 2;
+
+    DistancePyramid() : num_levels(0), width(0), height(0), resolution(0) {}
+
+    // build num_levels levels (0 for none) from a distance transform (float64, row major)
+    void assign(const std::vector<double> & dt, size_t width_, size_t height_, double resolution_, int num_levels_);
+    // compute the blocks over the rectangle [row_min, row_max] x [col_min, col_max] again after those cells of dt changed
+    void update(const std::vector<double> & dt, size_t row_min, size_t col_min, size_t row_max, size_t col_max);
+
+    bool empty() const {return num_levels == 0;}
+    int get_levels() const {return num_levels;}
+    size_t memory_usage() const;
+
+    // the step in meters from (x, y), in cells of the map frame, in the direction whose inverse is (inv_dir_x, inv_dir_y),
+    // of the coarsest level that can be used there, 0 if the full resolution cell has to be read.
+    // x and y must be inside the map
+    inline double step(double x, double y, double inv_dir_x, double inv_dir_y) const {
+        size_t col = x;
+        size_t row = y;
+        for (int l = num_levels - 1; l >= 0; l--) {
+            int bits = l + 1;
+            double value = levels[l][(row >> bits) * level_widths[l] + (col >> bits)];
+            if (value == 0) continue;
+
+            // where the ray leaves the block, the nearest of the sides it is heading to. The values are the distances
+            // between cell centers, 1.5 cells less keeps the end of the step out of every obstacle cell
+            double block = (size_t) 1 << bits;
+            double block_col = (col >> bits) << bits;
+            double block_row = (row >> bits) << bits;
+            double to_side_x = ((inv_dir_x > 0 ? block_col + block : block_col) - x) * inv_dir_x;
+            double to_side_y = ((inv_dir_y > 0 ? block_row + block : block_row) - y) * inv_dir_y;
+            double coarse_step = (std::min(to_side_x, to_side_y) - 1.5) * resolution + value;
+            if (coarse_step >= thresholds[l]) return coarse_step;
+        }
+        return 0;
+    }
+
+private:
+    // the minimum of the values of a block, rounded down to float
+    void compute_block(const std::vector<double> & dt, int level, size_t block_row, size_t block_col);
+
+    int num_levels;
+    size_t width, height;
+    double resolution;
+    // [level][block_row * level_widths[level] + block_col]
+    std::vector<std::vector<float>> levels;
+    std::vector<size_t> level_widths;
+    std::vector<size_t> level_heights;
+    // in meters, min_blocks blocks of the level
+    std::vector<double> thresholds;
+};
+
+}
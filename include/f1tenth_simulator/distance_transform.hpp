@@ -2,6 +2,9 @@
 
 #include <vector>
 #include <limits>
+#include <cstddef>
+
+#include "f1tenth_simulator/thread_pool.hpp"
 
 namespace racecar_simulator {
 
@@ -10,6 +13,11 @@ class DistanceTransform {
 private:
 
     static constexpr double inf = std::numeric_limits<double>::infinity();
+
+    // number of columns transposed together in the column pass, 16 doubles are two cache lines per row
+    static constexpr size_t column_tile = 16;
+    // number of rows a thread takes at a time in the row pass
+    static constexpr size_t row_grain = 16;
     
 public:
     DistanceTransform(size_t max_size);
@@ -18,18 +26,42 @@ public:
         const std::vector<double> & input,
         std::vector<double> & output);
 
+    // same as above on raw buffers, parabola_idxs needs size elements and parabola_boundaries size + 1,
+    // so the caller can reuse them for every line
+    static void distance_squared_1d(
+        const double * input,
+        double * output,
+        size_t size,
+        size_t * parabola_idxs,
+        double * parabola_boundaries);
+
+    // the columns and rows are split across the threads of pool, ThreadPool::shared() if it is null,
+    // the result is the same for any number of threads
     static void distance_squared_2d(
         std::vector<double> & input,
         size_t width,
         size_t height,
-        double boundary_value=0);
+        double boundary_value=0,
+        ThreadPool * pool=nullptr);
+
+    // same as distance_squared_2d() on a window of a bigger grid, each side of the window has its own boundary value:
+    // 0 where the window ends at the edge of the map, a free value where the grid continues
+    static void distance_squared_2d_window(
+        std::vector<double> & input,
+        size_t width,
+        size_t height,
+        double bottom_boundary,
+        double top_boundary,
+        double left_boundary,
+        double right_boundary);
 
     static void distance_2d(
         std::vector<double> & input,
         size_t width,
         size_t height,
         double resolution=1,
-        double boundary_value=0);
+        double boundary_value=0,
+        ThreadPool * pool=nullptr);
 };
 
 }
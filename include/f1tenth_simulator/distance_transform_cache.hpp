@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#include "f1tenth_simulator/pose_2d.hpp"
+#include "f1tenth_simulator/occupancy_bitmap.hpp"
+
+namespace racecar_simulator {
+
+/**
+ * Distance transforms saved on disk, so a map that was seen before doesn't need to be transformed again.
+ * Each file is named after a hash of the map data and the free threshold, and holds the distance transform
+ * together with the size, resolution and origin of the map it belongs to. A file is used when those and the hash
+ * match, the map data is not compared cell by cell. Files are memory mapped when loaded.
+ */
+class DistanceTransformCache {
+
+public:
+    DistanceTransformCache() {}
+    DistanceTransformCache(const std::string & directory);
+
+    // an empty directory means the cache is disabled
+    bool enabled() const {return not directory.empty();}
+
+    // hash of everything the distance transform depends on
+    static uint64_t hash(
+        const std::vector<double> & map,
+        size_t height,
+        size_t width,
+        double resolution,
+        double free_threshold);
+    // of a thresholded map, not the same key as the map it came from
+    static uint64_t hash(const OccupancyBitmap & bitmap);
+
+    // fill dt from the cache, returns false if there is no matching file
+    bool load(
+        uint64_t key,
+        size_t height,
+        size_t width,
+        double resolution,
+        const Pose2D & origin,
+        std::vector<double> & dt) const;
+
+    // save dt to the cache, returns false if the file can't be written
+    bool store(
+        uint64_t key,
+        size_t height,
+        size_t width,
+        double resolution,
+        const Pose2D & origin,
+        const std::vector<double> & dt) const;
+
+    std::string path(uint64_t key) const;
+
+private:
+    std::string directory;
+};
+
+}
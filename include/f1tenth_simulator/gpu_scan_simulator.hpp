@@ -0,0 +1,50 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <cstddef>
+
+#include "f1tenth_simulator/scan_simulator_2d.hpp"
+
+namespace racecar_simulator {
+
+/**
+ * The scans of ScanSimulator2D on a CUDA GPU, built as the separate library f1tenth_simulator_cuda (CMake option
+ * CUDA_SCAN). The distance transform stays on the device between steps, and scan_batch() computes every beam of
+ * every request, including the opponent cars, in one kernel launch.
+ * The per scan stage (footprints of the opponents, theta indices, noise seed) is the one of the CPU scanner,
+ * so the ranges are the same as ScanSimulator2D::scan_batch() without the range table and the distance pyramid,
+ * which the GPU doesn't use. It always reads dt itself (float64), whatever the DistanceField of the scanner is.
+ * upload_map() and scan_batch() can be called from different threads, they wait for each other.
+ * Nothing in here throws, every call returns false and says why in error if something failed.
+ */
+class GpuScanSimulator {
+
+public:
+    // whether there is a CUDA device to scan on
+    static bool available(std::string * error = nullptr);
+
+    // scanner must outlive this, its settings (noise, march settings, ...) are read by every scan_batch()
+    explicit GpuScanSimulator(const ScanSimulator2D & scanner);
+    ~GpuScanSimulator();
+
+    GpuScanSimulator(const GpuScanSimulator &) = delete;
+    GpuScanSimulator & operator=(const GpuScanSimulator &) = delete;
+
+    // copy the distance transform of the scanner to the device, before the first scan and after every
+    // set_map() or update_map() of the scanner. Takes the lock of its map shared, so CPU scans may run meanwhile
+    bool upload_map(std::string * error = nullptr);
+
+    // the same as ScanSimulator2D::scan_batch(), each request needs its own context, which gets the noise seed,
+    // the footprints and can_see_opponent like on the CPU. Blocks until the ranges are in the scan_data of the requests
+    bool scan_batch(ScanRequest * requests, size_t num_requests, std::string * error = nullptr);
+
+    // everything allocated on the device
+    size_t device_bytes() const;
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+#include "f1tenth_simulator/pose_2d.hpp"
+#include "f1tenth_simulator/occupancy_bitmap.hpp"
+
+namespace racecar_simulator {
+
+// A map as map_server publishes it, the same values as nav_msgs::OccupancyGrid
+struct OccupancyMap {
+    size_t width = 0;
+    size_t height = 0;
+    double resolution = 0;
+    // the cell (row 0, col 0) in the map frame
+    Pose2D origin = {0, 0, 0};
+    // row major, row 0 is the bottom of the image. 0 free, 100 occupied, -1 unknown
+    std::vector<int8_t> data;
+};
+
+/**
+ * Loads a map yaml of maps/ and its image without ROS, the same way map_server does in its default trinary mode:
+ * a pixel is occupied when (255 - value) / 255 (value / 255 with negate) is above occupied_thresh,
+ * free below free_thresh and unknown in between, colour pixels are the mean of their channels.
+ * Reads binary and ascii PGM, and PNG when the library is built with libpng.
+ * The image is read and thresholded one row at a time, only the map (one byte per cell) or the bitmap (one bit) is kept.
+ */
+class MapLoader {
+
+public:
+    // false if the yaml or the image can't be read, error says why
+    static bool load(const std::string & yaml_path, OccupancyMap & map, std::string * error = nullptr);
+
+    // the same into the map and the free cells of the scanner at once, either can be null.
+    // free_threshold is the one of ScanSimulator2D::set_map(), the bitmap goes straight to its distance transform
+    static bool load(const std::string & yaml_path, OccupancyMap * map, OccupancyBitmap * bitmap, double free_threshold,
+                     std::string * error = nullptr);
+
+    // the values ScanSimulator2D::set_map() takes, [0, 1] with 0.5 for unknown cells, like the map_callback() of the simulator
+    static std::vector<double> to_scan_map(const OccupancyMap & map);
+};
+
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "f1tenth_simulator/pose_2d.hpp"
+
+namespace racecar_simulator {
+
+/**
+ * The map as the distance transform needs it, one bit per cell that is set where the scanner sees free space,
+ * 64 times smaller than the [0, 1] values of ScanSimulator2D::set_map(). Cells are row major like OccupancyMap,
+ * row 0 is the bottom of the image, each row starts at a new word.
+ */
+struct OccupancyBitmap {
+    size_t width = 0;
+    size_t height = 0;
+    double resolution = 0;
+    // the cell (row 0, col 0) in the map frame
+    Pose2D origin = {0, 0, 0};
+    size_t words_per_row = 0;
+    std::vector<uint64_t> bits;
+
+    // all cells occupied
+    void resize(size_t width_, size_t height_) {
+        width = width_;
+        height = height_;
+        words_per_row = (width + 63) / 64;
+        bits.assign(words_per_row * height, 0);
+    }
+
+    bool is_free(size_t row, size_t col) const {return (bits[row * words_per_row + col / 64] >> (col % 64)) & 1;}
+    bool is_free(size_t cell) const {return is_free(cell / width, cell % width);}
+    void set_free(size_t row, size_t col) {bits[row * words_per_row + col / 64] |= uint64_t(1) << (col % 64);}
+
+    // whether a cell of a nav_msgs::OccupancyGrid is free with this threshold, the same as the map_callback() of the
+    // simulator and ScanSimulator2D::set_map(): [0, 100] is [0, 1] and anything else is unknown (0.5)
+    static bool free_value(int8_t value, double free_threshold) {
+        double occupancy = value < 0 or value > 100 ? 0.5 : value / 100.;
+        return occupancy <= free_threshold;
+    }
+
+    // threshold the cells of an OccupancyGrid (row major, width * height values)
+    void assign(const int8_t * data, size_t width_, size_t height_, double free_threshold) {
+        resize(width_, height_);
+        // the cell values are only 256 different ones
+        bool free[256];
+        for (int value = -128; value < 128; value++) free[uint8_t(value)] = free_value(value, free_threshold);
+        for (size_t row = 0; row < height; row++) {
+            for (size_t col = 0; col < width; col++) {
+                if (free[uint8_t(data[row * width + col])]) set_free(row, col);
+            }
+        }
+    }
+};
+
+}
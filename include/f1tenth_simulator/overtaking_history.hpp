@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+
+#include "f1tenth_simulator/car_state.hpp"
+
+namespace racecar_simulator {
+
+/**
+ * What the overtaking models of overtaking_models/ see of one car: its last `history` scans and
+ * (velocity_x, steer_angle), the two queues of ML_overtaking_red.py. A ring buffer, push() of every step
+ * only copies the scan over the oldest one, copy() writes them oldest first, the order of the model inputs.
+ */
+class OvertakingHistory {
+
+public:
+    OvertakingHistory() : OvertakingHistory(0, 0) {}
+    OvertakingHistory(size_t history, size_t num_beams);
+
+    // scan has num_beams ranges
+    void push(const float * scan, const CarState & state);
+    void clear();
+    // the model only runs once history steps are there, like ML_overtaking_red.py
+    bool full() const {return count == history and history > 0;}
+
+    // scans gets history * num_beams ranges, states history * 2 values, oldest first
+    void copy(float * scans, float * states) const;
+
+    size_t get_history() const {return history;}
+    size_t get_num_beams() const {return num_beams;}
+
+private:
+    size_t history;
+    size_t num_beams;
+    // the slot the next push() overwrites, and how many are filled
+    size_t next = 0;
+    size_t count = 0;
+    std::vector<float> scans;
+    std::vector<float> states;
+};
+
+}
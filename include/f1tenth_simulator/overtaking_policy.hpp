@@ -0,0 +1,60 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <cstddef>
+
+namespace racecar_simulator {
+
+// Everything OvertakingPolicy needs to know about a model, the defaults are the ones of ML_overtaking_red.py
+struct OvertakingModelConfig {
+    // a Keras SavedModel, e.g. overtaking_models/model_LSTM_10_3
+    std::string saved_model_dir;
+    // steps of history per prediction, size_of_input in ML_overtaking_red.py
+    size_t history = 6;
+    size_t num_beams = 1081;
+    // the model outputs tanh values, the command is them times these
+    double speed_scale = 17;
+    double steer_scale = 0.24;
+    // the operations of the serving_default signature, the same in all models of overtaking_models/:
+    // the scans [batch, history, num_beams], the speed and steering angle [batch, history, 2], and the output
+    // [batch, history, 2] of which the last step is the command
+    std::string scan_input = "serving_default_input_1";
+    std::string state_input = "serving_default_input_2";
+    std::string output = "StatefulPartitionedCall";
+    // threads of TensorFlow within one prediction, 0 for its default
+    int num_threads = 0;
+};
+
+/**
+ * The overtaking models run inside the simulator, through the TensorFlow C API, built as the separate library
+ * f1tenth_simulator_tf (CMake option TF_INFERENCE). The simulator node feeds it the scans and states of its
+ * own cars (see OvertakingHistory) and gets the drive commands back within the same step, instead of
+ * ML_overtaking_red.py reading them from topics. All cars driven by the model go into one batch.
+ * Nothing in here throws, every call returns false and says why in error if something failed.
+ */
+class OvertakingPolicy {
+
+public:
+    OvertakingPolicy();
+    ~OvertakingPolicy();
+
+    OvertakingPolicy(const OvertakingPolicy &) = delete;
+    OvertakingPolicy & operator=(const OvertakingPolicy &) = delete;
+
+    // load the SavedModel with the tag "serve" and find the operations of config
+    bool load(const OvertakingModelConfig & config, std::string * error = nullptr);
+    bool is_loaded() const;
+    const OvertakingModelConfig & get_config() const;
+
+    // scans [batch][history][num_beams] and states [batch][history][2] as OvertakingHistory::copy() writes them,
+    // commands gets the speed and the steering angle of every car of the batch
+    bool predict(const float * scans, const float * states, size_t batch, double * commands,
+                 std::string * error = nullptr);
+
+private:
+    struct Impl;
+    std::unique_ptr<Impl> impl;
+};
+
+}
@@ -1,5 +1,7 @@
 #pragma once 
 
+#include <vector>
+
 namespace racecar_simulator {
 
 class Precompute {
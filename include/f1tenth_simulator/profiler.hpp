@@ -0,0 +1,173 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <memory>
+#include <string>
+#include <vector>
+#include <thread>
+#include <utility>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+
+namespace racecar_simulator {
+
+// What a Profiler measured for one stage, see Profiler::snapshot()
+struct StageStats {
+    // bucket b counts the durations in [2^b, 2^(b + 1)) ns, the last one everything longer
+    static constexpr size_t num_buckets = 32;
+
+    std::string name;
+    uint64_t count = 0;
+    // e.g. the beams of a scan, see Profiler::record()
+    uint64_t items = 0;
+    uint64_t total_ns = 0;
+    uint64_t max_ns = 0;
+    std::array<uint64_t, num_buckets> histogram{};
+
+    double mean_ns() const {return count ? double(total_ns) / count : 0;}
+    // the upper end of the bucket that holds the q-th quantile (0 <= q <= 1), at most a factor 2 too high
+    double quantile_ns(double q) const;
+};
+
+/**
+ * Low overhead timing of the stages of a loop, e.g. the physics, the scans and the publishers of the simulator.
+ * Stages are added by name once, then every thread records durations with ScopedTimer or record().
+ * Each thread writes to its own block of counters (all stages of a thread are next to each other) with relaxed
+ * atomics, so recording doesn't take a lock and threads don't fight over cache lines.
+ * snapshot() adds up the blocks of all threads.
+ *
+ * Optionally every recorded duration is also written to a trace file in the Chrome trace event format,
+ * which chrome://tracing and https://ui.perfetto.dev open. The events are buffered per thread, a full block is handed
+ * to a writer thread, so the threads that record never wait for the file.
+ */
+class Profiler {
+
+public:
+    typedef size_t Stage;
+    static constexpr size_t max_stages = 32;
+    // threads after this many share the last block, which is still correct but slower
+    static constexpr size_t max_threads = 32;
+
+    Profiler();
+    ~Profiler();
+
+    Profiler(const Profiler &) = delete;
+    Profiler & operator=(const Profiler &) = delete;
+
+    // before the stage is recorded the first time, from any thread and while other stages are recorded,
+    // a name that is already there gets its stage back, after max_stages stages the last one is reused
+    Stage add_stage(const std::string & name);
+
+    // nothing is recorded while disabled, ScopedTimer doesn't even read the clock
+    void set_enabled(bool enabled_) {enabled.store(enabled_, std::memory_order_relaxed);}
+    bool is_enabled() const {return enabled.load(std::memory_order_relaxed);}
+
+    // nanoseconds since the profiler was created
+    uint64_t now_ns() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_time).count();
+    }
+
+    // one run of stage from begin_ns to end_ns (of now_ns()) that handled items things, e.g. beams
+    void record(Stage stage, uint64_t begin_ns, uint64_t end_ns, uint64_t items = 1);
+
+    // the stats of every stage since the last snapshot with reset (or since the start),
+    // with reset the counters start again from 0, a record() running at the same time may end up in either
+    std::vector<StageStats> snapshot(bool reset);
+
+    // write every recorded duration to file until stop_trace(), false if the file can't be created
+    bool start_trace(const std::string & file);
+    void stop_trace();
+    bool is_tracing() const {return tracing.load(std::memory_order_relaxed);}
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Counters {
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> items;
+        std::atomic<uint64_t> total_ns;
+        std::atomic<uint64_t> max_ns;
+        std::array<std::atomic<uint64_t>, StageStats::num_buckets> histogram;
+    };
+
+    struct TraceEvent {
+        Stage stage;
+        uint64_t begin_ns;
+        uint64_t end_ns;
+    };
+
+    // the trace events of one thread, the lock is only taken by that thread and when the trace is written
+    struct TraceBuffer {
+        std::mutex mutex;
+        std::vector<TraceEvent> events;
+    };
+
+    Clock::time_point start_time;
+    std::atomic<bool> enabled;
+
+    // all max_stages names exist from the start, so they never move. A name is written under stage_mutex before
+    // num_stages counts it, record() and snapshot() only read the first num_stages
+    std::array<std::string, max_stages> stage_names;
+    std::atomic<size_t> num_stages;
+    std::mutex stage_mutex;
+    // [thread][stage]
+    std::unique_ptr<Counters[]> counters;
+
+    std::atomic<bool> tracing;
+    // trace_mutex guards the queue, the spare blocks and trace_writer_stopping, the file is only written by the
+    // writer thread (and by stop_trace() once the writer is gone)
+    std::mutex trace_mutex;
+    std::condition_variable trace_condition;
+    std::thread trace_writer;
+    bool trace_writer_stopping;
+    // full blocks of events and the slot of the thread they are from, in the order they filled up
+    std::vector<std::pair<size_t, std::vector<TraceEvent>>> trace_queue;
+    // written blocks, cleared with their memory kept, for the next thread whose block is full
+    std::vector<std::vector<TraceEvent>> spare_blocks;
+    FILE * trace_file;
+    bool trace_first_event;
+    std::unique_ptr<TraceBuffer[]> trace_buffers;
+
+    // the block of the calling thread, threads get the next free one the first time they record
+    static size_t thread_slot();
+    void write_loop();
+    void write_trace_events(size_t slot, std::vector<TraceEvent> & events);
+};
+
+// times its own lifetime as one run of stage, e.g. {ScopedTimer timer(profiler, physics_stage); ...}
+class ScopedTimer {
+
+public:
+    ScopedTimer(Profiler & profiler_, Profiler::Stage stage_, uint64_t items_ = 1)
+      : profiler(profiler_.is_enabled() ? &profiler_ : nullptr),
+        stage(stage_),
+        items(items_),
+        begin_ns(profiler ? profiler->now_ns() : 0) {}
+
+    ~ScopedTimer() {stop();}
+
+    // ends the run before the timer goes out of scope, later calls do nothing
+    void stop() {
+        if (profiler) profiler->record(stage, begin_ns, profiler->now_ns(), items);
+        profiler = nullptr;
+    }
+
+    // the number of items is only known at the end, e.g. the beams of all cars that were scanned
+    void set_items(uint64_t items_) {items = items_;}
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer & operator=(const ScopedTimer &) = delete;
+
+private:
+    Profiler * profiler;
+    Profiler::Stage stage;
+    uint64_t items;
+    uint64_t begin_ns;
+};
+
+}
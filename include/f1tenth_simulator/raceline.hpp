@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstddef>
+
+namespace racecar_simulator {
+
+/**
+ * A raceline of a racetrack, e.g. maps/<map>_minTime.csv from Racetrack-Preparation, loaded once and kept in memory.
+ * The file has a heading and then one point per line: s_m; x_m; y_m; psi_rad; kappa_radpm; vx_mps; ax_mps2
+ * Points are stored column by column, the line is closed, the last point connects to the first one.
+ */
+class Raceline {
+
+public:
+    Raceline() {}
+
+    // read a raceline csv, returns false if the file can't be read or has no points
+    bool load(const std::string & path);
+
+    // move the points into the map frame: x' = scale_x * x + offset_x, y' = scale_y * y + offset_y,
+    // the headings follow and s is measured again along the new points. kappa is divided by the scale and changes
+    // its sign under a mirror, with different |scale_x| and |scale_y| it is divided by their geometric mean,
+    // which is only an approximation
+    void transform(double scale_x, double offset_x, double scale_y, double offset_y);
+
+    size_t size() const {return x.size();}
+    bool empty() const {return x.empty();}
+    // length of the closed line
+    double length() const {return total_length;}
+
+    // index of the point closest to (x, y), the raceline must not be empty
+    size_t closest_point(double x, double y) const;
+    // distance along the raceline of the point on it closest to (x, y), in [0, length())
+    double progress(double x, double y) const;
+
+    // one entry per point
+    std::vector<double> s;
+    std::vector<double> x;
+    std::vector<double> y;
+    // heading like the csv, 0 is north (+y) and the angle from the x axis is psi + Pi/2, in (-Pi, Pi]
+    std::vector<double> psi;
+    // curvature in 1/m, positive to the left
+    std::vector<double> kappa;
+    std::vector<double> vx;
+    std::vector<double> ax;
+
+private:
+    // s of every point and total_length from the points
+    void measure();
+
+    double total_length = 0;
+};
+
+}
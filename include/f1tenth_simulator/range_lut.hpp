@@ -0,0 +1,92 @@
+#pragma once
+
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <cstddef>
+
+#include "f1tenth_simulator/occupancy_bitmap.hpp"
+
+namespace racecar_simulator {
+
+/**
+ * A precomputed range lookup table for a static map, this is the "Compressed Directional Distance Transform" (CDDT) from
+ * Walsh and Karaman, "CDDT: Fast Approximate 2D Ray Casting for Accelerated Localization"
+ * https://arxiv.org/abs/1705.01167
+ *
+ * For every direction, the map is cut into lanes parallel to that direction, one cell wide.
+ * Each lane keeps a sorted list of where its centre line goes through the obstacles, the entry and the length of the chord.
+ * Casting a ray is then finding the lane of the ray and a binary search for the first obstacle after the start point.
+ * That is the range of the ray moved sideways onto the centre line of its lane, by up to half a cell: exact for a ray
+ * hitting a wall straight on, for a beam at angle a to the normal of a wall off by up to 0.5 * resolution * tan(a).
+ * Only obstacle cells next to a free cell are stored (a ray can't reach the others), and a lane is used for both
+ * a direction and its opposite, so only half of the directions are stored.
+ */
+class RangeLUT {
+
+public:
+    RangeLUT(int theta_discretization);
+    ~RangeLUT();
+
+    RangeLUT(const RangeLUT &) = delete;
+    RangeLUT & operator=(const RangeLUT &) = delete;
+
+    // build the table from a distance transform (0 means occupied), blocks until it is done
+    void build(const std::vector<double> & dt, size_t width, size_t height, double resolution);
+
+    // same as build() but the table is built in a background thread, ready() becomes true when it is done
+    void build_async(const std::vector<double> & dt, size_t width, size_t height, double resolution);
+
+    bool ready() const {return built.load(std::memory_order_acquire);}
+
+    // distance from (x, y) to the first obstacle in the direction of angle,
+    // x, y and angle are in the frame of the map, i.e. relative to its origin (bottom left corner)
+    double range(double x, double y, double angle) const;
+
+    size_t memory_usage() const;
+    int get_theta_discret() const {return theta_discretization;}
+
+private:
+    // position of an obstacle cell in the map frame
+    struct Cell {
+        float x;
+        float y;
+    };
+
+    // the free cells of a distance transform, the cells that are not 0
+    static OccupancyBitmap free_cells(const std::vector<double> & dt, size_t width, size_t height);
+    void build_from_bitmap(OccupancyBitmap free);
+    void find_boundary_cells(const OccupancyBitmap & free, std::vector<Cell> & cells) const;
+    void build_tables(std::vector<Cell> cells, size_t width, size_t height);
+    // where the line at direction (c, s) and offset along its normal (-s, c) from the centre of a cell enters and
+    // leaves the cell, entry <= exit along the direction
+    void chord(double c, double s, double offset, double * entry, double * exit) const;
+
+    // number of directions in 2Pi, the table stores theta_discretization/2 directions in [0, Pi)
+    int theta_discretization;
+    int num_directions;
+    double resolution;
+    // obstacle positions are stored in units of `unit` meters from the start of the lane list
+    double unit;
+
+    // for every direction
+    std::vector<double> sines, cosines;
+    std::vector<double> lane_start;   // smallest projection of the map on the normal of the direction
+    std::vector<double> z_start;      // smallest projection of the map on the direction
+    std::vector<uint32_t> num_lanes;
+    std::vector<uint32_t> first_lane; // index of the first lane of the direction in lane_offsets
+
+    // obstacles of lane i are entries[lane_offsets[i]] to entries[lane_offsets[i + 1]], the centre line of the lane
+    // enters the obstacle at entries[j] and leaves it at entries[j] + lengths[j], in units.
+    // A chord is at most sqrt(2) cells, at most 6 units
+    std::vector<uint32_t> lane_offsets;
+    std::vector<uint16_t> entries;
+    std::vector<uint8_t> lengths;
+
+    std::thread builder;
+    std::atomic<bool> built;
+    std::atomic<bool> cancelled;
+};
+
+}
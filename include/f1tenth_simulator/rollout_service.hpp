@@ -0,0 +1,84 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <cstddef>
+
+#include "f1tenth_simulator/car_state.hpp"
+#include "f1tenth_simulator/car_params.hpp"
+#include "f1tenth_simulator/vehicle_model.hpp"
+#include "f1tenth_simulator/thread_pool.hpp"
+
+namespace racecar_simulator {
+
+/**
+ * The vehicle model of the simulator for a model predictive controller: predicted trajectories of a batch of cars
+ * under sequences of drive commands, and the Jacobians of every step along them, so MPC_red.py can optimize
+ * against the dynamics the simulator really runs instead of its own copy of the bicycle model.
+ * A step is STKinematics::integrate() with the dt, physics_dt and integrator of the simulator node, the prediction
+ * of a command sequence is the race that would follow if the controller sent those commands at dt.
+ * Unlike BatchVehicleModel (one Euler step, vectorized), any integrator and sub-steps are the same as in the node.
+ *
+ * The cars, and for linearize() the steps of every car, are split across the threads of the service.
+ * The Jacobians are central differences, the model has kinks (the switch to the kinematic model below 0.5m/s,
+ * the limits of the speed and the steering angle), next to one of those they are the slope of one side.
+ * rollout(), linearize() and set_perturbation() can be called from several threads (the Python bindings release
+ * the GIL while they run), the calls are serialised by a mutex of the service, each one still uses all the threads.
+ */
+class RolloutService {
+
+public:
+    // x, y, theta, velocity_x, velocity_y, steer_angle, angular_velocity, slip_angle, the states of VecEnv
+    static const size_t state_size = 8;
+    // desired speed and desired steering angle, the drive command
+    static const size_t control_size = 2;
+
+    // num_threads includes the calling thread, 0 for one per CPU
+    RolloutService(const CarParams & params, double dt, double physics_dt = 0,
+                   STKinematics::Integrator integrator = STKinematics::EULER, size_t num_threads = 0);
+
+    // relative step of the central differences, the default cbrt of the machine epsilon balances truncation
+    // against rounding
+    void set_perturbation(double perturbation_) {
+        std::lock_guard<std::mutex> lock(mutex);
+        perturbation = perturbation_;
+    }
+
+    // trajectories [batch][horizon + 1], the first state of a car is its start, from starts [batch] under
+    // controls [batch][horizon][control_size]
+    void rollout(const CarState * starts, size_t batch, const double * controls, size_t horizon,
+                 CarState * trajectories);
+
+    // rollout() and per step k of every car state_jacobians [batch][horizon][state_size][state_size], the derivative
+    // of state k + 1 by state k, and control_jacobians [batch][horizon][state_size][control_size], by control k.
+    // Row major, a row is one component of state k + 1. Nothing depends on slip_angle, its column is 0
+    void linearize(const CarState * starts, size_t batch, const double * controls, size_t horizon,
+                   CarState * trajectories, double * state_jacobians, double * control_jacobians);
+
+    // one step of a car, what the simulator does with a command for dt seconds
+    CarState step(const CarState & state, double desired_speed, double desired_steer_angle) const;
+
+    static void to_vector(const CarState & state, double * vector);
+    // st_dyn says which model the car used in its last step, it moves the switch between them by 0.03m/s
+    static CarState from_vector(const double * vector, bool st_dyn);
+
+    size_t get_num_threads() const {return pool->size();}
+
+private:
+    // rollout() without taking the mutex, linearize() already holds it
+    void run_rollout(const CarState * starts, size_t batch, const double * controls, size_t horizon,
+                     CarState * trajectories);
+    void linearize_step(const CarState & state, const double * control, double * state_jacobian,
+                        double * control_jacobian) const;
+
+    CarParams params;
+    double dt;
+    double physics_dt;
+    STKinematics::Integrator integrator;
+    double perturbation;
+    std::unique_ptr<ThreadPool> pool;
+    // held for a whole rollout() or linearize()
+    std::mutex mutex;
+};
+
+}
@@ -1,13 +1,169 @@
 #pragma once
 
 #include <random>
+#include <memory>
+#include <shared_mutex>
+#include <cstdint>
 
 #include "f1tenth_simulator/pose_2d.hpp"
+#include "f1tenth_simulator/range_lut.hpp"
+#include "f1tenth_simulator/distance_transform_cache.hpp"
+#include "f1tenth_simulator/distance_field.hpp"
+#include "f1tenth_simulator/distance_pyramid.hpp"
+#include "f1tenth_simulator/occupancy_bitmap.hpp"
+#include "f1tenth_simulator/thread_pool.hpp"
+#include "f1tenth_simulator/sensor_geometry.hpp"
 
 namespace racecar_simulator {
 
+// Result of ScanSimulator2D::benchmark_distance_field()
+struct DistanceFieldReport {
+    size_t dt_bytes;
+    // 0 if the ray marcher reads dt itself
+    size_t field_bytes;
+    // the levels of the distance pyramid, 0 without
+    size_t pyramid_bytes;
+    double ms_per_scan;
+    // the same scans reading dt (float64, row major) without the pyramid
+    double baseline_ms_per_scan;
+};
+
+// The opponent car as seen from the LiDAR, everything in here is the same for all beams of one scan
+struct OpponentFootprint {
+    // center of the opponent car
+    double x;
+    double y;
+    // four corners in anti-clockwise direction
+    double corner_x[4];
+    double corner_y[4];
+    // distance between the LiDAR and the center of the opponent car
+    double this_to_opponent;
+    // only beams in [first_beam[i], last_beam[i]] can hit the opponent car,
+    // there can be more than one interval when it wraps around the start of the scan
+    int first_beam[3];
+    int last_beam[3];
+    int num_intervals;
+};
+
+/**
+ * The map as the scanner sees it, the distance transform and everything computed from it.
+ * Scans only read it, so every copy of a ScanSimulator2D and every thread scanning with one uses the same ScanMap,
+ * however large dt is. set_map() and update_map() of any of those scanners change it in place
+ * while they hold mutex exclusively, scans hold it shared.
+ */
+struct ScanMap {
+    double resolution = 0;
+    size_t width = 0;
+    size_t height = 0;
+    Pose2D origin = {0, 0, 0};
+    // cos and sin of origin.theta
+    double origin_c = 1;
+    double origin_s = 0;
+    std::vector<double> dt;
+    // what the ray marcher reads, a converted copy of dt, or nothing if dt is used as it is (float64, row major)
+    DistanceField field;
+    // optional coarse levels of dt for long steps away from the walls, empty unless enabled
+    DistancePyramid pyramid;
+    int pyramid_levels = 0;
+    // optional precomputed range table, built in the background after the map changed,
+    // the ray marcher is used until it is ready
+    std::shared_ptr<RangeLUT> range_lut;
+
+    mutable std::shared_timed_mutex mutex;
+
+    // distance to the nearest obstacle, 0 outside of the map
+    double distance_transform(double x, double y) const;
+    // index of the cell of (x, y) in dt, or in the field if it is a copy, -1 outside of the map
+    long long field_cell(double x, double y) const;
+    // the inverse of the beam direction (c, s) in the map frame, what the pyramid needs
+    void march_direction(double c, double s, double * inv_dir_x, double * inv_dir_y) const;
+    // a step of the marcher from (x, y) in the direction of march_direction(): if a level of the pyramid can be used,
+    // -1 and its step in coarse, otherwise field_cell() and 0 in coarse
+    long long march_cell(double x, double y, double inv_dir_x, double inv_dir_y, double * coarse) const;
+    // how far the marcher can step from (x, y), the coarse step of the pyramid or distance_transform()
+    double march_distance(double x, double y, double inv_dir_x, double inv_dir_y) const;
+    void xy_to_row_col(double x, double y, int * row, int * col) const;
+    int row_col_to_cell(int row, int col) const {return row * width + col;}
+
+    // recompute dt around the rectangle [row_min, row_max] x [col_min, col_max] where the map changed,
+    // is_free(cell) tells whether a cell of the rectangle is free now. mutex must be held exclusively
+    template <typename IsFree>
+    void update_region(
+        const IsFree & is_free,
+        size_t row_min,
+        size_t col_min,
+        size_t row_max,
+        size_t col_max);
+
+    // a copy that isn't shared with anybody, the range table is shared as it never changes once built
+    std::shared_ptr<ScanMap> clone() const;
+};
+
+/**
+ * Everything a scan changes, owned by the caller instead of the scanner, so the scans of different cars
+ * can run at the same time, each car with its own context.
+ */
+struct ScanContext {
+    // every scan draws one number from it, the noise of each beam is computed from that number and the beam index,
+    // so the noise is the same however the beams of a scan are split between threads
+    std::mt19937_64 noise_generator;
+    // whether the last scan with flag set hit another car closer than 5m
+    bool can_see_opponent = false;
+    // the ranges of the last scan() that returns a vector
+    std::vector<double> ranges;
+
+    // scratch of one scan, kept to avoid allocating for every scan
+    std::vector<OpponentFootprint> footprints;
+    size_t num_footprints = 0;
+    std::vector<int> theta_indices;
+    uint64_t noise_seed = 0;
+    // whether a chunk of beams of scan_batch() hit another car
+    std::vector<uint8_t> chunk_saw_opponent;
+
+    ScanContext() : noise_generator(std::random_device{}()) {}
+    explicit ScanContext(uint64_t seed) : noise_generator(seed) {}
+};
+
+// How the ray marcher finds where a beam hits the racetrack, the accuracy of the beams against the look ups per beam,
+// see ScanSimulator2D::set_march_settings()
+// The defaults are the original marcher, so the ranges stay what they were. params.yaml turns on
+// stop_at_max_range and bisect, which are faster and give slightly different ranges
+struct MarchSettings {
+    // stop a beam once it is further than scan_max_range from the car and still in free space,
+    // its range is scan_max_range anyway, only the opponent car can make it shorter
+    bool stop_at_max_range = false;
+    // the smallest step in meters, 0 steps exactly by the distance to the nearest obstacle.
+    // Larger steps need fewer look ups close to the walls, but may jump over obstacles thinner than the step
+    double min_step = 0;
+    // after the step that reached an obstacle, the boundary is bisected between the last free point and that point
+    // until it is known within refine_epsilon meters, about log2(step / refine_epsilon) look ups.
+    // If false, the beam backs off in steps of 0.01m like the original marcher, which can take dozens of look ups
+    bool bisect = false;
+    double refine_epsilon = 0.01;
+};
+
+// one scan of ScanSimulator2D::scan_batch()
+struct ScanRequest {
+    Pose2D pose;
+    // the other cars, see scan()
+    const Pose2D * opponent_poses;
+    size_t num_opponents;
+    // num_beams ranges, owned by the caller
+    float * scan_data;
+    // whether context->can_see_opponent is computed
+    bool flag;
+    ScanContext * context;
+};
+
+class GpuScanSimulator;
+namespace gpu {struct HostScanner;}
+
 class ScanSimulator2D {
 
+  // scans on the GPU with the same per scan stage, see prepare_scan(), and the kernel's beams on the host
+  friend class GpuScanSimulator;
+  friend struct gpu::HostScanner;
+
   private:
 
     // Laser settings
@@ -19,36 +175,120 @@ class ScanSimulator2D {
     double cube_width;
     // Ray tracing settings
     double ray_tracing_epsilon;
+    // if true, beams are marched in packets by march_packet(), otherwise one by one by trace_ray()
+    bool vectorized;
+    MarchSettings march;
 
-    // The distance transform
-    double resolution;
-    size_t width, height;
-    Pose2D origin;
-    std::vector<double> dt;
+    // The distance transform, shared with the copies of this scanner, never null
+    std::shared_ptr<ScanMap> scan_map;
+
+    // distance transforms of maps seen before, disabled unless a directory is set
+    DistanceTransformCache dt_cache;
+    bool dt_from_cache;
 
-    // Static output vector
-    std::vector<double> scan_output;
+    // whether the range table of the map is built and read, see ScanMap::range_lut
+    bool use_range_lut;
 
-    // Noise generation
-    std::mt19937 noise_generator;
-    std::normal_distribution<double> noise_dist;
+    // the context of the scan() overloads without one
+    ScanContext context;
 
     // Precomputed constants
-    double origin_c;
-    double origin_s;
+    std::shared_ptr<const SensorGeometry::AngleTables> angle_tables;
     int theta_discretization;
     double theta_index_increment;
 
-    bool flag_can_see_opponent;
     double threshold;
-    bool can_see_opponent;
+
+    // march a single beam through map until it reaches an obstacle, return the travelled distance and where it stopped
+    double march_ray(const ScanMap & map, double x, double y, int theta_index_, double * hit_x, double * hit_y) const;
+
+    // march packet_size beams (or fewer, given by lanes) from the same origin at the same time
+    void march_packet(
+        const ScanMap & map,
+        double x,
+        double y,
+        const int * theta_indices,
+        int lanes,
+        double * total_distances,
+        double * hit_x,
+        double * hit_y) const;
+
+    // look up the static ranges of the beams in the range table, same outputs as march_packet()
+    void lookup_packet(
+        const ScanMap & map,
+        double x,
+        double y,
+        const int * theta_indices,
+        int lanes,
+        double * total_distances,
+        double * hit_x,
+        double * hit_y) const;
+
+    // threshold the map and compute dt of scan_map, or load it from the cache, the mutex of scan_map must be held exclusively
+    void compute_distance_transform(const std::vector<double> & map, double free_threshold);
+    void compute_distance_transform(const OccupancyBitmap & bitmap);
+    // the parts of both around the thresholding: dt from the cache if it has key, and after dt is thresholded
+    bool load_cached_distance_transform(uint64_t key);
+    void finish_distance_transform(uint64_t key);
+
+    // update_map() of the changed cells, is_free(cell) is the new state of a cell
+    template <typename IsFree>
+    void update_cells(const IsFree & is_free, const std::vector<size_t> & changed_cells);
+
+    // start building the range table for the current map, the mutex of scan_map must be held exclusively
+    void build_range_lut();
+
+    // the range table is in use and finished building
+    bool lut_ready(const ScanMap & map) const {return use_range_lut and map.range_lut and map.range_lut->ready();}
+
+    // per scan stage: corners of the opponent car and the beams that can possibly hit it,
+    // returns false if the car is too far away to be hit by any beam
+    bool compute_footprint(const Pose2D & pose, const Pose2D & opponent_pose, OpponentFootprint & opponent) const;
+    bool may_hit_opponent(const OpponentFootprint & opponent, int beam) const;
+
+    // the scan itself, T is double or float, so the output can be written straight into e.g. a LaserScan message
+    template <typename T>
+    void scan_into(const Pose2D & pose, const Pose2D * opponent_poses, size_t num_opponents, T * scan_data,
+                   bool flag, ScanContext & context_) const;
+
+    // the part of a scan that is the same for all beams: the footprints of the opponents, the theta index of every beam
+    // and the seed of the noise, stored in context_
+    void prepare_scan(const Pose2D & pose, const Pose2D * opponent_poses, size_t num_opponents,
+                      ScanContext & context_) const;
+
+    // the beams [begin, end) of a scan prepared by prepare_scan(), scan_data points to the first beam of the scan.
+    // Different beams of the same scan can be computed by different threads at the same time,
+    // the mutex of map must be held (shared). Returns true if flag is set and a beam hit an opponent closer than threshold
+    template <typename T>
+    bool scan_beams(const ScanMap & map, const Pose2D & pose, const ScanContext & context_, int begin, int end,
+                    T * scan_data, bool flag) const;
+
+    // check whether the beam is blocked by the opponent car, return the final range of the beam.
+    // saw_opponent is set to true if it is not null and the car closer than threshold blocks the beam
+    double intersect_opponent(
+        double original_x,
+        double original_y,
+        int theta_index_,
+        double x,
+        double y,
+        double total_distance,
+        const OpponentFootprint & opponent,
+        bool * saw_opponent) const;
 
   public:
-    std::vector<double> sines;
-    std::vector<double> cosines;
-    std::vector<double> arctanes;
+    // how many beams are marched together in one packet, 8 doubles fit in an AVX-512 register, 4 in AVX2
+#if defined(__AVX512F__)
+    static constexpr int packet_size = 8;
+#else
+    static constexpr int packet_size = 4;
+#endif
+
+    // theta_discretization + 1 of each, in angle_tables, which is immutable and shared with the copies of the scanner
+    const double * sines = nullptr;
+    const double * cosines = nullptr;
+    const double * arctanes = nullptr;
 
-    ScanSimulator2D() {}
+    ScanSimulator2D() : scan_map(std::make_shared<ScanMap>()) {}
 
     ScanSimulator2D(
         int num_beams_, 
@@ -68,8 +308,54 @@ class ScanSimulator2D {
         double free_threshold);
     void set_map(const std::vector<double> &map, double free_threshold);
 
+    // The map changed only in a few places, e.g. a cone was placed on the racetrack.
+    // Only the part of dt that depends on the changed cells is computed again, the result is the same as
+    // set_map(map, free_threshold). Both can be called while other threads are scanning.
+    // map is the whole new map, but only the cells in the rectangle (inclusive) or the listed cells are read
+    void update_map(
+        const std::vector<double> & map,
+        size_t row_min,
+        size_t col_min,
+        size_t row_max,
+        size_t col_max,
+        double free_threshold);
+    void update_map(const std::vector<double> & map, const std::vector<size_t> & changed_cells, double free_threshold);
+
+    // the same with the map already thresholded, e.g. by MapLoader straight from the image, nothing but dt is allocated.
+    // The size, resolution and origin are the ones of the bitmap
+    void set_map(const OccupancyBitmap & bitmap);
+    // bitmap is the whole new map, the same size as the current one, only the listed cells are read
+    void update_map(const OccupancyBitmap & bitmap, const std::vector<size_t> & changed_cells);
+
+    // scan with any number of other cars on the racetrack, opponent_poses points to num_opponents poses.
+    // Cars further away than scan_max_range are skipped before the beams are traced,
+    // and every beam only checks the cars it can possibly hit.
+    // The scan() overloads without a ScanContext use the one of the scanner, only one thread can use them at a time
+    void scan(const Pose2D & pose, const Pose2D * opponent_poses, size_t num_opponents, double * scan_data);
+    // the same into a float buffer of num_beams ranges owned by the caller, e.g. LaserScan::ranges,
+    // flag is the same as below, nothing is copied and nothing is allocated
+    void scan(const Pose2D & pose, const Pose2D * opponent_poses, size_t num_opponents, float * scan_data, bool flag);
+    // the returned ranges are overwritten by the next scan
+    const std::vector<double> & scan(const Pose2D & pose, const std::vector<Pose2D> & opponent_poses, bool flag);
+
+    // one opponent car
     void scan(const Pose2D & pose, const Pose2D & opponent_pose, double * scan_data);
-    const std::vector<double> scan(const Pose2D & pose, const Pose2D & opponent_pose, bool flag);
+    const std::vector<double> & scan(const Pose2D & pose, const Pose2D & opponent_pose, bool flag);
+
+    // the same as the overloads above with the noise, the output and the visibility in context_ owned by the caller,
+    // any number of threads can scan with one scanner at the same time, each with its own context
+    void scan(const Pose2D & pose, const Pose2D * opponent_poses, size_t num_opponents, float * scan_data, bool flag,
+              ScanContext & context_) const;
+    void scan(const Pose2D & pose, const Pose2D * opponent_poses, size_t num_opponents, double * scan_data, bool flag,
+              ScanContext & context_) const;
+    // returns context_.ranges
+    const std::vector<double> & scan(const Pose2D & pose, const std::vector<Pose2D> & opponent_poses, bool flag,
+                                     ScanContext & context_) const;
+
+    // all scans of requests at once, e.g. one per car, split into chunks of beams_per_chunk beams
+    // that the threads of pool take one after another, so one scan of many beams is shared by the threads as well.
+    // Every request needs its own context, the results are the same as scanning one after another
+    void scan_batch(ScanRequest * requests, size_t num_requests, ThreadPool & pool, int beams_per_chunk = 128) const;
 
     double distance_transform(double x, double y) const;
 
@@ -79,7 +365,36 @@ class ScanSimulator2D {
     int row_col_to_cell(int row, int col) const;
     int xy_to_cell(double x, double y) const;
 
-    bool see_opponent();
+    // the map and distance transform, shared by all copies of this scanner
+    std::shared_ptr<const ScanMap> get_map() const {return scan_map;}
+
+    // the visibility of the last scan() without a context
+    bool see_opponent() const {return context.can_see_opponent;}
+    void set_vectorized(bool vectorized_) {vectorized = vectorized_;}
+    bool get_vectorized() const {return vectorized;}
+    // refine_epsilon defaults to ray_tracing_epsilon of the constructor. Not while other threads are scanning
+    void set_march_settings(const MarchSettings & march_);
+    const MarchSettings & get_march_settings() const {return march;}
+    void set_use_range_lut(bool use_range_lut_);
+    bool get_use_range_lut() const {return use_range_lut;}
+    // true when the range table is in use and finished building
+    bool range_lut_ready() const;
+    const RangeLUT * get_range_lut() const {return scan_map->range_lut.get();}
+    // storage of the distance transform used by the ray marcher, see DistanceField, it is part of the shared map
+    void set_distance_field(DistanceField::Format format, DistanceField::Layout layout);
+    const DistanceField & get_distance_field() const {return scan_map->field;}
+    // build a min-pyramid of levels levels over dt so beams far from the walls read a small coarse level that stays in
+    // the cache, see DistancePyramid. 0 (the default) disables it. Ranges stay within ray_tracing_epsilon
+    void set_distance_pyramid(int levels);
+    int get_distance_pyramid() const {return scan_map->pyramid_levels;}
+    // time num_scans scans from poses spread over the racetrack with the current field and with dt,
+    // without the range table and noise, with num_scans = 0 only the memory is reported
+    DistanceFieldReport benchmark_distance_field(int num_scans = 50) const;
+
+    // where distance transforms are saved, an empty directory disables the cache
+    void set_cache_directory(const std::string & directory) {dt_cache = DistanceTransformCache(directory);}
+    // true if the last set_map() found its distance transform in the cache
+    bool get_dt_from_cache() const {return dt_from_cache;}
     double get_field_of_view() const {return field_of_view;}
     double get_angle_increment() const {return angle_increment;}
     int get_theta_discret() const {return theta_discretization;}
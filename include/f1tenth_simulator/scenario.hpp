@@ -0,0 +1,235 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdio>
+#include <cstdint>
+#include <cstddef>
+
+#include "f1tenth_simulator/pose_2d.hpp"
+#include "f1tenth_simulator/car_state.hpp"
+#include "f1tenth_simulator/car_params.hpp"
+#include "f1tenth_simulator/vehicle_model.hpp"
+#include "f1tenth_simulator/scan_simulator_2d.hpp"
+#include "f1tenth_simulator/collision_checker.hpp"
+#include "f1tenth_simulator/thread_pool.hpp"
+
+namespace racecar_simulator {
+
+/**
+ * A race of the simulator node recorded so that it can be run again without ROS, step by step and bit by bit the same.
+ * Everything a step depends on but the map image is in the file: the settings of the physics and the scanner,
+ * the cars with their noise seeds at the start, every drive command and pose that changed a car, and the dt of
+ * every step (from the wall clock with the timers, lockstep_dt in lockstep mode). Every step also has checksums
+ * of all cars and all scans after it, which ScenarioReplay compares with the ones it computes.
+ *
+ * File layout (little endian, as in memory):
+ * ScenarioHeader, num_cars ScenarioCar, then one ScenarioEvent after another until the end of the file.
+ * The events before a STEP apply to that step, like the callbacks that ran before simulate_step() of the node.
+ */
+struct ScenarioHeader {
+    // "F1TSCEN1", change the version whenever the layout changes
+    char magic[8];
+    uint32_t num_cars;
+
+    // the physics, see STKinematics::integrate(), all cars are the same model
+    uint32_t integrator;
+    CarParams params;
+    double physics_dt;
+    double width;
+    double ttc_threshold;
+
+    // the scanner, see ScanSimulator2D
+    uint32_t scan_beams;
+    // RAY_MARCHING, RANGE_LUT or CUDA, only the ray marcher gives the same ranges in every run
+    uint32_t scan_backend;
+    double scan_field_of_view;
+    double scan_std_dev;
+    double scan_max_range;
+    double cube_width;
+    double scan_distance_to_base_link;
+    MarchSettings march;
+    uint32_t scan_vectorized;
+    // DistanceField::Format and DistanceField::Layout
+    uint32_t distance_field_format;
+    uint32_t distance_field_layout;
+    int32_t distance_pyramid_levels;
+
+    // the map as the scanner got it, the replay reads map_yaml again and checks map_hash,
+    // see DistanceTransformCache::hash(const OccupancyBitmap &)
+    char map_yaml[256];
+    double map_free_threshold;
+    double map_resolution;
+    Pose2D map_origin;
+    uint32_t map_width;
+    uint32_t map_height;
+    uint64_t map_hash;
+
+    // simulated time when the recording started
+    double start_time;
+
+    enum ScanBackend {RAY_MARCHING, RANGE_LUT, CUDA};
+};
+
+// one car when the recording started
+struct ScenarioCar {
+    // zero terminated
+    char name[32];
+    CarState state;
+    double desired_speed;
+    double desired_steer_angle;
+    // the seed of its ScanContext, the generator has not been used before
+    uint64_t noise_seed;
+    // stopped after a collision, see RacecarSimulator::first_ttc_actions()
+    uint32_t collided;
+};
+
+struct ScenarioEvent {
+    enum Type {
+        // values are the desired speed and steering angle of car
+        DRIVE = 1,
+        // values are x, y and theta of car, the rest of its state stays
+        POSE = 2,
+        // every car moved by values[0] seconds, then scanned and checked for collisions
+        STEP = 3
+    };
+
+    uint32_t type;
+    uint32_t car;
+    // simulated time, of the step before for DRIVE and POSE
+    double time;
+    double values[3];
+    // STEP only, see ScenarioChecksum
+    uint64_t state_checksum;
+    uint64_t scan_checksum;
+};
+
+// FNV-1a over the bits of the values, the same values in the same order give the same checksum
+struct ScenarioChecksum {
+    uint64_t value = 14695981039346656037ull;
+
+    void add(uint64_t word) {value = (value ^ word) * 1099511628211ull;}
+    void add(double number);
+    // x, y, theta, velocity_x, velocity_y, steer_angle, angular_velocity, slip_angle and st_dyn
+    void add(const CarState & state);
+    void add(const float * ranges, size_t num_ranges);
+};
+
+/**
+ * Writes a scenario file, see ScenarioHeader. The events are a few dozen bytes each and go through a stdio buffer
+ * that is written out every few steps, so the physics loop doesn't wait for the disk and not much is lost if the
+ * node dies. Not thread safe, the simulator node calls it with its mutex held.
+ */
+class ScenarioRecorder {
+
+public:
+    ScenarioRecorder() = default;
+    ~ScenarioRecorder();
+
+    ScenarioRecorder(const ScenarioRecorder &) = delete;
+    ScenarioRecorder & operator=(const ScenarioRecorder &) = delete;
+
+    // start a new file, header.magic and header.num_cars are set here, returns false if the file can't be written
+    bool open(const std::string & path, ScenarioHeader header, const std::vector<ScenarioCar> & cars,
+              std::string * error = nullptr);
+    void close();
+    bool is_open() const {return file != nullptr;}
+
+    void drive(double time, size_t car, double speed, double steer_angle);
+    void pose(double time, size_t car, const Pose2D & pose);
+    void step(double time, double dt, uint64_t state_checksum, uint64_t scan_checksum);
+
+    size_t get_steps() const {return steps;}
+    size_t get_events() const {return events;}
+    // true if writing to the file failed, the rest of the recording is lost
+    bool failed() const {return write_failed;}
+
+private:
+    void write(const ScenarioEvent & event);
+
+    std::FILE * file = nullptr;
+    size_t steps = 0;
+    size_t events = 0;
+    bool write_failed = false;
+};
+
+// what a replay computed, and where it differed from the recording
+struct ScenarioResult {
+    size_t steps = 0;
+    // steps whose checksums are not the recorded ones
+    size_t mismatched_steps = 0;
+    // the first of them, its simulated time, and whether the cars or the scans differed
+    size_t first_mismatch = 0;
+    double first_mismatch_time = 0;
+    bool state_mismatch = false;
+    bool scan_mismatch = false;
+
+    // the cars after the last step and the checksums of that step
+    std::vector<CarState> states;
+    uint64_t state_checksum = 0;
+    uint64_t scan_checksum = 0;
+
+    bool matched() const {return mismatched_steps == 0;}
+};
+
+/**
+ * Runs a scenario file again without ROS, as fast as the CPU allows: the steps of RacecarSimulator::simulate_step()
+ * through STKinematics, ScanSimulator2D and the collision checks of the node, with the recorded commands and dt.
+ * load() reads the file and the map once, run() can then be called any number of times, e.g. under a profiler
+ * or to check that a change of the simulator didn't change a race.
+ * The scans are always computed by the ray marcher on the CPU, a recording of the range_lut or the cuda backend
+ * replays, but its scans (and so its collisions) may differ.
+ */
+class ScenarioReplay {
+
+public:
+    // threads scanning, including the calling thread, 0 for one per CPU. The ranges don't depend on it
+    explicit ScenarioReplay(size_t num_threads = 1);
+
+    // distance transforms are loaded from and saved to directory, see DistanceTransformCache, call before load()
+    void set_cache_directory(const std::string & directory) {cache_directory = directory;}
+
+    // read a recording and its map, from map_yaml instead of the recorded path if it is not empty.
+    // Fails if the map is not the one of the recording
+    bool load(const std::string & path, const std::string & map_yaml = "", std::string * error = nullptr);
+
+    // all steps from the start, or until the first mismatch, every run computes the same
+    void run(ScenarioResult & result, bool stop_at_mismatch = false);
+
+    const ScenarioHeader & get_header() const {return header;}
+    const std::vector<ScenarioCar> & get_cars() const {return start_cars;}
+    const std::vector<ScenarioEvent> & get_events() const {return events;}
+    size_t get_steps() const {return num_steps;}
+
+private:
+    // one car during the replay, what the node keeps of it in Agent
+    struct Car {
+        CarState state;
+        double desired_speed;
+        double desired_steer_angle;
+        bool collided;
+        ScanContext scan_context;
+        std::vector<Pose2D> opponent_poses;
+    };
+
+    void step(double dt);
+    void check_collisions(size_t index);
+
+    ScenarioHeader header;
+    std::vector<ScenarioCar> start_cars;
+    std::vector<ScenarioEvent> events;
+    size_t num_steps = 0;
+
+    std::string cache_directory;
+    ScanSimulator2D scan_simulator;
+    CollisionChecker collision_checker;
+    std::unique_ptr<ThreadPool> pool;
+
+    std::vector<Car> cars;
+    std::vector<ScanRequest> scan_requests;
+    // num_beams per car
+    std::vector<float> scans;
+};
+
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstddef>
+
+namespace racecar_simulator {
+
+/**
+ * The tables that only depend on the settings of the LiDAR and the car, not on the map or the cars:
+ * the sines, cosines and arctanes of the angles of ScanSimulator2D and the distances to the edge of the car and
+ * cosines of the beams of CollisionChecker.
+ * Every table is built once per process for its settings and shared read only by every scanner and collision
+ * checker with the same settings, e.g. the copies of the scanner in the node, the VecEnv and the scenario replay,
+ * so more cars or envs don't mean more tables. A table lives as long as someone holds it, the next request for
+ * the same settings after that builds it again, with the same values. Thread safe.
+ */
+class SensorGeometry {
+
+public:
+    // theta_discretization + 1 angles from 0 to 2 pi, sines, cosines and arctanes (1 / tan) after each other in values
+    struct AngleTables {
+        int theta_discretization;
+        std::vector<double> values;
+
+        size_t size() const {return theta_discretization + 1;}
+        const double * sines() const {return values.data();}
+        const double * cosines() const {return values.data() + size();}
+        const double * arctanes() const {return values.data() + 2 * size();}
+    };
+
+    // per beam: distance from the LiDAR to the edge of the car and cosine of the beam angle, see Precompute
+    struct BeamTables {
+        std::vector<double> car_distances;
+        std::vector<double> cosines;
+    };
+
+    static std::shared_ptr<const AngleTables> angle_tables(int theta_discretization);
+
+    static std::shared_ptr<const BeamTables> beam_tables(
+            int scan_beams,
+            double wheelbase,
+            double width,
+            double scan_distance_to_base_link,
+            double angle_min,
+            double scan_ang_incr);
+};
+
+}
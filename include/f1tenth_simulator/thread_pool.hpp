@@ -0,0 +1,66 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <cstddef>
+
+namespace racecar_simulator {
+
+/**
+ * A fixed set of worker threads for splitting loops, e.g. the rows and columns of the distance transform.
+ * The thread calling parallel_for() works on the loop as well, so a pool of size 1 has no workers at all
+ * and simply runs the loop on the calling thread.
+ */
+class ThreadPool {
+
+public:
+    // body(begin, end, thread) handles the indices [begin, end), thread is in [0, size()) and can be used
+    // to pick per thread scratch buffers, no two chunks running at the same time get the same thread
+    typedef std::function<void(size_t begin, size_t end, size_t thread)> Body;
+
+    // num_threads includes the calling thread, 0 means one per CPU
+    explicit ThreadPool(size_t num_threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool & operator=(const ThreadPool &) = delete;
+
+    size_t size() const {return workers.size() + 1;}
+
+    // run body over [0, count) in chunks of at most grain indices, blocks until all chunks are done.
+    // parallel_for() can be called from several threads, the calls are serialised: a second caller waits
+    // until the first loop is done. it must not be called from inside a body of the same pool, that deadlocks.
+    void parallel_for(size_t count, size_t grain, const Body & body);
+
+    // one pool for the whole process, created the first time it is used
+    static ThreadPool & shared();
+
+private:
+    void work(size_t thread);
+    void run_chunks(size_t thread);
+
+    std::vector<std::thread> workers;
+
+    // held by parallel_for() for the whole call
+    std::mutex caller_mutex;
+
+    std::mutex mutex;
+    std::condition_variable start_condition;
+    std::condition_variable done_condition;
+    // increased for every loop, so the workers know there is something new to do
+    size_t generation;
+    size_t busy_workers;
+    bool stopping;
+
+    // the current loop
+    const Body * body;
+    size_t count;
+    size_t grain;
+    std::atomic<size_t> next_chunk;
+};
+
+}
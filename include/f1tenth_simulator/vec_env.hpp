@@ -0,0 +1,174 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+
+#include "f1tenth_simulator/pose_2d.hpp"
+#include "f1tenth_simulator/car_state.hpp"
+#include "f1tenth_simulator/car_params.hpp"
+#include "f1tenth_simulator/vehicle_model.hpp"
+#include "f1tenth_simulator/scan_simulator_2d.hpp"
+#include "f1tenth_simulator/collision_checker.hpp"
+#include "f1tenth_simulator/thread_pool.hpp"
+
+namespace racecar_simulator {
+
+// Everything a VecEnv is built from, the defaults are the values of params.yaml
+struct VecEnvConfig {
+    // independent copies of the racetrack, each with num_agents cars
+    size_t num_envs = 1;
+    size_t num_agents = 2;
+
+    // all cars are the same model, see default_car_params()
+    CarParams params;
+    double width = 0.2032;
+
+    // simulated seconds per step(), update_pose_rate of params.yaml. Split in sub-steps of about physics_dt,
+    // see STKinematics::integrate()
+    double dt = 0.005;
+    double physics_dt = 0.005;
+    STKinematics::Integrator integrator = STKinematics::EULER;
+
+    int scan_beams = 1081;
+    double scan_field_of_view = 4.71238898038469;
+    double scan_std_dev = 0.015;
+    double scan_max_range = 10;
+    double scan_distance_to_base_link = 0.275;
+    double cube_width = 0.20;
+    int scan_beams_per_chunk = 128;
+    // accuracy against speed of the ray marcher, see MarchSettings
+    MarchSettings scan_march;
+    // coarse levels of the distance transform for the ray marcher, 0 for none, see DistancePyramid
+    int distance_pyramid_levels = 0;
+    // the noise of car a in env e is seeded with scan_noise_seed + e * num_agents + a, 0 means a random seed
+    uint64_t scan_noise_seed = 0;
+
+    // a car collides when its time to collision is below ttc_threshold or it overlaps another car
+    double ttc_threshold = 0.01;
+    // an episode is truncated after this many steps, 0 means never
+    size_t max_episode_steps = 0;
+    // an env that ended in the last step starts again from its start poses in the next step(), see VecEnv
+    bool auto_reset = true;
+    // taken from the reward of a car in the step it collides
+    double collision_penalty = 1.0;
+
+    // where the cars of every env start, one pose of base link per car
+    std::vector<Pose2D> start_poses;
+
+    // threads stepping the envs and scanning, including the calling thread, 0 means one per CPU
+    size_t num_threads = 0;
+
+    VecEnvConfig();
+};
+
+/**
+ * The simulator without ROS, for reinforcement learning: num_envs independent races of num_agents cars on
+ * one racetrack, stepped together. A step is what RacecarSimulator::simulate_step() does for all envs at once,
+ * integrate every car by dt with its action, scan from every LiDAR (every car sees the others of its env)
+ * and check the collisions, nothing is published.
+ *
+ * All envs share one ScanSimulator2D and so one distance transform, set_map() once for all of them.
+ * The scans of all cars of all envs are split into chunks of beams that the threads take one after another
+ * (ScanSimulator2D::scan_batch()), the physics and the collision checks are split by env.
+ *
+ * The observations are contiguous buffers owned by the VecEnv, they are filled again by every step() and reset(),
+ * nothing is allocated per step:
+ * - scans:      float   [num_envs][num_agents][scan_beams]
+ * - states:     double  [num_envs][num_agents][state_size] x, y, theta, velocity_x, velocity_y, steer_angle,
+ *                                                        angular_velocity, slip_angle
+ * - rewards:    double  [num_envs][num_agents] the distance the car drove in the step,
+ *                                              minus collision_penalty if it collided
+ * - collisions: uint8_t [num_envs][num_agents]
+ * - terminated: uint8_t [num_envs] a car of the env collided
+ * - truncated:  uint8_t [num_envs] the episode reached max_episode_steps
+ * The actions are double [num_envs][num_agents][action_size], desired speed and desired steering angle.
+ *
+ * With auto_reset, an env that terminated or was truncated is reset by the next step() instead of being stepped:
+ * its action is ignored, its observation is the one of its start poses, reward 0 and not done.
+ * So the last observation of an episode can still be read after the step that ended it.
+ */
+class VecEnv {
+
+public:
+    static const size_t state_size = 8;
+    static const size_t action_size = 2;
+
+    explicit VecEnv(const VecEnvConfig & config);
+
+    // the racetrack of all envs, the same as ScanSimulator2D::set_map(), the cars stay where they are and scan again.
+    // Until there is a map there are no scans (they stay 0) and only the cars colliding with each other end an episode
+    void set_map(
+        const std::vector<double> & map,
+        size_t height,
+        size_t width,
+        double resolution,
+        const Pose2D & origin,
+        double free_threshold);
+
+    // every env back to its start poses
+    void reset();
+    // one env, poses has num_agents poses of base link or is null for the start poses
+    void reset(size_t env, const Pose2D * poses = nullptr);
+
+    // actions has num_envs * num_agents * action_size values
+    void step(const double * actions);
+
+    size_t get_num_envs() const {return config.num_envs;}
+    size_t get_num_agents() const {return config.num_agents;}
+    size_t get_num_beams() const {return config.scan_beams;}
+    const VecEnvConfig & get_config() const {return config;}
+    const ScanSimulator2D & get_scan_simulator() const {return scan_simulator;}
+
+    // the observation buffers, see above, valid as long as the VecEnv
+    const float * get_scans() const {return scans.data();}
+    const double * get_states() const {return states.data();}
+    const double * get_rewards() const {return rewards.data();}
+    const uint8_t * get_collisions() const {return collisions.data();}
+    const uint8_t * get_terminated() const {return terminated.data();}
+    const uint8_t * get_truncated() const {return truncated.data();}
+    // steps since the last reset of every env
+    const uint32_t * get_episode_steps() const {return episode_steps.data();}
+
+    // the full state of car agent in env
+    const CarState & get_car_state(size_t env, size_t agent) const {return cars[env * config.num_agents + agent];}
+
+    // the values of params.yaml
+    static CarParams default_car_params();
+
+private:
+    VecEnvConfig config;
+
+    ScanSimulator2D scan_simulator;
+    CollisionChecker collision_checker;
+    std::unique_ptr<ThreadPool> pool;
+    bool map_exists;
+
+    // one per car, env after env
+    std::vector<CarState> cars;
+    std::vector<ScanContext> scan_contexts;
+    std::vector<ScanRequest> scan_requests;
+    // the other cars of the env of every car, num_agents - 1 per car
+    std::vector<Pose2D> opponent_poses;
+
+    std::vector<float> scans;
+    std::vector<double> states;
+    std::vector<double> rewards;
+    std::vector<uint8_t> collisions;
+    std::vector<uint8_t> terminated;
+    std::vector<uint8_t> truncated;
+    std::vector<uint32_t> episode_steps;
+    // the envs step() resets instead of stepping them
+    std::vector<uint8_t> resetting;
+
+    void reset_env(size_t env, const Pose2D * poses);
+    // the cars of env integrated by dt, and their rewards without the collision penalty
+    void step_env(size_t env, const double * actions);
+    // scans of the envs [begin, end), all their beams are shared by the threads of the pool
+    void scan_envs(size_t begin, size_t end);
+    void check_collisions(size_t env);
+    void write_states(size_t env);
+};
+
+}
@@ -24,6 +24,34 @@ public:
             CarParams p,
             double dt);
 
+    // the same models as update() and update_k() with one classic Runge-Kutta step instead of an Euler step,
+    // the acceleration and the steering velocity are computed from start and held for the whole step
+    static CarState update_rk4(
+            const CarState start,
+            double desired_speed,
+            double desired_steer_ang,
+            CarParams p,
+            double dt);
+
+    enum Integrator {EULER, RK4};
+
+    // advance by dt in equal sub-steps of about max_step seconds, at most 1.5 max_step (and at most max_substeps of them),
+    // the limits of limit_state() are applied after every sub-step, so the physics runs at its own rate
+    // no matter how far apart the callers are
+    static CarState integrate(
+            const CarState start,
+            double desired_speed,
+            double desired_steer_ang,
+            CarParams p,
+            double dt,
+            double max_step,
+            Integrator integrator);
+
+    static constexpr int max_substeps = 100;
+
+    // keep the speed and the steering angle in the range of the car
+    static void limit_state(CarState & state, const CarParams & p);
+
     static double compute_accel(CarState & state, double desired_speed, CarParams & p);
 
     static double set_accel(double accel_, CarParams & p);
@@ -23,7 +23,7 @@ import rospy
 import rospkg
 from sensor_msgs.msg import LaserScan
 from ackermann_msgs.msg import AckermannDriveStamped
-from std_msgs.msg import String
+from f1tenth_simulator_two_agents.msg import CarStateStamped
 
 from tensorflow.python.keras.models import load_model
 
@@ -56,13 +56,9 @@ def LiDAR_callback(data):
 def carState_callback(data):
     global car_state_array
 
-    car_state = np.asarray(data.data.split(","), dtype=float)
-
     speed_steering = []
-    # car_state[3] is Velocity_X
-    speed_steering.append(car_state[3])
-    # car_state[5] is Steering_angle
-    speed_steering.append(car_state[5])
+    speed_steering.append(data.velocity_x)
+    speed_steering.append(data.steer_angle)
     speed_steering = np.asarray(speed_steering)
     speed_steering = np.reshape(speed_steering, (1, -1))
 
@@ -109,7 +105,7 @@ if __name__ == '__main__':
             print(" no activation attribute")
 
     carState_topic = rospy.get_param("~carState_topic_red")
-    rospy.Subscriber(carState_topic, String, carState_callback)
+    rospy.Subscriber(carState_topic, CarStateStamped, carState_callback)
 
     scan_topic_red = rospy.get_param("~scan_topic_red")
     rospy.Subscriber(scan_topic_red, LaserScan, LiDAR_callback)
@@ -23,7 +23,7 @@ from casadi import *
 import rospy
 import rospkg
 import visualization_msgs.msg
-from std_msgs.msg import String
+from f1tenth_simulator_two_agents.msg import CarStateStamped
 from sensor_msgs.msg import LaserScan
 from ackermann_msgs.msg import AckermannDriveStamped
 from nav_msgs.msg import OccupancyGrid
@@ -239,7 +239,8 @@ x_cl_nlp_dy = np.zeros(8)
 
 def carState_callback(data):
     global x_cl_nlp_dy
-    x_cl_nlp_dy = np.asarray(data.data.split(","), dtype=float)
+    x_cl_nlp_dy = np.array([data.x, data.y, data.theta, data.velocity_x, data.velocity_y,
+                            data.steer_angle, data.angular_velocity, data.slip_angle])
 
 
 def round_to_minusPI_PI(x):
@@ -288,7 +289,7 @@ if __name__ == '__main__':
 
 
     carState_topic = rospy.get_param("~carState_topic_red")
-    rospy.Subscriber(carState_topic, String, carState_callback)
+    rospy.Subscriber(carState_topic, CarStateStamped, carState_callback)
 
     MPC_drive_topic = rospy.get_param("~MPC_drive_topic")
     drive_pub_red = rospy.Publisher(MPC_drive_topic, AckermannDriveStamped, queue_size=10)
@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+
+"""
+Convert the binary logs of the simulator (<log_directory>/<name>_<date>.f1log, see data_logger.hpp)
+into the csv files the machine learning scripts read:
+    car_state_<name>_<date>.csv    Position_X,Position_Y,Theta,Velocity_X,Velocity_Y,Steering_angle,Angular_velocity,slip_angle
+    ML_dataset_<name>_<date>.csv   Speed,Steering_angle,LiDAR_scan (only if the log has scans)
+The csv files are written next to the log file.
+
+usage: rosrun f1tenth_simulator_two_agents log_to_csv.py <file.f1log> [<file.f1log> ...]
+"""
+
+import os
+import sys
+
+import numpy as np
+
+MAGIC = b"F1THLOG1"
+HEADER = np.dtype([("magic", "S8"), ("num_beams", "<u4"), ("record_size", "<u4"), ("name", "S32")])
+STATE_HEADING = "Position_X,Position_Y,Theta,Velocity_X,Velocity_Y,Steering_angle,Angular_velocity,slip_angle\n"
+ML_HEADING = "Speed,Steering_angle,LiDAR_scan\n"
+
+
+def read_log(path):
+    with open(path, "rb") as file:
+        data = file.read()
+
+    header = np.frombuffer(data, dtype=HEADER, count=1)[0]
+    if header["magic"] != MAGIC:
+        raise ValueError("%s is not a simulator log" % path)
+
+    num_beams = int(header["num_beams"])
+    fields = [("time", "<f8"), ("desired_speed", "<f8"), ("desired_steer_angle", "<f8"), ("state", "<f8", (8,))]
+    if num_beams > 0:
+        fields.append(("scan", "<f4", (num_beams,)))
+    record = np.dtype(fields)
+    if record.itemsize != header["record_size"]:
+        raise ValueError("%s has records of %d bytes, expected %d" % (path, header["record_size"], record.itemsize))
+
+    # a log cut off in the middle of a record still has all complete records
+    count = (len(data) - HEADER.itemsize) // record.itemsize
+    records = np.frombuffer(data, dtype=record, count=count, offset=HEADER.itemsize)
+    return header["name"].decode(), num_beams, records
+
+
+def convert(path):
+    name, num_beams, records = read_log(path)
+    directory = os.path.dirname(os.path.abspath(path))
+    # <name>_<date>.f1log
+    date = os.path.splitext(os.path.basename(path))[0][len(name) + 1:]
+
+    # the same number format as std::to_string, which wrote these files before
+    state_file = os.path.join(directory, "car_state_%s_%s.csv" % (name, date))
+    with open(state_file, "w") as file:
+        file.write(STATE_HEADING)
+        for state in records["state"]:
+            file.write(",".join("%f" % value for value in state) + "\n")
+    print("%d rows written to %s" % (len(records), state_file))
+
+    if num_beams > 0:
+        ml_file = os.path.join(directory, "ML_dataset_%s_%s.csv" % (name, date))
+        with open(ml_file, "w") as file:
+            file.write(ML_HEADING)
+            for speed, steer, scan in zip(records["desired_speed"], records["desired_steer_angle"], records["scan"]):
+                file.write("%f,%f," % (speed, steer) + "".join("%f," % value for value in scan) + "\n")
+        print("%d rows written to %s" % (len(records), ml_file))
+
+
+if __name__ == "__main__":
+    if len(sys.argv) < 2:
+        print(__doc__)
+        sys.exit(1)
+    for log in sys.argv[1:]:
+        convert(log)
@@ -9,6 +9,9 @@
 #include <std_msgs/String.h>
 
 #include "f1tenth_simulator/channel.h"
+#include "mux_channels.hpp"
+
+#include <algorithm>
 
 /**
  * this node is for publishing driving command from the selected controller
@@ -32,6 +35,8 @@ private:
     int key_mux_idx;
 
     int mux_size;
+    // the simulator routes the drive channels itself (mux_in_process), only the joystick and the keyboard are here
+    bool mux_in_process = false;
     // Mux controller array
     std::vector<bool> mux_controller;
     // For printing
@@ -94,59 +99,28 @@ public:
 
         // get size of mux
         n.getParam("mux_size", mux_size);
+        mux_size = std::max(mux_size, 0);
+        n.getParam("mux_in_process", mux_in_process);
 
-        // initialize mux controller
-        mux_controller.reserve(mux_size);
-        prev_mux.reserve(mux_size);
-
-        for (int i = 0; i < mux_size; i++) {
-            mux_controller[i] = false;
-            prev_mux[i] = false;
-        }
+        // initialize mux controller, all off
+        mux_controller.assign(mux_size, false);
+        prev_mux.assign(mux_size, false);
 
-        // A channel contains a subscriber to the given drive topic and a publisher to the main drive topic
+        // A channel contains a subscriber to the given drive topic and a publisher to the main drive topic,
+        // the channels are in mux_channels.hpp
         channels = std::vector<Channel*>();
+        if (mux_in_process) {
+            ROS_INFO("mux_in_process: the simulator reads the drive channels, the mux only handles joystick and keyboard");
+        } else {
+            for (const MuxChannel & channel : read_mux_channels(n)) {
+                add_channel(channel.topic, channel.drive_topic, channel.mux_idx);
+            }
+        }
+    }
 
-        /// Add new channels here:
-        // Random driver example
-        int random_walker_mux_idx;
-        std::string rand_drive_topic;
-        n.getParam("rand_drive_topic", rand_drive_topic);
-        n.getParam("random_walker_mux_idx", random_walker_mux_idx);
-        add_channel(rand_drive_topic, drive_topic_blue, random_walker_mux_idx);
-
-        // Channel for emergency braking
-        int brake_mux_idx;
-        std::string brake_drive_topic;
-        n.getParam("brake_drive_topic", brake_drive_topic);
-        n.getParam("brake_mux_idx", brake_mux_idx);
-        add_channel(brake_drive_topic, drive_topic_blue, brake_mux_idx);
-
-        // General navigation channel
-        int nav_mux_idx;
-        std::string nav_drive_topic;
-        n.getParam("nav_drive_topic", nav_drive_topic);
-        n.getParam("nav_mux_idx", nav_mux_idx);
-        add_channel(nav_drive_topic, drive_topic_blue, nav_mux_idx);
-
-        int mpc_mux_idx;
-        std::string mpc_drive_topic;
-        n.getParam("MPC_drive_topic", mpc_drive_topic);
-        n.getParam("MPC_mux_idx", mpc_mux_idx);
-        add_channel(mpc_drive_topic, drive_topic_red, mpc_mux_idx);
-
-        int LSTM_mux_idx;
-        std::string LSTM_drive_topic;
-        n.getParam("overtaking_drive_topic", LSTM_drive_topic);
-        n.getParam("LSTM_mux_idx", LSTM_mux_idx);
-        add_channel(LSTM_drive_topic, drive_topic_red, LSTM_mux_idx);
-
-        // ***Add a channel for a new planner here**
-        // int new_mux_idx;
-        // std::string new_drive_topic;
-        // n.getParam("new_drive_topic", new_drive_topic);
-        // n.getParam("new_mux_idx", new_mux_idx);
-        // add_channel(new_drive_topic, drive_topic_colour, new_mux_idx);
+    // true if the mux index is on, false for indices out of range
+    bool is_on(int mux_idx) const {
+        return mux_idx >= 0 and mux_idx < mux_size and mux_controller[mux_idx];
     }
 
 
@@ -171,7 +145,7 @@ public:
     void joy_callback(const sensor_msgs::Joy & msg) {
         // https://wiki.ros.org/joy/Tutorials/ConfiguringALinuxJoystick
         // make drive message from joystick if turned on
-        if (mux_controller[joy_mux_idx]) {
+        if (is_on(joy_mux_idx)) {
 
             // possibly this will be changed depends on different joystick
 
@@ -188,7 +162,7 @@ public:
 
     void key_callback(const std_msgs::String & msg) {
         // make drive message from keyboard if turned on 
-        if (mux_controller[key_mux_idx]) {
+        if (is_on(key_mux_idx)) {
             // Determine desired velocity and steering angle
             double desired_velocity_blue = 0.0;
             double desired_steer_blue = 0.0;
@@ -258,9 +232,9 @@ public:
     }
 
     void mux_callback(const std_msgs::Int32MultiArray & msg) {
-        // set mux_controller when we heard msg from behavior_controller
+        // set mux_controller when we heard msg from behavior_controller, indices the message doesn't have are off
         for (int i = 0; i < mux_size; i++) {
-            mux_controller[i] = bool(msg.data[i]);
+            mux_controller[i] = i < int(msg.data.size()) and bool(msg.data[i]);
         }
 
         // Prints the mux whenever it is changed
@@ -280,7 +254,8 @@ public:
 //            }
 //            std::cout << std::endl;
 //        }
-        if (!anything_on) {
+        // with mux_in_process the simulator halts the cars itself
+        if (!anything_on and !mux_in_process) {
             // if no mux channel is active, halt the car
             publish_to_drive_blue(0.0, 0.0);
             publish_to_drive_red(0.0, 0.0);
@@ -309,7 +284,7 @@ Channel::Channel(std::string channel_name, std::string drive_topic, int mux_idx_
 }
 
 void Channel::drive_callback(const ackermann_msgs::AckermannDriveStamped & msg) {
-    if (mp_mux->mux_controller[this->mux_idx]) {
+    if (mp_mux->is_on(this->mux_idx)) {
         drive_pub.publish(msg);
     }
 }
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <ros/ros.h>
+
+#include <string>
+#include <vector>
+
+/**
+ * The drive channels of the mux, read by node/mux.cpp and by the simulator with mux_in_process.
+ * A channel is the drive topic of one controller, its commands drive one car while its mux index is on.
+ */
+struct MuxChannel {
+    // where the controller publishes
+    std::string topic;
+    // the drive topic of the car it drives, drive_topic_blue or drive_topic_red
+    std::string drive_topic;
+    int mux_idx;
+};
+
+inline std::vector<MuxChannel> read_mux_channels(const ros::NodeHandle & n) {
+    std::string drive_topic_blue, drive_topic_red;
+    n.getParam("drive_topic_blue", drive_topic_blue);
+    n.getParam("drive_topic_red", drive_topic_red);
+
+    std::vector<MuxChannel> channels;
+    auto add_channel = [&n, &channels](const std::string & topic_param, const std::string & drive_topic,
+                                       const std::string & mux_idx_param) {
+        MuxChannel channel;
+        channel.drive_topic = drive_topic;
+        channel.mux_idx = -1;
+        n.getParam(topic_param, channel.topic);
+        n.getParam(mux_idx_param, channel.mux_idx);
+        channels.push_back(channel);
+    };
+
+    /// Add new channels here:
+    // Random driver example
+    add_channel("rand_drive_topic", drive_topic_blue, "random_walker_mux_idx");
+    // Channel for emergency braking
+    add_channel("brake_drive_topic", drive_topic_blue, "brake_mux_idx");
+    // General navigation channel
+    add_channel("nav_drive_topic", drive_topic_blue, "nav_mux_idx");
+    add_channel("MPC_drive_topic", drive_topic_red, "MPC_mux_idx");
+    add_channel("overtaking_drive_topic", drive_topic_red, "LSTM_mux_idx");
+
+    // ***Add a channel for a new planner here**
+    // add_channel("new_drive_topic", drive_topic_colour, "new_mux_idx");
+    return channels;
+}
@@ -0,0 +1,1394 @@
+#include "racecar_simulator.hpp"
+
+#include <ros/package.h>
+#include <interactive_markers/interactive_marker_server.h>
+#include <tf2/impl/utils.h>
+#include <tf2/LinearMath/Quaternion.h>
+#include <nav_msgs/Path.h>
+#include <std_msgs/String.h>
+#include <geometry_msgs/PoseWithCovarianceStamped.h>
+#include <geometry_msgs/PointStamped.h>
+#include <visualization_msgs/MarkerArray.h>
+#include <rosgraph_msgs/Clock.h>
+#include <diagnostic_msgs/DiagnosticArray.h>
+#include <ros/callback_queue.h>
+#include <boost/make_shared.hpp>
+
+#include "f1tenth_simulator/ackermann_kinematics.hpp"
+#include "f1tenth_simulator/map_loader.hpp"
+#include "f1tenth_simulator/distance_transform_cache.hpp"
+#include "mux_channels.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <math.h>
+#include <ctime>
+#include <cstdlib>
+#include <cctype>
+#include <cstring>
+#include <random>
+#include <map>
+#include <sstream>
+
+using namespace racecar_simulator;
+
+RacecarSimulator::RacecarSimulator(const ros::NodeHandle & node_handle, bool allow_lockstep)
+  : n(node_handle) {
+
+    // Get the topic names
+    n.getParam("map_topic", map_topic);
+    n.getParam("odom_topic", odom_topic);
+    n.getParam("pose_rviz_topic", pose_rviz_topic);
+    n.getParam("imu_topic", imu_topic);
+    n.getParam("ground_truth_pose_topic", gt_pose_topic);
+    n.getParam("cube_width", cube_width);
+
+    // Get the transformation frame names
+    n.getParam("map_frame", map_frame);
+
+
+    n.getParam("update_pose_rate", update_pose_rate);
+    n.getParam("physics_dt", physics_dt);
+    std::string integrator_name = "euler";
+    n.getParam("integrator", integrator_name);
+    if (integrator_name == "rk4") {
+        integrator = STKinematics::RK4;
+    } else if (integrator_name != "euler") {
+        ROS_WARN("Unknown integrator %s, using euler", integrator_name.c_str());
+    }
+    n.getParam("lockstep", lockstep);
+    n.getParam("lockstep_dt", lockstep_dt);
+    n.getParam("real_time_factor", real_time_factor);
+    n.getParam("lockstep_wait_for_commands", lockstep_wait_for_commands);
+    n.getParam("lockstep_command_timeout", lockstep_command_timeout);
+    if (lockstep_dt <= 0) lockstep_dt = update_pose_rate;
+    if (lockstep and not allow_lockstep) {
+        ROS_ERROR("Lockstep is not available here, the cars are updated by timers");
+        lockstep = false;
+    }
+    n.getParam("scan_beams", scan_beams);
+    n.getParam("scan_field_of_view", scan_fov);
+    n.getParam("scan_std_dev", scan_std_dev);
+    n.getParam("scan_max_range", scan_max_range);
+    n.getParam("scan_vectorized", scan_vectorized);
+    n.getParam("scan_backend", scan_backend);
+    n.getParam("scan_refinement", scan_refinement);
+    n.getParam("scan_refine_epsilon", scan_refine_epsilon);
+    n.getParam("scan_min_step", scan_min_step);
+    n.getParam("scan_stop_at_max_range", scan_stop_at_max_range);
+    n.getParam("scan_publish_intensities", scan_publish_intensities);
+    n.getParam("scan_threads", scan_threads);
+    n.getParam("scan_beams_per_chunk", scan_beams_per_chunk);
+    n.getParam("scan_noise_seed", scan_noise_seed);
+    n.getParam("spinner_threads", spinner_threads);
+    n.getParam("mux_in_process", mux_in_process);
+    n.getParam("overtaking_model", overtaking_model);
+    n.getParam("overtaking_agents", overtaking_agent_names);
+    n.getParam("overtaking_history", overtaking_history);
+    n.getParam("overtaking_threads", overtaking_threads);
+    n.getParam("distance_field_format", distance_field_format);
+    n.getParam("distance_field_layout", distance_field_layout);
+    n.getParam("distance_pyramid_levels", distance_pyramid_levels);
+    n.getParam("map_free_threshold", map_free_threshold);
+    n.getParam("map_yaml", map_yaml);
+    n.getParam("dt_cache_dir", dt_cache_dir);
+    n.getParam("scan_distance_to_base_link", scan_distance_to_base_link);
+
+    n.getParam("width", width);
+
+    // all cars are the same model
+    CarParams params;
+    n.getParam("wheelbase", params.wheelbase);
+    n.getParam("friction_coeff", params.friction_coeff);
+    n.getParam("height_cg", params.h_cg);
+    n.getParam("l_cg2rear", params.l_r);
+    n.getParam("l_cg2front", params.l_f);
+    n.getParam("C_S_front", params.cs_f);
+    n.getParam("C_S_rear", params.cs_r);
+    n.getParam("moment_inertia", params.Iz);
+    n.getParam("mass", params.mass);
+    n.getParam("empirical_drivetrain_parameters_1", params.Cm1);
+    n.getParam("empirical_drivetrain_parameters_2", params.Cm2);
+    n.getParam("empirical_drivetrain_parameters_3", params.Cm3);
+    n.getParam("empirical_Pacejka_parameters_B_f", params.B_f);
+    n.getParam("empirical_Pacejka_parameters_C_f", params.C_f);
+    n.getParam("empirical_Pacejka_parameters_D_f", params.D_f);
+    n.getParam("empirical_Pacejka_parameters_B_r", params.B_r);
+    n.getParam("empirical_Pacejka_parameters_C_r", params.C_r);
+    n.getParam("empirical_Pacejka_parameters_D_r", params.D_r);
+    n.getParam("max_speed", params.max_speed);
+    n.getParam("max_steering_angle", params.max_steering_angle);
+    n.getParam("max_steering_vel", params.max_steering_vel);
+    n.getParam("max_accel", params.max_accel);
+    n.getParam("max_decel", params.max_decel);
+
+    n.getParam("data_topic", data_topic);
+    n.getParam("log_directory", path);
+    n.getParam("log_buffer_records", log_buffer_records);
+    n.getParam("scenario_record_file", scenario_record_file);
+    if (scenario_record_file.compare(0, 2, "~/") == 0 and getenv("HOME") != nullptr) {
+        scenario_record_file = std::string(getenv("HOME")) + scenario_record_file.substr(1);
+    }
+    n.getParam("reference_line", reference_line);
+    n.getParam("reference_line_rate", reference_line_rate);
+    n.getParam("map_name", map_name);
+
+    // Determine if we should broadcast
+    n.getParam("broadcast_transform", broadcast_transform);
+    n.getParam("publish_ground_truth_pose", pub_gt_pose);
+    n.getParam("ttc_threshold", ttc_threshold);
+
+    n.getParam("profiling", profiling);
+    n.getParam("diagnostics_rate", diagnostics_rate);
+    n.getParam("diagnostics_topic", diagnostics_topic);
+    n.getParam("profiling_trace_file", profiling_trace_file);
+
+    // the stages of simulate_step(), in the order they run
+    tick_stage = profiler.add_stage("tick");
+    tick_interval_stage = profiler.add_stage("tick_interval");
+    physics_stage = profiler.add_stage("physics");
+    transform_stage = profiler.add_stage("transforms");
+    scan_stage = profiler.add_stage("scan");
+    collision_stage = profiler.add_stage("collision");
+    publish_stage = profiler.add_stage("publish_scan");
+    logging_stage = profiler.add_stage("logging");
+    reference_line_stage = profiler.add_stage("reference_line");
+    // from the stamp of a drive command (or its arrival, without a stamp) to the step that applied it
+    command_latency_stage = profiler.add_stage("command_latency");
+#ifdef F1TENTH_WITH_TENSORFLOW
+    // one prediction of overtaking_model for all its cars
+    inference_stage = profiler.add_stage("inference");
+#endif
+    profiler.set_enabled(profiling);
+    if (profiling and not profiling_trace_file.empty()) {
+        if (profiler.start_trace(profiling_trace_file)) {
+            ROS_INFO("Writing a trace of every step to %s", profiling_trace_file.c_str());
+        } else {
+            ROS_ERROR("Cannot create the trace file %s", profiling_trace_file.c_str());
+        }
+    }
+    if (profiling and diagnostics_rate > 0) {
+        diagnostics_pub = n.advertise<diagnostic_msgs::DiagnosticArray>(diagnostics_topic, 1);
+        last_report = ros::WallTime::now();
+        diagnostics_timer = n.createWallTimer(ros::WallDuration(1.0 / diagnostics_rate),
+                                              &RacecarSimulator::report_diagnostics, this);
+    }
+
+    std::vector<std::string> agent_names = {"blue", "red"};
+    n.getParam("agents", agent_names);
+    if (agent_names.empty()) {
+        ROS_WARN("No agents given, simulating blue and red");
+        agent_names = {"blue", "red"};
+    }
+
+    // starting poses of the default cars
+    // blue:
+    // monaco x:16 y:-2 t:0
+    // de-espana x:18 y:31 t:3.14
+    // Malaysian x:18 y:31 t:3.14
+    // Circuit-Of-The-Americas x:26 y:6 t:2.9
+    // red:
+    // monaco x:10 y:-1 t:0
+    // de-espana x:22 y:30.5 t:3.14
+    // Malaysian x:22 y:27.5 t:3.14
+    // Circuit-Of-The-Americas x:30 y:3 t:2.9
+    std::map<std::string, std::vector<double>> default_start_poses = {{"blue", {18, 31, 3.14}},
+                                                                      {"red", {22, 30.5, 3.14}}};
+
+    // the callbacks below keep the index of their car, agents must not be resized after this
+    agents.resize(agent_names.size());
+    for (size_t i = 0; i < agents.size(); i++) {
+        Agent & agent = agents[i];
+        agent.name = agent_names[i];
+        agent.params = params;
+
+        // the topics and frames default to the pattern of blue and red
+        agent.drive_topic = agent_param("drive_topic", agent.name, "/drive_" + agent.name);
+        agent.scan_topic = agent_param("scan_topic", agent.name, "/" + agent.name + "/scan");
+        agent.pose_topic = agent_param("pose_topic", agent.name, "/" + agent.name + "/pose");
+        agent.odom_topic = agent_param("odom_topic", agent.name, odom_topic);
+        agent.base_frame = agent_param("base_frame", agent.name, agent.name + "/base_link");
+        agent.scan_frame = agent_param("scan_frame", agent.name, agent.name + "/laser");
+        agent.carState_topic = agent_param("carState_topic", agent.name, "");
+        agent.switch_topic = agent_param("switch_topic", agent.name, "");
+
+        // start_pose_<name>: [x, y, theta], a car without one starts 4m behind the car before it
+        std::vector<double> start_pose;
+        if (not n.getParam("start_pose_" + agent.name, start_pose) or start_pose.size() != 3) {
+            if (default_start_poses.count(agent.name)) {
+                start_pose = default_start_poses[agent.name];
+            } else if (i > 0) {
+                const CarState & previous = agents[i - 1].state;
+                start_pose = {previous.x - 4 * std::cos(previous.theta),
+                              previous.y - 4 * std::sin(previous.theta),
+                              previous.theta};
+            } else {
+                start_pose = default_start_poses["blue"];
+            }
+        }
+        agent.state = {.x=start_pose[0], .y=start_pose[1], .theta=start_pose[2], .velocity_x=0, .velocity_y=0, .steer_angle=0.0, .angular_velocity=0.0, .slip_angle=0.0, .st_dyn=false};
+
+        // only the first car records its LiDAR scans for machine learning, every car records its state
+        agent.log_scan = i == 0;
+        agent.logger.reset(new DataLogger(std::max(log_buffer_records, 1)));
+
+        if (scan_noise_seed != 0) agent.scan_context = ScanContext(scan_noise_seed + i);
+        agent.opponent_poses.reserve(agents.size());
+    }
+    previous_seconds = ros::Time::now().toSec();
+    scan_pool.reset(new ThreadPool(std::max(scan_threads, 0)));
+    scan_requests.reserve(agents.size());
+
+    // Start a timer to output the pose, in lockstep mode run_lockstep() steps all cars instead
+    if (lockstep) {
+        clock_pub = n.advertise<rosgraph_msgs::Clock>("/clock", 1);
+    } else {
+        update_timer = n.createTimer(ros::Duration(update_pose_rate), &RacecarSimulator::update_pose, this);
+    }
+
+    // Start a subscriber to listen to drive commands, without Nagle's algorithm holding small messages back
+    for (size_t i = 0; i < agents.size(); i++) {
+        agents[i].drive_sub = n.subscribe<ackermann_msgs::AckermannDriveStamped>(agents[i].drive_topic, 1,
+                [this, i](const ackermann_msgs::AckermannDriveStamped::ConstPtr & msg) {drive_callback(i, *msg);},
+                ros::VoidConstPtr(), ros::TransportHints().tcpNoDelay());
+    }
+    if (mux_in_process) start_mux();
+    if (not overtaking_model.empty()) start_overtaking();
+
+    // Initialize a simulator of the laser scanner
+    scan_simulator = ScanSimulator2D(scan_beams, scan_fov, scan_std_dev, scan_max_range, cube_width);
+    scan_simulator.set_vectorized(scan_vectorized);
+    MarchSettings march;
+    march.stop_at_max_range = scan_stop_at_max_range;
+    march.min_step = scan_min_step;
+    march.refine_epsilon = scan_refine_epsilon;
+    march.bisect = scan_refinement == "bisection";
+    if (scan_refinement != "bisection" and scan_refinement != "back_off") {
+        ROS_WARN("Unknown scan_refinement %s, using back_off", scan_refinement.c_str());
+    }
+    scan_simulator.set_march_settings(march);
+    if (scan_backend == "range_lut") {
+        // the table is built in the background once the map arrives, until then the ray marcher is used
+        scan_simulator.set_use_range_lut(true);
+    } else if (scan_backend == "cuda") {
+#ifdef F1TENTH_WITH_CUDA
+        // the map is uploaded when it arrives
+        std::string error;
+        if (GpuScanSimulator::available(&error)) {
+            gpu_scanner.reset(new GpuScanSimulator(scan_simulator));
+        } else {
+            ROS_WARN("scan_backend cuda: %s, using ray_marching", error.c_str());
+        }
+#else
+        ROS_WARN("The simulator was built without CUDA_SCAN, using ray_marching");
+#endif
+    } else if (scan_backend != "ray_marching") {
+        ROS_WARN("Unknown scan_backend %s, using ray_marching", scan_backend.c_str());
+    }
+    // ~ is not expanded by the parameter server
+    if (dt_cache_dir.compare(0, 2, "~/") == 0 and getenv("HOME") != nullptr) {
+        dt_cache_dir = std::string(getenv("HOME")) + dt_cache_dir.substr(1);
+    }
+    scan_simulator.set_cache_directory(dt_cache_dir);
+
+    DistanceField::Format field_format;
+    DistanceField::Layout field_layout;
+    if (not DistanceField::parse_format(distance_field_format, field_format)) {
+        ROS_WARN("Unknown distance_field_format %s, using float64", distance_field_format.c_str());
+        field_format = DistanceField::FLOAT64;
+    }
+    if (not DistanceField::parse_layout(distance_field_layout, field_layout)) {
+        ROS_WARN("Unknown distance_field_layout %s, using row_major", distance_field_layout.c_str());
+        field_layout = DistanceField::ROW_MAJOR;
+    }
+    scan_simulator.set_distance_field(field_format, field_layout);
+    scan_simulator.set_distance_pyramid(distance_pyramid_levels);
+
+    for (Agent & agent : agents) {
+        // Make a publisher for laser scan messages
+        agent.scan_pub = n.advertise<sensor_msgs::LaserScan>(agent.scan_topic, 1);
+
+        // Make a publisher for odometry messages
+        agent.odom_pub = n.advertise<nav_msgs::Odometry>(agent.odom_topic, 1);
+
+        if (not agent.carState_topic.empty()) {
+            agent.carState_pub = n.advertise<f1tenth_simulator_two_agents::CarStateStamped>(agent.carState_topic, 1);
+            agent.carState_msg.header.frame_id = map_frame;
+        }
+        if (not agent.switch_topic.empty()) {
+            agent.switch_pub = n.advertise<std_msgs::Bool>(agent.switch_topic, 1);
+        }
+    }
+
+    // Make a publisher for IMU messages
+    imu_pub = n.advertise<sensor_msgs::Imu>(imu_topic, 1);
+
+    // latched, the map is only published once
+    map_pub = n.advertise<nav_msgs::OccupancyGrid>(map_topic, 1, true);
+
+    // Make a publisher for ground truth pose
+    pose_pub = n.advertise<geometry_msgs::PoseStamped>(gt_pose_topic, 10);
+
+    // latched, so rviz gets the reference line whenever it connects, the timer repeats it for late displays
+    reference_line_pub = n.advertise<visualization_msgs::Marker>(reference_line, 1, true);
+    if (reference_line_rate > 0) {
+        reference_line_timer = n.createWallTimer(ros::WallDuration(1.0 / reference_line_rate),
+                                                 &RacecarSimulator::reference_line_timer_callback, this);
+    }
+
+    // Start a subscriber to listen to new maps
+    map_sub = n.subscribe(map_topic, 1, &RacecarSimulator::map_callback, this);
+
+    // Start a subscriber to listen to pose messages
+    for (size_t i = 0; i < agents.size(); i++) {
+        agents[i].pose_sub = n.subscribe<geometry_msgs::PoseStamped>(agents[i].pose_topic, 1,
+                [this, i](const geometry_msgs::PoseStamped::ConstPtr & msg) {pose_callback(i, *msg);});
+    }
+
+    data_sub = n.subscribe(data_topic, 1, &RacecarSimulator::data_callback, this);
+
+
+    scan_ang_incr = scan_simulator.get_angle_increment();
+
+    collision_checker = CollisionChecker(scan_beams, params.wheelbase, width,
+                                         scan_distance_to_base_link, -scan_fov / 2.0, scan_ang_incr);
+
+    // the map straight from its image, or one map message from map_server
+    if (not map_yaml.empty()) {
+        load_map_file(map_yaml);
+    } else {
+        nav_msgs::OccupancyGridConstPtr map_ptr = ros::topic::waitForMessage<nav_msgs::OccupancyGrid>(map_topic);
+        if (map_ptr != NULL) {
+            map_width = map_ptr->info.width;
+            map_height = map_ptr->info.height;
+            origin_x = map_ptr->info.origin.position.x;
+            origin_y = map_ptr->info.origin.position.y;
+            map_resolution = map_ptr->info.resolution;
+        }
+    }
+
+    ROS_INFO("Simulator constructed with %zu cars, %zu scan threads.", agents.size(), scan_pool->size());
+}
+
+void RacecarSimulator::update_pose(const ros::TimerEvent &) {
+    ros::Time timestamp = ros::Time::now();
+    simulate_step(timestamp.toSec() - previous_seconds, timestamp);
+}
+
+void RacecarSimulator::simulate_step(double dt, ros::Time timestamp) {
+    std::lock_guard<std::mutex> lock(mutex);
+    uint64_t tick_begin = profiler.now_ns();
+    // the timer can't catch up when a step takes too long, then dt grows, and the ticks come late
+    if (not lockstep and last_tick_ns > 0) {
+        profiler.record(tick_interval_stage, last_tick_ns, tick_begin);
+        if (tick_begin - last_tick_ns > 1.5e9 * update_pose_rate) late_ticks++;
+    }
+    last_tick_ns = tick_begin;
+
+    apply_commands(tick_begin);
+    // the cars and their commands as they are before this step are where the recording starts
+    if (not scenario_record_file.empty()) update_recording(timestamp);
+
+    if (dt > 0) {
+        ScopedTimer timer(profiler, physics_stage, agents.size());
+        for (Agent & agent : agents) update_state(agent, dt);
+    }
+    previous_seconds = timestamp.toSec();
+
+    update_sensors(timestamp);
+    if (scenario_recorder.is_open()) record_step(dt, timestamp);
+
+    uint64_t tick_end = profiler.now_ns();
+    profiler.record(tick_stage, tick_begin, tick_end);
+    // the wall time one step may take, in lockstep only when it follows the wall time
+    double budget = lockstep ? (real_time_factor > 0 ? lockstep_dt / real_time_factor : 0) : update_pose_rate;
+    if (budget > 0 and tick_end - tick_begin > 1e9 * budget) tick_overruns++;
+}
+
+void RacecarSimulator::run_lockstep() {
+    ROS_INFO("Lockstep mode, dt %fs, real time factor %f", lockstep_dt, real_time_factor);
+
+    // simulated time starts at 1s, time 0 means there is no time yet for nodes using /clock
+    const double start_seconds = 1.0;
+    // the map message is waiting since the constructor
+    ros::spinOnce();
+    publish_clock(ros::Time(start_seconds));
+    simulate_step(0, ros::Time(start_seconds));
+
+    ros::WallTime wall_start = ros::WallTime::now();
+    for (uint64_t step = 1; ros::ok(); step++) {
+        if (lockstep_wait_for_commands and map_exists) {
+            wait_for_commands();
+        } else {
+            ros::spinOnce();
+        }
+
+        // multiply instead of adding up, so the time doesn't drift after millions of steps
+        double elapsed = step * lockstep_dt;
+        ros::Time timestamp(start_seconds + elapsed);
+
+        // first move every car, then scan, so all cars see each other at the same time
+        publish_clock(timestamp);
+        simulate_step(lockstep_dt, timestamp);
+
+        if (real_time_factor > 0) {
+            ros::WallTime target = wall_start + ros::WallDuration(elapsed / real_time_factor);
+            ros::WallTime now = ros::WallTime::now();
+            if (now < target) (target - now).sleep();
+        }
+    }
+}
+
+void RacecarSimulator::wait_for_commands() {
+    ros::WallTime deadline = ros::WallTime::now() + ros::WallDuration(lockstep_command_timeout);
+    while (ros::ok()) {
+        ros::getGlobalCallbackQueue()->callAvailable(ros::WallDuration(0.001));
+
+        bool all_received = true;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < agents.size(); i++) {
+                bool received = agents[i].command_received or (command_mux and command_mux->pending(i));
+                all_received = all_received and received;
+            }
+        }
+        if (all_received) break;
+
+        if (deadline < ros::WallTime::now()) {
+            ROS_WARN_THROTTLE(5, "Lockstep: not every car sent a drive command within %fs, stepping anyway",
+                              lockstep_command_timeout);
+            break;
+        }
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    for (Agent & agent : agents) agent.command_received = false;
+}
+
+void RacecarSimulator::publish_clock(ros::Time time) {
+    rosgraph_msgs::Clock msg;
+    msg.clock = time;
+    clock_pub.publish(msg);
+}
+
+void RacecarSimulator::update_state(Agent & agent, double dt) {
+    agent.state = STKinematics::integrate(
+            agent.state,
+            agent.desired_speed,
+            agent.desired_steer_ang,
+            agent.params,
+            dt,
+            physics_dt,
+            integrator);
+}
+
+void RacecarSimulator::update_sensors(ros::Time timestamp) {
+    {
+        ScopedTimer timer(profiler, transform_stage, agents.size());
+        for (Agent & agent : agents) {
+            // for machine learning, not necessarily
+            if (not agent.carState_topic.empty()) {
+                pub_carState(agent, timestamp);
+            }
+
+            // Publish the pose as a transformation
+            pub_pose_transform(agent, timestamp);
+
+            // Publish the steering angle as a transformation so the wheels move
+            pub_steer_ang_transform(agent, timestamp);
+
+            // Make an odom message as well and publish it
+            pub_odom(agent, timestamp);
+        }
+    }
+
+    // If we have a map, perform a scan
+    if (not map_exists) return;
+
+    scan_requests.resize(agents.size());
+    for (size_t index = 0; index < agents.size(); index++) {
+        Agent & agent = agents[index];
+
+        // calculating the pose of the lidar, given the pose of base link
+        // (base link is the center of the rear axle)
+        Pose2D scan_pose;
+        scan_pose.x = agent.state.x + scan_distance_to_base_link * std::cos(agent.state.theta);
+        scan_pose.y = agent.state.y + scan_distance_to_base_link * std::sin(agent.state.theta);
+        scan_pose.theta = agent.state.theta;
+
+        // we need the pose of all other cars for simulating LiDAR data,
+        // the scanner skips the ones that are out of range
+        agent.opponent_poses.clear();
+        for (size_t other = 0; other < agents.size(); other++) {
+            if (other == index) continue;
+            agent.opponent_poses.push_back({agents[other].state.x, agents[other].state.y, agents[other].state.theta});
+        }
+
+        // the scan from the lidar goes straight into the message,
+        // a car with a switch topic wants to know whether it can see another car
+        agent.scan_msg = next_scan_msg(agent);
+        scan_requests[index] = {scan_pose, agent.opponent_poses.data(), agent.opponent_poses.size(),
+                                agent.scan_msg->ranges.data(), not agent.switch_topic.empty(), &agent.scan_context};
+    }
+
+    // the beams of all cars are shared by the threads of the pool
+    {
+        ScopedTimer timer(profiler, scan_stage, scan_requests.size() * scan_simulator.get_num_beams());
+        bool scanned = false;
+#ifdef F1TENTH_WITH_CUDA
+        if (gpu_scanner) {
+            std::string error;
+            scanned = gpu_scanner->scan_batch(scan_requests.data(), scan_requests.size(), &error);
+            if (not scanned) ROS_WARN_THROTTLE(5, "GPU scan failed: %s, scanning on the CPU", error.c_str());
+        }
+#endif
+        if (not scanned) {
+            scan_simulator.scan_batch(scan_requests.data(), scan_requests.size(), *scan_pool, scan_beams_per_chunk);
+        }
+    }
+#ifdef F1TENTH_WITH_TENSORFLOW
+    // the scan and the state the car publishes in this step, what ML_overtaking_red.py got from the topics
+    for (OvertakingAgent & car : overtaking_agents) {
+        car.history.push(scan_requests[car.index].scan_data, agents[car.index].state);
+    }
+#endif
+    if (scenario_recorder.is_open()) {
+        ScenarioChecksum checksum;
+        for (const ScanRequest & request : scan_requests) checksum.add(request.scan_data, scan_beams);
+        step_scan_checksum = checksum.value;
+    }
+
+    for (size_t index = 0; index < agents.size(); index++) {
+        publish_scan(index, timestamp);
+    }
+#ifdef F1TENTH_WITH_TENSORFLOW
+    if (not overtaking_agents.empty()) run_overtaking();
+#endif
+}
+
+void RacecarSimulator::publish_scan(size_t index, ros::Time timestamp) {
+    Agent & agent = agents[index];
+    const std::vector<float> & scan_ = agent.scan_msg->ranges;
+    ScopedTimer collision_timer(profiler, collision_stage);
+
+    // TTC Calculations are done here so the car can be halted in the simulator,
+    // the smallest time to collision of all beams, INFINITY when the car stands still
+    double ttc = collision_checker.min_ttc(scan_.data(), agent.state.velocity_x);
+    bool lidar_collision = ttc < ttc_threshold;
+
+    // In order to implement box collider for all cars, which treating each car as a box or a rectangle in this 2D world
+    // We can simplify the problem into decide whether two rectangle is overlapping or not,
+    // every car is the rectangle from its rear axle to its front axle
+    std::string box_collisions;
+    if (agent.state.velocity_x != 0) {
+        OrientedBox box = CollisionChecker::car_box(agent.state, agent.params.wheelbase, width);
+        for (size_t other = 0; other < agents.size(); other++) {
+            if (other == index) continue;
+            const Agent & opponent = agents[other];
+
+            // two cars further apart than their lengths can't touch
+            double reach = agent.params.wheelbase + opponent.params.wheelbase + width;
+            if (std::abs(opponent.state.x - agent.state.x) > reach or std::abs(opponent.state.y - agent.state.y) > reach) {
+                continue;
+            }
+
+            if (CollisionChecker::overlap(box, CollisionChecker::car_box(opponent.state, opponent.params.wheelbase, width))) {
+                box_collisions += (box_collisions.empty() ? "" : ", ") + upper_case(opponent.name);
+            }
+        }
+    }
+
+    // a collision is reported once when it starts, not for every beam and every step while it lasts
+    bool collision = lidar_collision or not box_collisions.empty();
+    if (collision and not agent.TTC) {
+        first_ttc_actions(agent);
+        if (lidar_collision) {
+            ROS_INFO("LiDAR collision detected: %s, time to collision %.3fs", upper_case(agent.name).c_str(), ttc);
+        }
+        if (not box_collisions.empty()) {
+            ROS_INFO("Box collider detected: %s with %s", upper_case(agent.name).c_str(), box_collisions.c_str());
+        }
+    }
+    // reset TTC
+    agent.TTC = collision;
+    collision_timer.stop();
+
+    ScopedTimer publish_timer(profiler, publish_stage);
+    // this is the flag for switching between MPC and overtaking algorithm
+    // if this car can see another car within a certain distance, then using overtaking algorithm, otherwise MPC
+    if (not agent.switch_topic.empty()) {
+        std_msgs::Bool msg;
+        msg.data = agent.scan_context.can_see_opponent;
+        agent.switch_pub.publish(msg);
+    }
+
+    // Publish the laser message, the message must not be changed after this
+    agent.scan_msg->header.stamp = timestamp;
+    if (scan_publish_intensities) {
+        agent.scan_msg->intensities = scan_;
+    }
+    agent.scan_pub.publish(agent.scan_msg);
+
+    // Publish a transformation between base link and laser
+    pub_laser_link_transform(agent, timestamp);
+    publish_timer.stop();
+    // for machine learning, not necessarily
+    if (log_data_flag) {
+        ScopedTimer timer(profiler, logging_stage);
+        agent.logger->log(timestamp.toSec(), agent.desired_speed, agent.desired_steer_ang, agent.state, scan_.data());
+    }
+    // only the subscribers hold it now, next_scan_msg() can take it again once they are done
+    agent.scan_msg.reset();
+}
+
+sensor_msgs::LaserScanPtr RacecarSimulator::next_scan_msg(Agent & agent) {
+    for (const sensor_msgs::LaserScanPtr & msg : agent.scan_msgs) {
+        if (msg.use_count() == 1) return msg;
+    }
+
+    sensor_msgs::LaserScanPtr msg = boost::make_shared<sensor_msgs::LaserScan>();
+    msg->header.frame_id = agent.scan_frame;
+    msg->angle_min = -scan_simulator.get_field_of_view() / 2.;
+    msg->angle_max = scan_simulator.get_field_of_view() / 2.;
+    msg->angle_increment = scan_simulator.get_angle_increment();
+    msg->range_max = 100;
+    msg->ranges.resize(scan_simulator.get_num_beams());
+    if (agent.scan_msgs.size() < max_scan_msgs) {
+        agent.scan_msgs.push_back(msg);
+    }
+    return msg;
+}
+
+std::string RacecarSimulator::agent_param(const std::string & key, const std::string & name, const std::string & fallback) {
+    std::string value;
+    if (n.getParam(key + "_" + name, value)) return value;
+    return fallback;
+}
+
+std::string RacecarSimulator::upper_case(std::string text) {
+    for (char & c : text) c = std::toupper(c);
+    return text;
+}
+
+void RacecarSimulator::start_logging() {
+    time_t now = time(0);
+    char date[32];
+    std::strftime(date, sizeof(date), "%Y-%m-%d_%H-%M-%S", std::localtime(&now));
+
+    for (Agent & agent : agents) {
+        std::string file = path + "/" + agent.name + "_" + date + ".f1log";
+        if (agent.logger->open(file, agent.name, agent.log_scan ? scan_beams : 0)) {
+            ROS_WARN("Starting writing data (%s) to %s", agent.name.c_str(), file.c_str());
+        } else {
+            ROS_ERROR("Cannot create a file (%s)", agent.name.c_str());
+        }
+    }
+}
+
+void RacecarSimulator::stop_logging() {
+    for (Agent & agent : agents) {
+        if (not agent.logger->is_open()) continue;
+        agent.logger->close();
+        if (agent.logger->failed()) {
+            ROS_ERROR("Writing data (%s) failed", agent.name.c_str());
+        } else {
+            ROS_WARN("Finishing writing data (%s), %zu records, %zu dropped", agent.name.c_str(),
+                     agent.logger->get_written(), agent.logger->get_dropped());
+        }
+    }
+}
+
+void RacecarSimulator::update_recording(ros::Time timestamp) {
+    if (not scenario_started and map_exists) {
+        scenario_started = true;
+        start_recording(timestamp.toSec());
+    }
+    if (not scenario_recorder.is_open()) return;
+    if (map_version != scenario_map_version) {
+        ROS_WARN("The map changed, a replay can't follow, stopping the scenario recording");
+        stop_recording();
+    } else if (scenario_recorder.failed()) {
+        stop_recording();
+    }
+}
+
+void RacecarSimulator::start_recording(double time) {
+    ScenarioHeader header;
+    // the padding too, so the same race is the same bytes (MarchSettings has defaults, but no other constructor)
+    std::memset(static_cast<void *>(&header), 0, sizeof(header));
+    header.integrator = integrator;
+    header.params = agents.front().params;
+    header.physics_dt = physics_dt;
+    header.width = width;
+    header.ttc_threshold = ttc_threshold;
+
+    header.scan_beams = scan_beams;
+    header.scan_backend = ScenarioHeader::RAY_MARCHING;
+    if (scan_simulator.get_use_range_lut()) header.scan_backend = ScenarioHeader::RANGE_LUT;
+#ifdef F1TENTH_WITH_CUDA
+    if (gpu_scanner) header.scan_backend = ScenarioHeader::CUDA;
+#endif
+    if (header.scan_backend != ScenarioHeader::RAY_MARCHING) {
+        ROS_WARN("Recording a scenario with scan_backend %s, only ray_marching replays bit by bit",
+                 scan_backend.c_str());
+    }
+    header.scan_field_of_view = scan_fov;
+    header.scan_std_dev = scan_std_dev;
+    header.scan_max_range = scan_max_range;
+    header.cube_width = cube_width;
+    header.scan_distance_to_base_link = scan_distance_to_base_link;
+    header.march = scan_simulator.get_march_settings();
+    header.scan_vectorized = scan_simulator.get_vectorized();
+    header.distance_field_format = scan_simulator.get_distance_field().get_format();
+    header.distance_field_layout = scan_simulator.get_distance_field().get_layout();
+    header.distance_pyramid_levels = scan_simulator.get_distance_pyramid();
+    {
+        std::lock_guard<std::mutex> lock(map_mutex);
+        std::strncpy(header.map_yaml, scanner_map_yaml.c_str(), sizeof(header.map_yaml) - 1);
+        header.map_free_threshold = map_free_threshold;
+        header.map_resolution = map_resolution;
+        header.map_origin = scanner_map_origin;
+        header.map_width = scanner_grid->info.width;
+        header.map_height = scanner_grid->info.height;
+        header.map_hash = scanner_map_hash;
+        scenario_map_version = map_version;
+    }
+    header.start_time = time;
+
+    // every noise generator starts again from a seed the file knows, a random one if scan_noise_seed is 0
+    std::random_device device;
+    std::vector<ScenarioCar> cars(agents.size());
+    for (size_t i = 0; i < agents.size(); i++) {
+        Agent & agent = agents[i];
+        ScenarioCar & car = cars[i];
+        std::memset(&car, 0, sizeof(car));
+        std::strncpy(car.name, agent.name.c_str(), sizeof(car.name) - 1);
+        car.state = agent.state;
+        car.desired_speed = agent.desired_speed;
+        car.desired_steer_angle = agent.desired_steer_ang;
+        car.noise_seed = scan_noise_seed != 0 ? scan_noise_seed + i : (uint64_t(device()) << 32 | device()) + 1;
+        car.collided = agent.TTC;
+        agent.scan_context = ScanContext(car.noise_seed);
+    }
+
+    std::string error;
+    if (scenario_recorder.open(scenario_record_file, header, cars, &error)) {
+        ROS_WARN("Recording the scenario to %s", scenario_record_file.c_str());
+    } else {
+        ROS_ERROR("Cannot record the scenario: %s", error.c_str());
+    }
+}
+
+void RacecarSimulator::stop_recording() {
+    scenario_recorder.close();
+    if (scenario_recorder.failed()) {
+        ROS_ERROR("Writing the scenario to %s failed after %zu steps", scenario_record_file.c_str(),
+                  scenario_recorder.get_steps());
+    } else {
+        ROS_WARN("Scenario recording stopped, %zu steps in %s", scenario_recorder.get_steps(),
+                 scenario_record_file.c_str());
+    }
+}
+
+void RacecarSimulator::record_step(double dt, ros::Time timestamp) {
+    ScenarioChecksum checksum;
+    for (const Agent & agent : agents) {
+        checksum.add(agent.state);
+        checksum.add(agent.desired_speed);
+        checksum.add(agent.desired_steer_ang);
+    }
+    scenario_recorder.step(timestamp.toSec(), dt, checksum.value, step_scan_checksum);
+}
+
+void RacecarSimulator::first_ttc_actions(Agent & agent) {
+    // completely stop vehicle
+    agent.state.velocity_x = 0.0;
+    agent.state.velocity_y = 0.0;
+    agent.state.angular_velocity = 0.0;
+    agent.state.slip_angle = 0.0;
+    agent.state.steer_angle = 0.0;
+    agent.desired_speed = 0.0;
+    agent.desired_steer_ang = 0.0;
+}
+
+void RacecarSimulator::data_callback(const std_msgs::Bool &msg) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (msg.data == log_data_flag) return;
+    log_data_flag = msg.data;
+    if (log_data_flag) {
+        ROS_INFO_STREAM("start logging driving data");
+        start_logging();
+    } else {
+        ROS_INFO_STREAM("stop logging driving data and save to file");
+        stop_logging();
+    }
+}
+
+void RacecarSimulator::pose_callback(size_t index, const geometry_msgs::PoseStamped &msg) {
+    std::lock_guard<std::mutex> lock(mutex);
+    Agent & agent = agents[index];
+    agent.state.x = msg.pose.position.x;
+    agent.state.y = msg.pose.position.y;
+    geometry_msgs::Quaternion q = msg.pose.orientation;
+    tf2::Quaternion quat(q.x, q.y, q.z, q.w);
+    agent.state.theta = tf2::impl::getYaw(quat);
+    if (scenario_recorder.is_open()) {
+        scenario_recorder.pose(previous_seconds, index, {agent.state.x, agent.state.y, agent.state.theta});
+    }
+}
+
+void RacecarSimulator::drive_callback(size_t index, const ackermann_msgs::AckermannDriveStamped &msg) {
+    uint64_t origin_ns = command_origin(msg.header);
+    std::lock_guard<std::mutex> lock(mutex);
+    set_command(index, msg.drive.speed, msg.drive.steering_angle, origin_ns);
+}
+
+void RacecarSimulator::set_command(size_t index, double speed, double steer_angle, uint64_t origin_ns) {
+    Agent & agent = agents[index];
+    // only the commands that change something, most controllers send the same one again and again
+    if (scenario_recorder.is_open() and (speed != agent.desired_speed or steer_angle != agent.desired_steer_ang)) {
+        scenario_recorder.drive(previous_seconds, index, speed, steer_angle);
+    }
+    agent.desired_speed = speed;
+    agent.desired_steer_ang = steer_angle;
+    agent.command_received = true;
+    agent.command_origin_ns = std::max<uint64_t>(origin_ns, 1);
+}
+
+uint64_t RacecarSimulator::command_origin(const std_msgs::Header & header) {
+    uint64_t now_ns = profiler.now_ns();
+    if (header.stamp.isZero()) return now_ns;
+    double age = (ros::Time::now() - header.stamp).toSec();
+    if (not (age > 0)) return now_ns;
+    return now_ns - std::min<uint64_t>(age * 1e9, now_ns);
+}
+
+void RacecarSimulator::start_mux() {
+    int mux_size = 0;
+    std::string mux_topic;
+    n.getParam("mux_size", mux_size);
+    n.getParam("mux_topic", mux_topic);
+
+    std::vector<MuxChannel> channels = read_mux_channels(n);
+    std::vector<CommandChannel> command_channels;
+    for (const MuxChannel & channel : channels) {
+        // the car whose drive topic the channel published to through the mux node
+        size_t car = agents.size();
+        for (size_t i = 0; i < agents.size(); i++) {
+            if (agents[i].drive_topic == channel.drive_topic) car = i;
+        }
+        if (car == agents.size()) {
+            ROS_WARN("Mux channel %s drives %s, which is no car", channel.topic.c_str(), channel.drive_topic.c_str());
+        }
+        command_channels.push_back({car, channel.mux_idx});
+    }
+    command_mux.reset(new CommandMux(agents.size(), std::max(mux_size, 0), command_channels));
+
+    for (size_t c = 0; c < channels.size(); c++) {
+        if (command_channels[c].car == agents.size()) continue;
+        mux_channel_subs.push_back(n.subscribe<ackermann_msgs::AckermannDriveStamped>(channels[c].topic, 1,
+                [this, c](const ackermann_msgs::AckermannDriveStamped::ConstPtr & msg) {
+                    command_mux->write(c, msg->drive.speed, msg->drive.steering_angle, command_origin(msg->header));
+                },
+                ros::VoidConstPtr(), ros::TransportHints().tcpNoDelay()));
+    }
+    mux_sub = n.subscribe(mux_topic, 1, &RacecarSimulator::mux_callback, this);
+    ROS_INFO("In-process mux with %zu drive channels", mux_channel_subs.size());
+}
+
+void RacecarSimulator::mux_callback(const std_msgs::Int32MultiArray & msg) {
+    // indices the message doesn't have are off
+    bool anything_on = false;
+    for (size_t i = 0; i < command_mux->get_mux_size(); i++) {
+        bool on = i < msg.data.size() and msg.data[i] != 0;
+        command_mux->set_enabled(i, on);
+        anything_on = anything_on or on;
+    }
+    // if no mux channel is active, halt the cars
+    if (not anything_on) command_mux->halt(profiler.now_ns());
+}
+
+void RacecarSimulator::apply_commands(uint64_t tick_ns) {
+    for (size_t i = 0; i < agents.size(); i++) {
+        CommandMux::Command command;
+        if (command_mux and command_mux->read(i, command)) {
+            set_command(i, command.speed, command.steer_angle, command.origin_ns);
+        }
+        Agent & agent = agents[i];
+#ifdef F1TENTH_WITH_TENSORFLOW
+        for (OvertakingAgent & car : overtaking_agents) {
+            if (car.index != i or not car.has_command) continue;
+            set_command(i, car.speed, car.steer_angle, car.origin_ns);
+            car.has_command = false;
+        }
+#endif
+        if (agent.command_origin_ns != 0) {
+            profiler.record(command_latency_stage, agent.command_origin_ns, tick_ns);
+            agent.command_origin_ns = 0;
+        }
+    }
+}
+
+void RacecarSimulator::start_overtaking() {
+#ifdef F1TENTH_WITH_TENSORFLOW
+    OvertakingModelConfig config;
+    config.saved_model_dir = overtaking_model[0] == '/' ? overtaking_model :
+            ros::package::getPath("f1tenth_simulator_two_agents") + "/overtaking_models/" + overtaking_model;
+    config.history = std::max(overtaking_history, 1);
+    config.num_beams = scan_beams;
+    config.num_threads = overtaking_threads;
+    std::string error;
+    if (not overtaking_policy.load(config, &error)) {
+        ROS_ERROR("Cannot load overtaking_model: %s", error.c_str());
+        return;
+    }
+
+    std::string overtaking_topic;
+    n.getParam("overtaking_drive_topic", overtaking_topic);
+    std::vector<MuxChannel> channels = read_mux_channels(n);
+    for (const std::string & name : overtaking_agent_names) {
+        size_t index = agents.size();
+        for (size_t i = 0; i < agents.size(); i++) {
+            if (agents[i].name == name) index = i;
+        }
+        if (index == agents.size()) {
+            ROS_WARN("overtaking_agents: there is no car %s", name.c_str());
+            continue;
+        }
+        OvertakingAgent car;
+        car.index = index;
+        car.history = OvertakingHistory(config.history, config.num_beams);
+        for (size_t c = 0; c < channels.size(); c++) {
+            if (channels[c].topic != overtaking_topic or channels[c].drive_topic != agents[index].drive_topic) continue;
+            if (command_mux) {
+                car.mux_channel = c;
+            } else {
+                car.publisher = n.advertise<ackermann_msgs::AckermannDriveStamped>(overtaking_topic, 1);
+            }
+        }
+        overtaking_agents.push_back(std::move(car));
+    }
+    overtaking_scans.resize(overtaking_agents.size() * config.history * config.num_beams);
+    overtaking_states.resize(overtaking_agents.size() * config.history * 2);
+    overtaking_commands.resize(overtaking_agents.size() * 2);
+    overtaking_batch.reserve(overtaking_agents.size());
+    ROS_INFO("overtaking_model %s drives %zu cars", config.saved_model_dir.c_str(), overtaking_agents.size());
+#else
+    ROS_WARN("The simulator was built without TF_INFERENCE, overtaking_model %s is not used", overtaking_model.c_str());
+#endif
+}
+
+#ifdef F1TENTH_WITH_TENSORFLOW
+void RacecarSimulator::run_overtaking() {
+    const OvertakingModelConfig & config = overtaking_policy.get_config();
+    size_t scan_size = config.history * config.num_beams;
+    size_t state_size = config.history * 2;
+    overtaking_batch.clear();
+    for (size_t k = 0; k < overtaking_agents.size(); k++) {
+        const OvertakingHistory & history = overtaking_agents[k].history;
+        if (not history.full()) continue;
+        size_t b = overtaking_batch.size();
+        history.copy(overtaking_scans.data() + b * scan_size, overtaking_states.data() + b * state_size);
+        overtaking_batch.push_back(k);
+    }
+    if (overtaking_batch.empty()) return;
+
+    ScopedTimer timer(profiler, inference_stage, overtaking_batch.size());
+    uint64_t origin_ns = profiler.now_ns();
+    std::string error;
+    if (not overtaking_policy.predict(overtaking_scans.data(), overtaking_states.data(), overtaking_batch.size(),
+                                      overtaking_commands.data(), &error)) {
+        ROS_WARN_THROTTLE(5, "overtaking_model: %s", error.c_str());
+        return;
+    }
+
+    for (size_t b = 0; b < overtaking_batch.size(); b++) {
+        OvertakingAgent & car = overtaking_agents[overtaking_batch[b]];
+        double speed = overtaking_commands[2 * b];
+        double steer_angle = overtaking_commands[2 * b + 1];
+        if (car.mux_channel >= 0) {
+            // dropped while the behavior controller has the channel off, like the commands of ML_overtaking_red.py
+            command_mux->write(car.mux_channel, speed, steer_angle, origin_ns);
+        } else if (car.publisher) {
+            ackermann_msgs::AckermannDriveStamped msg;
+            msg.header.stamp = ros::Time::now();
+            msg.drive.speed = speed;
+            msg.drive.steering_angle = steer_angle;
+            car.publisher.publish(msg);
+        } else {
+            car.has_command = true;
+            car.speed = speed;
+            car.steer_angle = steer_angle;
+            car.origin_ns = origin_ns;
+        }
+    }
+}
+
+#endif
+void RacecarSimulator::map_callback(const nav_msgs::OccupancyGridConstPtr & msg) {
+    std::lock_guard<std::mutex> lock(map_mutex);
+    // the map of load_map_file() coming back, it is in the scanner already
+    if (msg == scanner_grid) return;
+
+    // http://docs.ros.org/en/lunar/api/nav_msgs/html/msg/OccupancyGrid.html
+    // Fetch the map parameters
+    size_t height = msg->info.height;
+    size_t width = msg->info.width;
+    // Convert the ROS origin to a pose
+    Pose2D origin;
+    // bottom right conner is the origin point
+    origin.x = msg->info.origin.position.x;
+    origin.y = msg->info.origin.position.y;
+
+    geometry_msgs::Quaternion q = msg->info.origin.orientation;
+    tf2::Quaternion quat(q.x, q.y, q.z, q.w);
+    origin.theta = tf2::impl::getYaw(quat);
+
+    // the same map with some cells changed, e.g. obstacles placed on the racetrack, only update those cells
+    bool same_layout = map_exists and scanner_grid and height == scanner_grid->info.height and
+                       width == scanner_grid->info.width and msg->info.resolution == scanner_grid->info.resolution and
+                       origin.x == scanner_map_origin.x and origin.y == scanner_map_origin.y and
+                       origin.theta == scanner_map_origin.theta;
+    std::vector<size_t> changed_cells;
+    if (same_layout) {
+        const std::vector<int8_t> & old_data = scanner_grid->data;
+        for (size_t i = 0; i < msg->data.size(); i++) {
+            if (msg->data[i] != old_data[i]) changed_cells.push_back(i);
+        }
+        // e.g. the latched map of load_map_file() again, through another connection
+        if (changed_cells.empty()) return;
+    }
+
+    // msg.data [0, 100] is [0, 1], 0 means definitely not occupied, 1 means definitely occupied, anything else unknown.
+    // Only whether a cell is free matters to the scanner, one bit per cell
+    ROS_INFO_STREAM("map height: " << height);
+    ROS_INFO_STREAM("map width: " << width);
+    OccupancyBitmap bitmap;
+    bitmap.assign(msg->data.data(), width, height, map_free_threshold);
+    bitmap.resolution = msg->info.resolution;
+    bitmap.origin = origin;
+    scanner_map_yaml.clear();
+    send_map_to_scanner(msg, bitmap, same_layout and changed_cells.size() < msg->data.size() / 10, changed_cells);
+}
+
+bool RacecarSimulator::load_map_file(const std::string & yaml) {
+    OccupancyMap grid;
+    OccupancyBitmap bitmap;
+    std::string error;
+    if (not MapLoader::load(yaml, &grid, &bitmap, map_free_threshold, &error)) {
+        ROS_ERROR("Can't load the map: %s", error.c_str());
+        return false;
+    }
+    // the resolution of the message is a float, the distance transform should be the same as with map_server
+    bitmap.resolution = float(bitmap.resolution);
+
+    boost::shared_ptr<nav_msgs::OccupancyGrid> msg = boost::make_shared<nav_msgs::OccupancyGrid>();
+    msg->header.frame_id = map_frame;
+    msg->header.stamp = ros::Time::now();
+    msg->info.map_load_time = msg->header.stamp;
+    msg->info.resolution = grid.resolution;
+    msg->info.width = grid.width;
+    msg->info.height = grid.height;
+    msg->info.origin.position.x = grid.origin.x;
+    msg->info.origin.position.y = grid.origin.y;
+    tf2::Quaternion quat;
+    quat.setEuler(0., 0., grid.origin.theta);
+    msg->info.origin.orientation.x = quat.x();
+    msg->info.origin.orientation.y = quat.y();
+    msg->info.origin.orientation.z = quat.z();
+    msg->info.origin.orientation.w = quat.w();
+    // the cells move into the message
+    msg->data.swap(grid.data);
+    ROS_INFO("map %s: %u x %u cells", yaml.c_str(), msg->info.width, msg->info.height);
+
+    map_width = msg->info.width;
+    map_height = msg->info.height;
+    origin_x = grid.origin.x;
+    origin_y = grid.origin.y;
+    {
+        std::lock_guard<std::mutex> lock(map_mutex);
+        scanner_map_yaml = yaml;
+        send_map_to_scanner(msg, bitmap, false, {});
+    }
+    // as a shared pointer, so subscribers in this process get it without a copy, map_callback() included
+    map_pub.publish(nav_msgs::OccupancyGridConstPtr(msg));
+    return true;
+}
+
+void RacecarSimulator::send_map_to_scanner(const nav_msgs::OccupancyGridConstPtr & msg, const OccupancyBitmap & bitmap, bool update,
+                                           const std::vector<size_t> & changed_cells) {
+    map_resolution = bitmap.resolution;
+    if (update) {
+        scan_simulator.update_map(bitmap, changed_cells);
+        ROS_INFO_STREAM("map updated, " << changed_cells.size() << " cells changed");
+    } else {
+        scan_simulator.set_map(bitmap);
+        if (scan_simulator.get_dt_from_cache()) {
+            ROS_INFO_STREAM("distance transform loaded from " << dt_cache_dir);
+        }
+        report_distance_field();
+        load_reference_line(bitmap.origin);
+    }
+#ifdef F1TENTH_WITH_CUDA
+    std::string error;
+    if (gpu_scanner and not gpu_scanner->upload_map(&error)) {
+        ROS_WARN("Can't upload the map to the GPU: %s", error.c_str());
+    }
+#endif
+
+    scanner_grid = msg;
+    scanner_map_origin = bitmap.origin;
+    if (not scenario_record_file.empty()) scanner_map_hash = DistanceTransformCache::hash(bitmap);
+    map_version++;
+    map_exists = true;
+}
+
+void RacecarSimulator::report_distance_field() {
+    const DistanceField & field = scan_simulator.get_distance_field();
+    std::string name = DistanceField::format_name(field.get_format()) + "/" + DistanceField::layout_name(field.get_layout());
+    int pyramid_levels = scan_simulator.get_distance_pyramid();
+    if (pyramid_levels > 0) name += " with " + std::to_string(pyramid_levels) + " pyramid levels";
+    if (not field.is_copy() and pyramid_levels == 0) {
+        ROS_INFO_STREAM("distance field " << name << ": " << scan_simulator.benchmark_distance_field(0).dt_bytes / 1e6 << "MB");
+        return;
+    }
+    // a few scans with both, so the effect on this map and machine is known
+    DistanceFieldReport report = scan_simulator.benchmark_distance_field();
+    ROS_INFO_STREAM("distance field " << name << ": " << report.field_bytes / 1e6 << "MB copy and "
+                    << report.pyramid_bytes / 1e6 << "MB pyramid read by the scanner (float64/row_major "
+                    << report.dt_bytes / 1e6 << "MB), " << report.ms_per_scan << "ms per scan (float64/row_major "
+                    << report.baseline_ms_per_scan << "ms), speedup " << report.baseline_ms_per_scan / report.ms_per_scan);
+}
+
+void RacecarSimulator::load_reference_line(const Pose2D & origin) {
+    std::string csv = ros::package::getPath("f1tenth_simulator_two_agents") + "/maps/" + map_name + "_minTime.csv";
+    reference_line_msg.points.clear();
+    if (not raceline.load(csv)) {
+        ROS_WARN("Cannot read the reference line %s", csv.c_str());
+        return;
+    }
+
+    // https://wiki.ros.org/rviz/DisplayTypes/Marker
+    visualization_msgs::Marker & msg = reference_line_msg;
+    msg.header.frame_id = map_frame;
+    msg.header.stamp = ros::Time();
+    msg.ns = "points";
+    msg.id = 0;
+    msg.type = visualization_msgs::Marker::SPHERE_LIST;
+    msg.action = visualization_msgs::Marker::ADD;
+    msg.pose.position.z = 0;
+    msg.pose.orientation.w = 1.0;
+    msg.scale.x = 0.1;
+    msg.scale.y = 0.1;
+    msg.scale.z = 0.1;
+    msg.color.a = 1.0;
+    msg.color.r = 0.96;
+    msg.color.g = 0.82;
+    msg.color.b = 0.4;
+
+    // weight is the scale in map_to_centerline.py in Racetrack-Preparation
+    // bias is offset value, need some attempts, usually is resolution* width or height
+    // Australia
+//        double weight_x = 5;
+//        double weight_y = 5;
+//        double bias_x = -120;
+//        double bias_y = 0;
+    // Shanghai
+//        double weight_x = 5;
+//        double weight_y = 5;
+//        double bias_x = 0;
+//        double bias_y = -65.1;
+    // Gulf-Air-Bahrain
+//        double weight_x = 6;
+//        double weight_y = 6;
+//        double bias_x = 0;
+//        double bias_y = -65.4;
+    // Malaysian
+//        double weight_x = 3;
+//        double weight_y = 3;
+//        double bias_x = 0;
+//        double bias_y = -60;
+    // Circuit-Of-The-Americas
+//        double weight_x = 3;
+//        double weight_y = 3;
+//        double bias_x = 0;
+//        double bias_y = -112.5;
+    //de-espana
+//        double weight_x = 3;
+//        double weight_y = 3;
+//        double bias_x = 0;
+//        double bias_y = -85.9;
+
+    double weight_x = 3;
+    double weight_y = 3;
+    double bias_x = 0;
+    double bias_y = -85.9;
+
+    // the raceline is in pixels of the scaled image, y pointing down
+    raceline.transform(weight_x * map_resolution, origin.x + bias_x, -weight_y * map_resolution, origin.y - bias_y);
+
+    msg.points.resize(raceline.size());
+    for (size_t i = 0; i < raceline.size(); i++) {
+        msg.points[i].x = raceline.x[i];
+        msg.points[i].y = raceline.y[i];
+    }
+
+    ROS_INFO("Reference line with %zu points, %.1fm", raceline.size(), raceline.length());
+    publish_reference_line();
+}
+
+void RacecarSimulator::publish_reference_line() {
+    ScopedTimer timer(profiler, reference_line_stage);
+    if (not reference_line_msg.points.empty()) reference_line_pub.publish(reference_line_msg);
+}
+
+void RacecarSimulator::report_diagnostics(const ros::WallTimerEvent &) {
+    ros::WallTime now = ros::WallTime::now();
+    double seconds = (now - last_report).toSec();
+    last_report = now;
+    if (seconds <= 0) return;
+
+    std::vector<StageStats> stats = profiler.snapshot(true);
+    uint64_t overruns = tick_overruns.exchange(0);
+    uint64_t late = late_ticks.exchange(0);
+
+    diagnostic_msgs::DiagnosticStatus status;
+    status.name = "f1tenth_simulator: step timing";
+    status.hardware_id = "simulator";
+    status.level = overruns > 0 ? diagnostic_msgs::DiagnosticStatus::WARN : diagnostic_msgs::DiagnosticStatus::OK;
+    status.message = overruns > 0 ? std::to_string(overruns) + " steps overran their period" : "OK";
+
+    auto add = [&status](const std::string & key, double value) {
+        diagnostic_msgs::KeyValue pair;
+        pair.key = key;
+        std::ostringstream text;
+        text << value;
+        pair.value = text.str();
+        status.values.push_back(pair);
+    };
+    add("tick_overruns", overruns);
+    add("late_ticks", late);
+    add("tick_rate_hz", stats[tick_stage].count / seconds);
+    add("physics_rate_hz", stats[physics_stage].count / seconds);
+    add("scan_rate_hz", stats[scan_stage].count / seconds);
+    add("beams_per_sec", stats[scan_stage].items / seconds);
+    for (const StageStats & stage : stats) {
+        if (stage.count == 0) continue;
+        add(stage.name + "_mean_us", stage.mean_ns() * 1e-3);
+        add(stage.name + "_p50_us", stage.quantile_ns(0.5) * 1e-3);
+        add(stage.name + "_p99_us", stage.quantile_ns(0.99) * 1e-3);
+        add(stage.name + "_max_us", stage.max_ns * 1e-3);
+    }
+
+    diagnostic_msgs::DiagnosticArray msg;
+    msg.header.stamp = ros::Time::now();
+    msg.status.push_back(status);
+    diagnostics_pub.publish(msg);
+}
+
+void RacecarSimulator::reference_line_timer_callback(const ros::WallTimerEvent &) {
+    std::lock_guard<std::mutex> lock(map_mutex);
+    publish_reference_line();
+}
+
+void RacecarSimulator::pub_pose_transform(const Agent & agent, ros::Time timestamp) {
+    // Convert the pose into a transformation
+    geometry_msgs::Transform t;
+    t.translation.x = agent.state.x;
+    t.translation.y = agent.state.y;
+    tf2::Quaternion quat;
+    quat.setEuler(0., 0., agent.state.theta);
+    t.rotation.x = quat.x();
+    t.rotation.y = quat.y();
+    t.rotation.z = quat.z();
+    t.rotation.w = quat.w();
+
+    // publish ground truth pose
+    geometry_msgs::PoseStamped ps;
+    ps.header.frame_id = map_frame;
+    ps.pose.position.x = agent.state.x;
+    ps.pose.position.y = agent.state.y;
+    ps.pose.orientation.x = quat.x();
+    ps.pose.orientation.y = quat.y();
+    ps.pose.orientation.z = quat.z();
+    ps.pose.orientation.w = quat.w();
+
+    // Add a header to the transformation
+    geometry_msgs::TransformStamped ts;
+    ts.transform = t;
+    ts.header.stamp = timestamp;
+    ts.header.frame_id = map_frame;
+    ts.child_frame_id = agent.base_frame;
+
+    // Publish them
+    if (broadcast_transform) {
+        br.sendTransform(ts);
+    }
+    if (pub_gt_pose) {
+        pose_pub.publish(ps);
+    }
+}
+
+void RacecarSimulator::pub_steer_ang_transform(const Agent & agent, ros::Time timestamp) {
+    // Set the steering angle to make the wheels move
+    // Publish the steering angle
+    tf2::Quaternion quat_wheel;
+    quat_wheel.setEuler(0., 0., agent.state.steer_angle);
+    geometry_msgs::TransformStamped ts_wheel;
+    ts_wheel.transform.rotation.x = quat_wheel.x();
+    ts_wheel.transform.rotation.y = quat_wheel.y();
+    ts_wheel.transform.rotation.z = quat_wheel.z();
+    ts_wheel.transform.rotation.w = quat_wheel.w();
+    ts_wheel.header.stamp = timestamp;
+    // the joints of the car model are prefixed with the name of the car, see racecar_blue.xacro
+    ts_wheel.header.frame_id = agent.name + "/front_left_hinge";
+    ts_wheel.child_frame_id = agent.name + "/front_left_wheel";
+    br.sendTransform(ts_wheel);
+    ts_wheel.header.frame_id = agent.name + "/front_right_hinge";
+    ts_wheel.child_frame_id = agent.name + "/front_right_wheel";
+    br.sendTransform(ts_wheel);
+}
+
+void RacecarSimulator::pub_laser_link_transform(const Agent & agent, ros::Time timestamp) {
+    // Publish a transformation between base link and laser
+    geometry_msgs::TransformStamped scan_ts;
+    scan_ts.transform.translation.x = scan_distance_to_base_link;
+    scan_ts.transform.rotation.w = 1;
+    scan_ts.header.stamp = timestamp;
+    scan_ts.header.frame_id = agent.base_frame;
+    scan_ts.child_frame_id = agent.scan_frame;
+    br.sendTransform(scan_ts);
+}
+
+void RacecarSimulator::pub_odom(const Agent & agent, ros::Time timestamp) {
+    // Make an odom message and publish it
+    nav_msgs::Odometry odom;
+    odom.header.stamp = timestamp;
+    odom.header.frame_id = map_frame;
+    odom.child_frame_id = agent.base_frame;
+    odom.pose.pose.position.x = agent.state.x;
+    odom.pose.pose.position.y = agent.state.y;
+    tf2::Quaternion quat;
+    quat.setEuler(0., 0., agent.state.theta);
+    odom.pose.pose.orientation.x = quat.x();
+    odom.pose.pose.orientation.y = quat.y();
+    odom.pose.pose.orientation.z = quat.z();
+    odom.pose.pose.orientation.w = quat.w();
+    odom.twist.twist.linear.x = agent.state.velocity_x;
+    odom.twist.twist.angular.z = agent.state.angular_velocity;
+    agent.odom_pub.publish(odom);
+}
+
+void RacecarSimulator::pub_carState(Agent & agent, ros::Time timestamp) {
+    f1tenth_simulator_two_agents::CarStateStamped & msg = agent.carState_msg;
+    msg.header.stamp = timestamp;
+    msg.x = agent.state.x;
+    msg.y = agent.state.y;
+    msg.theta = agent.state.theta;
+    msg.velocity_x = agent.state.velocity_x;
+    msg.velocity_y = agent.state.velocity_y;
+    msg.steer_angle = agent.state.steer_angle;
+    msg.angular_velocity = agent.state.angular_velocity;
+    msg.slip_angle = agent.state.slip_angle;
+    msg.st_dyn = agent.state.st_dyn;
+    agent.carState_pub.publish(msg);
+}
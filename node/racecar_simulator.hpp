@@ -0,0 +1,458 @@
+#pragma once
+
+#include <ros/ros.h>
+
+#include <tf2_ros/transform_broadcaster.h>
+#include <ackermann_msgs/AckermannDriveStamped.h>
+#include <nav_msgs/OccupancyGrid.h>
+#include <nav_msgs/Odometry.h>
+#include <sensor_msgs/Imu.h>
+#include <std_msgs/Int32MultiArray.h>
+#include <std_msgs/Bool.h>
+#include <f1tenth_simulator_two_agents/CarStateStamped.h>
+#include <sensor_msgs/LaserScan.h>
+#include <geometry_msgs/PoseStamped.h>
+#include <visualization_msgs/Marker.h>
+
+#include "f1tenth_simulator/pose_2d.hpp"
+#include "f1tenth_simulator/scan_simulator_2d.hpp"
+#include "f1tenth_simulator/thread_pool.hpp"
+#ifdef F1TENTH_WITH_CUDA
+#include "f1tenth_simulator/gpu_scan_simulator.hpp"
+#endif
+#ifdef F1TENTH_WITH_TENSORFLOW
+#include "f1tenth_simulator/overtaking_policy.hpp"
+#include "f1tenth_simulator/overtaking_history.hpp"
+#endif
+
+#include "f1tenth_simulator/car_state.hpp"
+#include "f1tenth_simulator/car_params.hpp"
+#include "f1tenth_simulator/vehicle_model.hpp"
+#include "f1tenth_simulator/collision_checker.hpp"
+#include "f1tenth_simulator/raceline.hpp"
+#include "f1tenth_simulator/data_logger.hpp"
+#include "f1tenth_simulator/profiler.hpp"
+#include "f1tenth_simulator/scenario.hpp"
+#include "f1tenth_simulator/command_mux.hpp"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+
+namespace racecar_simulator {
+
+/**
+ * Everything the simulator keeps for one car.
+ * All cars live next to each other in RacecarSimulator::agents, the index in there is how callbacks find their car.
+ * Topics, frames and the start pose of a car are parameters ending with _<name>, e.g. drive_topic_blue.
+ */
+struct Agent {
+    // blue, red, ... from the agents parameter
+    std::string name;
+
+    // The car state and parameters
+    CarState state;
+    CarParams params;
+    double desired_speed = 0.0;
+    double desired_steer_ang = 0.0;
+
+    // for collision check, true while this car is stopped after a collision
+    bool TTC = false;
+    // a drive command arrived since the last lockstep step
+    bool command_received = false;
+    // when the controller sent the newest command, in Profiler::now_ns(), 0 once a step applied it
+    uint64_t command_origin_ns = 0;
+
+    std::string drive_topic, scan_topic, pose_topic, odom_topic, carState_topic, switch_topic;
+
+    // The transformation frames used
+    std::string base_frame, scan_frame;
+
+    ros::Publisher scan_pub;
+    // LaserScan messages that were published before. A message is filled again once no subscriber holds it anymore,
+    // so scans are not allocated for every step, and subscribers in the same process (nodelets) get them without a copy
+    std::vector<sensor_msgs::LaserScanPtr> scan_msgs;
+    // the message the scan of the current step goes into, released once it is published
+    sensor_msgs::LaserScanPtr scan_msg;
+    // the noise of the LiDAR of this car and whether it saw another car, so the scans of all cars can run at once
+    ScanContext scan_context;
+    // poses of the other cars for the current scan, kept to avoid allocating for every scan
+    std::vector<Pose2D> opponent_poses;
+    ros::Publisher odom_pub;
+    // only advertised if carState_topic_<name> / switch_topic_<name> is set
+    ros::Publisher carState_pub;
+    // filled again for every tick instead of creating a new message
+    f1tenth_simulator_two_agents::CarStateStamped carState_msg;
+    ros::Publisher switch_pub;
+
+    ros::Subscriber drive_sub;
+    ros::Subscriber pose_sub;
+
+    // whether the LiDAR scan is recorded for machine learning, the state and the commands are always recorded
+    bool log_scan = false;
+    // records the car while logging is on, behind a pointer because the logger owns a thread and can't be moved
+    std::unique_ptr<DataLogger> logger;
+};
+
+#ifdef F1TENTH_WITH_TENSORFLOW
+// a car driven by overtaking_model, see RacecarSimulator::run_overtaking()
+struct OvertakingAgent {
+    size_t index;
+    OvertakingHistory history;
+    // the commands go where the ones of ML_overtaking_red.py went if this car is the one of the mux channel of
+    // overtaking_drive_topic: into that channel of the in-process mux, or published for the mux node.
+    // Any other car is driven directly
+    int mux_channel = -1;
+    ros::Publisher publisher;
+    // the command of the last prediction, applied at the start of the next step like a command of the mux
+    bool has_command = false;
+    double speed = 0;
+    double steer_angle = 0;
+    uint64_t origin_ns = 0;
+};
+#endif
+
+class RacecarSimulator {
+private:
+    // A ROS node
+    ros::NodeHandle n;
+
+    double update_pose_rate;
+    // one timer steps all cars, see simulate_step()
+    ros::Timer update_timer;
+    double previous_seconds = 0.0;
+    // held by simulate_step() and every callback that changes the cars, so a step always sees the cars and the commands
+    // of one moment, even with several spinner threads
+    std::mutex mutex;
+    // threads of ros::MultiThreadedSpinner in the simulator node
+    int spinner_threads = 2;
+    // the longest step of the physics, see STKinematics::integrate()
+    double physics_dt = 0;
+    STKinematics::Integrator integrator = STKinematics::EULER;
+
+    // lockstep mode, see run_lockstep()
+    bool lockstep = false;
+    double lockstep_dt = 0;
+    double real_time_factor = 0;
+    bool lockstep_wait_for_commands = false;
+    double lockstep_command_timeout = 1.0;
+    ros::Publisher clock_pub;
+
+    // mux_in_process: the drive channels of mux_channels.hpp go into the slots of a CommandMux, which every step reads,
+    // instead of a message from the controller to the mux node and another one from the mux node to the simulator
+    bool mux_in_process = false;
+    std::unique_ptr<CommandMux> command_mux;
+    std::vector<ros::Subscriber> mux_channel_subs;
+    ros::Subscriber mux_sub;
+
+    // a SavedModel of overtaking_models/ (its name, or an absolute path) that drives the cars of overtaking_agents
+    // inside the simulator, right after their scans, instead of ML_overtaking_red.py. Empty for off
+    std::string overtaking_model = "";
+    std::vector<std::string> overtaking_agent_names = {"red"};
+    // steps of history per prediction, size_of_input of ML_overtaking_red.py
+    int overtaking_history = 6;
+    // threads of TensorFlow, 0 for its default
+    int overtaking_threads = 0;
+#ifdef F1TENTH_WITH_TENSORFLOW
+    OvertakingPolicy overtaking_policy;
+    std::vector<OvertakingAgent> overtaking_agents;
+    // the inputs and outputs of one batch, kept to avoid allocating for every step
+    std::vector<float> overtaking_scans;
+    std::vector<float> overtaking_states;
+    std::vector<double> overtaking_commands;
+    std::vector<size_t> overtaking_batch;
+    Profiler::Stage inference_stage;
+#endif
+
+    // For publishing transformations
+    tf2_ros::TransformBroadcaster br;
+
+    std::string map_topic, gt_pose_topic,pose_rviz_topic, odom_topic, imu_topic, data_topic, reference_line;
+
+    // The transformation frames used
+    std::string map_frame;
+
+    // all cars on the racetrack, the size never changes after the constructor
+    std::vector<Agent> agents;
+    double scan_distance_to_base_link;
+    double cube_width;
+    double width;
+
+    // A simulator of the laser, shared by all cars, so the map and its distance transform exist only once
+    ScanSimulator2D scan_simulator;
+    // the scans of all cars in a step are split into chunks of beams and computed by the threads of this pool
+    std::unique_ptr<ThreadPool> scan_pool;
+    // 0 for one thread per CPU
+    int scan_threads = 0;
+    int scan_beams_per_chunk = 128;
+    // seed of the noise of the first car, the next car gets seed + 1 and so on, 0 for a random seed
+    int scan_noise_seed = 0;
+    // one per car, kept to avoid allocating for every step
+    std::vector<ScanRequest> scan_requests;
+#ifdef F1TENTH_WITH_CUDA
+    // scan_backend: cuda, all scans of a step in one kernel, null with any other backend
+    std::unique_ptr<GpuScanSimulator> gpu_scanner;
+#endif
+
+    // Publish a scan, odometry, and imu data
+    bool broadcast_transform;
+    bool pub_gt_pose;
+
+    ros::Publisher pose_pub;
+    ros::Publisher imu_pub;
+    ros::Publisher reference_line_pub;
+    // the raceline of the current map, loaded once per map, other parts can use it for progress and lap times
+    Raceline raceline;
+    visualization_msgs::Marker reference_line_msg;
+    // how often the reference line marker is published again, 0 for only once per map
+    double reference_line_rate = 1.0;
+    ros::WallTimer reference_line_timer;
+
+    ros::Subscriber data_sub;
+
+    // publishes the map of map_yaml once, latched, for RViz and the other nodes
+    ros::Publisher map_pub;
+    // Listen for a map
+    ros::Subscriber map_sub;
+    // a map yaml of maps/ the simulator loads itself instead of waiting for map_server, empty to wait for map_topic
+    std::string map_yaml = "";
+    double map_free_threshold;
+    // distance transforms of maps are saved here, empty to disable
+    std::string dt_cache_dir = "";
+    // set by the map callback, read by simulate_step()
+    std::atomic<bool> map_exists{false};
+    // the map callback can run next to simulate_step(), it only shares the scanner with it, which can change its map while scanning
+    std::mutex map_mutex;
+    // the last map sent to the scanner, so a new map message with a few edits only updates the changed cells,
+    // the message itself, not a copy
+    nav_msgs::OccupancyGridConstPtr scanner_grid;
+    Pose2D scanner_map_origin;
+    // the yaml of that map if it was loaded by load_map_file(), and the hash of its bitmap if a scenario is recorded
+    std::string scanner_map_yaml;
+    uint64_t scanner_map_hash = 0;
+    // name of current map
+    std::string map_name;
+    int map_width, map_height;
+    double map_resolution, origin_x, origin_y;
+
+    // time to collision with the precomputed distances to the edge of the car and cosines of the beams, and the box collider
+    CollisionChecker collision_checker;
+    // for collision check
+    double ttc_threshold;
+
+    // scan parameters
+    double scan_fov;
+    double scan_ang_incr;
+    int scan_beams;
+    double scan_std_dev;
+    double scan_max_range;
+    bool scan_vectorized = true;
+    std::string scan_backend = "ray_marching";
+    std::string scan_refinement = "back_off";
+    double scan_refine_epsilon = 0.01;
+    double scan_min_step = 0;
+    bool scan_stop_at_max_range = false;
+    std::string distance_field_format = "float64";
+    std::string distance_field_layout = "row_major";
+    int distance_pyramid_levels = 0;
+    // the simulated LiDAR has no intensities, they used to be a copy of the ranges
+    bool scan_publish_intensities = false;
+    // scan messages kept per car, subscribers holding more than that get newly allocated ones
+    static constexpr size_t max_scan_msgs = 8;
+
+    // flag that indicate start or stop recording data
+    bool log_data_flag = 0;
+    // the path where save data
+    std::string path = "/media/psf/Ubuntu";
+    // records each logger can hold before the writer thread saves them
+    int log_buffer_records = 1024;
+
+    // the race is recorded into this file for ScenarioReplay (tools/replay_scenario), empty for no recording.
+    // The recording starts with the first step that has a map and stops when the map changes
+    std::string scenario_record_file = "";
+    ScenarioRecorder scenario_recorder;
+    bool scenario_started = false;
+    // counts the maps sent to the scanner, the recording is only valid with the map it started with
+    std::atomic<uint64_t> map_version{0};
+    uint64_t scenario_map_version = 0;
+    // the checksum of the scans of the current step, see record_step()
+    uint64_t step_scan_checksum = 0;
+
+    // how long the stages of a step take, see report_diagnostics()
+    Profiler profiler;
+    Profiler::Stage tick_stage, tick_interval_stage, physics_stage, transform_stage, scan_stage, collision_stage,
+                    publish_stage, logging_stage, reference_line_stage, command_latency_stage;
+    bool profiling = true;
+    // how often the timing is published on diagnostics_topic, 0 for never
+    double diagnostics_rate = 1.0;
+    std::string diagnostics_topic = "/diagnostics";
+    // every stage of every step goes to this Chrome trace file, empty for no trace
+    std::string profiling_trace_file = "";
+    ros::Publisher diagnostics_pub;
+    ros::WallTimer diagnostics_timer;
+    ros::WallTime last_report;
+    // start of the last step, in Profiler::now_ns()
+    uint64_t last_tick_ns = 0;
+    // steps that took longer than their period, and steps that started more than half a period late
+    std::atomic<uint64_t> tick_overruns{0};
+    std::atomic<uint64_t> late_ticks{0};
+
+public:
+    // node_handle is the private node handle the parameters are read from, the simulator node passes "~",
+    // the nodelet its private node handle. Lockstep needs the whole process (see run_lockstep()),
+    // without allow_lockstep the timers are used even if the lockstep parameter is set
+    explicit RacecarSimulator(const ros::NodeHandle & node_handle = ros::NodeHandle("~"), bool allow_lockstep = true);
+
+    bool lockstep_enabled() const {return lockstep;}
+    int get_spinner_threads() const {return spinner_threads;}
+
+    // called by the timer, advances all cars by the wall time since the last call
+    void update_pose(const ros::TimerEvent &);
+
+    /**
+     * main loop and the core of the simulator, one step of all cars
+     * First, update the state of every car
+     * Second, update LiDAR scan data of all cars at once, every car sees the others where they are after the first part
+     * Third, using the LiDAR data to check collision
+     * The cars and their commands are locked for the whole step, the callbacks arriving meanwhile apply to the next step
+     */
+    void simulate_step(double dt, ros::Time timestamp);
+
+    /**
+     * Lockstep mode, used instead of the timers when lockstep is true.
+     * All cars are advanced together by exactly lockstep_dt seconds of simulated time per step, and the simulated
+     * time is published on /clock (set use_sim_time so the other nodes follow it). The physics doesn't depend on
+     * timer jitter or the load of the machine any more, the same commands always give the same race.
+     * Steps run as fast as the CPU allows, or at real_time_factor times the wall time if it is above 0.
+     * With lockstep_wait_for_commands, every step waits until each car got a drive command for the scan of the
+     * previous step (at most lockstep_command_timeout seconds of wall time).
+     */
+    void run_lockstep();
+
+    // handle callbacks until every car got a drive command since the last step, or the timeout is over
+    void wait_for_commands();
+
+    void publish_clock(ros::Time time);
+
+    // Update the car state by dt seconds, all equation of vehicle model is in STKinematics class,
+    // dt is split in sub-steps of at most physics_dt, so the physics doesn't get coarser when the sensors update less often
+    void update_state(Agent & agent, double dt);
+
+    // publish the state of every car, scan from their LiDARs and check collision
+    void update_sensors(ros::Time timestamp);
+
+    // check collisions with the scan of this step and publish it
+    void publish_scan(size_t index, ros::Time timestamp);
+
+    /// ---------------------- GENERAL HELPER FUNCTIONS ----------------------
+    // a scan message of this car that nobody else holds, only the stamp, the ranges and the intensities change
+    // between scans, the rest is set once when the message is created
+    sensor_msgs::LaserScanPtr next_scan_msg(Agent & agent);
+
+    // the parameter key_<name> of a car, or fallback if it is not set
+    std::string agent_param(const std::string & key, const std::string & name, const std::string & fallback);
+
+    static std::string upper_case(std::string text);
+
+    // one file per car, <log_directory>/<name>_<date>.f1log, node/log_to_csv.py turns them into csv files
+    void start_logging();
+
+    void stop_logging();
+
+    // start the recording once there is a map, stop it when the map changed or the file can't be written
+    void update_recording(ros::Time timestamp);
+
+    void start_recording(double time);
+
+    void stop_recording();
+
+    // the dt of a step and the checksums ScenarioReplay compares with, of all cars after the collisions
+    void record_step(double dt, ros::Time timestamp);
+
+    void first_ttc_actions(Agent & agent);
+
+    /// ---------------------- CALLBACK FUNCTIONS ----------------------
+
+    void data_callback(const std_msgs::Bool &msg);
+
+    void pose_callback(size_t index, const geometry_msgs::PoseStamped &msg);
+
+    void drive_callback(size_t index, const ackermann_msgs::AckermannDriveStamped &msg);
+
+    // the new desired speed and steering angle of a car, mutex must be held
+    void set_command(size_t index, double speed, double steer_angle, uint64_t origin_ns);
+
+    // when a command was sent, in Profiler::now_ns(), from the stamp of its header, or now if it has none.
+    // Stamped with ros::Time::now() by the controller, so with use_sim_time the latency is in simulated time
+    uint64_t command_origin(const std_msgs::Header & header);
+
+    /// ---------------------- IN-PROCESS MUX ----------------------
+
+    // subscribe to the drive channels and the mux topic, the callbacks only write into the CommandMux, without the mutex
+    void start_mux();
+
+    // the mux indices from behavior_controller, like Mux::mux_callback() of mux.cpp
+    void mux_callback(const std_msgs::Int32MultiArray & msg);
+
+    // the newest command of the in-process mux for every car, and the latency of the commands this step applies.
+    // mutex must be held
+    void apply_commands(uint64_t tick_ns);
+
+
+    /// ---------------------- OVERTAKING MODEL ----------------------
+
+    // load overtaking_model and find its cars, called once by the constructor after start_mux()
+    void start_overtaking();
+
+#ifdef F1TENTH_WITH_TENSORFLOW
+    // one prediction for every car of overtaking_model with a full history, in the step of their scans.
+    // mutex must be held
+    void run_overtaking();
+#endif
+
+    void map_callback(const nav_msgs::OccupancyGridConstPtr & msg);
+
+    // read map_yaml and its image like map_server does, thresholded row by row into the grid for RViz and the free cells
+    // of the scanner, so the map is never in memory as doubles. The grid is published once, latched
+    bool load_map_file(const std::string & yaml);
+
+    // the map of msg, thresholded into bitmap, to the scanner, only the changed cells if update is set.
+    // map_mutex must be held
+    void send_map_to_scanner(const nav_msgs::OccupancyGridConstPtr & msg, const OccupancyBitmap & bitmap, bool update,
+                             const std::vector<size_t> & changed_cells);
+
+    void report_distance_field();
+
+    /// ---------------------- PUBLISHING HELPER FUNCTIONS ----------------------
+
+    // read the raceline of the map once and build its marker, called when a new map arrives
+    void load_reference_line(const Pose2D & origin);
+
+    void publish_reference_line();
+
+    /**
+     * Called by diagnostics_timer, publishes what the profiler measured since the last report as one
+     * DiagnosticStatus: the achieved rates of the steps, the physics and the scans, the LiDAR beams per second,
+     * the overruns, and the mean, median, 99th percentile and longest duration of every stage in microseconds
+     * (the percentiles are the ends of power of 2 histogram buckets). WARN if a step overran its period.
+     */
+    void report_diagnostics(const ros::WallTimerEvent &);
+
+    void reference_line_timer_callback(const ros::WallTimerEvent &);
+
+    void pub_pose_transform(const Agent & agent, ros::Time timestamp);
+
+    void pub_steer_ang_transform(const Agent & agent, ros::Time timestamp);
+
+    void pub_laser_link_transform(const Agent & agent, ros::Time timestamp);
+
+    void pub_odom(const Agent & agent, ros::Time timestamp);
+
+
+    void pub_carState(Agent & agent, ros::Time timestamp);
+};
+
+}
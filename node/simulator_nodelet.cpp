@@ -0,0 +1,30 @@
+#include <ros/ros.h>
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+
+#include "racecar_simulator.hpp"
+
+namespace racecar_simulator {
+
+/**
+ * The simulator as a nodelet, loaded into the same nodelet manager as the nodes that use the scans,
+ * it publishes exactly the same topics as the simulator node. Publishers and subscribers in one process
+ * pass messages by pointer, so a controller nodelet gets the LaserScan the simulator filled without it being
+ * serialized or copied. Messages received this way are shared and must not be changed.
+ *
+ * Lockstep mode isn't available, run_lockstep() would block the thread of the nodelet manager.
+ */
+class SimulatorNodelet : public nodelet::Nodelet {
+private:
+    std::unique_ptr<RacecarSimulator> simulator;
+
+    void onInit() override {
+        // the multi threaded private node handle, the timer and the callbacks of the commands and the map
+        // can run at the same time on the threads of the nodelet manager, the simulator locks what they share
+        simulator.reset(new RacecarSimulator(getMTPrivateNodeHandle(), false));
+    }
+};
+
+}
+
+PLUGINLIB_EXPORT_CLASS(racecar_simulator::SimulatorNodelet, nodelet::Nodelet)
@@ -0,0 +1,326 @@
+#include <pybind11/pybind11.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+
+#include "f1tenth_simulator/vec_env.hpp"
+#include "f1tenth_simulator/rollout_service.hpp"
+
+#include <vector>
+#include <stdexcept>
+
+namespace py = pybind11;
+using namespace racecar_simulator;
+
+/**
+ * Python module f1tenth_vec_env, the VecEnv without ROS:
+ *
+ *   import numpy as np, f1tenth_vec_env as f1
+ *   config = f1.VecEnvConfig()
+ *   config.num_envs = 256
+ *   env = f1.VecEnv(config)
+ *   env.set_map(occupancy, resolution=0.05, origin=(-51.225, -51.225, 0.0))
+ *   scans, states, rewards, terminated, truncated = env.step(actions)  # actions (num_envs, num_agents, 2)
+ *
+ * The arrays are numpy views of the buffers of the VecEnv, nothing is copied. They keep the VecEnv alive,
+ * are read only, and every step() and reset() changes them in place, copy them to keep an observation.
+ * step() releases the GIL while the envs are stepped.
+ *
+ * RolloutService predicts with the vehicle model of the simulator, e.g. for MPC_red.py:
+ *
+ *   service = f1.RolloutService(f1.CarParams(), dt=0.01)
+ *   trajectories, A, B = service.linearize(states, controls)  # states (batch, 8), controls (batch, horizon, 2)
+ *
+ * trajectories (batch, horizon + 1, 8), A (batch, horizon, 8, 8) and B (batch, horizon, 8, 2) are new arrays.
+ */
+
+namespace {
+
+// a read only view of a buffer of env, the view holds a reference to env
+template <typename T>
+py::array view(py::object env, const T * data, const std::vector<py::ssize_t> & shape) {
+    py::array array(py::dtype::of<T>(), shape, {}, data, env);
+    // not writeable, changing an observation from Python would go unnoticed by the next step
+    py::detail::array_proxy(array.ptr())->flags &= ~py::detail::npy_api::NPY_ARRAY_WRITEABLE_;
+    return array;
+}
+
+py::ssize_t envs(const VecEnv & env) {return (py::ssize_t) env.get_num_envs();}
+py::ssize_t agents(const VecEnv & env) {return (py::ssize_t) env.get_num_agents();}
+
+py::array scans(py::object self) {
+    const VecEnv & env = self.cast<const VecEnv &>();
+    return view(self, env.get_scans(), {envs(env), agents(env), (py::ssize_t) env.get_num_beams()});
+}
+
+py::array states(py::object self) {
+    const VecEnv & env = self.cast<const VecEnv &>();
+    return view(self, env.get_states(), {envs(env), agents(env), (py::ssize_t) VecEnv::state_size});
+}
+
+py::array rewards(py::object self) {
+    const VecEnv & env = self.cast<const VecEnv &>();
+    return view(self, env.get_rewards(), {envs(env), agents(env)});
+}
+
+// the flags are uint8_t 0 or 1, the same bytes as numpy bools
+py::array terminated(py::object self) {
+    const VecEnv & env = self.cast<const VecEnv &>();
+    return view(self, reinterpret_cast<const bool *>(env.get_terminated()), {envs(env)});
+}
+
+py::array truncated(py::object self) {
+    const VecEnv & env = self.cast<const VecEnv &>();
+    return view(self, reinterpret_cast<const bool *>(env.get_truncated()), {envs(env)});
+}
+
+py::array collisions(py::object self) {
+    const VecEnv & env = self.cast<const VecEnv &>();
+    return view(self, reinterpret_cast<const bool *>(env.get_collisions()), {envs(env), agents(env)});
+}
+
+py::array episode_steps(py::object self) {
+    const VecEnv & env = self.cast<const VecEnv &>();
+    return view(self, env.get_episode_steps(), {envs(env)});
+}
+
+// what step() and reset() return, gym style
+py::tuple observations(py::object self) {
+    return py::make_tuple(scans(self), states(self), rewards(self), terminated(self), truncated(self));
+}
+
+// num_agents poses (x, y, theta) from an array of shape (num_agents, 3)
+// the starts of RolloutService from states of shape (batch, state_size), st_dyn of shape (batch,) or None,
+// then a car uses the dynamic model if it is faster than 0.5m/s
+std::vector<CarState> to_car_states(py::array_t<double, py::array::c_style | py::array::forcecast> states,
+                                    py::object st_dyn) {
+    if (states.ndim() != 2 or (size_t) states.shape(1) != RolloutService::state_size) {
+        throw std::invalid_argument("states must have the shape (batch, 8)");
+    }
+    size_t batch = states.shape(0);
+    std::vector<CarState> result(batch);
+    py::array_t<bool, py::array::c_style | py::array::forcecast> flags;
+    if (not st_dyn.is_none()) {
+        flags = st_dyn.cast<py::array_t<bool, py::array::c_style | py::array::forcecast>>();
+        if ((size_t) flags.size() != batch) throw std::invalid_argument("st_dyn must have the shape (batch,)");
+    }
+    for (size_t i = 0; i < batch; i++) {
+        const double * state = states.data() + i * RolloutService::state_size;
+        result[i] = RolloutService::from_vector(state, st_dyn.is_none() ? state[3] >= 0.5 : flags.data()[i]);
+    }
+    return result;
+}
+
+// controls of shape (batch, horizon, control_size) for batch cars, returns horizon
+size_t check_controls(const py::array_t<double, py::array::c_style | py::array::forcecast> & controls, size_t batch) {
+    if (controls.ndim() != 3 or (size_t) controls.shape(0) != batch or
+        (size_t) controls.shape(2) != RolloutService::control_size) {
+        throw std::invalid_argument("controls must have the shape (batch, horizon, 2)");
+    }
+    return controls.shape(1);
+}
+
+py::array_t<double> to_trajectories(const std::vector<CarState> & trajectories, size_t batch, size_t horizon) {
+    py::array_t<double> result({(py::ssize_t) batch, (py::ssize_t) horizon + 1, (py::ssize_t) RolloutService::state_size});
+    double * data = result.mutable_data();
+    for (size_t i = 0; i < trajectories.size(); i++) {
+        RolloutService::to_vector(trajectories[i], data + i * RolloutService::state_size);
+    }
+    return result;
+}
+
+std::vector<Pose2D> to_poses(py::array_t<double, py::array::c_style | py::array::forcecast> poses, size_t num_agents) {
+    if (poses.ndim() != 2 or (size_t) poses.shape(0) != num_agents or poses.shape(1) != 3) {
+        throw std::invalid_argument("poses must have the shape (num_agents, 3)");
+    }
+    std::vector<Pose2D> result(num_agents);
+    for (size_t i = 0; i < num_agents; i++) {
+        result[i] = {poses.at(i, 0), poses.at(i, 1), poses.at(i, 2)};
+    }
+    return result;
+}
+
+}
+
+PYBIND11_MODULE(f1tenth_vec_env, m) {
+    m.doc() = "Headless vectorized F1TENTH simulator, see include/f1tenth_simulator/vec_env.hpp";
+
+    py::enum_<STKinematics::Integrator>(m, "Integrator")
+        .value("EULER", STKinematics::EULER)
+        .value("RK4", STKinematics::RK4);
+
+    py::class_<CarParams>(m, "CarParams")
+        .def(py::init(&VecEnv::default_car_params))
+        .def_readwrite("wheelbase", &CarParams::wheelbase)
+        .def_readwrite("friction_coeff", &CarParams::friction_coeff)
+        .def_readwrite("h_cg", &CarParams::h_cg)
+        .def_readwrite("l_f", &CarParams::l_f)
+        .def_readwrite("l_r", &CarParams::l_r)
+        .def_readwrite("cs_f", &CarParams::cs_f)
+        .def_readwrite("cs_r", &CarParams::cs_r)
+        .def_readwrite("mass", &CarParams::mass)
+        .def_readwrite("Iz", &CarParams::Iz)
+        .def_readwrite("Cm1", &CarParams::Cm1)
+        .def_readwrite("Cm2", &CarParams::Cm2)
+        .def_readwrite("Cm3", &CarParams::Cm3)
+        .def_readwrite("B_f", &CarParams::B_f)
+        .def_readwrite("C_f", &CarParams::C_f)
+        .def_readwrite("D_f", &CarParams::D_f)
+        .def_readwrite("B_r", &CarParams::B_r)
+        .def_readwrite("C_r", &CarParams::C_r)
+        .def_readwrite("D_r", &CarParams::D_r)
+        .def_readwrite("max_speed", &CarParams::max_speed)
+        .def_readwrite("max_steering_angle", &CarParams::max_steering_angle)
+        .def_readwrite("max_steering_vel", &CarParams::max_steering_vel)
+        .def_readwrite("max_accel", &CarParams::max_accel)
+        .def_readwrite("max_decel", &CarParams::max_decel);
+
+    py::class_<MarchSettings>(m, "MarchSettings")
+        .def(py::init<>())
+        .def_readwrite("stop_at_max_range", &MarchSettings::stop_at_max_range)
+        .def_readwrite("min_step", &MarchSettings::min_step)
+        .def_readwrite("bisect", &MarchSettings::bisect)
+        .def_readwrite("refine_epsilon", &MarchSettings::refine_epsilon);
+
+    py::class_<VecEnvConfig>(m, "VecEnvConfig")
+        .def(py::init<>())
+        .def_readwrite("num_envs", &VecEnvConfig::num_envs)
+        .def_readwrite("num_agents", &VecEnvConfig::num_agents)
+        .def_readwrite("params", &VecEnvConfig::params)
+        .def_readwrite("width", &VecEnvConfig::width)
+        .def_readwrite("dt", &VecEnvConfig::dt)
+        .def_readwrite("physics_dt", &VecEnvConfig::physics_dt)
+        .def_readwrite("integrator", &VecEnvConfig::integrator)
+        .def_readwrite("scan_beams", &VecEnvConfig::scan_beams)
+        .def_readwrite("scan_field_of_view", &VecEnvConfig::scan_field_of_view)
+        .def_readwrite("scan_std_dev", &VecEnvConfig::scan_std_dev)
+        .def_readwrite("scan_max_range", &VecEnvConfig::scan_max_range)
+        .def_readwrite("scan_distance_to_base_link", &VecEnvConfig::scan_distance_to_base_link)
+        .def_readwrite("cube_width", &VecEnvConfig::cube_width)
+        .def_readwrite("scan_beams_per_chunk", &VecEnvConfig::scan_beams_per_chunk)
+        .def_readwrite("scan_march", &VecEnvConfig::scan_march)
+        .def_readwrite("distance_pyramid_levels", &VecEnvConfig::distance_pyramid_levels)
+        .def_readwrite("scan_noise_seed", &VecEnvConfig::scan_noise_seed)
+        .def_readwrite("ttc_threshold", &VecEnvConfig::ttc_threshold)
+        .def_readwrite("max_episode_steps", &VecEnvConfig::max_episode_steps)
+        .def_readwrite("auto_reset", &VecEnvConfig::auto_reset)
+        .def_readwrite("collision_penalty", &VecEnvConfig::collision_penalty)
+        .def_readwrite("num_threads", &VecEnvConfig::num_threads)
+        // a list of (x, y, theta), one per car
+        .def_property("start_poses",
+            [](const VecEnvConfig & c) {
+                py::list poses;
+                for (const Pose2D & pose : c.start_poses) poses.append(py::make_tuple(pose.x, pose.y, pose.theta));
+                return poses;
+            },
+            [](VecEnvConfig & c, const std::vector<std::vector<double>> & poses) {
+                c.start_poses.clear();
+                for (const std::vector<double> & pose : poses) {
+                    if (pose.size() != 3) throw std::invalid_argument("a start pose is (x, y, theta)");
+                    c.start_poses.push_back({pose[0], pose[1], pose[2]});
+                }
+            });
+
+    py::class_<RolloutService>(m, "RolloutService")
+        .def(py::init<const CarParams &, double, double, STKinematics::Integrator, size_t>(),
+             py::arg("params"), py::arg("dt"), py::arg("physics_dt") = 0.0,
+             py::arg("integrator") = STKinematics::EULER, py::arg("num_threads") = 0)
+        .def("set_perturbation", &RolloutService::set_perturbation, py::arg("perturbation"))
+        // trajectories of shape (batch, horizon + 1, 8)
+        .def("rollout",
+            [](RolloutService & service, py::array_t<double, py::array::c_style | py::array::forcecast> states,
+               py::array_t<double, py::array::c_style | py::array::forcecast> controls, py::object st_dyn) {
+                std::vector<CarState> starts = to_car_states(states, st_dyn);
+                size_t batch = starts.size();
+                size_t horizon = check_controls(controls, batch);
+                std::vector<CarState> trajectories(batch * (horizon + 1));
+                {
+                    py::gil_scoped_release release;
+                    service.rollout(starts.data(), batch, controls.data(), horizon, trajectories.data());
+                }
+                return to_trajectories(trajectories, batch, horizon);
+            },
+            py::arg("states"), py::arg("controls"), py::arg("st_dyn") = py::none())
+        // (trajectories, A, B), A = d state k+1 / d state k of shape (batch, horizon, 8, 8),
+        // B = d state k+1 / d control k of shape (batch, horizon, 8, 2)
+        .def("linearize",
+            [](RolloutService & service, py::array_t<double, py::array::c_style | py::array::forcecast> states,
+               py::array_t<double, py::array::c_style | py::array::forcecast> controls, py::object st_dyn) {
+                std::vector<CarState> starts = to_car_states(states, st_dyn);
+                size_t batch = starts.size();
+                size_t horizon = check_controls(controls, batch);
+                std::vector<CarState> trajectories(batch * (horizon + 1));
+                py::ssize_t n = RolloutService::state_size;
+                py::ssize_t d = RolloutService::control_size;
+                py::array_t<double> state_jacobians({(py::ssize_t) batch, (py::ssize_t) horizon, n, n});
+                py::array_t<double> control_jacobians({(py::ssize_t) batch, (py::ssize_t) horizon, n, d});
+                double * A = state_jacobians.mutable_data();
+                double * B = control_jacobians.mutable_data();
+                {
+                    py::gil_scoped_release release;
+                    service.linearize(starts.data(), batch, controls.data(), horizon, trajectories.data(), A, B);
+                }
+                return py::make_tuple(to_trajectories(trajectories, batch, horizon), state_jacobians, control_jacobians);
+            },
+            py::arg("states"), py::arg("controls"), py::arg("st_dyn") = py::none())
+        .def_property_readonly("num_threads", &RolloutService::get_num_threads);
+
+    py::class_<VecEnv>(m, "VecEnv")
+        .def(py::init<const VecEnvConfig &>(), py::arg("config"))
+        // occupancy of shape (height, width), row 0 at origin, values in [0, 1] as in ScanSimulator2D::set_map()
+        .def("set_map",
+            [](VecEnv & env, py::array_t<double, py::array::c_style | py::array::forcecast> occupancy,
+               double resolution, std::vector<double> origin, double free_threshold) {
+                if (occupancy.ndim() != 2) throw std::invalid_argument("occupancy must have the shape (height, width)");
+                if (origin.size() != 3) throw std::invalid_argument("origin is (x, y, theta)");
+                std::vector<double> map(occupancy.data(), occupancy.data() + occupancy.size());
+                size_t height = occupancy.shape(0);
+                size_t width = occupancy.shape(1);
+                py::gil_scoped_release release;
+                env.set_map(map, height, width, resolution,
+                            {origin[0], origin[1], origin[2]}, free_threshold);
+            },
+            py::arg("occupancy"), py::arg("resolution"), py::arg("origin"), py::arg("free_threshold") = 0.5)
+        .def("reset",
+            [](py::object self) {
+                {
+                    py::gil_scoped_release release;
+                    self.cast<VecEnv &>().reset();
+                }
+                return observations(self);
+            })
+        // one env, poses of shape (num_agents, 3) or None for the start poses
+        .def("reset_env",
+            [](py::object self, size_t env_index, py::object poses) {
+                VecEnv & env = self.cast<VecEnv &>();
+                if (env_index >= env.get_num_envs()) throw py::index_error("env out of range");
+                std::vector<Pose2D> start;
+                if (not poses.is_none()) start = to_poses(poses, env.get_num_agents());
+                py::gil_scoped_release release;
+                env.reset(env_index, start.empty() ? nullptr : start.data());
+            },
+            py::arg("env"), py::arg("poses") = py::none())
+        // actions of shape (num_envs, num_agents, 2): desired speed, desired steering angle
+        .def("step",
+            [](py::object self, py::array_t<double, py::array::c_style | py::array::forcecast> actions) {
+                VecEnv & env = self.cast<VecEnv &>();
+                if ((size_t) actions.size() != env.get_num_envs() * env.get_num_agents() * VecEnv::action_size) {
+                    throw std::invalid_argument("actions must have the shape (num_envs, num_agents, 2)");
+                }
+                {
+                    py::gil_scoped_release release;
+                    env.step(actions.data());
+                }
+                return observations(self);
+            },
+            py::arg("actions"))
+        .def_property_readonly("num_envs", &VecEnv::get_num_envs)
+        .def_property_readonly("num_agents", &VecEnv::get_num_agents)
+        .def_property_readonly("num_beams", &VecEnv::get_num_beams)
+        .def_property_readonly("scans", &scans)
+        .def_property_readonly("states", &states)
+        .def_property_readonly("rewards", &rewards)
+        .def_property_readonly("terminated", &terminated)
+        .def_property_readonly("truncated", &truncated)
+        .def_property_readonly("collisions", &collisions)
+        .def_property_readonly("episode_steps", &episode_steps);
+}
@@ -0,0 +1,340 @@
+#include "f1tenth_simulator/batch_vehicle_model.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace racecar_simulator;
+
+namespace {
+
+// <cmath>, the same functions STKinematics uses
+struct ExactMath {
+    static double atan(double x) {return std::atan(x);}
+    static void sincos(double x, double & s, double & c) {
+        s = std::sin(x);
+        c = std::cos(x);
+    }
+    static double sin(double x) {return std::sin(x);}
+    static double tan(double x) {return std::tan(x);}
+};
+
+// Polynomials without branches or calls, so the compiler can vectorize the loop over the cars.
+// atan is the rational approximation of Cephes, sin and cos are reduced to [-pi/4, pi/4] and use their Taylor series.
+// Both sides of every selection are computed before it, arithmetic in only one side could raise a floating point
+// exception the other side doesn't, so without -fno-trapping-math GCC keeps the branch and doesn't vectorize.
+struct FastMath {
+    // round to the nearest integer for |x| < 2^51 with plain additions, nearbyint is only vectorized with SSE4.1
+    static double round(double x) {
+        const double magic = 6755399441055744.0; // 1.5 * 2^52
+        return (x + magic) - magic;
+    }
+
+    static double atan(double x) {
+        double a = std::abs(x);
+        // atan(a) = pi/2 + atan(-1/a) above tan(3pi/8), pi/4 + atan((a-1)/(a+1)) above 0.66
+        bool big = a > 2.41421356237309504880;
+        bool mid = a > 0.66;
+        double offset = big ? M_PI_2 : (mid ? M_PI_4 : 0.);
+        double more_bits = big ? 6.123233995736765886130e-17 : (mid ? 3.061616997868382943065e-17 : 0.);
+        double a_minus_1 = a - 1.;
+        double a_plus_1 = a + 1.;
+        double r = (big ? -1. : (mid ? a_minus_1 : a)) / (big ? a : (mid ? a_plus_1 : 1.));
+
+        double z = r * r;
+        double p = (((-8.750608600031904122785e-1 * z - 1.615753718733365076637e1) * z
+                     - 7.500855792314704667340e1) * z - 1.228866684490136173410e2) * z - 6.485021904942025371773e1;
+        double q = ((((z + 2.485846490142306297962e1) * z + 1.650270098316988542046e2) * z
+                     + 4.328810604912902668951e2) * z + 4.853903996359136964868e2) * z + 1.945506571482613964425e2;
+        double result = offset + (r * z * p / q + r + more_bits);
+        return std::copysign(result, x);
+    }
+
+    static void sincos(double x, double & s, double & c) {
+        // x = n * pi/2 + r, pi/2 is split in two parts so r stays accurate
+        double n = round(x * 0.63661977236758134308);
+        double r = (x - n * 1.57079632673412561417e+00) - n * 6.07710050650619224932e-11;
+        // quadrant 0..3
+        double quadrant = n - 4 * round(n * 0.25);
+        double wrapped = quadrant + 4;
+        quadrant = quadrant < 0 ? wrapped : quadrant;
+
+        double z = r * r;
+        double sin_r = r + r * z * (-1. / 6 + z * (1. / 120 + z * (-1. / 5040 + z * (1. / 362880
+                       + z * (-1. / 39916800 + z * (1. / 6227020800 + z * (-1. / 1307674368000)))))));
+        double cos_r = 1. + z * (-1. / 2 + z * (1. / 24 + z * (-1. / 720 + z * (1. / 40320 + z * (-1. / 3628800
+                       + z * (1. / 479001600 + z * (-1. / 87178291200 + z * (1. / 20922789888000))))))));
+
+        // & and | instead of and, or, they don't branch
+        bool odd = (quadrant == 1) | (quadrant == 3);
+        s = odd ? cos_r : sin_r;
+        c = odd ? sin_r : cos_r;
+        s = quadrant >= 2 ? -s : s;
+        c = ((quadrant == 1) | (quadrant == 2)) ? -c : c;
+    }
+
+    static double sin(double x) {
+        double s, c;
+        sincos(x, s, c);
+        return s;
+    }
+
+    static double tan(double x) {
+        double s, c;
+        sincos(x, s, c);
+        return s / c;
+    }
+};
+
+// cars handled together by the two loops of step_block()
+const size_t block_size = 64;
+
+// one step of count cars, see STKinematics::update() and update_k() for the equations,
+// they are written out in the same order so that ExactMath gives the same results.
+// The first loop computes the sines, cosines and tire forces and the second one the rest,
+// as one loop the body is too large for the vectorizer of GCC. GCC only trusts __restrict__ on parameters,
+// without it the loops would need too many checks whether the fields overlap.
+template <class Math>
+void step_block(
+        double * __restrict__ xs,
+        double * __restrict__ ys,
+        double * __restrict__ thetas,
+        double * __restrict__ velocities_x,
+        double * __restrict__ velocities_y,
+        double * __restrict__ steer_angles,
+        double * __restrict__ angular_velocities,
+        double * __restrict__ slip_angles,
+        uint8_t * __restrict__ st_dyns,
+        const double * __restrict__ desired_speeds,
+        const double * __restrict__ desired_steer_angs,
+        size_t count,
+        const CarParams & p,
+        double dt) {
+    // the parameters as local constants, loads from p in only one branch of a selection can't be vectorized
+    const double wheelbase = p.wheelbase;
+    const double l_f = p.l_f;
+    const double l_r = p.l_r;
+    const double mass = p.mass;
+    const double Iz = p.Iz;
+    const double Cm1 = p.Cm1;
+    const double Cm2 = p.Cm2;
+    const double Cm3 = p.Cm3;
+    const double B_f = p.B_f;
+    const double C_f = p.C_f;
+    const double D_f = p.D_f;
+    const double B_r = p.B_r;
+    const double C_r = p.C_r;
+    const double D_r = p.D_r;
+    const double max_speed = p.max_speed;
+    const double max_steering_angle = p.max_steering_angle;
+    const double max_steering_vel = p.max_steering_vel;
+    const double max_accel = p.max_accel;
+    const double max_decel = p.max_decel;
+    const double kp_accel = 2.0 * max_accel / max_speed;
+    const double kp_decel = 2.0 * max_decel / max_speed;
+
+    double sines_theta[block_size];
+    double cosines_theta[block_size];
+    double sines_steer[block_size];
+    double cosines_steer[block_size];
+    double tangents_steer[block_size];
+    double alphas_f[block_size];
+    double forces_f[block_size];
+    double forces_r[block_size];
+
+    for (size_t j = 0; j < count; j++) {
+        double velocity_x = velocities_x[j];
+        double velocity_y = velocities_y[j];
+        double steer_angle = steer_angles[j];
+        double angular_velocity = angular_velocities[j];
+
+        Math::sincos(thetas[j], sines_theta[j], cosines_theta[j]);
+        Math::sincos(steer_angle, sines_steer[j], cosines_steer[j]);
+        tangents_steer[j] = Math::tan(steer_angle);
+
+        // slip angle
+        double alpha_f = -Math::atan((angular_velocity * l_f + velocity_y) / velocity_x) + steer_angle;
+        double alpha_r =  Math::atan((angular_velocity * l_r - velocity_y) / velocity_x);
+        alphas_f[j] = alpha_f;
+
+        // lateral force
+        forces_f[j] = D_f * Math::sin(C_f * Math::atan(B_f * alpha_f)) * 25;
+        forces_r[j] = D_r * Math::sin(C_r * Math::atan(B_r * alpha_r)) * 25;
+    }
+
+    for (size_t j = 0; j < count; j++) {
+        double x = xs[j];
+        double y = ys[j];
+        double theta = thetas[j];
+        double velocity_x = velocities_x[j];
+        double velocity_y = velocities_y[j];
+        double steer_angle = steer_angles[j];
+        double angular_velocity = angular_velocities[j];
+        double sin_theta = sines_theta[j];
+        double cos_theta = cosines_theta[j];
+        double sin_steer = sines_steer[j];
+        double cos_steer = cosines_steer[j];
+        double Fy_f = forces_f[j];
+        double Fy_r = forces_r[j];
+
+        // compute_accel()
+        double dif = desired_speeds[j] - velocity_x;
+        double accel_forward = std::min(std::max(kp_accel * dif, -max_accel), max_accel);
+        double accel_backward = std::min(std::max(kp_decel * dif, -max_accel), max_accel);
+        // driving forward: accelerate or brake, backward: brake or accelerate, standing: accelerate either way,
+        // one selection after the other, GCC doesn't vectorize a three way merge
+        double accel_when_forward = dif > 0 ? accel_forward : -max_decel;
+        double accel_when_backward = dif > 0 ? max_accel : accel_backward;
+        double accel = velocity_x > 0 ? accel_when_forward : accel_forward;
+        accel = velocity_x < 0 ? accel_when_backward : accel;
+
+        // compute_steer_vel()
+        double steer_dif = desired_steer_angs[j] - steer_angle;
+        // dif / |dif| is the sign, the selections below only pick values that were computed before, see FastMath
+        double full_steer_vel = std::copysign(1., steer_dif) * max_steering_vel;
+        double steer_vel = std::abs(steer_dif) > .0001 ? full_steer_vel : 0.;
+        steer_vel = std::min(std::max(steer_vel, -max_steering_vel), max_steering_vel);
+
+        // cut off to avoid singular behavior, with a deadband to avoid flip flop
+        double thresh = st_dyns[j] ? .5 : .5 + .03;
+        bool dynamic = not (velocity_x < thresh);
+
+        // update_k(), normal kinematic equations
+        double k_x = x + velocity_x * cos_theta * dt;
+        double k_y = y + velocity_x * sin_theta * dt;
+        double k_theta = theta + velocity_x / wheelbase * tangents_steer[j] * dt;
+        double k_velocity_x = std::min(std::max(velocity_x + accel * dt, -2.0), 2.0);
+
+        // update(), standard dynamic bicycle model, force from engine
+        double d = accel / 7.51;
+        double Fx_fr = Cm1 * d / Cm2 - velocity_x / Cm3;
+
+        double x_dot = velocity_x * cos_theta - velocity_y * sin_theta;
+        // the same as STKinematics::update(), which uses sin for both terms
+        double y_dot = velocity_x * sin_theta + velocity_y * sin_theta;
+        double velocity_x_dot = (Fx_fr * cos_steer - Fy_f * sin_steer + mass * velocity_y * angular_velocity) / mass;
+        double velocity_y_dot = (Fy_r + Fy_f * sin_steer + Fx_fr * sin_steer - mass * velocity_x * angular_velocity) / mass;
+        double angular_velocity_dot = (Fy_f * l_f * cos_steer - Fy_r * l_r) / Iz;
+
+        double next_angular_velocity = angular_velocity + dt * angular_velocity_dot;
+        // we don't want the car turning very fast
+        double d_angular_velocity = ((std::abs(steer_angle) < 0.005) & (std::abs(next_angular_velocity) < 1)) ? 0.
+                                  : std::min(std::max(-2.0, next_angular_velocity), 2.0);
+
+        double d_x = x + dt * x_dot;
+        double d_y = y + dt * y_dot;
+        double d_theta = theta + dt * angular_velocity;
+        double d_velocity_x = velocity_x + dt * velocity_x_dot;
+        double d_velocity_y = velocity_y + dt * velocity_y_dot;
+        double next_velocity_x = dynamic ? d_velocity_x : k_velocity_x;
+        double next_steer_angle = steer_angle + steer_vel * dt;
+
+        xs[j] = dynamic ? d_x : k_x;
+        ys[j] = dynamic ? d_y : k_y;
+        thetas[j] = dynamic ? d_theta : k_theta;
+        velocities_y[j] = dynamic ? d_velocity_y : 0.;
+        angular_velocities[j] = dynamic ? d_angular_velocity : 0.;
+        slip_angles[j] = dynamic ? alphas_f[j] : 0.;
+        st_dyns[j] = dynamic;
+
+        // the limits of STKinematics::limit_state()
+        velocities_x[j] = std::min(std::max(next_velocity_x, -max_speed), max_speed);
+        steer_angles[j] = std::min(std::max(next_steer_angle, -max_steering_angle), max_steering_angle);
+    }
+}
+
+template <class Math>
+void step_range(CarStateBatch & states, size_t begin, size_t end, const double * desired_speeds,
+                const double * desired_steer_angs, const CarParams & p, double dt) {
+    for (size_t block = begin; block < end; block += block_size) {
+        step_block<Math>(states.x.data() + block, states.y.data() + block, states.theta.data() + block,
+                         states.velocity_x.data() + block, states.velocity_y.data() + block,
+                         states.steer_angle.data() + block, states.angular_velocity.data() + block,
+                         states.slip_angle.data() + block, states.st_dyn.data() + block,
+                         desired_speeds + block, desired_steer_angs + block, std::min(block_size, end - block), p, dt);
+    }
+}
+
+void step_range(CarStateBatch & states, size_t begin, size_t end, const double * desired_speeds,
+                const double * desired_steer_angs, const CarParams & p, double dt, BatchVehicleModel::Math math) {
+    if (math == BatchVehicleModel::EXACT) {
+        step_range<ExactMath>(states, begin, end, desired_speeds, desired_steer_angs, p, dt);
+    } else {
+        step_range<FastMath>(states, begin, end, desired_speeds, desired_steer_angs, p, dt);
+    }
+}
+
+// the cars [begin, end) of from into the cars starting at offset of to
+void copy_range(const CarStateBatch & from, size_t begin, size_t end, CarStateBatch & to, size_t offset) {
+    std::copy(from.x.begin() + begin, from.x.begin() + end, to.x.begin() + offset);
+    std::copy(from.y.begin() + begin, from.y.begin() + end, to.y.begin() + offset);
+    std::copy(from.theta.begin() + begin, from.theta.begin() + end, to.theta.begin() + offset);
+    std::copy(from.velocity_x.begin() + begin, from.velocity_x.begin() + end, to.velocity_x.begin() + offset);
+    std::copy(from.velocity_y.begin() + begin, from.velocity_y.begin() + end, to.velocity_y.begin() + offset);
+    std::copy(from.steer_angle.begin() + begin, from.steer_angle.begin() + end, to.steer_angle.begin() + offset);
+    std::copy(from.angular_velocity.begin() + begin, from.angular_velocity.begin() + end, to.angular_velocity.begin() + offset);
+    std::copy(from.slip_angle.begin() + begin, from.slip_angle.begin() + end, to.slip_angle.begin() + offset);
+    std::copy(from.st_dyn.begin() + begin, from.st_dyn.begin() + end, to.st_dyn.begin() + offset);
+}
+
+// cars per chunk of rollout(), small enough that the states of a chunk stay in the L1 cache
+const size_t rollout_grain = 256;
+
+}
+
+void CarStateBatch::resize(size_t size) {
+    x.resize(size);
+    y.resize(size);
+    theta.resize(size);
+    velocity_x.resize(size);
+    velocity_y.resize(size);
+    steer_angle.resize(size);
+    angular_velocity.resize(size);
+    slip_angle.resize(size);
+    st_dyn.resize(size);
+}
+
+void CarStateBatch::set(size_t i, const CarState & state) {
+    x[i] = state.x;
+    y[i] = state.y;
+    theta[i] = state.theta;
+    velocity_x[i] = state.velocity_x;
+    velocity_y[i] = state.velocity_y;
+    steer_angle[i] = state.steer_angle;
+    angular_velocity[i] = state.angular_velocity;
+    slip_angle[i] = state.slip_angle;
+    st_dyn[i] = state.st_dyn;
+}
+
+CarState CarStateBatch::get(size_t i) const {
+    CarState state;
+    state.x = x[i];
+    state.y = y[i];
+    state.theta = theta[i];
+    state.velocity_x = velocity_x[i];
+    state.velocity_y = velocity_y[i];
+    state.steer_angle = steer_angle[i];
+    state.angular_velocity = angular_velocity[i];
+    state.slip_angle = slip_angle[i];
+    state.st_dyn = st_dyn[i];
+    return state;
+}
+
+void BatchVehicleModel::step(CarStateBatch & states, const double * desired_speeds, const double * desired_steer_angs,
+                             const CarParams & p, double dt, Math math) {
+    step_range(states, 0, states.size(), desired_speeds, desired_steer_angs, p, dt, math);
+}
+
+void BatchVehicleModel::rollout(CarStateBatch & states, const double * desired_speeds, const double * desired_steer_angs,
+                                size_t num_steps, const CarParams & p, double dt, Math math,
+                                CarStateBatch * trajectory, ThreadPool * pool) {
+    size_t num_cars = states.size();
+    if (trajectory != nullptr) trajectory->resize(num_steps * num_cars);
+    if (pool == nullptr) pool = &ThreadPool::shared();
+
+    pool->parallel_for(num_cars, rollout_grain, [&](size_t begin, size_t end, size_t) {
+        for (size_t step = 0; step < num_steps; step++) {
+            step_range(states, begin, end, desired_speeds + step * num_cars, desired_steer_angs + step * num_cars, p, dt, math);
+            if (trajectory != nullptr) copy_range(states, begin, end, *trajectory, step * num_cars + begin);
+        }
+    });
+}
@@ -0,0 +1,93 @@
+#include "f1tenth_simulator/collision_checker.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+using namespace racecar_simulator;
+
+namespace {
+
+// half of the box projected onto the unit vector (ux, uy)
+inline double projected_radius(const OrientedBox & box, double ux, double uy) {
+    double along = box.axis_x * ux + box.axis_y * uy;
+    double sideways = -box.axis_y * ux + box.axis_x * uy;
+    return box.half_length * std::abs(along) + box.half_width * std::abs(sideways);
+}
+
+// true if the boxes are apart along the unit vector (ux, uy)
+inline bool separated(const OrientedBox & a, const OrientedBox & b, double ux, double uy) {
+    double distance = (b.center_x - a.center_x) * ux + (b.center_y - a.center_y) * uy;
+    return std::abs(distance) > projected_radius(a, ux, uy) + projected_radius(b, ux, uy);
+}
+
+}
+
+CollisionChecker::CollisionChecker(
+    int scan_beams,
+    double wheelbase,
+    double width,
+    double scan_distance_to_base_link,
+    double angle_min,
+    double scan_ang_incr)
+  : beams(SensorGeometry::beam_tables(scan_beams, wheelbase, width, scan_distance_to_base_link,
+                                      angle_min, scan_ang_incr)) {
+}
+
+double CollisionChecker::min_ttc(const float * ranges, double velocity_x) const {
+    double best = INFINITY;
+    if (velocity_x == 0 or not beams) return best;
+    const double * car_distances = beams->car_distances.data();
+    const double * cosines = beams->cosines.data();
+
+    // the vector of velocity can be seen as always point to the middle beam, and cosines here is the cos of beams not cos of map frame,
+    // hence, the middle beam direction has cos0 = 1, and so on.
+    // A negative time (driving away) or NaN (0 / 0 for a sideways beam touching the car) is not counted
+    size_t num_beams = beams->cosines.size();
+    size_t i = 0;
+#if defined(__AVX2__)
+    __m256d velocity = _mm256_set1_pd(velocity_x);
+    __m256d infinity = _mm256_set1_pd(INFINITY);
+    __m256d zero = _mm256_setzero_pd();
+    __m256d best_packet = infinity;
+    for (; i + 4 <= num_beams; i += 4) {
+        __m256d range = _mm256_cvtps_pd(_mm_loadu_ps(ranges + i));
+        __m256d distance = _mm256_sub_pd(range, _mm256_loadu_pd(car_distances + i));
+        __m256d proj_velocity = _mm256_mul_pd(velocity, _mm256_loadu_pd(cosines + i));
+        __m256d ttc = _mm256_div_pd(distance, proj_velocity);
+        // ordered comparison, NaN lanes become infinity as well
+        ttc = _mm256_blendv_pd(infinity, ttc, _mm256_cmp_pd(ttc, zero, _CMP_GE_OQ));
+        best_packet = _mm256_min_pd(best_packet, ttc);
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, best_packet);
+    best = std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3]));
+#endif
+    for (; i < num_beams; i++) {
+        double ttc = (ranges[i] - car_distances[i]) / (velocity_x * cosines[i]);
+        if (ttc >= 0 and ttc < best) best = ttc;
+    }
+    return best;
+}
+
+OrientedBox CollisionChecker::car_box(const CarState & state, double length, double width) {
+    OrientedBox box;
+    box.axis_x = std::cos(state.theta);
+    box.axis_y = std::sin(state.theta);
+    box.half_length = length / 2;
+    box.half_width = width / 2;
+    box.center_x = state.x + box.half_length * box.axis_x;
+    box.center_y = state.y + box.half_length * box.axis_y;
+    return box;
+}
+
+bool CollisionChecker::overlap(const OrientedBox & a, const OrientedBox & b) {
+    // two rectangles are apart if and only if they are apart along one of their four edge directions
+    return not (separated(a, b, a.axis_x, a.axis_y) or
+                separated(a, b, -a.axis_y, a.axis_x) or
+                separated(a, b, b.axis_x, b.axis_y) or
+                separated(a, b, -b.axis_y, b.axis_x));
+}
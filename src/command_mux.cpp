@@ -0,0 +1,117 @@
+#include "f1tenth_simulator/command_mux.hpp"
+
+#include <cstring>
+
+using namespace racecar_simulator;
+
+namespace {
+
+uint64_t to_bits(double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+double from_bits(uint64_t bits) {
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+}
+
+CommandMux::CommandMux(size_t num_cars_, size_t mux_size_, const std::vector<CommandChannel> & channels_)
+  : num_cars(num_cars_),
+    mux_size(mux_size_),
+    channels(channels_),
+    slots(new Slot[channels_.size() + num_cars_]),
+    enabled(new std::atomic<uint8_t>[mux_size_]),
+    car_slots(num_cars_),
+    last_read(num_cars_, 0) {
+    for (size_t i = 0; i < mux_size; i++) enabled[i].store(0, std::memory_order_relaxed);
+    for (size_t channel = 0; channel < channels.size(); channel++) {
+        if (channels[channel].car < num_cars) car_slots[channels[channel].car].push_back(channel);
+    }
+    for (size_t car = 0; car < num_cars; car++) car_slots[car].push_back(channels.size() + car);
+}
+
+bool CommandMux::write(size_t channel, double speed, double steer_angle, uint64_t origin_ns) {
+    if (channel >= channels.size() or channels[channel].car >= num_cars) return false;
+    if (not is_enabled(channels[channel].mux_index)) return false;
+    store(slots[channel], speed, steer_angle, origin_ns);
+    return true;
+}
+
+void CommandMux::set_enabled(int mux_index, bool enabled_) {
+    if (mux_index < 0 or size_t(mux_index) >= mux_size) return;
+    enabled[mux_index].store(enabled_, std::memory_order_relaxed);
+}
+
+bool CommandMux::is_enabled(int mux_index) const {
+    if (mux_index < 0 or size_t(mux_index) >= mux_size) return false;
+    return enabled[mux_index].load(std::memory_order_relaxed) != 0;
+}
+
+void CommandMux::halt(uint64_t origin_ns) {
+    for (size_t car = 0; car < num_cars; car++) store(slots[channels.size() + car], 0.0, 0.0, origin_ns);
+}
+
+bool CommandMux::read(size_t car, Command & command) {
+    if (car >= num_cars) return false;
+    uint64_t newest = last_read[car];
+    for (size_t slot : car_slots[car]) {
+        Command candidate;
+        uint64_t sequence = load(slots[slot], candidate);
+        if (sequence > newest) {
+            newest = sequence;
+            command = candidate;
+        }
+    }
+    if (newest == last_read[car]) return false;
+    last_read[car] = newest;
+    return true;
+}
+
+bool CommandMux::pending(size_t car) const {
+    if (car >= num_cars) return false;
+    for (size_t slot : car_slots[car]) {
+        if (slots[slot].sequence.load(std::memory_order_acquire) > last_read[car]) return true;
+    }
+    return false;
+}
+
+void CommandMux::store(Slot & slot, double speed, double steer_angle, uint64_t origin_ns) {
+    // two controllers may publish on the same topic, the second writer waits until the first left the slot
+    uint64_t version = slot.version.load(std::memory_order_relaxed);
+    do {
+        while (version & 1) version = slot.version.load(std::memory_order_relaxed);
+    } while (not slot.version.compare_exchange_weak(version, version + 1, std::memory_order_acquire,
+                                                    std::memory_order_relaxed));
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.speed.store(to_bits(speed), std::memory_order_relaxed);
+    slot.steer_angle.store(to_bits(steer_angle), std::memory_order_relaxed);
+    slot.origin_ns.store(origin_ns, std::memory_order_relaxed);
+    // taken inside the slot, so a newer command of the slot always has a larger sequence
+    slot.sequence.store(next_sequence.fetch_add(1, std::memory_order_relaxed), std::memory_order_relaxed);
+
+    slot.version.store(version + 2, std::memory_order_release);
+}
+
+uint64_t CommandMux::load(const Slot & slot, Command & command) const {
+    while (true) {
+        uint64_t before = slot.version.load(std::memory_order_acquire);
+        if (before & 1) continue;
+        uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+        uint64_t speed = slot.speed.load(std::memory_order_relaxed);
+        uint64_t steer_angle = slot.steer_angle.load(std::memory_order_relaxed);
+        uint64_t origin_ns = slot.origin_ns.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.version.load(std::memory_order_relaxed) != before) continue;
+
+        command.speed = from_bits(speed);
+        command.steer_angle = from_bits(steer_angle);
+        command.origin_ns = origin_ns;
+        return sequence;
+    }
+}
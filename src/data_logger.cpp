@@ -0,0 +1,136 @@
+#include "f1tenth_simulator/data_logger.hpp"
+
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+
+using namespace racecar_simulator;
+
+namespace {
+
+const char magic[8] = {'F', '1', 'T', 'H', 'L', 'O', 'G', '1'};
+
+// how long the writer sleeps when there is nothing to write
+const std::chrono::milliseconds idle_time(5);
+
+}
+
+DataLogger::DataLogger(size_t capacity_)
+  : capacity(std::max(capacity_, (size_t) 1)),
+    record_size(sizeof(LogRecord)),
+    num_beams(0),
+    head(0),
+    tail(0),
+    file(nullptr),
+    stopping(false),
+    write_failed(false),
+    written(0),
+    dropped(0) {
+}
+
+DataLogger::~DataLogger() {
+    close();
+}
+
+bool DataLogger::open(const std::string & path, const std::string & name, int num_beams_) {
+    close();
+
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) return false;
+    // the writer writes whole chunks of records, a large stdio buffer saves most of the system calls
+    std::setvbuf(file, nullptr, _IOFBF, 1 << 20);
+
+    num_beams = std::max(num_beams_, 0);
+    record_size = sizeof(LogRecord) + num_beams * sizeof(float);
+    // allocated here once, log() never allocates
+    buffer.assign(capacity * record_size, 0);
+    head.store(0);
+    tail.store(0);
+    written.store(0);
+    dropped = 0;
+    write_failed.store(false);
+    stopping.store(false);
+
+    LogHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.num_beams = num_beams;
+    header.record_size = record_size;
+    std::strncpy(header.name, name.c_str(), sizeof(header.name) - 1);
+    if (std::fwrite(&header, sizeof(header), 1, file) != 1) {
+        std::fclose(file);
+        file = nullptr;
+        return false;
+    }
+
+    writer = std::thread(&DataLogger::write_loop, this);
+    return true;
+}
+
+void DataLogger::close() {
+    if (file == nullptr) return;
+    // the writer empties the buffer before it stops
+    stopping.store(true);
+    writer.join();
+    if (std::fclose(file) != 0) write_failed.store(true);
+    file = nullptr;
+}
+
+bool DataLogger::log(double time, double desired_speed, double desired_steer_angle, const CarState & state, const float * scan) {
+    if (file == nullptr) return false;
+
+    size_t head_ = head.load(std::memory_order_relaxed);
+    if (head_ - tail.load(std::memory_order_acquire) == capacity) {
+        dropped++;
+        return false;
+    }
+
+    char * slot = buffer.data() + (head_ % capacity) * record_size;
+    LogRecord record;
+    record.time = time;
+    record.desired_speed = desired_speed;
+    record.desired_steer_angle = desired_steer_angle;
+    record.state[0] = state.x;
+    record.state[1] = state.y;
+    record.state[2] = state.theta;
+    record.state[3] = state.velocity_x;
+    record.state[4] = state.velocity_y;
+    record.state[5] = state.steer_angle;
+    record.state[6] = state.angular_velocity;
+    record.state[7] = state.slip_angle;
+    std::memcpy(slot, &record, sizeof(record));
+    if (num_beams > 0) std::memcpy(slot + sizeof(record), scan, num_beams * sizeof(float));
+
+    // the writer may only read the slot after it is filled
+    head.store(head_ + 1, std::memory_order_release);
+    return true;
+}
+
+void DataLogger::write_loop() {
+    while (true) {
+        size_t tail_ = tail.load(std::memory_order_relaxed);
+        size_t head_ = head.load(std::memory_order_acquire);
+
+        if (head_ == tail_) {
+            // a log() may publish a record between the load of head above and close() setting stopping, so head is
+            // read again after stopping was seen: everything logged before close() is in it and nothing is lost
+            if (stopping.load() and head.load(std::memory_order_acquire) == tail_) break;
+            if (not stopping.load()) std::this_thread::sleep_for(idle_time);
+            continue;
+        }
+
+        // everything up to the end of the buffer in one go, the rest in the next round
+        size_t first = tail_ % capacity;
+        size_t count = std::min(head_ - tail_, capacity - first);
+        if (not write_failed.load()) {
+            if (std::fwrite(buffer.data() + first * record_size, record_size, count, file) != count) {
+                write_failed.store(true);
+            } else {
+                written.fetch_add(count);
+            }
+        }
+        // the slots can be used again
+        tail.store(tail_ + count, std::memory_order_release);
+    }
+    if (std::fflush(file) != 0) write_failed.store(true);
+}
@@ -0,0 +1,133 @@
+#include "f1tenth_simulator/distance_field.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace racecar_simulator;
+
+constexpr int DistanceField::tile_bits;
+constexpr size_t DistanceField::tile_size;
+constexpr double DistanceField::uint16_scale;
+
+namespace {
+
+// number of bits needed for the indices [0, size)
+int bits_for(size_t size) {
+    int bits = 0;
+    while (((size_t) 1 << bits) < size) bits++;
+    return bits;
+}
+
+}
+
+DistanceField::DistanceField(Format format_, Layout layout_)
+  : format(format_),
+    layout(layout_),
+    width(0),
+    height(0),
+    tiles_per_row(0),
+    row_bits(0),
+    col_bits(0),
+    common_bits(0) {
+}
+
+bool DistanceField::parse_format(const std::string & name, Format & format) {
+    if (name == "float64") format = FLOAT64;
+    else if (name == "float32") format = FLOAT32;
+    else if (name == "uint16") format = UINT16;
+    else return false;
+    return true;
+}
+
+bool DistanceField::parse_layout(const std::string & name, Layout & layout) {
+    if (name == "row_major") layout = ROW_MAJOR;
+    else if (name == "tiled") layout = TILED;
+    else if (name == "morton") layout = MORTON;
+    else return false;
+    return true;
+}
+
+std::string DistanceField::format_name(Format format) {
+    switch (format) {
+        case FLOAT32: return "float32";
+        case UINT16: return "uint16";
+        default: return "float64";
+    }
+}
+
+std::string DistanceField::layout_name(Layout layout) {
+    switch (layout) {
+        case TILED: return "tiled";
+        case MORTON: return "morton";
+        default: return "row_major";
+    }
+}
+
+size_t DistanceField::storage_size() const {
+    switch (layout) {
+        case TILED:
+            // the tiles at the right and top edge are padded to full tiles
+            return tiles_per_row * ((height + tile_size - 1) / tile_size) * tile_size * tile_size;
+        case MORTON:
+            // the curve covers a power of two in each direction
+            return (size_t) 1 << (row_bits + col_bits);
+        default:
+            return width * height;
+    }
+}
+
+void DistanceField::assign(const std::vector<double> & dt, size_t width_, size_t height_) {
+    width = width_;
+    height = height_;
+    tiles_per_row = (width + tile_size - 1) / tile_size;
+    row_bits = bits_for(height);
+    col_bits = bits_for(width);
+    common_bits = std::min(row_bits, col_bits);
+
+    values64.clear();
+    values32.clear();
+    values16.clear();
+    // padding cells are never read
+    switch (format) {
+        case FLOAT32: values32.assign(storage_size(), 0); break;
+        case UINT16: values16.assign(storage_size(), 0); break;
+        default: values64.assign(storage_size(), 0); break;
+    }
+    values64.shrink_to_fit();
+    values32.shrink_to_fit();
+    values16.shrink_to_fit();
+
+    if (width > 0 and height > 0) update(dt, 0, 0, height - 1, width - 1);
+}
+
+void DistanceField::update(const std::vector<double> & dt, size_t row_min, size_t col_min, size_t row_max, size_t col_max) {
+    for (size_t row = row_min; row <= row_max; row++) {
+        for (size_t col = col_min; col <= col_max; col++) {
+            store(index(row, col), dt[row * width + col]);
+        }
+    }
+}
+
+void DistanceField::store(size_t index, double value) {
+    switch (format) {
+        case FLOAT32: {
+            // round towards 0, so the ray marcher never steps further than the exact distance
+            float rounded = value;
+            if (rounded > value) rounded = std::nextafter(rounded, 0.f);
+            values32[index] = rounded;
+            break;
+        }
+        case UINT16: {
+            double units = std::floor(value / uint16_scale);
+            values16[index] = std::min(units, 65535.);
+            break;
+        }
+        default:
+            values64[index] = value;
+    }
+}
+
+size_t DistanceField::memory_usage() const {
+    return values64.capacity() * sizeof(double) + values32.capacity() * sizeof(float) +
+           values16.capacity() * sizeof(uint16_t);
+}
@@ -0,0 +1,75 @@
+#include "f1tenth_simulator/distance_pyramid.hpp"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+using namespace racecar_simulator;
+
+constexpr double DistancePyramid::min_blocks;
+
+void DistancePyramid::assign(const std::vector<double> & dt, size_t width_, size_t height_, double resolution_,
+                             int num_levels_) {
+    width = width_;
+    height = height_;
+    resolution = resolution_;
+    num_levels = std::max(num_levels_, 0);
+    levels.assign(num_levels, std::vector<float>());
+    level_widths.assign(num_levels, 0);
+    level_heights.assign(num_levels, 0);
+    thresholds.assign(num_levels, 0);
+
+    for (int l = 0; l < num_levels; l++) {
+        size_t block = (size_t) 1 << (l + 1);
+        level_widths[l] = (width + block - 1) / block;
+        level_heights[l] = (height + block - 1) / block;
+        levels[l].resize(level_widths[l] * level_heights[l]);
+        thresholds[l] = min_blocks * block * resolution;
+    }
+    if (num_levels > 0 and not dt.empty()) update(dt, 0, 0, height - 1, width - 1);
+}
+
+void DistancePyramid::update(const std::vector<double> & dt, size_t row_min, size_t col_min, size_t row_max,
+                             size_t col_max) {
+    // each level from the one below, the blocks that contain a changed cell
+    for (int l = 0; l < num_levels; l++) {
+        for (size_t block_row = row_min >> (l + 1); block_row <= row_max >> (l + 1); block_row++) {
+            for (size_t block_col = col_min >> (l + 1); block_col <= col_max >> (l + 1); block_col++) {
+                compute_block(dt, l, block_row, block_col);
+            }
+        }
+    }
+}
+
+void DistancePyramid::compute_block(const std::vector<double> & dt, int level, size_t block_row, size_t block_col) {
+    double smallest = std::numeric_limits<double>::infinity();
+    if (level == 0) {
+        // 2 x 2 cells, the last row and column may be cut off by the edge of the map
+        for (size_t row = 2 * block_row; row < std::min(2 * block_row + 2, height); row++) {
+            for (size_t col = 2 * block_col; col < std::min(2 * block_col + 2, width); col++) {
+                smallest = std::min(smallest, dt[row * width + col]);
+            }
+        }
+    } else {
+        // 2 x 2 blocks of the level below
+        const std::vector<float> & below = levels[level - 1];
+        size_t below_width = level_widths[level - 1];
+        size_t below_height = level_heights[level - 1];
+        for (size_t row = 2 * block_row; row < std::min(2 * block_row + 2, below_height); row++) {
+            for (size_t col = 2 * block_col; col < std::min(2 * block_col + 2, below_width); col++) {
+                smallest = std::min(smallest, (double) below[row * below_width + col]);
+            }
+        }
+    }
+
+    // round towards 0, so a step never goes further than the exact distance
+    float value = smallest;
+    if (value > smallest) value = std::nextafter(value, 0.f);
+    levels[level][block_row * level_widths[level] + block_col] = value;
+}
+
+size_t DistancePyramid::memory_usage() const {
+    size_t bytes = 0;
+    for (const std::vector<float> & level : levels) bytes += level.capacity() * sizeof(float);
+    return bytes;
+}
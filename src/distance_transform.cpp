@@ -1,10 +1,10 @@
-#include <ros/package.h>
 #include <cstddef>
 #include <vector>
 #include <cmath>
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <algorithm>
 #include "f1tenth_simulator/distance_transform.hpp"
 
 // Implementation based on the paper
@@ -14,22 +14,35 @@
 
 using namespace racecar_simulator;
 
+constexpr size_t DistanceTransform::column_tile;
+constexpr size_t DistanceTransform::row_grain;
+
 void DistanceTransform::distance_squared_1d(
     const std::vector<double> & input, 
     std::vector<double> & output) {
 
+  std::vector<size_t> parabola_idxs(input.size());
+  std::vector<double> parabola_boundaries(input.size() + 1);
+  distance_squared_1d(input.data(), output.data(), input.size(), parabola_idxs.data(), parabola_boundaries.data());
+}
+
+void DistanceTransform::distance_squared_1d(
+    const double * input,
+    double * output,
+    size_t size,
+    size_t * parabola_idxs,
+    double * parabola_boundaries) {
+
   // Each parabola has the form
   //
   //     input[index] + (query - index)^2
 
   // The grid location of the i-th parabola is parabola_idxs[i]
-  std::vector<size_t> parabola_idxs(input.size());
   parabola_idxs[0] = 0;
 
   // The range of the i-th parabola is
   // parabola_boundaries[i] to parabola_boundaries[i + 1]
   // Initialize all of the ranges to extend to infinity
-  std::vector<double> parabola_boundaries(input.size() + 1);
   parabola_boundaries[0] = -inf;
   parabola_boundaries[1] = inf;
 
@@ -38,7 +51,7 @@ void DistanceTransform::distance_squared_1d(
 
   // Compute the lower envelope over all grid cells
   double intersection_point;
-  for (size_t idx = 1; idx < input.size(); idx++) {
+  for (size_t idx = 1; idx < size; idx++) {
 
     num_parabolas++;
 
@@ -73,7 +86,7 @@ void DistanceTransform::distance_squared_1d(
   }
 
   int parabola = 0;
-  for (size_t idx = 0; idx < input.size(); idx++) {
+  for (size_t idx = 0; idx < size; idx++) {
     // Find the parabola corresponding to the index
     while (parabola_boundaries[parabola + 1] < idx) parabola++;
 
@@ -87,35 +100,126 @@ void DistanceTransform::distance_squared_2d(
     std::vector<double> & input, 
     size_t width, 
     size_t height, 
-    double boundary_value) {
+    double boundary_value,
+    ThreadPool * pool) {
+
+  if (pool == nullptr) pool = &ThreadPool::shared();
+
+  // Every column and every row is independent of the others, so they are split across the threads of the pool.
+  // Each thread has its own scratch buffers, allocated once here instead of once per line.
+  size_t longest = std::max(width, height) + 2;
+  std::vector<std::vector<double>> line_vecs(pool->size());
+  std::vector<std::vector<double>> line_dts(pool->size());
+  std::vector<std::vector<size_t>> parabola_idxs(pool->size());
+  std::vector<std::vector<double>> parabola_boundaries(pool->size());
 
   // Transform along the columns
-  std::vector<double> col_vec(height + 2);
-  std::vector<double> col_dt(height + 2);
+  // Reading one column at a time jumps a whole row between two values, so the columns are copied in tiles of
+  // column_tile columns: each row of the tile is a short contiguous read, and the tile is transposed into
+  // column_tile contiguous columns in the scratch buffer.
+  pool->parallel_for((width + column_tile - 1) / column_tile, 1, [&](size_t begin, size_t end, size_t thread) {
+    std::vector<double> & col_vecs = line_vecs[thread];
+    std::vector<double> & col_dt = line_dts[thread];
+    col_vecs.resize(column_tile * (height + 2));
+    col_dt.resize(height + 2);
+    parabola_idxs[thread].resize(longest);
+    parabola_boundaries[thread].resize(longest + 1);
+
+    for (size_t tile = begin; tile < end; tile++) {
+      size_t first_col = tile * column_tile;
+      size_t cols = std::min(column_tile, width - first_col);
+
+      for (size_t i = 0; i < cols; i++) {
+        col_vecs[i * (height + 2)] = boundary_value;
+        col_vecs[i * (height + 2) + height + 1] = boundary_value;
+      }
+      for (size_t row = 0; row < height; row++) {
+        const double * source = &input[row * width + first_col];
+        for (size_t i = 0; i < cols; i++) {
+          col_vecs[i * (height + 2) + row + 1] = source[i];
+        }
+      }
+
+      for (size_t i = 0; i < cols; i++) {
+        // the result overwrites the column in the tile, so the tile can be written back row by row
+        double * col_vec = &col_vecs[i * (height + 2)];
+        distance_squared_1d(col_vec, col_dt.data(), height + 2,
+                            parabola_idxs[thread].data(), parabola_boundaries[thread].data());
+        std::copy(col_dt.begin(), col_dt.end(), col_vec);
+      }
+
+      for (size_t row = 0; row < height; row++) {
+        double * destination = &input[row * width + first_col];
+        for (size_t i = 0; i < cols; i++) {
+          destination[i] = col_vecs[i * (height + 2) + row + 1];
+        }
+      }
+    }
+  });
+
+  // Transform along the rows
+  pool->parallel_for(height, row_grain, [&](size_t begin, size_t end, size_t thread) {
+    std::vector<double> & row_vec = line_vecs[thread];
+    std::vector<double> & row_dt = line_dts[thread];
+    row_vec.resize(std::max(row_vec.size(), width + 2));
+    row_dt.resize(std::max(row_dt.size(), width + 2));
+    parabola_idxs[thread].resize(longest);
+    parabola_boundaries[thread].resize(longest + 1);
+
+    for (size_t row = begin; row < end; row++) {
+      row_vec[0] = boundary_value;
+      row_vec[width + 1] = boundary_value;
+      for (size_t col = 0; col < width; col++) {
+        row_vec[col + 1] = input[row * width + col];
+      }
+      distance_squared_1d(row_vec.data(), row_dt.data(), width + 2,
+                          parabola_idxs[thread].data(), parabola_boundaries[thread].data());
+      for (size_t col = 0; col < width; col++) {
+        input[row * width + col] = row_dt[col + 1];
+      }
+    }
+  });
+}
+
+void DistanceTransform::distance_squared_2d_window(
+    std::vector<double> & input,
+    size_t width,
+    size_t height,
+    double bottom_boundary,
+    double top_boundary,
+    double left_boundary,
+    double right_boundary) {
+
+  // windows are small, so this runs on the calling thread
+  size_t longest = std::max(width, height) + 2;
+  std::vector<double> line_vec(longest);
+  std::vector<double> line_dt(longest);
+  std::vector<size_t> parabola_idxs(longest);
+  std::vector<double> parabola_boundaries(longest + 1);
+
+  // Transform along the columns, row 0 is the bottom of the window
   for (size_t col = 0; col < width; col++) {
-    col_vec[0] = boundary_value;
-    col_vec[height + 1] = boundary_value;
+    line_vec[0] = bottom_boundary;
+    line_vec[height + 1] = top_boundary;
     for (size_t row = 0; row < height; row++) {
-      col_vec[row + 1] = input[row * width + col];
+      line_vec[row + 1] = input[row * width + col];
     }
-    distance_squared_1d(col_vec, col_dt);
+    distance_squared_1d(line_vec.data(), line_dt.data(), height + 2, parabola_idxs.data(), parabola_boundaries.data());
     for (size_t row = 0; row < height; row++) {
-      input[row * width + col] = col_dt[row + 1];
+      input[row * width + col] = line_dt[row + 1];
     }
   }
 
   // Transform along the rows
-  std::vector<double> row_vec(width + 2);
-  std::vector<double> row_dt(width + 2);
   for (size_t row = 0; row < height; row++) {
-    row_vec[0] = boundary_value;
-    row_vec[width + 1] = boundary_value;
+    line_vec[0] = left_boundary;
+    line_vec[width + 1] = right_boundary;
     for (size_t col = 0; col < width; col++) {
-      row_vec[col + 1] = input[row * width + col];
+      line_vec[col + 1] = input[row * width + col];
     }
-    distance_squared_1d(row_vec, row_dt);
+    distance_squared_1d(line_vec.data(), line_dt.data(), width + 2, parabola_idxs.data(), parabola_boundaries.data());
     for (size_t col = 0; col < width; col++) {
-      input[row * width + col] = row_dt[col + 1];
+      input[row * width + col] = line_dt[col + 1];
     }
   }
 }
@@ -125,9 +229,12 @@ void DistanceTransform::distance_2d(
     size_t width, 
     size_t height, 
     double resolution,
-    double boundary_value) {
+    double boundary_value,
+    ThreadPool * pool) {
+
+    if (pool == nullptr) pool = &ThreadPool::shared();
 
-    distance_squared_2d(input, width, height, boundary_value);
+    distance_squared_2d(input, width, height, boundary_value, pool);
 
     /**
      * this code is for calculating minimum time trajectory, it will generate a csv file where has raw data of the input
@@ -159,7 +266,9 @@ void DistanceTransform::distance_2d(
 //        image.close();
 //    }
 
-    for (size_t i = 0; i < input.size(); i++) {
-        input[i] = resolution * sqrt(input[i]);
-    }
+    pool->parallel_for(height, row_grain, [&](size_t begin, size_t end, size_t) {
+        for (size_t i = begin * width; i < end * width; i++) {
+            input[i] = resolution * sqrt(input[i]);
+        }
+    });
 }
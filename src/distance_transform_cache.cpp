@@ -0,0 +1,180 @@
+#include "f1tenth_simulator/distance_transform_cache.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace racecar_simulator;
+
+namespace {
+
+// the file starts with this header, followed by width * height doubles of the distance transform
+struct Header {
+    char magic[8];
+    uint64_t key;
+    uint64_t height;
+    uint64_t width;
+    double resolution;
+    double origin_x;
+    double origin_y;
+    double origin_theta;
+};
+
+// change the version whenever the file layout or the distance transform itself changes
+const char magic[8] = {'F', '1', 'T', 'H', 'D', 'T', '0', '1'};
+
+// FNV-1a, one 64 bit word at a time
+const uint64_t fnv_offset = 14695981039346656037ull;
+const uint64_t fnv_prime = 1099511628211ull;
+
+inline uint64_t mix(uint64_t hash, uint64_t word) {
+    return (hash ^ word) * fnv_prime;
+}
+
+inline uint64_t bits(double value) {
+    uint64_t word;
+    std::memcpy(&word, &value, sizeof(word));
+    return word;
+}
+
+// mkdir -p
+bool make_directories(const std::string & directory) {
+    for (size_t i = 1; i <= directory.size(); i++) {
+        if (i == directory.size() or directory[i] == '/') {
+            std::string part = directory.substr(0, i);
+            if (mkdir(part.c_str(), 0755) != 0 and errno != EEXIST) return false;
+        }
+    }
+    return true;
+}
+
+}
+
+DistanceTransformCache::DistanceTransformCache(const std::string & directory_)
+  : directory(directory_) {
+    // remove trailing slashes, path() adds one
+    while (directory.size() > 1 and directory.back() == '/') directory.pop_back();
+}
+
+uint64_t DistanceTransformCache::hash(
+        const std::vector<double> & map,
+        size_t height,
+        size_t width,
+        double resolution,
+        double free_threshold) {
+    uint64_t hash = fnv_offset;
+    hash = mix(hash, height);
+    hash = mix(hash, width);
+    hash = mix(hash, bits(resolution));
+    hash = mix(hash, bits(free_threshold));
+    for (double value : map) {
+        hash = mix(hash, bits(value));
+    }
+    return hash;
+}
+
+uint64_t DistanceTransformCache::hash(const OccupancyBitmap & bitmap) {
+    uint64_t hash = fnv_offset;
+    hash = mix(hash, bitmap.height);
+    hash = mix(hash, bitmap.width);
+    hash = mix(hash, bits(bitmap.resolution));
+    // tells it apart from the hash of a map of values, those mix in the threshold here
+    hash = mix(hash, ~uint64_t(0));
+    for (uint64_t word : bitmap.bits) {
+        hash = mix(hash, word);
+    }
+    return hash;
+}
+
+std::string DistanceTransformCache::path(uint64_t key) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.dt", (unsigned long long) key);
+    return directory + "/" + name;
+}
+
+bool DistanceTransformCache::load(
+        uint64_t key,
+        size_t height,
+        size_t width,
+        double resolution,
+        const Pose2D & origin,
+        std::vector<double> & dt) const {
+    if (not enabled()) return false;
+
+    int fd = open(path(key).c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    size_t size = sizeof(Header) + height * width * sizeof(double);
+    struct stat info;
+    if (fstat(fd, &info) != 0 or (size_t) info.st_size != size) {
+        close(fd);
+        return false;
+    }
+
+    void * data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return false;
+
+    // the header checks the key and the size, resolution and origin of the map, the cells themselves are only
+    // compared through the 64 bit hash of the key. Two maps of the same size with the same hash would share a file,
+    // that is unlikely enough to not read the whole map again
+    Header header;
+    std::memcpy(&header, data, sizeof(header));
+    bool match = std::memcmp(header.magic, magic, sizeof(magic)) == 0 and
+                 header.key == key and
+                 header.height == height and
+                 header.width == width and
+                 header.resolution == resolution and
+                 header.origin_x == origin.x and
+                 header.origin_y == origin.y and
+                 header.origin_theta == origin.theta;
+
+    if (match) {
+        dt.resize(height * width);
+        std::memcpy(dt.data(), static_cast<const char *>(data) + sizeof(Header), height * width * sizeof(double));
+    }
+    munmap(data, size);
+    return match;
+}
+
+bool DistanceTransformCache::store(
+        uint64_t key,
+        size_t height,
+        size_t width,
+        double resolution,
+        const Pose2D & origin,
+        const std::vector<double> & dt) const {
+    if (not enabled() or dt.size() != height * width) return false;
+    if (not make_directories(directory)) return false;
+
+    Header header;
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.key = key;
+    header.height = height;
+    header.width = width;
+    header.resolution = resolution;
+    header.origin_x = origin.x;
+    header.origin_y = origin.y;
+    header.origin_theta = origin.theta;
+
+    // several simulators may start with the same map at the same time,
+    // write to a file of our own first and then rename it, so nobody reads a half written file
+    std::string final_path = path(key);
+    std::string temporary_path = final_path + "." + std::to_string(getpid()) + ".tmp";
+
+    FILE * file = std::fopen(temporary_path.c_str(), "wb");
+    if (file == nullptr) return false;
+    bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 and
+                   std::fwrite(dt.data(), sizeof(double), dt.size(), file) == dt.size();
+    written = std::fclose(file) == 0 and written;
+
+    if (not written or std::rename(temporary_path.c_str(), final_path.c_str()) != 0) {
+        std::remove(temporary_path.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,306 @@
+#include "f1tenth_simulator/map_loader.hpp"
+
+#include <cstdio>
+#include <cctype>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#ifdef F1TENTH_WITH_PNG
+#include <png.h>
+#endif
+
+using namespace racecar_simulator;
+
+namespace {
+
+// the keys of a map yaml, the comments and unknown keys are skipped
+struct MapYaml {
+    std::string image;
+    double resolution = 0;
+    std::vector<double> origin;
+    bool negate = false;
+    double occupied_thresh = 0.65;
+    double free_thresh = 0.196;
+};
+
+std::string trim(const std::string & text) {
+    size_t begin = text.find_first_not_of(" \t\r\"'");
+    if (begin == std::string::npos) return "";
+    size_t end = text.find_last_not_of(" \t\r\"'");
+    return text.substr(begin, end - begin + 1);
+}
+
+bool read_yaml(const std::string & path, MapYaml & yaml, std::string & error) {
+    std::ifstream file(path);
+    if (not file.is_open()) {
+        error = "can't open " + path;
+        return false;
+    }
+    std::string line;
+    while (std::getline(file, line)) {
+        line = line.substr(0, line.find('#'));
+        size_t colon = line.find(':');
+        if (colon == std::string::npos) continue;
+        std::string key = trim(line.substr(0, colon));
+        std::string value = trim(line.substr(colon + 1));
+
+        if (key == "image") {
+            yaml.image = value;
+        } else if (key == "resolution") {
+            yaml.resolution = std::atof(value.c_str());
+        } else if (key == "negate") {
+            yaml.negate = std::atoi(value.c_str()) != 0;
+        } else if (key == "occupied_thresh") {
+            yaml.occupied_thresh = std::atof(value.c_str());
+        } else if (key == "free_thresh") {
+            yaml.free_thresh = std::atof(value.c_str());
+        } else if (key == "origin") {
+            // [x, y, theta]
+            for (char & c : value) {
+                if (c == '[' or c == ']' or c == ',') c = ' ';
+            }
+            std::istringstream numbers(value);
+            double number;
+            while (numbers >> number) yaml.origin.push_back(number);
+        }
+    }
+    if (yaml.image.empty() or yaml.resolution <= 0 or yaml.origin.size() != 3) {
+        error = path + " needs image, resolution and origin: [x, y, theta]";
+        return false;
+    }
+    return true;
+}
+
+// the next number of a PGM header, after white space and comments
+bool pgm_number(std::istream & file, size_t & number) {
+    while (true) {
+        int c = file.peek();
+        if (c == '#') {
+            std::string comment;
+            std::getline(file, comment);
+        } else if (std::isspace(c)) {
+            file.get();
+        } else {
+            break;
+        }
+    }
+    return bool(file >> number);
+}
+
+// one grey value per pixel, start() is called once width and height are known,
+// then row(image_row, pixels) for one row after the other, row 0 is the top of the image
+template <typename Start, typename RowSink>
+bool read_pgm(const std::string & path, size_t & width, size_t & height, Start start, RowSink row, std::string & error) {
+    std::ifstream file(path, std::ios::binary);
+    std::string magic;
+    if (not file.is_open() or not (file >> magic) or (magic != "P5" and magic != "P2")) {
+        error = "can't read the PGM " + path;
+        return false;
+    }
+    size_t max_value;
+    if (not pgm_number(file, width) or not pgm_number(file, height) or not pgm_number(file, max_value) or
+        max_value == 0 or max_value > 65535) {
+        error = "bad PGM header in " + path;
+        return false;
+    }
+    start();
+
+    std::vector<uint8_t> pixels(width);
+    if (magic == "P5") {
+        // exactly one white space after the header
+        file.get();
+        size_t bytes = max_value > 255 ? 2 : 1;
+        std::vector<uint8_t> raw(width * bytes);
+        for (size_t image_row = 0; image_row < height; image_row++) {
+            file.read(reinterpret_cast<char *>(raw.data()), raw.size());
+            if (size_t(file.gcount()) != raw.size()) {
+                error = path + " is too short";
+                return false;
+            }
+            for (size_t col = 0; col < width; col++) {
+                // 16 bit values are big endian
+                size_t value = bytes == 2 ? (raw[2 * col] << 8) | raw[2 * col + 1] : raw[col];
+                pixels[col] = value * 255 / max_value;
+            }
+            row(image_row, pixels.data());
+        }
+    } else {
+        for (size_t image_row = 0; image_row < height; image_row++) {
+            for (size_t col = 0; col < width; col++) {
+                size_t value;
+                if (not (file >> value)) {
+                    error = path + " is too short";
+                    return false;
+                }
+                pixels[col] = std::min(value, max_value) * 255 / max_value;
+            }
+            row(image_row, pixels.data());
+        }
+    }
+    return true;
+}
+
+#ifdef F1TENTH_WITH_PNG
+template <typename Start, typename RowSink>
+bool read_png(const std::string & path, size_t & width, size_t & height, Start start, RowSink row, std::string & error) {
+    FILE * file = std::fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        error = "can't open " + path;
+        return false;
+    }
+    // before setjmp(), so a longjmp() on an error doesn't skip their destructors
+    std::vector<uint8_t> raw;
+    std::vector<png_bytep> rows;
+    std::vector<uint8_t> pixels;
+    png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_infop info = png == nullptr ? nullptr : png_create_info_struct(png);
+    if (info == nullptr or setjmp(png_jmpbuf(png))) {
+        png_destroy_read_struct(&png, &info, nullptr);
+        std::fclose(file);
+        error = "can't read the PNG " + path;
+        return false;
+    }
+    png_init_io(png, file);
+    png_read_info(png, info);
+
+    // 8 bit grey or RGB without alpha, whatever the file has
+    png_set_expand(png);
+    png_set_strip_16(png);
+    png_set_strip_alpha(png);
+    // interlaced images come in several passes over the whole image, only those are read at once
+    int passes = png_set_interlace_handling(png);
+    png_read_update_info(png, info);
+
+    width = png_get_image_width(png, info);
+    height = png_get_image_height(png, info);
+    size_t channels = png_get_channels(png, info);
+    start();
+    raw.resize((passes > 1 ? height : 1) * width * channels);
+    if (passes > 1) {
+        rows.resize(height);
+        for (size_t image_row = 0; image_row < height; image_row++) rows[image_row] = raw.data() + image_row * width * channels;
+        png_read_image(png, rows.data());
+    }
+
+    pixels.resize(width);
+    for (size_t image_row = 0; image_row < height; image_row++) {
+        const uint8_t * line = raw.data();
+        if (passes > 1) {
+            line += image_row * width * channels;
+        } else {
+            png_read_row(png, raw.data(), nullptr);
+        }
+        for (size_t col = 0; col < width; col++) {
+            size_t sum = 0;
+            for (size_t c = 0; c < channels; c++) sum += line[col * channels + c];
+            pixels[col] = sum / channels;
+        }
+        row(image_row, pixels.data());
+    }
+    png_read_end(png, nullptr);
+    png_destroy_read_struct(&png, &info, nullptr);
+    std::fclose(file);
+    return true;
+}
+#endif
+
+bool ends_with(const std::string & text, const std::string & end) {
+    return text.size() >= end.size() and text.compare(text.size() - end.size(), end.size(), end) == 0;
+}
+
+}
+
+bool MapLoader::load(const std::string & yaml_path, OccupancyMap & map, std::string * error) {
+    return load(yaml_path, &map, nullptr, 0, error);
+}
+
+bool MapLoader::load(const std::string & yaml_path, OccupancyMap * map, OccupancyBitmap * bitmap, double free_threshold,
+                     std::string * error) {
+    std::string message;
+    MapYaml yaml;
+    if (not read_yaml(yaml_path, yaml, message)) {
+        if (error) *error = message;
+        return false;
+    }
+
+    // the image is relative to the yaml
+    std::string image = yaml.image;
+    if (image[0] != '/') {
+        size_t slash = yaml_path.rfind('/');
+        if (slash != std::string::npos) image = yaml_path.substr(0, slash + 1) + image;
+    }
+
+    // the cell of every grey value, the trinary mode of map_server, and whether the scanner sees it as free
+    int8_t cell_of[256];
+    bool free_of[256];
+    for (int pixel = 0; pixel < 256; pixel++) {
+        double occupancy = yaml.negate ? pixel / 255.0 : (255 - pixel) / 255.0;
+        if (occupancy > yaml.occupied_thresh) {
+            cell_of[pixel] = 100;
+        } else if (occupancy < yaml.free_thresh) {
+            cell_of[pixel] = 0;
+        } else {
+            cell_of[pixel] = -1;
+        }
+        free_of[pixel] = OccupancyBitmap::free_value(cell_of[pixel], free_threshold);
+    }
+
+    size_t width = 0, height = 0;
+    // once the size is known, before the first row
+    auto start = [&]() {
+        if (map) {
+            map->width = width;
+            map->height = height;
+            map->resolution = yaml.resolution;
+            map->origin = {yaml.origin[0], yaml.origin[1], yaml.origin[2]};
+            map->data.resize(width * height);
+        }
+        if (bitmap) {
+            bitmap->resize(width, height);
+            bitmap->resolution = yaml.resolution;
+            bitmap->origin = {yaml.origin[0], yaml.origin[1], yaml.origin[2]};
+        }
+    };
+    // every row is thresholded as soon as it is read, the image is never in memory as a whole
+    auto row = [&](size_t image_row, const uint8_t * pixels) {
+        // the top of the image is the last row of the map
+        size_t map_row = height - 1 - image_row;
+        if (map) {
+            int8_t * cell = map->data.data() + map_row * width;
+            for (size_t col = 0; col < width; col++) cell[col] = cell_of[pixels[col]];
+        }
+        if (bitmap) {
+            for (size_t col = 0; col < width; col++) {
+                if (free_of[pixels[col]]) bitmap->set_free(map_row, col);
+            }
+        }
+    };
+
+    bool read = false;
+    if (ends_with(image, ".png")) {
+#ifdef F1TENTH_WITH_PNG
+        read = read_png(image, width, height, start, row, message);
+#else
+        message = "built without libpng, can't read " + image;
+#endif
+    } else {
+        read = read_pgm(image, width, height, start, row, message);
+    }
+    if (not read) {
+        if (error) *error = message;
+        return false;
+    }
+    return true;
+}
+
+std::vector<double> MapLoader::to_scan_map(const OccupancyMap & map) {
+    std::vector<double> values(map.data.size());
+    for (size_t i = 0; i < values.size(); i++) {
+        // [0, 100] to [0, 1], anything else is unknown
+        int8_t value = map.data[i];
+        values[i] = value < 0 or value > 100 ? 0.5 : value / 100.;
+    }
+    return values;
+}
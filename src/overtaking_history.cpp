@@ -0,0 +1,37 @@
+#include "f1tenth_simulator/overtaking_history.hpp"
+
+#include <algorithm>
+
+using namespace racecar_simulator;
+
+OvertakingHistory::OvertakingHistory(size_t history_, size_t num_beams_)
+  : history(history_),
+    num_beams(num_beams_),
+    scans(history_ * num_beams_, 0.f),
+    states(history_ * 2, 0.f) {
+}
+
+void OvertakingHistory::push(const float * scan, const CarState & state) {
+    if (history == 0) return;
+    std::copy(scan, scan + num_beams, scans.begin() + next * num_beams);
+    states[2 * next] = state.velocity_x;
+    states[2 * next + 1] = state.steer_angle;
+    next = (next + 1) % history;
+    count = std::min(count + 1, history);
+}
+
+void OvertakingHistory::clear() {
+    next = 0;
+    count = 0;
+}
+
+void OvertakingHistory::copy(float * scans_out, float * states_out) const {
+    // the oldest step is the one push() overwrites next once the buffer is full
+    size_t oldest = count == history ? next : 0;
+    for (size_t i = 0; i < count; i++) {
+        size_t slot = (oldest + i) % history;
+        std::copy(scans.begin() + slot * num_beams, scans.begin() + (slot + 1) * num_beams, scans_out + i * num_beams);
+        states_out[2 * i] = states[2 * slot];
+        states_out[2 * i + 1] = states[2 * slot + 1];
+    }
+}
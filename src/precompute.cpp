@@ -10,8 +10,7 @@ std::vector<double> Precompute::get_car_distances(int scan_beams, double wheelba
     double scan_distance_to_base_link, double angle_min, double scan_ang_incr) {
     // Precompute distance from lidar to edge of car for each beam
 
-    std::vector<double> car_distances = std::vector<double>();
-    car_distances.reserve(scan_beams);
+    std::vector<double> car_distances(scan_beams);
     double dist_to_sides = width / 2.0;
     double dist_to_front = wheelbase - scan_distance_to_base_link;
     double dist_to_back = scan_distance_to_base_link;
@@ -50,9 +49,8 @@ std::vector<double> Precompute::get_car_distances(int scan_beams, double wheelba
 }
 
 std::vector<double> Precompute::get_cosines(int scan_beams, double angle_min, double scan_ang_incr) {
-    // Precompute distance from lidar to edge of car for each beam
-    std::vector<double> cosines = std::vector<double>();
-    cosines.reserve(scan_beams);
+    // Precompute the cosine of the angle of each beam
+    std::vector<double> cosines(scan_beams);
 
     for (int i = 0; i < scan_beams; i++) {
         double angle = angle_min + i * scan_ang_incr;
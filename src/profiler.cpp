@@ -0,0 +1,217 @@
+#include "f1tenth_simulator/profiler.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace racecar_simulator;
+
+namespace {
+
+// events a thread collects before it writes them to the trace file
+const size_t trace_block = 4096;
+
+size_t bucket_of(uint64_t duration_ns) {
+    if (duration_ns < 2) return 0;
+    size_t bucket = 63 - __builtin_clzll(duration_ns);
+    return std::min(bucket, StageStats::num_buckets - 1);
+}
+
+}
+
+constexpr size_t StageStats::num_buckets;
+constexpr size_t Profiler::max_stages;
+constexpr size_t Profiler::max_threads;
+
+double StageStats::quantile_ns(double q) const {
+    if (count == 0) return 0;
+    uint64_t target = std::max<uint64_t>(1, std::ceil(q * count));
+    uint64_t seen = 0;
+    for (size_t b = 0; b < num_buckets; b++) {
+        seen += histogram[b];
+        if (seen >= target) return std::min<double>(double(uint64_t(1) << (b + 1)), max_ns);
+    }
+    return max_ns;
+}
+
+Profiler::Profiler()
+  : start_time(Clock::now()),
+    enabled(true),
+    num_stages(0),
+    counters(new Counters[max_threads * max_stages]),
+    tracing(false),
+    trace_writer_stopping(false),
+    trace_file(nullptr),
+    trace_first_event(true),
+    trace_buffers(new TraceBuffer[max_threads]) {
+
+    for (size_t i = 0; i < max_threads * max_stages; i++) {
+        Counters & c = counters[i];
+        c.count.store(0);
+        c.items.store(0);
+        c.total_ns.store(0);
+        c.max_ns.store(0);
+        for (std::atomic<uint64_t> & bucket : c.histogram) bucket.store(0);
+    }
+}
+
+Profiler::~Profiler() {
+    stop_trace();
+}
+
+Profiler::Stage Profiler::add_stage(const std::string & name) {
+    std::lock_guard<std::mutex> lock(stage_mutex);
+    size_t stages = num_stages.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < stages; i++) {
+        if (stage_names[i] == name) return i;
+    }
+    if (stages == max_stages) return max_stages - 1;
+    stage_names[stages] = name;
+    // the name is there before anybody sees the stage
+    num_stages.store(stages + 1, std::memory_order_release);
+    return stages;
+}
+
+size_t Profiler::thread_slot() {
+    static std::atomic<size_t> next_slot(0);
+    thread_local size_t slot = std::min(next_slot.fetch_add(1), max_threads - 1);
+    return slot;
+}
+
+void Profiler::record(Stage stage, uint64_t begin_ns, uint64_t end_ns, uint64_t items) {
+    if (stage >= num_stages.load(std::memory_order_acquire) or not is_enabled()) return;
+    uint64_t duration = end_ns > begin_ns ? end_ns - begin_ns : 0;
+    size_t slot = thread_slot();
+
+    // only this thread writes these counters (unless there are more than max_threads threads),
+    // the atomics are for snapshot() reading them meanwhile
+    Counters & c = counters[slot * max_stages + stage];
+    c.count.fetch_add(1, std::memory_order_relaxed);
+    c.items.fetch_add(items, std::memory_order_relaxed);
+    c.total_ns.fetch_add(duration, std::memory_order_relaxed);
+    uint64_t longest = c.max_ns.load(std::memory_order_relaxed);
+    while (duration > longest and not c.max_ns.compare_exchange_weak(longest, duration, std::memory_order_relaxed)) {}
+    c.histogram[bucket_of(duration)].fetch_add(1, std::memory_order_relaxed);
+
+    if (tracing.load(std::memory_order_relaxed)) {
+        TraceBuffer & buffer = trace_buffers[slot];
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        buffer.events.push_back({stage, begin_ns, end_ns});
+        if (buffer.events.size() >= trace_block) {
+            // only the vectors are swapped here, writing the file is the job of the writer thread
+            std::vector<TraceEvent> spare;
+            {
+                std::lock_guard<std::mutex> trace_lock(trace_mutex);
+                trace_queue.emplace_back(slot, std::move(buffer.events));
+                if (not spare_blocks.empty()) {
+                    spare = std::move(spare_blocks.back());
+                    spare_blocks.pop_back();
+                }
+            }
+            trace_condition.notify_one();
+            buffer.events = std::move(spare);
+        }
+    }
+}
+
+std::vector<StageStats> Profiler::snapshot(bool reset) {
+    auto take = [reset](std::atomic<uint64_t> & counter) {
+        return reset ? counter.exchange(0, std::memory_order_relaxed) : counter.load(std::memory_order_relaxed);
+    };
+
+    std::vector<StageStats> stats(num_stages.load(std::memory_order_acquire));
+    for (size_t stage = 0; stage < stats.size(); stage++) {
+        StageStats & s = stats[stage];
+        s.name = stage_names[stage];
+        for (size_t slot = 0; slot < max_threads; slot++) {
+            Counters & c = counters[slot * max_stages + stage];
+            s.count += take(c.count);
+            s.items += take(c.items);
+            s.total_ns += take(c.total_ns);
+            s.max_ns = std::max(s.max_ns, take(c.max_ns));
+            for (size_t b = 0; b < StageStats::num_buckets; b++) s.histogram[b] += take(c.histogram[b]);
+        }
+    }
+    return stats;
+}
+
+bool Profiler::start_trace(const std::string & file) {
+    stop_trace();
+    // events of a record() that started before the last stop_trace()
+    for (size_t slot = 0; slot < max_threads; slot++) {
+        std::lock_guard<std::mutex> buffer_lock(trace_buffers[slot].mutex);
+        trace_buffers[slot].events.clear();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        trace_queue.clear();
+        trace_file = std::fopen(file.c_str(), "w");
+        if (trace_file == nullptr) return false;
+        // the JSON array format of the trace event format, one complete event ("ph": "X") per run of a stage
+        std::fputs("[\n", trace_file);
+        trace_first_event = true;
+        trace_writer_stopping = false;
+    }
+    trace_writer = std::thread(&Profiler::write_loop, this);
+    tracing.store(true);
+    return true;
+}
+
+void Profiler::stop_trace() {
+    if (not tracing.exchange(false)) return;
+
+    // the writer empties the queue before it stops
+    {
+        std::lock_guard<std::mutex> lock(trace_mutex);
+        trace_writer_stopping = true;
+    }
+    trace_condition.notify_one();
+    trace_writer.join();
+
+    // what is left in the blocks that weren't full yet
+    for (size_t slot = 0; slot < max_threads; slot++) {
+        std::lock_guard<std::mutex> buffer_lock(trace_buffers[slot].mutex);
+        write_trace_events(slot, trace_buffers[slot].events);
+    }
+
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    std::fputs("\n]\n", trace_file);
+    std::fclose(trace_file);
+    trace_file = nullptr;
+}
+
+void Profiler::write_loop() {
+    std::unique_lock<std::mutex> lock(trace_mutex);
+    while (true) {
+        trace_condition.wait(lock, [this] {return trace_writer_stopping or not trace_queue.empty();});
+        if (trace_queue.empty()) break;
+
+        std::pair<size_t, std::vector<TraceEvent>> block = std::move(trace_queue.front());
+        trace_queue.erase(trace_queue.begin());
+        // the threads that record can queue more blocks meanwhile
+        lock.unlock();
+        write_trace_events(block.first, block.second);
+        lock.lock();
+        spare_blocks.push_back(std::move(block.second));
+    }
+}
+
+void Profiler::write_trace_events(size_t slot, std::vector<TraceEvent> & events) {
+    // only called by the writer thread, or by stop_trace() when the writer is gone
+    if (trace_file != nullptr) {
+        for (const TraceEvent & event : events) {
+            // a stage name is a JSON string, " and \ need a backslash
+            std::string name;
+            for (char c : stage_names[event.stage]) {
+                if (c == '"' or c == '\\') name += '\\';
+                name += c;
+            }
+            // timestamps in microseconds
+            std::fprintf(trace_file, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %zu, \"ts\": %.3f, \"dur\": %.3f}",
+                         trace_first_event ? "" : ",\n", name.c_str(), slot,
+                         event.begin_ns * 1e-3, (event.end_ns - event.begin_ns) * 1e-3);
+            trace_first_event = false;
+        }
+    }
+    events.clear();
+}
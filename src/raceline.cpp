@@ -0,0 +1,119 @@
+#include "f1tenth_simulator/raceline.hpp"
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <algorithm>
+
+using namespace racecar_simulator;
+
+bool Raceline::load(const std::string & path) {
+    std::ifstream file(path);
+    if (not file.is_open()) return false;
+
+    s.clear();
+    x.clear();
+    y.clear();
+    psi.clear();
+    kappa.clear();
+    vx.clear();
+    ax.clear();
+
+    std::string line;
+    while (std::getline(file, line)) {
+        // the heading starts with #
+        if (line.empty() or line[0] == '#') continue;
+
+        // s; x; y; psi; kappa; vx; ax
+        double values[7];
+        const char * begin = line.c_str();
+        int count = 0;
+        for (; count < 7; count++) {
+            char * end;
+            values[count] = std::strtod(begin, &end);
+            if (end == begin) break;
+            begin = end;
+            while (*begin == ';' or *begin == ' ') begin++;
+        }
+        if (count < 7) continue;
+
+        s.push_back(values[0]);
+        x.push_back(values[1]);
+        y.push_back(values[2]);
+        psi.push_back(values[3]);
+        kappa.push_back(values[4]);
+        vx.push_back(values[5]);
+        ax.push_back(values[6]);
+    }
+
+    measure();
+    return not empty();
+}
+
+void Raceline::transform(double scale_x, double offset_x, double scale_y, double offset_y) {
+    // the curvature is per unit of length, a mirror (one negative scale) turns left into right
+    double kappa_scale = 1 / std::sqrt(std::abs(scale_x * scale_y));
+    if (scale_x * scale_y < 0) kappa_scale = -kappa_scale;
+    for (size_t i = 0; i < size(); i++) {
+        x[i] = scale_x * x[i] + offset_x;
+        y[i] = scale_y * y[i] + offset_y;
+        // psi of the csv is 0 for north (+y), the heading from the x axis is psi + Pi/2.
+        // That heading is scaled like the points, a negative scale mirrors it
+        double heading = psi[i] + M_PI / 2;
+        heading = std::atan2(scale_y * std::sin(heading), scale_x * std::cos(heading));
+        psi[i] = heading - M_PI / 2;
+        if (psi[i] <= -M_PI) psi[i] += 2 * M_PI;
+        kappa[i] *= kappa_scale;
+    }
+    measure();
+}
+
+void Raceline::measure() {
+    total_length = 0;
+    s.resize(size());
+    for (size_t i = 0; i < size(); i++) {
+        s[i] = total_length;
+        size_t next = i + 1 == size() ? 0 : i + 1;
+        total_length += std::hypot(x[next] - x[i], y[next] - y[i]);
+    }
+}
+
+size_t Raceline::closest_point(double x_, double y_) const {
+    size_t closest = 0;
+    double closest_distance = INFINITY;
+    for (size_t i = 0; i < size(); i++) {
+        // squared distances are enough for comparing
+        double distance = (x[i] - x_) * (x[i] - x_) + (y[i] - y_) * (y[i] - y_);
+        if (distance < closest_distance) {
+            closest_distance = distance;
+            closest = i;
+        }
+    }
+    return closest;
+}
+
+double Raceline::progress(double x_, double y_) const {
+    if (empty()) return 0;
+    size_t closest = closest_point(x_, y_);
+
+    // the closest point on the line is on one of the two segments next to the closest point
+    double best_distance = INFINITY;
+    double best_s = s[closest];
+    size_t previous = closest == 0 ? size() - 1 : closest - 1;
+    for (size_t start : {previous, closest}) {
+        size_t end = start + 1 == size() ? 0 : start + 1;
+        double dx = x[end] - x[start];
+        double dy = y[end] - y[start];
+        double squared_length = dx * dx + dy * dy;
+        double t = squared_length > 0 ? ((x_ - x[start]) * dx + (y_ - y[start]) * dy) / squared_length : 0;
+        t = std::min(std::max(t, 0.), 1.);
+        double px = x[start] + t * dx - x_;
+        double py = y[start] + t * dy - y_;
+        double distance = px * px + py * py;
+        if (distance < best_distance) {
+            best_distance = distance;
+            best_s = s[start] + t * std::sqrt(squared_length);
+        }
+    }
+    return best_s >= total_length ? best_s - total_length : best_s;
+}
@@ -0,0 +1,283 @@
+#include "f1tenth_simulator/range_lut.hpp"
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <numeric>
+
+using namespace racecar_simulator;
+
+RangeLUT::RangeLUT(int theta_discretization_)
+  : theta_discretization(theta_discretization_),
+    num_directions(std::max(theta_discretization_ / 2, 1)),
+    resolution(0),
+    unit(0),
+    built(false),
+    cancelled(false) {
+}
+
+RangeLUT::~RangeLUT() {
+    // a new map may arrive while the old table is still being built, tell the builder to give up and wait for it
+    cancelled.store(true);
+    if (builder.joinable()) builder.join();
+}
+
+void RangeLUT::build(const std::vector<double> & dt, size_t width, size_t height, double resolution_) {
+    resolution = resolution_;
+    build_from_bitmap(free_cells(dt, width, height));
+}
+
+void RangeLUT::build_async(const std::vector<double> & dt, size_t width, size_t height, double resolution_) {
+    resolution = resolution_;
+    // the caller holds the lock of the map, so only one pass over dt is done here, for a bit per cell the thread
+    // keeps. Finding the boundary cells and building the tables happens in the thread
+    builder = std::thread(&RangeLUT::build_from_bitmap, this, free_cells(dt, width, height));
+}
+
+OccupancyBitmap RangeLUT::free_cells(const std::vector<double> & dt, size_t width, size_t height) {
+    OccupancyBitmap free;
+    free.resize(width, height);
+    for (size_t row = 0; row < height; row++) {
+        const double * cells = dt.data() + row * width;
+        uint64_t * words = free.bits.data() + row * free.words_per_row;
+        // a word at a time, this is bound by reading dt
+        for (size_t word = 0; word < free.words_per_row; word++) {
+            size_t begin = word * 64, end = std::min(begin + 64, width);
+            uint64_t bits = 0;
+            for (size_t col = begin; col < end; col++) bits |= uint64_t(cells[col] != 0) << (col - begin);
+            words[word] = bits;
+        }
+    }
+    return free;
+}
+
+void RangeLUT::build_from_bitmap(OccupancyBitmap free) {
+    size_t width = free.width, height = free.height;
+    std::vector<Cell> cells;
+    find_boundary_cells(free, cells);
+    // only the cells are needed from here on
+    free = OccupancyBitmap();
+    build_tables(std::move(cells), width, height);
+}
+
+void RangeLUT::find_boundary_cells(const OccupancyBitmap & free, std::vector<Cell> & cells) const {
+    long long width = free.width, height = free.height;
+    // a ray going through free space can only enter an obstacle through the edge of an occupied cell that touches a free cell,
+    // so all other occupied cells are never the first obstacle of a ray and are not stored
+    auto is_free = [&](long long row, long long col) {
+        if (row < 0 or col < 0 or row >= height or col >= width) return false;
+        return free.is_free(row, col);
+    };
+    auto add = [&](long long row, long long col) {
+        cells.push_back({(float) ((col + 0.5) * resolution), (float) ((row + 0.5) * resolution)});
+    };
+
+    for (long long row = 0; row < height; row++) {
+        for (long long col = 0; col < width; col++) {
+            if (is_free(row, col)) continue;
+            if (is_free(row - 1, col) or is_free(row + 1, col) or is_free(row, col - 1) or is_free(row, col + 1)) {
+                add(row, col);
+            }
+        }
+    }
+
+    // the ray marcher treats everything outside of the map as an obstacle,
+    // so a ring of occupied cells around the map stops the rays that would leave it
+    for (long long col = 0; col < width; col++) {
+        if (is_free(0, col)) add(-1, col);
+        if (is_free(height - 1, col)) add(height, col);
+    }
+    for (long long row = 0; row < height; row++) {
+        if (is_free(row, 0)) add(row, -1);
+        if (is_free(row, width - 1)) add(row, width);
+    }
+}
+
+void RangeLUT::chord(double c, double s, double offset, double * entry, double * exit) const {
+    // the line is z * (c, s) + offset * (-s, c) from the centre of the cell, it is inside the square
+    // while both |x| and |y| are at most half a cell, the slab method
+    double h = 0.5 * resolution;
+    double low = -std::numeric_limits<double>::infinity();
+    double high = std::numeric_limits<double>::infinity();
+    // x = z * c - offset * s
+    if (std::abs(c) > 1e-12) {
+        double a = (-h + offset * s) / c;
+        double b = (h + offset * s) / c;
+        low = std::max(low, std::min(a, b));
+        high = std::min(high, std::max(a, b));
+    }
+    // y = z * s + offset * c
+    if (std::abs(s) > 1e-12) {
+        double a = (-h - offset * c) / s;
+        double b = (h - offset * c) / s;
+        low = std::max(low, std::min(a, b));
+        high = std::min(high, std::max(a, b));
+    }
+    // the line only touches a corner (or misses it by a rounding error), it goes in and out at the same point
+    if (low > high) low = high = 0.5 * (low + high);
+    *entry = low;
+    *exit = high;
+}
+
+void RangeLUT::build_tables(std::vector<Cell> cells, size_t width, size_t height) {
+    // everything is within the map plus the ring of cells around it
+    double min_x = -resolution, max_x = (width + 1) * resolution;
+    double min_y = -resolution, max_y = (height + 1) * resolution;
+    double diagonal = std::hypot(max_x - min_x, max_y - min_y);
+
+    // positions along a lane are stored as 16 bit integers, a quarter of a cell is precise enough
+    // compared with the ray marcher, bigger maps get a coarser unit so the whole lane fits
+    unit = std::max(resolution / 4, diagonal / std::numeric_limits<uint16_t>::max());
+
+    sines.resize(num_directions);
+    cosines.resize(num_directions);
+    lane_start.resize(num_directions);
+    z_start.resize(num_directions);
+    num_lanes.resize(num_directions);
+    first_lane.resize(num_directions);
+
+    std::vector<uint32_t> lanes, counts;
+    std::vector<double> z;
+    std::vector<uint32_t> order(cells.size());
+    lane_offsets.clear();
+    entries.clear();
+    lengths.clear();
+
+    for (int t = 0; t < num_directions; t++) {
+        if (cancelled.load(std::memory_order_relaxed)) return;
+
+        // directions are the same as the ones of the scanner, theta = 2Pi * t / theta_discretization,
+        // t + num_directions is the opposite direction and uses the same lanes backwards
+        double theta = 2 * M_PI * t / theta_discretization;
+        double c = std::cos(theta);
+        double s = std::sin(theta);
+        cosines[t] = c;
+        sines[t] = s;
+
+        // z is the position along the direction, n is the position along its normal (-s, c)
+        double corners_z[4] = {min_x * c + min_y * s, max_x * c + min_y * s, min_x * c + max_y * s, max_x * c + max_y * s};
+        double corners_n[4] = {-min_x * s + min_y * c, -max_x * s + min_y * c, -min_x * s + max_y * c, -max_x * s + max_y * c};
+        z_start[t] = *std::min_element(corners_z, corners_z + 4);
+        lane_start[t] = *std::min_element(corners_n, corners_n + 4);
+        double lane_end = *std::max_element(corners_n, corners_n + 4);
+        num_lanes[t] = std::ceil((lane_end - lane_start[t]) / resolution) + 1;
+        first_lane[t] = lane_offsets.size();
+
+        // a cell is stored in the lanes whose centre line goes through its square, that is one or two lanes.
+        // a ray is looked up on the centre line of its lane, so the cells its lane only clips at a corner
+        // would stop it short
+        double half_extent = 0.5 * resolution * (std::abs(s) + std::abs(c));
+
+        z.resize(cells.size());
+        for (size_t i = 0; i < cells.size(); i++) {
+            z[i] = cells[i].x * c + cells[i].y * s;
+        }
+        // insert the cells in the order along the direction, then every lane is almost sorted already
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {return z[a] < z[b];});
+
+        // count the cells of each lane first, then fill them in (compressed sparse row)
+        counts.assign(num_lanes[t] + 1, 0);
+        lanes.resize(2 * cells.size());
+        for (size_t i = 0; i < cells.size(); i++) {
+            double n = -cells[i].x * s + cells[i].y * c - lane_start[t];
+            long long first = std::ceil((n - half_extent) / resolution - 0.5);
+            long long last = std::floor((n + half_extent) / resolution - 0.5);
+            first = std::max(first, 0ll);
+            last = std::min(last, (long long) num_lanes[t] - 1);
+            // a square can't be wider than two lanes, so store the range as a start and a size
+            lanes[2 * i] = first;
+            lanes[2 * i + 1] = std::max(last - first + 1, 0ll);
+            for (long long lane = first; lane <= last; lane++) counts[lane + 1]++;
+        }
+        for (uint32_t lane = 0; lane < num_lanes[t]; lane++) counts[lane + 1] += counts[lane];
+
+        size_t base = entries.size();
+        entries.resize(base + counts[num_lanes[t]]);
+        lengths.resize(base + counts[num_lanes[t]]);
+        for (uint32_t lane = 0; lane < num_lanes[t]; lane++) {
+            lane_offsets.push_back(base + counts[lane]);
+        }
+        for (uint32_t i : order) {
+            double n = -cells[i].x * s + cells[i].y * c - lane_start[t];
+            for (uint32_t lane = lanes[2 * i]; lane < lanes[2 * i] + lanes[2 * i + 1]; lane++) {
+                // where the centre line of the lane enters and leaves the square, relative to the centre of the cell
+                double entry, exit;
+                chord(c, s, (lane + 0.5) * resolution - n, &entry, &exit);
+                long long entry_unit = std::lround((z[i] + entry - z_start[t]) / unit);
+                long long exit_unit = std::lround((z[i] + exit - z_start[t]) / unit);
+                entries[base + counts[lane]] = entry_unit;
+                lengths[base + counts[lane]] = std::max(exit_unit - entry_unit, 0ll);
+                counts[lane]++;
+            }
+        }
+
+        // the chords of the cells on the centre line of a lane don't overlap, but the order of the centres of
+        // the cells isn't always the order of their chords, a few neighbours have to be swapped
+        for (uint32_t lane = 0; lane < num_lanes[t]; lane++) {
+            size_t begin = lane_offsets[first_lane[t] + lane];
+            size_t end = base + counts[lane];
+            for (size_t i = begin + 1; i < end; i++) {
+                for (size_t j = i; j > begin and entries[j - 1] > entries[j]; j--) {
+                    std::swap(entries[j - 1], entries[j]);
+                    std::swap(lengths[j - 1], lengths[j]);
+                }
+            }
+        }
+    }
+    // the end of the last lane
+    lane_offsets.push_back(entries.size());
+    lane_offsets.shrink_to_fit();
+    entries.shrink_to_fit();
+    lengths.shrink_to_fit();
+
+    built.store(true, std::memory_order_release);
+}
+
+double RangeLUT::range(double x, double y, double angle) const {
+    // snap the angle to the nearest direction in the table
+    long long t = std::lround(angle * theta_discretization / (2 * M_PI));
+    t %= 2 * num_directions;
+    if (t < 0) t += 2 * num_directions;
+    bool backwards = t >= num_directions;
+    if (backwards) t -= num_directions;
+
+    double c = cosines[t];
+    double s = sines[t];
+    long long lane = std::floor((-x * s + y * c - lane_start[t]) / resolution);
+    // outside of the map, same as distance_transform() returning 0
+    if (lane < 0 or lane >= num_lanes[t]) return 0;
+
+    size_t begin = lane_offsets[first_lane[t] + lane];
+    size_t end = lane_offsets[first_lane[t] + lane + 1];
+    size_t first = begin, last = end;
+    double z = (x * c + y * s - z_start[t]) / unit;
+
+    // the ray is looked up on the centre line of its lane, a ray starting inside an obstacle has range 0
+    // like the ray marcher
+    if (not backwards) {
+        // the first obstacle that doesn't end before z
+        while (first < last) {
+            size_t middle = first + (last - first) / 2;
+            if (entries[middle] + lengths[middle] <= z) first = middle + 1;
+            else last = middle;
+        }
+        if (first == end) return std::numeric_limits<double>::infinity();
+        return std::max(entries[first] * unit - z * unit, 0.);
+    } else {
+        // the last obstacle that starts before z
+        while (first < last) {
+            size_t middle = first + (last - first) / 2;
+            if (entries[middle] < z) first = middle + 1;
+            else last = middle;
+        }
+        if (first == begin) return std::numeric_limits<double>::infinity();
+        return std::max(z * unit - (entries[first - 1] + lengths[first - 1]) * unit, 0.);
+    }
+}
+
+size_t RangeLUT::memory_usage() const {
+    return entries.capacity() * sizeof(uint16_t) + lengths.capacity() * sizeof(uint8_t) + lane_offsets.capacity() * sizeof(uint32_t) +
+           (sines.capacity() + cosines.capacity() + lane_start.capacity() + z_start.capacity()) * sizeof(double) +
+           (num_lanes.capacity() + first_lane.capacity()) * sizeof(uint32_t);
+}
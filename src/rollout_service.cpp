@@ -0,0 +1,130 @@
+#include "f1tenth_simulator/rollout_service.hpp"
+
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+using namespace racecar_simulator;
+
+namespace {
+
+// cars per chunk of rollout(), every car is horizon steps
+const size_t rollout_grain = 4;
+// steps per chunk of linearize(), every step is 2 * (state_size - 1 + control_size) steps of the model
+const size_t linearize_grain = 16;
+
+}
+
+RolloutService::RolloutService(const CarParams & params_, double dt_, double physics_dt_,
+                               STKinematics::Integrator integrator_, size_t num_threads)
+  : params(params_),
+    dt(dt_),
+    physics_dt(physics_dt_),
+    integrator(integrator_),
+    perturbation(std::cbrt(DBL_EPSILON)),
+    pool(new ThreadPool(num_threads)) {
+}
+
+CarState RolloutService::step(const CarState & state, double desired_speed, double desired_steer_angle) const {
+    return STKinematics::integrate(state, desired_speed, desired_steer_angle, params, dt, physics_dt, integrator);
+}
+
+void RolloutService::rollout(const CarState * starts, size_t batch, const double * controls, size_t horizon,
+                             CarState * trajectories) {
+    std::lock_guard<std::mutex> lock(mutex);
+    run_rollout(starts, batch, controls, horizon, trajectories);
+}
+
+void RolloutService::run_rollout(const CarState * starts, size_t batch, const double * controls, size_t horizon,
+                                 CarState * trajectories) {
+    pool->parallel_for(batch, rollout_grain, [&](size_t begin, size_t end, size_t) {
+        for (size_t car = begin; car < end; car++) {
+            CarState * trajectory = trajectories + car * (horizon + 1);
+            const double * control = controls + car * horizon * control_size;
+            trajectory[0] = starts[car];
+            for (size_t k = 0; k < horizon; k++) {
+                trajectory[k + 1] = step(trajectory[k], control[k * control_size], control[k * control_size + 1]);
+            }
+        }
+    });
+}
+
+void RolloutService::linearize(const CarState * starts, size_t batch, const double * controls, size_t horizon,
+                               CarState * trajectories, double * state_jacobians, double * control_jacobians) {
+    std::lock_guard<std::mutex> lock(mutex);
+    run_rollout(starts, batch, controls, horizon, trajectories);
+
+    // the steps are independent once the trajectories are there, so the threads share them, not the cars
+    pool->parallel_for(batch * horizon, linearize_grain, [&](size_t begin, size_t end, size_t) {
+        for (size_t index = begin; index < end; index++) {
+            size_t car = index / horizon;
+            size_t k = index % horizon;
+            linearize_step(trajectories[car * (horizon + 1) + k], controls + index * control_size,
+                           state_jacobians + index * state_size * state_size,
+                           control_jacobians + index * state_size * control_size);
+        }
+    });
+}
+
+void RolloutService::linearize_step(const CarState & state, const double * control, double * state_jacobian,
+                                    double * control_jacobian) const {
+    double x[state_size];
+    to_vector(state, x);
+    double plus[state_size], minus[state_size];
+
+    for (size_t column = 0; column < state_size; column++) {
+        // the model ignores slip_angle, it only writes the slip of the front tire
+        if (column == 7) {
+            for (size_t row = 0; row < state_size; row++) state_jacobian[row * state_size + column] = 0;
+            continue;
+        }
+        double h = perturbation * std::max(1.0, std::abs(x[column]));
+        double saved = x[column];
+        x[column] = saved + h;
+        to_vector(step(from_vector(x, state.st_dyn), control[0], control[1]), plus);
+        x[column] = saved - h;
+        to_vector(step(from_vector(x, state.st_dyn), control[0], control[1]), minus);
+        x[column] = saved;
+        for (size_t row = 0; row < state_size; row++) {
+            state_jacobian[row * state_size + column] = (plus[row] - minus[row]) / (2 * h);
+        }
+    }
+
+    for (size_t column = 0; column < control_size; column++) {
+        double u_plus[control_size] = {control[0], control[1]};
+        double u_minus[control_size] = {control[0], control[1]};
+        double h = perturbation * std::max(1.0, std::abs(control[column]));
+        u_plus[column] += h;
+        u_minus[column] -= h;
+        to_vector(step(state, u_plus[0], u_plus[1]), plus);
+        to_vector(step(state, u_minus[0], u_minus[1]), minus);
+        for (size_t row = 0; row < state_size; row++) {
+            control_jacobian[row * control_size + column] = (plus[row] - minus[row]) / (2 * h);
+        }
+    }
+}
+
+void RolloutService::to_vector(const CarState & state, double * vector) {
+    vector[0] = state.x;
+    vector[1] = state.y;
+    vector[2] = state.theta;
+    vector[3] = state.velocity_x;
+    vector[4] = state.velocity_y;
+    vector[5] = state.steer_angle;
+    vector[6] = state.angular_velocity;
+    vector[7] = state.slip_angle;
+}
+
+CarState RolloutService::from_vector(const double * vector, bool st_dyn) {
+    CarState state;
+    state.x = vector[0];
+    state.y = vector[1];
+    state.theta = vector[2];
+    state.velocity_x = vector[3];
+    state.velocity_y = vector[4];
+    state.steer_angle = vector[5];
+    state.angular_velocity = vector[6];
+    state.slip_angle = vector[7];
+    state.st_dyn = st_dyn;
+    return state;
+}
@@ -1,13 +1,62 @@
 #include "f1tenth_simulator/pose_2d.hpp"
 #include "f1tenth_simulator/scan_simulator_2d.hpp"
 #include "f1tenth_simulator/distance_transform.hpp"
-#include <ros/ros.h>
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <cmath>
+#include <chrono>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 using namespace racecar_simulator;
 
+namespace {
+
+// Gather dt[cells[i]] for every lane with a non-negative cell, other lanes get 0,
+// which is the same as distance_transform() returns for a position outside the map.
+// AVX2 has a real masked gather instruction. NEON does not have one, so on ARM (and on plain x86-64 builds)
+// the lanes are loaded one by one, the rest of the packet arithmetic is still vectorized by the compiler.
+inline void gather_distances(const double * dt, const long long * cells, int lanes, double * distances) {
+#if defined(__AVX2__)
+    int lane = 0;
+    for (; lane + 4 <= lanes; lane += 4) {
+        __m256i index = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(cells + lane));
+        // sign bit of every 64 bit lane is set when the cell is inside the map
+        __m256d mask = _mm256_castsi256_pd(_mm256_cmpgt_epi64(index, _mm256_set1_epi64x(-1)));
+        __m256d result = _mm256_mask_i64gather_pd(_mm256_setzero_pd(), dt, index, mask, 8);
+        _mm256_storeu_pd(distances + lane, result);
+    }
+    for (; lane < lanes; lane++) {
+        distances[lane] = cells[lane] < 0 ? 0 : dt[cells[lane]];
+    }
+#else
+    for (int lane = 0; lane < lanes; lane++) {
+        distances[lane] = cells[lane] < 0 ? 0 : dt[cells[lane]];
+    }
+#endif
+}
+
+// SplitMix64, a good 64 bit hash of a counter, so the noise of a beam only depends on the seed of the scan and the beam
+inline uint64_t mix_bits(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Gaussian noise of one beam, Box-Muller with two uniform numbers hashed from the seed and the beam,
+// the first one is in (0, 1] so its log is finite
+inline double beam_noise(uint64_t seed, int beam, double std_dev) {
+    uint64_t counter = seed + 2 * static_cast<uint64_t>(beam) * 0x9e3779b97f4a7c15ULL;
+    double u1 = ((mix_bits(counter) >> 11) + 1) / 9007199254740992.0;
+    double u2 = (mix_bits(counter + 0x9e3779b97f4a7c15ULL) >> 11) / 9007199254740992.0;
+    return std_dev * std::sqrt(-2 * std::log(u1)) * std::cos(2 * M_PI * u2);
+}
+
+}
+
 ScanSimulator2D::ScanSimulator2D(
     int num_beams_, 
     double field_of_view_, 
@@ -22,17 +71,15 @@ ScanSimulator2D::ScanSimulator2D(
     scan_max_range(scan_max_range_),
     cube_width(cube_width_),
     ray_tracing_epsilon(ray_tracing_epsilon_),
+    vectorized(true),
+    scan_map(std::make_shared<ScanMap>()),
+    dt_from_cache(false),
+    use_range_lut(false),
     theta_discretization(theta_discretization) {
+    march.refine_epsilon = ray_tracing_epsilon;
     // Initialize laser settings
     angle_increment = field_of_view / (num_beams - 1);
 
-    // Initialize the output
-    scan_output = std::vector<double>(num_beams);
-
-    // Initialize the noise
-    noise_generator = std::mt19937(std::random_device{}());
-    noise_dist = std::normal_distribution<double>(0., scan_std_dev);
-
     // It is very IMPORTANT to understand theta_index_increment and why they implemented this
     // angle_increment/(2 * M_PI) means how many beams there are if we scan 360 degree with current angular_increment
     // we know that with current angular_increment, there are 1080+1 beams for 270 degree
@@ -46,49 +93,108 @@ ScanSimulator2D::ScanSimulator2D(
     // theta_index_increment means how many teeth incremented in larger gear when smaller gear incremented 1 tooth.
     theta_index_increment = theta_discretization * angle_increment / (2 * M_PI);
 
-    // Precompute sines, cosines and arctanes
-    sines = std::vector<double>(theta_discretization + 1);
-    cosines = std::vector<double>(theta_discretization + 1);
-    arctanes = std::vector<double>(theta_discretization + 1);
-
-    // slice 2PI into theta_discretization(2000+1) parts, and calculate sin cos arctan
-    for (int i = 0; i <= theta_discretization; i++) {
-        // calculate theta on the discretization from 0 to 2Pi
-        double theta = (2 * M_PI * i) / ((double) theta_discretization);
-
-        // calculate sin and cos of that theta value
-        // the reason we precompute all sin and cos is that we can only compute sin and cos for each theta just one time
-        // although we can calculate theta of beam easily and then calculate the sin and cos, imagine there are 1081 beams in one scan,
-        // and in every second there are hundreds scans happened, but a lot of theta actually is calculated over and over again.
-        // hence, better have a copy of all sin and cos, and when we need it, just directly get it from vector.
-        sines[i] = std::sin(theta);
-        cosines[i] = std::cos(theta);
-
-        // this is for calculating slope of beams, so that we will know whether a beam intersects with the opponent car
-        // due to theta actually starts from X axis which is y/x, so we need to calculate tan(theta) first and divided by 1, which will become x/y.
-        // and when theta = 0 or Pi or 2Pi, tan(theta) will be 0, so avoid those number, although no exception will occur if not do this
-        if (theta != 0 or theta != M_PI or theta != 2 * M_PI) {
-            arctanes[i] = 1 / std::tan(theta);
-        }
-    }
+    // sines, cosines and arctanes of theta_discretization(2000+1) angles, shared with every scanner of the same
+    // theta_discretization, see SensorGeometry
+    angle_tables = SensorGeometry::angle_tables(theta_discretization);
+    sines = angle_tables->sines();
+    cosines = angle_tables->cosines();
+    arctanes = angle_tables->arctanes();
 
     // this threshold is for reporting can see the opponent when the opponent is in the threshold distance
     threshold = 5;
 }
 
-const std::vector<double> ScanSimulator2D::scan(const Pose2D & pose, const Pose2D & opponent_pose, bool flag) {
+const std::vector<double> & ScanSimulator2D::scan(const Pose2D & pose, const Pose2D & opponent_pose, bool flag) {
+    context.ranges.resize(num_beams);
+    scan_into(pose, &opponent_pose, 1, context.ranges.data(), flag, context);
+    return context.ranges;
+}
+
+void ScanSimulator2D::scan(const Pose2D & pose, const Pose2D & opponent_pose, double * scan_data) {
+    scan(pose, &opponent_pose, 1, scan_data);
+}
+
+const std::vector<double> & ScanSimulator2D::scan(const Pose2D & pose, const std::vector<Pose2D> & opponent_poses, bool flag) {
 
     // this flag indicates that whether the car, called scan() method, want to know can see opponent or not
     // for example, blue car is calling scan method, and blue car don't want to know whether it can see red car or not,
     // then, blue car can pass false.
-    flag_can_see_opponent = flag;
-    can_see_opponent = false;
+    return scan(pose, opponent_poses, flag, context);
+}
 
-    scan(pose, opponent_pose, scan_output.data());
-    return scan_output;
+void ScanSimulator2D::scan(const Pose2D & pose, const Pose2D * opponent_poses, size_t num_opponents, double * scan_data) {
+    // scans without a flag leave the visibility of the last scan as it is
+    bool can_see_opponent = context.can_see_opponent;
+    scan_into(pose, opponent_poses, num_opponents, scan_data, false, context);
+    context.can_see_opponent = can_see_opponent;
 }
 
-void ScanSimulator2D::scan(const Pose2D & pose, const Pose2D & opponent_pose, double * scan_data) {
+void ScanSimulator2D::scan(const Pose2D & pose, const Pose2D * opponent_poses, size_t num_opponents, float * scan_data, bool flag) {
+    scan_into(pose, opponent_poses, num_opponents, scan_data, flag, context);
+}
+
+void ScanSimulator2D::scan(const Pose2D & pose, const Pose2D * opponent_poses, size_t num_opponents, float * scan_data, bool flag,
+                           ScanContext & context_) const {
+    scan_into(pose, opponent_poses, num_opponents, scan_data, flag, context_);
+}
+
+void ScanSimulator2D::scan(const Pose2D & pose, const Pose2D * opponent_poses, size_t num_opponents, double * scan_data, bool flag,
+                           ScanContext & context_) const {
+    scan_into(pose, opponent_poses, num_opponents, scan_data, flag, context_);
+}
+
+const std::vector<double> & ScanSimulator2D::scan(const Pose2D & pose, const std::vector<Pose2D> & opponent_poses, bool flag,
+                                                  ScanContext & context_) const {
+    context_.ranges.resize(num_beams);
+    scan_into(pose, opponent_poses.data(), opponent_poses.size(), context_.ranges.data(), flag, context_);
+    return context_.ranges;
+}
+
+template <typename T>
+void ScanSimulator2D::scan_into(const Pose2D & pose, const Pose2D * opponent_poses, size_t num_opponents, T * scan_data,
+                                bool flag, ScanContext & context_) const {
+    // the map must not change in the middle of a scan
+    std::shared_lock<std::shared_timed_mutex> lock(scan_map->mutex);
+
+    prepare_scan(pose, opponent_poses, num_opponents, context_);
+    context_.can_see_opponent = scan_beams(*scan_map, pose, context_, 0, num_beams, scan_data, flag);
+}
+
+void ScanSimulator2D::scan_batch(ScanRequest * requests, size_t num_requests, ThreadPool & pool, int beams_per_chunk) const {
+    std::shared_lock<std::shared_timed_mutex> lock(scan_map->mutex);
+    const ScanMap & map = *scan_map;
+
+    // the per scan part is cheap, it is done before the beams are split up
+    beams_per_chunk = std::max(beams_per_chunk, 1);
+    size_t chunks_per_scan = (num_beams + beams_per_chunk - 1) / beams_per_chunk;
+    for (size_t r = 0; r < num_requests; r++) {
+        ScanContext & context_ = *requests[r].context;
+        prepare_scan(requests[r].pose, requests[r].opponent_poses, requests[r].num_opponents, context_);
+        context_.chunk_saw_opponent.assign(chunks_per_scan, 0);
+    }
+
+    // every chunk is (scan, first beam), all chunks of all scans go to the pool together.
+    // The workers don't take the lock again, a writer waiting for the mutex would block them while this thread waits for them
+    pool.parallel_for(num_requests * chunks_per_scan, 1, [&](size_t begin, size_t end, size_t) {
+        for (size_t chunk = begin; chunk < end; chunk++) {
+            const ScanRequest & request = requests[chunk / chunks_per_scan];
+            size_t index = chunk % chunks_per_scan;
+            int first = index * beams_per_chunk;
+            int last = std::min(first + beams_per_chunk, num_beams);
+            request.context->chunk_saw_opponent[index] =
+                scan_beams(map, request.pose, *request.context, first, last, request.scan_data, request.flag);
+        }
+    });
+
+    for (size_t r = 0; r < num_requests; r++) {
+        ScanContext & context_ = *requests[r].context;
+        context_.can_see_opponent = std::find(context_.chunk_saw_opponent.begin(), context_.chunk_saw_opponent.end(), 1)
+                                    != context_.chunk_saw_opponent.end();
+    }
+}
+
+void ScanSimulator2D::prepare_scan(const Pose2D & pose, const Pose2D * opponent_poses, size_t num_opponents,
+                                   ScanContext & context_) const {
     // Make theta discrete by mapping the range [-pi,pi] onto [0, theta_discretization)
     // field_of_view/2 = 3/4 PI
     // (pose.theta - field_of_view/2.)/(2 * M_PI) is to calculate the orientation of lidar scan starting beam
@@ -103,15 +209,21 @@ void ScanSimulator2D::scan(const Pose2D & pose, const Pose2D & opponent_pose, do
     // if theta_index less than 0, add a theta_discretization, then it will be greater than 0
     if (theta_index < 0) theta_index += theta_discretization;
 
-    // process through each beam (1081).
-    // For theta_index, we will only use number of theta_index that equal to number of beams
-    for (int i = 0; i < num_beams; i++) {
-        // Compute the distance to the nearest point
-        scan_data[i] = trace_ray(pose.x, pose.y, theta_index, opponent_pose.x, opponent_pose.y, opponent_pose.theta);
+    // everything about the opponent cars that doesn't depend on the beam,
+    // cars that are out of range are dropped here, so they cost nothing per beam
+    context_.footprints.resize(num_opponents);
+    context_.num_footprints = 0;
+    for (size_t i = 0; i < num_opponents; i++) {
+        if (compute_footprint(pose, opponent_poses[i], context_.footprints[context_.num_footprints])) context_.num_footprints++;
+    }
 
-        // Add Gaussian noise to the trace ray
-        if (scan_std_dev > 0)
-            scan_data[i] += noise_dist(noise_generator);
+    // For theta_index, we will only use number of theta_index that equal to number of beams (1081).
+    // They are added up beam after beam like the scalar version always did, so every path (and every chunk of beams)
+    // uses the same sines and cosines
+    context_.theta_indices.resize(num_beams);
+    for (int i = 0; i < num_beams; i++) {
+        // Add 0.5 to make this operation round to ceil rather than floor
+        context_.theta_indices[i] = theta_index + 0.5;
 
         // Increment the scan
         theta_index += theta_index_increment;
@@ -121,6 +233,59 @@ void ScanSimulator2D::scan(const Pose2D & pose, const Pose2D & opponent_pose, do
         while (theta_index >= theta_discretization)
             theta_index -= theta_discretization;
     }
+
+    context_.noise_seed = context_.noise_generator();
+}
+
+template <typename T>
+bool ScanSimulator2D::scan_beams(const ScanMap & map, const Pose2D & pose, const ScanContext & context_, int begin, int end,
+                                 T * scan_data, bool flag) const {
+    const OpponentFootprint * footprints = context_.footprints.data();
+    size_t num_footprints = context_.num_footprints;
+    bool saw_opponent = false;
+
+    // beams are handled packet_size at a time, in the scalar mode the packet just goes through trace_ray() beam by beam
+    double total_distances[packet_size];
+    double hit_x[packet_size];
+    double hit_y[packet_size];
+
+    for (int i = begin; i < end; i += packet_size) {
+        int lanes = std::min(packet_size, end - i);
+        const int * theta_indices = context_.theta_indices.data() + i;
+
+        if (lut_ready(map)) {
+            lookup_packet(map, pose.x, pose.y, theta_indices, lanes, total_distances, hit_x, hit_y);
+        } else if (vectorized) {
+            march_packet(map, pose.x, pose.y, theta_indices, lanes, total_distances, hit_x, hit_y);
+        } else {
+            for (int lane = 0; lane < lanes; lane++) {
+                total_distances[lane] = march_ray(map, pose.x, pose.y, theta_indices[lane], hit_x + lane, hit_y + lane);
+            }
+        }
+
+        for (int lane = 0; lane < lanes; lane++) {
+            // Compute the distance to the nearest point, beams that can't reach any opponent car only see the racetrack,
+            // when a beam can reach several cars the closest one wins
+            bool hit_checked = false;
+            double range = 0;
+            for (size_t j = 0; j < num_footprints; j++) {
+                if (not may_hit_opponent(footprints[j], i + lane)) continue;
+                double opponent_range = intersect_opponent(pose.x, pose.y, theta_indices[lane],
+                                                           hit_x[lane], hit_y[lane], total_distances[lane], footprints[j],
+                                                           flag ? &saw_opponent : nullptr);
+                range = hit_checked ? std::min(range, opponent_range) : opponent_range;
+                hit_checked = true;
+            }
+            // the range is computed in double precision and only rounded when it is stored
+            double output = hit_checked ? range : std::min(total_distances[lane], scan_max_range);
+
+            // Add Gaussian noise to the trace ray
+            if (scan_std_dev > 0)
+                output += beam_noise(context_.noise_seed, i + lane, scan_std_dev);
+            scan_data[i + lane] = output;
+        }
+    }
+    return saw_opponent;
 }
 
 // Ray marching algorithm
@@ -129,21 +294,39 @@ double ScanSimulator2D::trace_ray(double x, double y, double theta_index, double
     // why?
     int theta_index_ = theta_index + 0.5;
 
+    std::shared_lock<std::shared_timed_mutex> lock(scan_map->mutex);
+    double hit_x, hit_y;
+    double total_distance = march_ray(*scan_map, x, y, theta_index_, &hit_x, &hit_y);
+
+    // a single beam has no scan to share the footprint with, so it is computed here
+    Pose2D pose = {x, y, 0};
+    Pose2D opponent_pose = {opponent_X, opponent_Y, opponent_theta};
+    OpponentFootprint opponent;
+    compute_footprint(pose, opponent_pose, opponent);
+
+    return intersect_opponent(x, y, theta_index_, hit_x, hit_y, total_distance, opponent, nullptr);
+}
+
+double ScanSimulator2D::march_ray(const ScanMap & map, double x, double y, int theta_index_, double * hit_x, double * hit_y) const {
     double s = sines[theta_index_];
     double c = cosines[theta_index_];
-    // slope
-    double k = arctanes[theta_index_];
-
-    double original_x = x;
-    double original_y = y;
+    double inv_dir_x, inv_dir_y;
+    map.march_direction(c, s, &inv_dir_x, &inv_dir_y);
 
     // Initialize the distance to the nearest obstacle
     // if x and y is out of racetrack, distance_to_nearest = 0, and while loop will be skipped
-    double distance_to_nearest = distance_transform(x, y);
-    double total_distance = distance_to_nearest;
+    double distance_to_nearest = map.distance_transform(x, y);
+    // how far x and y are from where the beam started
+    double total_distance = 0;
+    // the last step, and where it started, the last point known to be free
+    double step = 0;
+    double free_x = x, free_y = y, free_distance = 0;
 
     // when distance_to_nearest == 0, means either the car out of the map, or this beam reached the boundary of the racetrack
     while (distance_to_nearest != 0) {
+        // x and y are in free space beyond the maximum range, whatever is further away can't change the range
+        if (march.stop_at_max_range and total_distance >= scan_max_range) break;
+
         // Move in the direction of the ray
         // REMEMBER, pose.theta 0 is the positive direction of X axis not Y axis, and ALL theta related value starts from X axis not Y axis
         // hence, the idea is we know that the distance to nearest obstacle of current car position,
@@ -153,20 +336,40 @@ double ScanSimulator2D::trace_ray(double x, double y, double theta_index, double
         // the result is sum of all the distance to nearest obstacle along the way.
         // And the movement can be divided into x direction and y direction,
         // due to theta value is angle between current beam and x direction, so x need to time cos, and y need to time sin.
-        x += distance_to_nearest * c;
-        y += distance_to_nearest * s;
-
-        // get the nearest distance at that point
-        distance_to_nearest = distance_transform(x, y);
-        total_distance += distance_to_nearest;
-
-        // you can comment off the if section below, and you will see something like Moiré pattern
-        // when the racetrack is straight
-        // this is because the size of grid in distance_transform is not small enough
-        // We can apply a small distance to x and y, let them go back a little distance,
-        // and try again to see whether the x and y still in the obstacle or not
-        // this is the first time x and y out of the racetrack
-        if (distance_to_nearest == 0) {
+        step = std::max(distance_to_nearest, march.min_step);
+        free_x = x;
+        free_y = y;
+        free_distance = total_distance;
+        x += step * c;
+        y += step * s;
+        total_distance += step;
+
+        // get the nearest distance at that point, or less if the pyramid has a long step
+        distance_to_nearest = map.march_distance(x, y, inv_dir_x, inv_dir_y);
+    }
+
+    // this is the first time x and y out of the racetrack, the boundary is somewhere in the last step.
+    // Without a refinement you will see something like Moiré pattern when the racetrack is straight,
+    // this is because the size of grid in distance_transform is not small enough
+    if (distance_to_nearest == 0 and step > 0) {
+        if (march.bisect) {
+            // halve the step until it is shorter than refine_epsilon, keeping the free end
+            while (step > march.refine_epsilon) {
+                step *= 0.5;
+                double middle_x = free_x + step * c;
+                double middle_y = free_y + step * s;
+                if (map.distance_transform(middle_x, middle_y) != 0) {
+                    free_x = middle_x;
+                    free_y = middle_y;
+                    free_distance += step;
+                }
+            }
+            x = free_x;
+            y = free_y;
+            total_distance = free_distance;
+        } else {
+            // We can apply a small distance to x and y, let them go back a little distance,
+            // and try again to see whether the x and y still in the obstacle or not
             double error = 0;
             while (distance_to_nearest == 0) {
                 // accumulating error
@@ -174,40 +377,329 @@ double ScanSimulator2D::trace_ray(double x, double y, double theta_index, double
                 // move back a little
                 x -= 0.01 * c;
                 y -= 0.01 * s;
-                distance_to_nearest = distance_transform(x, y);
+                distance_to_nearest = map.distance_transform(x, y);
             }
             // minus total error
             total_distance -= error;
-            break;
         }
     }
+    *hit_x = x;
+    *hit_y = y;
+    return total_distance;
+}
 
-    // start calculating vehicle obstacle in LiDAR
+// Packet version of march_ray()
+// Every lane runs exactly the same sequence of floating point operations as march_ray() does for that beam,
+// only the order between lanes is different, so the results are bit-identical to the scalar path,
+// tests/test_march_packet.cpp checks that. (This needs the compiler not to contract a * b + c into FMA instructions,
+// scalar and packet code could be contracted differently, NATIVE_ARCH builds with -ffp-contract=off for that.)
+// Each lane is in one of four states:
+// marching: moving forward by the distance to the nearest obstacle, same as the while loop in march_ray()
+// bisecting: the lane reached an obstacle and halves its last step, same as the bisection in march_ray()
+// backing off: the lane reached an obstacle and moves back 0.01m a time, without bisection
+// done: the lane finished, it keeps its position and is not looked up anymore
+void ScanSimulator2D::march_packet(
+        const ScanMap & map,
+        double x,
+        double y,
+        const int * theta_indices,
+        int lanes,
+        double * total_distances,
+        double * hit_x,
+        double * hit_y) const {
 
-    // bias of the beam x = ky + b
-    double b = x - k * y;
+    enum {marching, bisecting, backing_off, done};
+
+    double s[packet_size], c[packet_size];
+    double distance_to_nearest[packet_size], error[packet_size];
+    double step[packet_size], free_x[packet_size], free_y[packet_size], free_distance[packet_size];
+    // the steps of marching lanes that were read from the pyramid, 0 if the lane reads its cell
+    double coarse[packet_size], inv_dir_x[packet_size], inv_dir_y[packet_size];
+    long long cells[packet_size];
+    int state[packet_size];
+
+    for (int lane = 0; lane < lanes; lane++) {
+        s[lane] = sines[theta_indices[lane]];
+        c[lane] = cosines[theta_indices[lane]];
+        map.march_direction(c[lane], s[lane], inv_dir_x + lane, inv_dir_y + lane);
+        hit_x[lane] = x;
+        hit_y[lane] = y;
+        total_distances[lane] = 0;
+        error[lane] = 0;
+        step[lane] = 0;
+        cells[lane] = map.field_cell(x, y);
+    }
+
+    // the field is read one lane after the other, only dt can use the gather instruction
+    auto gather = [&]() {
+        if (map.field.is_copy()) {
+            for (int lane = 0; lane < lanes; lane++) {
+                distance_to_nearest[lane] = cells[lane] < 0 ? 0 : map.field.value(cells[lane]);
+            }
+        } else {
+            gather_distances(map.dt.data(), cells, lanes, distance_to_nearest);
+        }
+    };
 
+    // the end of the bisection, the lane stops at the last free point
+    auto finish_bisection = [&](int lane) {
+        hit_x[lane] = free_x[lane];
+        hit_y[lane] = free_y[lane];
+        total_distances[lane] = free_distance[lane];
+        state[lane] = done;
+    };
+
+    // all lanes start from the same position, so the first look up is one and the same for everyone
+    gather();
+
+    int active = 0;
+    for (int lane = 0; lane < lanes; lane++) {
+        // if x and y is out of racetrack, distance_to_nearest = 0, and the lane has nothing to do
+        state[lane] = distance_to_nearest[lane] != 0 ? marching : done;
+        if (state[lane] != done) active++;
+    }
+
+    while (active > 0) {
+        // move every lane, in the direction of the ray, to the middle of its last step or a little bit back
+        for (int lane = 0; lane < lanes; lane++) {
+            if (state[lane] == marching) {
+                if (march.stop_at_max_range and total_distances[lane] >= scan_max_range) {
+                    // free space beyond the maximum range
+                    state[lane] = done;
+                    active--;
+                } else {
+                    step[lane] = std::max(distance_to_nearest[lane], march.min_step);
+                    free_x[lane] = hit_x[lane];
+                    free_y[lane] = hit_y[lane];
+                    free_distance[lane] = total_distances[lane];
+                    hit_x[lane] += step[lane] * c[lane];
+                    hit_y[lane] += step[lane] * s[lane];
+                    total_distances[lane] += step[lane];
+                }
+            } else if (state[lane] == bisecting) {
+                step[lane] *= 0.5;
+                hit_x[lane] = free_x[lane] + step[lane] * c[lane];
+                hit_y[lane] = free_y[lane] + step[lane] * s[lane];
+            } else if (state[lane] == backing_off) {
+                error[lane] += 0.01;
+                hit_x[lane] -= 0.01 * c[lane];
+                hit_y[lane] -= 0.01 * s[lane];
+            }
+            coarse[lane] = 0;
+            if (state[lane] == marching) {
+                cells[lane] = map.march_cell(hit_x[lane], hit_y[lane], inv_dir_x[lane], inv_dir_y[lane], coarse + lane);
+            } else {
+                cells[lane] = state[lane] == done ? -1 : map.field_cell(hit_x[lane], hit_y[lane]);
+            }
+        }
+
+        // get the nearest distance at the new points, lanes that are done get 0 and ignore it
+        gather();
+        for (int lane = 0; lane < lanes; lane++) {
+            if (coarse[lane] > 0) distance_to_nearest[lane] = coarse[lane];
+        }
+
+        for (int lane = 0; lane < lanes; lane++) {
+            if (state[lane] == marching) {
+                // this is the first time x and y out of the racetrack, start refining the last step
+                if (distance_to_nearest[lane] == 0) {
+                    if (not march.bisect) {
+                        state[lane] = backing_off;
+                    } else if (step[lane] > march.refine_epsilon) {
+                        state[lane] = bisecting;
+                    } else {
+                        finish_bisection(lane);
+                        active--;
+                    }
+                }
+            } else if (state[lane] == bisecting) {
+                // keep the free half
+                if (distance_to_nearest[lane] != 0) {
+                    free_x[lane] = hit_x[lane];
+                    free_y[lane] = hit_y[lane];
+                    free_distance[lane] += step[lane];
+                }
+                if (step[lane] <= march.refine_epsilon) {
+                    finish_bisection(lane);
+                    active--;
+                }
+            } else if (state[lane] == backing_off) {
+                // back in the racetrack, minus total error
+                if (distance_to_nearest[lane] != 0) {
+                    total_distances[lane] -= error[lane];
+                    state[lane] = done;
+                    active--;
+                }
+            }
+        }
+    }
+}
+
+void ScanSimulator2D::lookup_packet(
+        const ScanMap & map,
+        double x,
+        double y,
+        const int * theta_indices,
+        int lanes,
+        double * total_distances,
+        double * hit_x,
+        double * hit_y) const {
+
+    // the table works in the frame of the map, same transform as xy_to_row_col()
+    double x_trans = x - map.origin.x;
+    double y_trans = y - map.origin.y;
+    double x_rot =   x_trans * map.origin_c + y_trans * map.origin_s;
+    double y_rot = - x_trans * map.origin_s + y_trans * map.origin_c;
+
+    // same as the ray marcher, a car outside of the racetrack sees nothing
+    bool inside = map.distance_transform(x, y) != 0;
+
+    for (int lane = 0; lane < lanes; lane++) {
+        double total_distance = 0;
+        if (inside) {
+            double theta = 2 * M_PI * theta_indices[lane] / theta_discretization - map.origin.theta;
+            total_distance = map.range_lut->range(x_rot, y_rot, theta);
+            // every lane inside the map ends in an obstacle, this is only a safety net
+            if (not std::isfinite(total_distance)) total_distance = scan_max_range;
+        }
+        total_distances[lane] = total_distance;
+        // where the beam hit the racetrack, intersect_opponent() needs it
+        hit_x[lane] = x + total_distance * cosines[theta_indices[lane]];
+        hit_y[lane] = y + total_distance * sines[theta_indices[lane]];
+    }
+}
+
+void ScanSimulator2D::set_march_settings(const MarchSettings & march_) {
+    march = march_;
+    // the bisection has to end, and a negative step would march backwards
+    march.refine_epsilon = std::max(march.refine_epsilon, 1e-6);
+    march.min_step = std::max(march.min_step, 0.0);
+}
+
+void ScanSimulator2D::set_use_range_lut(bool use_range_lut_) {
+    use_range_lut = use_range_lut_;
+    // the table belongs to the map, other scanners sharing the map may still use it
+    if (use_range_lut) {
+        std::unique_lock<std::shared_timed_mutex> lock(scan_map->mutex);
+        if (not scan_map->range_lut and not scan_map->dt.empty()) build_range_lut();
+    }
+}
+
+bool ScanSimulator2D::range_lut_ready() const {
+    std::shared_lock<std::shared_timed_mutex> lock(scan_map->mutex);
+    return lut_ready(*scan_map);
+}
+
+void ScanSimulator2D::build_range_lut() {
+    // replacing the pointer stops the build of the old table, clones of the map keep the table they had
+    ScanMap & map = *scan_map;
+    map.range_lut = std::make_shared<RangeLUT>(theta_discretization);
+    map.range_lut->build_async(map.dt, map.width, map.height, map.resolution);
+}
+
+bool ScanSimulator2D::compute_footprint(const Pose2D & pose, const Pose2D & opponent_pose, OpponentFootprint & opponent) const {
     // calculate coordinate of four points of opponent car first,
     // x1 y1 is the first corner in anti-clockwise direction from opponent_theta
     // x2 y2 is the second corner, and so on
+    // they are the same for all beams of a scan, so they are only calculated once per scan here
     double center_to_corner = sqrt(2) * cube_width / 2;
 
-    double x1 = center_to_corner * std::cos(    M_PI / 4 + opponent_theta) + opponent_X;
-    double y1 = center_to_corner * std::sin(    M_PI / 4 + opponent_theta) + opponent_Y;
+    opponent.x = opponent_pose.x;
+    opponent.y = opponent_pose.y;
+    for (int i = 0; i < 4; i++) {
+        opponent.corner_x[i] = center_to_corner * std::cos((2 * i + 1) * M_PI / 4 + opponent_pose.theta) + opponent_pose.x;
+        opponent.corner_y[i] = center_to_corner * std::sin((2 * i + 1) * M_PI / 4 + opponent_pose.theta) + opponent_pose.y;
+    }
+
+    // calculate the distance between the LiDAR sensor and opponent car
+    opponent.this_to_opponent = sqrt(pow((pose.x - opponent_pose.x), 2) + pow((pose.y - opponent_pose.y), 2));
+
+    // find out which beams can possibly hit the opponent car, the other beams can skip intersect_opponent()
+    opponent.num_intervals = 0;
+    if (opponent.this_to_opponent <= 2 * center_to_corner) {
+        // the opponent car is too close (or even overlapping), every beam need to be checked
+        opponent.first_beam[0] = 0;
+        opponent.last_beam[0] = num_beams - 1;
+        opponent.num_intervals = 1;
+        return true;
+    }
+
+    // every point of the car is further away than scan_max_range, intersect_opponent() would return
+    // scan_max_range for every beam anyway
+    if (opponent.this_to_opponent - center_to_corner > scan_max_range) return false;
+
+    // the opponent car is inside a circle whose radius is center_to_corner, so a beam can only hit the car
+    // if its angle is within asin(center_to_corner / this_to_opponent) of the direction to the opponent car.
+    // Because the LiDAR is outside of the circle (checked above), all these beams hit the car in front of the LiDAR,
+    // beams pointing away from the car are rejected by the distance checks in intersect_opponent() anyway.
+    double half_width = std::asin(center_to_corner / opponent.this_to_opponent);
+    double direction = std::atan2(opponent_pose.y - pose.y, opponent_pose.x - pose.x) - (pose.theta - field_of_view / 2.);
+    direction = std::fmod(direction, 2 * M_PI);
+    if (direction < 0) direction += 2 * M_PI;
+
+    // beams are spaced angle_increment apart starting from the first beam, two extra beams on each side cover
+    // the rounding of theta_index in scan(), which moves a beam by at most half of a theta_discretization step
+    double first = std::floor((direction - half_width) / angle_increment) - 2;
+    double last = std::ceil((direction + half_width) / angle_increment) + 2;
+    double beams_per_turn = 2 * M_PI / angle_increment;
+
+    // the interval may wrap around the start of the scan, so also try it one turn before and after
+    for (int turn = -1; turn <= 1; turn++) {
+        double first_ = std::max(first + turn * beams_per_turn, 0.);
+        double last_ = std::min(last + turn * beams_per_turn, num_beams - 1.);
+        if (first_ <= last_) {
+            opponent.first_beam[opponent.num_intervals] = std::ceil(first_);
+            opponent.last_beam[opponent.num_intervals] = std::floor(last_);
+            opponent.num_intervals++;
+        }
+    }
+    return opponent.num_intervals > 0;
+}
+
+bool ScanSimulator2D::may_hit_opponent(const OpponentFootprint & opponent, int beam) const {
+    for (int i = 0; i < opponent.num_intervals; i++) {
+        if (opponent.first_beam[i] <= beam and beam <= opponent.last_beam[i]) return true;
+    }
+    return false;
+}
 
-    double x2 = center_to_corner * std::cos(3 * M_PI / 4 + opponent_theta) + opponent_X;
-    double y2 = center_to_corner * std::sin(3 * M_PI / 4 + opponent_theta) + opponent_Y;
+double ScanSimulator2D::intersect_opponent(
+        double original_x,
+        double original_y,
+        int theta_index_,
+        double x,
+        double y,
+        double total_distance,
+        const OpponentFootprint & opponent,
+        bool * saw_opponent) const {
+    // x and y is where the beam reached the obstacle, original_x and original_y is where the beam started
+    // start calculating vehicle obstacle in LiDAR
+
+    // slope
+    double k = arctanes[theta_index_];
+
+    // bias of the beam x = ky + b
+    double b = x - k * y;
 
-    double x3 = center_to_corner * std::cos(5 * M_PI / 4 + opponent_theta) + opponent_X;
-    double y3 = center_to_corner * std::sin(5 * M_PI / 4 + opponent_theta) + opponent_Y;
+    double opponent_X = opponent.x;
+    double opponent_Y = opponent.y;
 
-    double x4 = center_to_corner * std::cos(7 * M_PI / 4 + opponent_theta) + opponent_X;
-    double y4 = center_to_corner * std::sin(7 * M_PI / 4 + opponent_theta) + opponent_Y;
+    double x1 = opponent.corner_x[0];
+    double y1 = opponent.corner_y[0];
 
-    std::vector<std::vector<double>> points = {{y1, y2, x1, x2},
-                                               {y2, y3, x2, x3},
-                                               {y3, y4, x3, x4},
-                                               {y4, y1, x4, x1}};
+    double x2 = opponent.corner_x[1];
+    double y2 = opponent.corner_y[1];
+
+    double x3 = opponent.corner_x[2];
+    double y3 = opponent.corner_y[2];
+
+    double x4 = opponent.corner_x[3];
+    double y4 = opponent.corner_y[3];
+
+    const double points[4][4] = {{y1, y2, x1, x2},
+                                 {y2, y3, x2, x3},
+                                 {y3, y4, x3, x4},
+                                 {y4, y1, x4, x1}};
 
     // decided whether this beam (line) intersects with opponent car (square) or not
     // if we put y coordinate of four corner points into the beam equation, and compare the result with actual x coordinate
@@ -234,8 +726,7 @@ double ScanSimulator2D::trace_ray(double x, double y, double theta_index, double
     // For both circles, their radius need to be smaller than distance between this car and the obstacle,
     // which is the total length of this LiDAR beam.
     // this makes sure that there are one common intersect point and this point is between this car and the obstacle
-    // calculate the distance between the LiDAR sensor and opponent car
-    double this_to_opponent = sqrt(pow((original_x - opponent_X), 2) + pow((original_y - opponent_Y), 2));
+    double this_to_opponent = opponent.this_to_opponent;
 
     // for this car, the opponent car need to be closer than the obstacle
     if (this_to_opponent < total_distance) {
@@ -247,9 +738,8 @@ double ScanSimulator2D::trace_ray(double x, double y, double theta_index, double
         if (obstacle_to_opponent < total_distance) {
 
             // if you don't use MPC and overtaking algorithm, this if section can be ignored
-            if (flag_can_see_opponent and this_to_opponent < threshold) {
-                can_see_opponent = true;
-                flag_can_see_opponent = false;
+            if (saw_opponent and this_to_opponent < threshold) {
+                *saw_opponent = true;
             }
 
             // if slope is INF, simply return distance between this car to opponent car and minus half square width
@@ -271,10 +761,10 @@ double ScanSimulator2D::trace_ray(double x, double y, double theta_index, double
             double intersection_point4_y = (y1 * x4 - y1 * b + y4 * b - y4 * x1) / (k * y1 - k * y4 - x1 + x4);
             double intersection_point4_x = k * intersection_point4_y + b;
 
-            std::vector<std::vector<double>> array = {{intersection_point1_y, intersection_point1_x},
-                                                      {intersection_point2_y, intersection_point2_x},
-                                                      {intersection_point3_y, intersection_point3_x},
-                                                      {intersection_point4_y, intersection_point4_x}};
+            const double array[4][2] = {{intersection_point1_y, intersection_point1_x},
+                                        {intersection_point2_y, intersection_point2_x},
+                                        {intersection_point3_y, intersection_point3_x},
+                                        {intersection_point4_y, intersection_point4_x}};
             double scan_to_square = scan_max_range;
             for (int i = 0; i < 4; i++) {
                 // There will be four intersection point, but the real point we want is just one
@@ -302,20 +792,90 @@ double ScanSimulator2D::trace_ray(double x, double y, double theta_index, double
     return std::min(total_distance, scan_max_range);
 }
 
-double ScanSimulator2D::distance_transform(double x, double y) const {
+double ScanMap::distance_transform(double x, double y) const {
   // Convert the pose to a grid cell
-  int cell = xy_to_cell(x, y);
+  long long cell = field_cell(x, y);
   if (cell < 0) return 0;
-  return dt[cell];
+  return field.is_copy() ? field.value(cell) : dt[cell];
 }
 
-int ScanSimulator2D::xy_to_cell(double x, double y) const {
+long long ScanMap::field_cell(double x, double y) const {
     int row, col;
     xy_to_row_col(x, y, &row, &col);
-    return row_col_to_cell(row, col);
+    if (row < 0) return -1;
+    return field.is_copy() ? (long long) field.index(row, col) : (long long) row_col_to_cell(row, col);
+}
+
+void ScanMap::march_direction(double c, double s, double * inv_dir_x, double * inv_dir_y) const {
+    // rotated into the map frame like xy_to_row_col(), 1 / 0 is infinite and never the nearest side of a block
+    *inv_dir_x = 1 / (c * origin_c + s * origin_s);
+    *inv_dir_y = 1 / (- c * origin_s + s * origin_c);
+}
+
+long long ScanMap::march_cell(double x, double y, double inv_dir_x, double inv_dir_y, double * coarse) const {
+    *coarse = 0;
+    if (pyramid.empty()) return field_cell(x, y);
+
+    // same as xy_to_row_col(), the pyramid needs the position inside the cell as well
+    double x_trans = x - origin.x;
+    double y_trans = y - origin.y;
+    double x_rot =   x_trans * origin_c + y_trans * origin_s;
+    double y_rot = - x_trans * origin_s + y_trans * origin_c;
+    if (x_rot < 0 or x_rot >= width * resolution or y_rot < 0 or y_rot >= height * resolution) return -1;
+
+    *coarse = pyramid.step(x_rot / resolution, y_rot / resolution, inv_dir_x, inv_dir_y);
+    if (*coarse > 0) return -1;
+    int col = std::floor(x_rot / resolution);
+    int row = std::floor(y_rot / resolution);
+    return field.is_copy() ? (long long) field.index(row, col) : (long long) row_col_to_cell(row, col);
+}
+
+double ScanMap::march_distance(double x, double y, double inv_dir_x, double inv_dir_y) const {
+    double coarse;
+    long long cell = march_cell(x, y, inv_dir_x, inv_dir_y, &coarse);
+    if (cell < 0) return coarse;
+    return field.is_copy() ? field.value(cell) : dt[cell];
+}
+
+std::shared_ptr<ScanMap> ScanMap::clone() const {
+    std::shared_ptr<ScanMap> copy = std::make_shared<ScanMap>();
+    copy->resolution = resolution;
+    copy->width = width;
+    copy->height = height;
+    copy->origin = origin;
+    copy->origin_c = origin_c;
+    copy->origin_s = origin_s;
+    copy->dt = dt;
+    copy->field = field;
+    copy->pyramid = pyramid;
+    copy->pyramid_levels = pyramid_levels;
+    copy->range_lut = range_lut;
+    return copy;
+}
+
+double ScanSimulator2D::distance_transform(double x, double y) const {
+    std::shared_lock<std::shared_timed_mutex> lock(scan_map->mutex);
+    return scan_map->distance_transform(x, y);
+}
+
+int ScanSimulator2D::xy_to_cell(double x, double y) const {
+    std::shared_lock<std::shared_timed_mutex> lock(scan_map->mutex);
+    int row, col;
+    scan_map->xy_to_row_col(x, y, &row, &col);
+    return scan_map->row_col_to_cell(row, col);
 }
 
 void ScanSimulator2D::xy_to_row_col(double x, double y, int * row, int * col) const {
+    std::shared_lock<std::shared_timed_mutex> lock(scan_map->mutex);
+    scan_map->xy_to_row_col(x, y, row, col);
+}
+
+int ScanSimulator2D::row_col_to_cell(int row, int col) const {
+    std::shared_lock<std::shared_timed_mutex> lock(scan_map->mutex);
+    return scan_map->row_col_to_cell(row, col);
+}
+
+void ScanMap::xy_to_row_col(double x, double y, int * row, int * col) const {
     // distance between x or y and the bottom left conner of the original map image
     double x_trans = x - origin.x;
     double y_trans = y - origin.y;
@@ -343,24 +903,13 @@ void ScanSimulator2D::xy_to_row_col(double x, double y, int * row, int * col) co
     }
 }
 
-int ScanSimulator2D::row_col_to_cell(int row, int col) const {
-    // calculate how many full rows first, then plus the last row
-    return row * width + col;
-}
-
-bool ScanSimulator2D::see_opponent(){
-    return can_see_opponent;
-}
 // overload for changing map on the fly
 void ScanSimulator2D::set_map(const std::vector<double> & map, double free_threshold) {
-    for (size_t i = 0; i < map.size(); i++) {
-        if (0 <= map[i] and map[i] <= free_threshold) {
-            dt[i] = 99999; // Free
-        } else {
-            dt[i] = 0; // Occupied
-        }
-    }
-    DistanceTransform::distance_2d(dt, width, height, resolution);
+    std::unique_lock<std::shared_timed_mutex> lock(scan_map->mutex);
+    compute_distance_transform(map, free_threshold);
+
+    // the old table doesn't match the new map anymore
+    if (use_range_lut) build_range_lut();
 }
 
 void ScanSimulator2D::set_map(
@@ -371,13 +920,28 @@ void ScanSimulator2D::set_map(
         const Pose2D & origin_,
         double free_threshold) {
 
+    std::unique_lock<std::shared_timed_mutex> lock(scan_map->mutex);
+
     // Assign parameters
-    height = height_;
-    width = width_;
-    resolution = resolution_;
-    origin = origin_;
-    origin_c = std::cos(origin.theta);
-    origin_s = std::sin(origin.theta);
+    scan_map->height = height_;
+    scan_map->width = width_;
+    scan_map->resolution = resolution_;
+    scan_map->origin = origin_;
+    scan_map->origin_c = std::cos(origin_.theta);
+    scan_map->origin_s = std::sin(origin_.theta);
+
+    compute_distance_transform(map, free_threshold);
+    if (use_range_lut) build_range_lut();
+}
+
+void ScanSimulator2D::compute_distance_transform(const std::vector<double> & map, double free_threshold) {
+    ScanMap & m = *scan_map;
+    std::vector<double> & dt = m.dt;
+
+    // same map and threshold as a previous run, the distance transform is on the disk already
+    uint64_t key = 0;
+    if (dt_cache.enabled()) key = DistanceTransformCache::hash(map, m.height, m.width, m.resolution, free_threshold);
+    if (load_cached_distance_transform(key)) return;
 
     // Threshold the map
     dt = std::vector<double>(map.size());
@@ -388,7 +952,338 @@ void ScanSimulator2D::set_map(
             dt[i] = 0; // Occupied
         }
     }
+    finish_distance_transform(key);
+}
+
+void ScanSimulator2D::compute_distance_transform(const OccupancyBitmap & bitmap) {
+    ScanMap & m = *scan_map;
+    std::vector<double> & dt = m.dt;
+
+    uint64_t key = 0;
+    if (dt_cache.enabled()) key = DistanceTransformCache::hash(bitmap);
+    if (load_cached_distance_transform(key)) return;
+
+    // the bits are the thresholded map already
+    dt.resize(bitmap.width * bitmap.height);
+    for (size_t row = 0; row < bitmap.height; row++) {
+        double * cell = dt.data() + row * bitmap.width;
+        for (size_t col = 0; col < bitmap.width; col++) cell[col] = bitmap.is_free(row, col) ? 99999 : 0;
+    }
+    finish_distance_transform(key);
+}
+
+bool ScanSimulator2D::load_cached_distance_transform(uint64_t key) {
+    ScanMap & m = *scan_map;
+    dt_from_cache = dt_cache.enabled() and dt_cache.load(key, m.height, m.width, m.resolution, m.origin, m.dt);
+    if (not dt_from_cache) return false;
+    if (m.field.is_copy()) m.field.assign(m.dt, m.width, m.height);
+    m.pyramid.assign(m.dt, m.width, m.height, m.resolution, m.pyramid_levels);
+    return true;
+}
+
+void ScanSimulator2D::finish_distance_transform(uint64_t key) {
+    ScanMap & m = *scan_map;
     // this is to calculate the distance from each pixel to the nearest occupied pixel in coordinate
     // so the elements in dt vector represent the distance and we can directly use them.
-    DistanceTransform::distance_2d(dt, width, height, resolution);
+    DistanceTransform::distance_2d(m.dt, m.width, m.height, m.resolution);
+
+    // a failed store only means the next run computes it again
+    if (dt_cache.enabled()) dt_cache.store(key, m.height, m.width, m.resolution, m.origin, m.dt);
+
+    if (m.field.is_copy()) m.field.assign(m.dt, m.width, m.height);
+    m.pyramid.assign(m.dt, m.width, m.height, m.resolution, m.pyramid_levels);
+}
+
+void ScanSimulator2D::set_map(const OccupancyBitmap & bitmap) {
+    std::unique_lock<std::shared_timed_mutex> lock(scan_map->mutex);
+    scan_map->height = bitmap.height;
+    scan_map->width = bitmap.width;
+    scan_map->resolution = bitmap.resolution;
+    scan_map->origin = bitmap.origin;
+    scan_map->origin_c = std::cos(bitmap.origin.theta);
+    scan_map->origin_s = std::sin(bitmap.origin.theta);
+
+    compute_distance_transform(bitmap);
+    if (use_range_lut) build_range_lut();
+}
+
+void ScanSimulator2D::update_map(
+        const std::vector<double> & map,
+        size_t row_min,
+        size_t col_min,
+        size_t row_max,
+        size_t col_max,
+        double free_threshold) {
+    std::unique_lock<std::shared_timed_mutex> lock(scan_map->mutex);
+    size_t width = scan_map->width;
+    size_t height = scan_map->height;
+    if (row_min > row_max or col_min > col_max or row_min >= height or col_min >= width) return;
+    row_max = std::min(row_max, height - 1);
+    col_max = std::min(col_max, width - 1);
+
+    auto is_free = [&map, free_threshold](size_t cell) {return 0 <= map[cell] and map[cell] <= free_threshold;};
+    scan_map->update_region(is_free, row_min, col_min, row_max, col_max);
+
+    // the table is built from dt, scans march the rays until the new one is ready
+    if (use_range_lut) build_range_lut();
+}
+
+void ScanSimulator2D::update_map(const std::vector<double> & map, const std::vector<size_t> & changed_cells, double free_threshold) {
+    update_cells([&map, free_threshold](size_t cell) {return 0 <= map[cell] and map[cell] <= free_threshold;},
+                 changed_cells);
+}
+
+void ScanSimulator2D::update_map(const OccupancyBitmap & bitmap, const std::vector<size_t> & changed_cells) {
+    update_cells([&bitmap](size_t cell) {return bitmap.is_free(cell);}, changed_cells);
+}
+
+template <typename IsFree>
+void ScanSimulator2D::update_cells(const IsFree & is_free, const std::vector<size_t> & changed_cells) {
+    if (changed_cells.empty()) return;
+
+    std::unique_lock<std::shared_timed_mutex> lock(scan_map->mutex);
+    size_t width = scan_map->width;
+    size_t height = scan_map->height;
+
+    // cells that are close to each other are updated together, each tile of the map that has changed cells in it
+    // is updated once, over the bounding rectangle of its changed cells
+    const size_t tile = 32;
+    size_t tiles_per_row = (width + tile - 1) / tile;
+    std::vector<size_t> touched;
+    std::vector<size_t> bounds; // row_min, col_min, row_max, col_max of each touched tile
+    std::vector<long long> tile_index((height + tile - 1) / tile * tiles_per_row, -1);
+
+    for (size_t cell : changed_cells) {
+        if (cell >= width * height) continue;
+        size_t row = cell / width;
+        size_t col = cell % width;
+        size_t t = row / tile * tiles_per_row + col / tile;
+        if (tile_index[t] < 0) {
+            tile_index[t] = touched.size();
+            touched.push_back(t);
+            bounds.insert(bounds.end(), {row, col, row, col});
+        } else {
+            size_t * b = &bounds[4 * tile_index[t]];
+            b[0] = std::min(b[0], row);
+            b[1] = std::min(b[1], col);
+            b[2] = std::max(b[2], row);
+            b[3] = std::max(b[3], col);
+        }
+    }
+    if (touched.empty()) return;
+
+    for (size_t i = 0; i < touched.size(); i++) {
+        scan_map->update_region(is_free, bounds[4 * i], bounds[4 * i + 1], bounds[4 * i + 2], bounds[4 * i + 3]);
+    }
+
+    if (use_range_lut) build_range_lut();
+}
+
+template <typename IsFree>
+void ScanMap::update_region(
+        const IsFree & is_free,
+        size_t row_min,
+        size_t col_min,
+        size_t row_max,
+        size_t col_max) {
+
+    // nothing to do if no cell in the rectangle changed between free and occupied
+    bool changed = false;
+    double largest = 0;
+    for (size_t row = row_min; row <= row_max; row++) {
+        for (size_t col = col_min; col <= col_max; col++) {
+            size_t cell = row * width + col;
+            changed = changed or (is_free(cell) != (dt[cell] != 0));
+            largest = std::max(largest, dt[cell]);
+        }
+    }
+    if (not changed) return;
+
+    // A cell p can only get a different distance if its nearest obstacle, before or after the change, is in the rectangle.
+    // Either way, the old distance of p is at least the distance from p to the rectangle, so all other cells keep their old
+    // distance. If a cell p outside of a window `margin` cells around the rectangle could change, there is a cell b of the
+    // outer ring of the window on the way from p to the rectangle, and b is at most sqrt(2) less far from an obstacle
+    // than from the rectangle. So if no cell of the ring is like that, only cells in the window can change.
+    // The new distances of those cells are exact if they are at most `margin`, computed from the obstacles within
+    // another margin around the window. Start with a margin from the old distances and double it until both hold.
+    long long margin = std::ceil(largest / resolution) + 2;
+
+    // beyond this the free cells (99999 before the square root) start to act like obstacles in distance_squared_2d(),
+    // and the window is a large part of the map anyway
+    const long long largest_margin = 300;
+
+    // squared distance in cells from (row, col) to the rectangle
+    auto to_rectangle = [&](long long row, long long col) {
+        long long d_row = std::max({(long long) row_min - row, 0ll, row - (long long) row_max});
+        long long d_col = std::max({(long long) col_min - col, 0ll, col - (long long) col_max});
+        return (double) (d_row * d_row + d_col * d_col);
+    };
+    // old distance in cells, the small tolerance only adds cells that don't change to the ones recomputed
+    auto old_distance = [&](long long row, long long col) {
+        return dt[row * width + col] / resolution + 1e-6;
+    };
+
+    std::vector<double> window;
+    for (; margin <= largest_margin; margin *= 2) {
+        // the window whose distances may change, and the context around it whose obstacles are needed
+        long long w_row_min = std::max((long long) row_min - margin, 0ll);
+        long long w_col_min = std::max((long long) col_min - margin, 0ll);
+        long long w_row_max = std::min((long long) row_max + margin, (long long) height - 1);
+        long long w_col_max = std::min((long long) col_max + margin, (long long) width - 1);
+
+        // the outer ring of the window, sides cut off by the edge of the map have no cells outside to worry about
+        bool ring_close = true;
+        for (long long row = w_row_min; row <= w_row_max and ring_close; row++) {
+            for (long long col = w_col_min; col <= w_col_max; col++) {
+                bool ring = (row == (long long) row_min - margin) or (row == (long long) row_max + margin) or
+                            (col == (long long) col_min - margin) or (col == (long long) col_max + margin);
+                if (ring and old_distance(row, col) + 1.5 >= std::sqrt(to_rectangle(row, col))) {
+                    ring_close = false;
+                    break;
+                }
+                // only the first and last column of the inner rows can be on the ring
+                if (not ring and row != w_row_min and row != w_row_max and col < w_col_max) col = w_col_max - 1;
+            }
+        }
+        if (not ring_close) continue;
+
+        long long c_row_min = std::max(w_row_min - margin, 0ll);
+        long long c_col_min = std::max(w_col_min - margin, 0ll);
+        long long c_row_max = std::min(w_row_max + margin, (long long) height - 1);
+        long long c_col_max = std::min(w_col_max + margin, (long long) width - 1);
+        size_t c_width = c_col_max - c_col_min + 1;
+        size_t c_height = c_row_max - c_row_min + 1;
+
+        // the new map in the context, occupied cells outside of the rectangle didn't change
+        window.resize(c_width * c_height);
+        for (long long row = c_row_min; row <= c_row_max; row++) {
+            for (long long col = c_col_min; col <= c_col_max; col++) {
+                size_t cell = row * width + col;
+                bool inside = (size_t) row >= row_min and (size_t) row <= row_max and
+                              (size_t) col >= col_min and (size_t) col <= col_max;
+                bool free = inside ? is_free(cell) : dt[cell] != 0;
+                window[(row - c_row_min) * c_width + (col - c_col_min)] = free ? 99999 : 0;
+            }
+        }
+
+        // the edges of the map are obstacles in distance_2d(), sides of the context inside the map are not
+        DistanceTransform::distance_squared_2d_window(
+            window, c_width, c_height,
+            c_row_min == 0 ? 0 : 99999,
+            c_row_max == (long long) height - 1 ? 0 : 99999,
+            c_col_min == 0 ? 0 : 99999,
+            c_col_max == (long long) width - 1 ? 0 : 99999);
+
+        // every cell that can change needs an exact new distance
+        double limit = margin * margin;
+        bool exact = true;
+        for (long long row = w_row_min; row <= w_row_max and exact; row++) {
+            for (long long col = w_col_min; col <= w_col_max; col++) {
+                double old_cells = old_distance(row, col);
+                if (old_cells * old_cells >= to_rectangle(row, col) and
+                    window[(row - c_row_min) * c_width + (col - c_col_min)] > limit) {
+                    exact = false;
+                    break;
+                }
+            }
+        }
+        if (not exact) continue;
+
+        // same operation as the end of distance_2d(), so the values are the same as a full update
+        for (long long row = w_row_min; row <= w_row_max; row++) {
+            for (long long col = w_col_min; col <= w_col_max; col++) {
+                double old_cells = old_distance(row, col);
+                if (old_cells * old_cells >= to_rectangle(row, col)) {
+                    dt[row * width + col] = resolution * sqrt(window[(row - c_row_min) * c_width + (col - c_col_min)]);
+                }
+            }
+        }
+        if (field.is_copy()) field.update(dt, w_row_min, w_col_min, w_row_max, w_col_max);
+        pyramid.update(dt, w_row_min, w_col_min, w_row_max, w_col_max);
+        return;
+    }
+
+    // open space around the change, just do the whole map
+    std::vector<double> occupancy(dt.size());
+    for (size_t i = 0; i < dt.size(); i++) {
+        size_t row = i / width;
+        size_t col = i % width;
+        bool inside = row >= row_min and row <= row_max and col >= col_min and col <= col_max;
+        occupancy[i] = (inside ? is_free(i) : dt[i] != 0) ? 99999 : 0;
+    }
+    DistanceTransform::distance_2d(occupancy, width, height, resolution);
+    dt.swap(occupancy);
+    if (field.is_copy()) field.assign(dt, width, height);
+    pyramid.assign(dt, width, height, resolution, pyramid_levels);
+}
+
+void ScanSimulator2D::set_distance_field(DistanceField::Format format, DistanceField::Layout layout) {
+    std::unique_lock<std::shared_timed_mutex> lock(scan_map->mutex);
+    ScanMap & m = *scan_map;
+    m.field = DistanceField(format, layout);
+    if (m.field.is_copy() and not m.dt.empty()) m.field.assign(m.dt, m.width, m.height);
+}
+
+void ScanSimulator2D::set_distance_pyramid(int levels) {
+    std::unique_lock<std::shared_timed_mutex> lock(scan_map->mutex);
+    ScanMap & m = *scan_map;
+    m.pyramid_levels = std::max(levels, 0);
+    if (m.dt.empty()) return;
+    m.pyramid.assign(m.dt, m.width, m.height, m.resolution, m.pyramid_levels);
+}
+
+DistanceFieldReport ScanSimulator2D::benchmark_distance_field(int num_scans) const {
+    DistanceFieldReport report;
+    std::shared_lock<std::shared_timed_mutex> lock(scan_map->mutex);
+    const ScanMap & m = *scan_map;
+    report.dt_bytes = m.dt.capacity() * sizeof(double);
+    report.field_bytes = m.field.is_copy() ? m.field.memory_usage() : 0;
+    report.pyramid_bytes = m.pyramid.memory_usage();
+    report.ms_per_scan = 0;
+    report.baseline_ms_per_scan = 0;
+    if (num_scans <= 0) return report;
+
+    // two copies, one with the field (sharing the map) and one only with dt (a map of its own), both just march the rays
+    ScanSimulator2D current(*this);
+    ScanSimulator2D baseline(*this);
+    baseline.scan_map = m.clone();
+    baseline.scan_map->field = DistanceField();
+    baseline.scan_map->pyramid = DistancePyramid();
+
+    // poses on the racetrack, not too close to the walls, in a fixed pseudo random order so both copies scan the same
+    std::vector<Pose2D> poses;
+    std::minstd_rand random(1);
+    std::uniform_real_distribution<double> unit(0, 1);
+    for (int attempt = 0; attempt < 1000 * num_scans and (int) poses.size() < num_scans; attempt++) {
+        double x_map = unit(random) * m.width * m.resolution;
+        double y_map = unit(random) * m.height * m.resolution;
+        Pose2D pose;
+        pose.x = m.origin.x + x_map * m.origin_c - y_map * m.origin_s;
+        pose.y = m.origin.y + x_map * m.origin_s + y_map * m.origin_c;
+        pose.theta = unit(random) * 2 * M_PI;
+        if (m.distance_transform(pose.x, pose.y) > 0.3) poses.push_back(pose);
+    }
+    // the scans below lock the map themselves
+    lock.unlock();
+
+    for (ScanSimulator2D * copy : {&current, &baseline}) {
+        copy->use_range_lut = false;
+        copy->scan_std_dev = 0;
+    }
+
+    // the opponent car is far away, so only the racetrack is scanned
+    std::vector<double> ranges(num_beams);
+    auto time_scans = [&](ScanSimulator2D & scanner) {
+        if (poses.empty()) return 0.;
+        auto start = std::chrono::steady_clock::now();
+        for (const Pose2D & pose : poses) {
+            Pose2D far_away = {pose.x + 1e6, pose.y + 1e6, 0};
+            scanner.scan(pose, far_away, ranges.data());
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        return elapsed.count() / poses.size();
+    };
+    report.ms_per_scan = time_scans(current);
+    report.baseline_ms_per_scan = time_scans(baseline);
+    return report;
 }
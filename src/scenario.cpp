@@ -0,0 +1,343 @@
+#include "f1tenth_simulator/scenario.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "f1tenth_simulator/map_loader.hpp"
+#include "f1tenth_simulator/occupancy_bitmap.hpp"
+#include "f1tenth_simulator/distance_field.hpp"
+#include "f1tenth_simulator/distance_transform_cache.hpp"
+
+using namespace racecar_simulator;
+
+namespace {
+
+const char magic[8] = {'F', '1', 'T', 'S', 'C', 'E', 'N', '1'};
+
+// the buffered events are written out this often, a few kB at 100 steps per second
+const size_t flush_steps = 128;
+
+// a header with a larger number of cars is not a scenario file
+const uint32_t max_cars = 256;
+
+bool fail(std::string * error, const std::string & message) {
+    if (error) *error = message;
+    return false;
+}
+
+}
+
+void ScenarioChecksum::add(double number) {
+    uint64_t word;
+    std::memcpy(&word, &number, sizeof(word));
+    add(word);
+}
+
+void ScenarioChecksum::add(const CarState & state) {
+    add(state.x);
+    add(state.y);
+    add(state.theta);
+    add(state.velocity_x);
+    add(state.velocity_y);
+    add(state.steer_angle);
+    add(state.angular_velocity);
+    add(state.slip_angle);
+    add(uint64_t(state.st_dyn));
+}
+
+void ScenarioChecksum::add(const float * ranges, size_t num_ranges) {
+    // two ranges per word, half the multiplications
+    size_t i = 0;
+    for (; i + 1 < num_ranges; i += 2) {
+        uint32_t low, high;
+        std::memcpy(&low, ranges + i, sizeof(low));
+        std::memcpy(&high, ranges + i + 1, sizeof(high));
+        add(uint64_t(low) | uint64_t(high) << 32);
+    }
+    if (i < num_ranges) {
+        uint32_t low;
+        std::memcpy(&low, ranges + i, sizeof(low));
+        add(uint64_t(low));
+    }
+}
+
+ScenarioRecorder::~ScenarioRecorder() {
+    close();
+}
+
+bool ScenarioRecorder::open(const std::string & path, ScenarioHeader header, const std::vector<ScenarioCar> & cars,
+                            std::string * error) {
+    close();
+    steps = 0;
+    events = 0;
+    write_failed = false;
+
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) return fail(error, "cannot create " + path);
+    std::setvbuf(file, nullptr, _IOFBF, 1 << 16);
+
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.num_cars = cars.size();
+    if (std::fwrite(&header, sizeof(header), 1, file) != 1 or
+        (not cars.empty() and std::fwrite(cars.data(), sizeof(ScenarioCar), cars.size(), file) != cars.size())) {
+        close();
+        return fail(error, "cannot write " + path);
+    }
+    return true;
+}
+
+void ScenarioRecorder::close() {
+    if (file == nullptr) return;
+    if (std::fclose(file) != 0) write_failed = true;
+    file = nullptr;
+}
+
+void ScenarioRecorder::drive(double time, size_t car, double speed, double steer_angle) {
+    ScenarioEvent event = {};
+    event.type = ScenarioEvent::DRIVE;
+    event.car = car;
+    event.time = time;
+    event.values[0] = speed;
+    event.values[1] = steer_angle;
+    write(event);
+}
+
+void ScenarioRecorder::pose(double time, size_t car, const Pose2D & pose) {
+    ScenarioEvent event = {};
+    event.type = ScenarioEvent::POSE;
+    event.car = car;
+    event.time = time;
+    event.values[0] = pose.x;
+    event.values[1] = pose.y;
+    event.values[2] = pose.theta;
+    write(event);
+}
+
+void ScenarioRecorder::step(double time, double dt, uint64_t state_checksum, uint64_t scan_checksum) {
+    ScenarioEvent event = {};
+    event.type = ScenarioEvent::STEP;
+    event.time = time;
+    event.values[0] = dt;
+    event.state_checksum = state_checksum;
+    event.scan_checksum = scan_checksum;
+    write(event);
+    steps++;
+    if (file and steps % flush_steps == 0 and std::fflush(file) != 0) write_failed = true;
+}
+
+void ScenarioRecorder::write(const ScenarioEvent & event) {
+    if (file == nullptr or write_failed) return;
+    if (std::fwrite(&event, sizeof(event), 1, file) != 1) {
+        write_failed = true;
+        return;
+    }
+    events++;
+}
+
+ScenarioReplay::ScenarioReplay(size_t num_threads)
+  : pool(new ThreadPool(num_threads)) {
+    // the padding too, so the same race is the same bytes (MarchSettings has defaults, but no other constructor)
+    std::memset(static_cast<void *>(&header), 0, sizeof(header));
+}
+
+bool ScenarioReplay::load(const std::string & path, const std::string & map_yaml, std::string * error) {
+    std::unique_ptr<std::FILE, int (*)(std::FILE *)> file(std::fopen(path.c_str(), "rb"), std::fclose);
+    if (not file) return fail(error, "cannot open " + path);
+
+    ScenarioHeader read_header;
+    if (std::fread(&read_header, sizeof(read_header), 1, file.get()) != 1 or
+        std::memcmp(read_header.magic, magic, sizeof(magic)) != 0) {
+        return fail(error, path + " is not a scenario file of this version");
+    }
+    if (read_header.num_cars == 0 or read_header.num_cars > max_cars or read_header.scan_beams == 0) {
+        return fail(error, path + " has a broken header");
+    }
+    read_header.map_yaml[sizeof(read_header.map_yaml) - 1] = 0;
+
+    std::vector<ScenarioCar> read_cars(read_header.num_cars);
+    if (std::fread(read_cars.data(), sizeof(ScenarioCar), read_cars.size(), file.get()) != read_cars.size()) {
+        return fail(error, path + " ends within the cars");
+    }
+
+    // a recording that was cut off ends with the last whole event
+    std::vector<ScenarioEvent> read_events;
+    size_t read_steps = 0;
+    ScenarioEvent event;
+    while (std::fread(&event, sizeof(event), 1, file.get()) == 1) {
+        if (event.type == ScenarioEvent::STEP) {
+            read_steps++;
+        } else if ((event.type != ScenarioEvent::DRIVE and event.type != ScenarioEvent::POSE) or
+                   event.car >= read_header.num_cars) {
+            return fail(error, path + " has a broken event after " + std::to_string(read_steps) + " steps");
+        }
+        read_events.push_back(event);
+    }
+
+    // the map the scanner of the node had, its resolution and origin as they were in the map message
+    std::string yaml = map_yaml.empty() ? std::string(read_header.map_yaml) : map_yaml;
+    if (yaml.empty()) return fail(error, path + " doesn't know its map, it came from map_topic, give the map yaml");
+    OccupancyBitmap bitmap;
+    std::string map_error;
+    if (not MapLoader::load(yaml, nullptr, &bitmap, read_header.map_free_threshold, &map_error)) {
+        return fail(error, map_error);
+    }
+    bitmap.resolution = read_header.map_resolution;
+    bitmap.origin = read_header.map_origin;
+    if (bitmap.width != read_header.map_width or bitmap.height != read_header.map_height or
+        DistanceTransformCache::hash(bitmap) != read_header.map_hash) {
+        return fail(error, yaml + " is not the map of the recording");
+    }
+
+    header = read_header;
+    start_cars.swap(read_cars);
+    events.swap(read_events);
+    num_steps = read_steps;
+
+    // the scanner of the node, see the constructor of RacecarSimulator
+    scan_simulator = ScanSimulator2D(header.scan_beams, header.scan_field_of_view, header.scan_std_dev,
+                                     header.scan_max_range, header.cube_width);
+    scan_simulator.set_vectorized(header.scan_vectorized != 0);
+    scan_simulator.set_march_settings(header.march);
+    scan_simulator.set_cache_directory(cache_directory);
+    scan_simulator.set_distance_field(DistanceField::Format(header.distance_field_format),
+                                      DistanceField::Layout(header.distance_field_layout));
+    scan_simulator.set_distance_pyramid(header.distance_pyramid_levels);
+    scan_simulator.set_map(bitmap);
+    collision_checker = CollisionChecker(header.scan_beams, header.params.wheelbase, header.width,
+                                         header.scan_distance_to_base_link, -header.scan_field_of_view / 2.0,
+                                         scan_simulator.get_angle_increment());
+
+    size_t num_cars = header.num_cars;
+    cars.resize(num_cars);
+    scans.assign(num_cars * header.scan_beams, 0.f);
+    scan_requests.resize(num_cars);
+    for (size_t i = 0; i < num_cars; i++) {
+        cars[i].opponent_poses.resize(num_cars - 1);
+        scan_requests[i] = {Pose2D(), cars[i].opponent_poses.data(), num_cars - 1,
+                            scans.data() + i * header.scan_beams, false, &cars[i].scan_context};
+    }
+    return true;
+}
+
+void ScenarioReplay::run(ScenarioResult & result, bool stop_at_mismatch) {
+    result = ScenarioResult();
+    for (size_t i = 0; i < cars.size(); i++) {
+        const ScenarioCar & start = start_cars[i];
+        Car & car = cars[i];
+        car.state = start.state;
+        car.desired_speed = start.desired_speed;
+        car.desired_steer_angle = start.desired_steer_angle;
+        car.collided = start.collided != 0;
+        car.scan_context = ScanContext(start.noise_seed);
+    }
+
+    for (const ScenarioEvent & event : events) {
+        if (event.type == ScenarioEvent::DRIVE) {
+            cars[event.car].desired_speed = event.values[0];
+            cars[event.car].desired_steer_angle = event.values[1];
+            continue;
+        }
+        if (event.type == ScenarioEvent::POSE) {
+            CarState & state = cars[event.car].state;
+            state.x = event.values[0];
+            state.y = event.values[1];
+            state.theta = event.values[2];
+            continue;
+        }
+
+        step(event.values[0]);
+
+        // the same values in the same order as RacecarSimulator::record_step()
+        ScenarioChecksum state_checksum, scan_checksum;
+        for (const Car & car : cars) {
+            state_checksum.add(car.state);
+            state_checksum.add(car.desired_speed);
+            state_checksum.add(car.desired_steer_angle);
+        }
+        for (size_t i = 0; i < cars.size(); i++) {
+            scan_checksum.add(scans.data() + i * header.scan_beams, header.scan_beams);
+        }
+        result.state_checksum = state_checksum.value;
+        result.scan_checksum = scan_checksum.value;
+
+        bool state_mismatch = state_checksum.value != event.state_checksum;
+        bool scan_mismatch = scan_checksum.value != event.scan_checksum;
+        if (state_mismatch or scan_mismatch) {
+            if (result.mismatched_steps == 0) {
+                result.first_mismatch = result.steps;
+                result.first_mismatch_time = event.time;
+                result.state_mismatch = state_mismatch;
+                result.scan_mismatch = scan_mismatch;
+            }
+            result.mismatched_steps++;
+        }
+        result.steps++;
+        if (stop_at_mismatch and result.mismatched_steps > 0) break;
+    }
+
+    result.states.resize(cars.size());
+    for (size_t i = 0; i < cars.size(); i++) result.states[i] = cars[i].state;
+}
+
+void ScenarioReplay::step(double dt) {
+    // RacecarSimulator::update_state()
+    if (dt > 0) {
+        for (Car & car : cars) {
+            car.state = STKinematics::integrate(car.state, car.desired_speed, car.desired_steer_angle, header.params,
+                                                dt, header.physics_dt, STKinematics::Integrator(header.integrator));
+        }
+    }
+
+    // RacecarSimulator::update_sensors()
+    for (size_t index = 0; index < cars.size(); index++) {
+        const CarState & state = cars[index].state;
+        ScanRequest & request = scan_requests[index];
+        request.pose.x = state.x + header.scan_distance_to_base_link * std::cos(state.theta);
+        request.pose.y = state.y + header.scan_distance_to_base_link * std::sin(state.theta);
+        request.pose.theta = state.theta;
+
+        Pose2D * opponent = cars[index].opponent_poses.data();
+        for (size_t other = 0; other < cars.size(); other++) {
+            if (other == index) continue;
+            *opponent++ = {cars[other].state.x, cars[other].state.y, cars[other].state.theta};
+        }
+    }
+    scan_simulator.scan_batch(scan_requests.data(), scan_requests.size(), *pool);
+
+    // one car after the other, a car that collided is stopped before the next one is checked
+    for (size_t index = 0; index < cars.size(); index++) check_collisions(index);
+}
+
+void ScenarioReplay::check_collisions(size_t index) {
+    // the same checks as RacecarSimulator::publish_scan()
+    Car & car = cars[index];
+    double ttc = collision_checker.min_ttc(scans.data() + index * header.scan_beams, car.state.velocity_x);
+    bool collision = ttc < header.ttc_threshold;
+
+    if (car.state.velocity_x != 0) {
+        OrientedBox box = CollisionChecker::car_box(car.state, header.params.wheelbase, header.width);
+        double reach = 2 * header.params.wheelbase + header.width;
+        for (size_t other = 0; other < cars.size(); other++) {
+            if (other == index) continue;
+            const CarState & opponent = cars[other].state;
+            if (std::abs(opponent.x - car.state.x) > reach or std::abs(opponent.y - car.state.y) > reach) continue;
+            if (CollisionChecker::overlap(box, CollisionChecker::car_box(opponent, header.params.wheelbase,
+                                                                         header.width))) {
+                collision = true;
+            }
+        }
+    }
+
+    // RacecarSimulator::first_ttc_actions(), once when the collision starts
+    if (collision and not car.collided) {
+        car.state.velocity_x = 0.0;
+        car.state.velocity_y = 0.0;
+        car.state.angular_velocity = 0.0;
+        car.state.slip_angle = 0.0;
+        car.state.steer_angle = 0.0;
+        car.desired_speed = 0.0;
+        car.desired_steer_angle = 0.0;
+    }
+    car.collided = collision;
+}
@@ -0,0 +1,113 @@
+#include "f1tenth_simulator/sensor_geometry.hpp"
+#include "f1tenth_simulator/precompute.hpp"
+
+#include <map>
+#include <mutex>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+
+using namespace racecar_simulator;
+
+namespace {
+
+// the settings of a table, doubles by their bits, so only exactly the same settings share a table
+typedef std::vector<uint64_t> Key;
+
+uint64_t bits(double value) {
+    uint64_t result;
+    std::memcpy(&result, &value, sizeof(result));
+    return result;
+}
+
+// the tables currently held by someone, expired entries are dropped when a new table is added
+template <typename Table>
+class Registry {
+
+public:
+    template <typename Build>
+    std::shared_ptr<const Table> get(const Key & key, const Build & build) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = tables.find(key);
+        if (found != tables.end()) {
+            std::shared_ptr<const Table> table = found->second.lock();
+            if (table) return table;
+        }
+        for (auto it = tables.begin(); it != tables.end();) {
+            it = it->second.expired() ? tables.erase(it) : std::next(it);
+        }
+        std::shared_ptr<const Table> table = build();
+        tables[key] = table;
+        return table;
+    }
+
+private:
+    std::mutex mutex;
+    std::map<Key, std::weak_ptr<const Table>> tables;
+};
+
+Registry<SensorGeometry::AngleTables> & angle_registry() {
+    static Registry<SensorGeometry::AngleTables> registry;
+    return registry;
+}
+
+Registry<SensorGeometry::BeamTables> & beam_registry() {
+    static Registry<SensorGeometry::BeamTables> registry;
+    return registry;
+}
+
+std::shared_ptr<const SensorGeometry::AngleTables> build_angle_tables(int theta_discretization) {
+    std::shared_ptr<SensorGeometry::AngleTables> tables = std::make_shared<SensorGeometry::AngleTables>();
+    tables->theta_discretization = theta_discretization;
+    tables->values.assign(3 * tables->size(), 0.0);
+    double * sines = tables->values.data();
+    double * cosines = sines + tables->size();
+    double * arctanes = cosines + tables->size();
+
+    // slice 2PI into theta_discretization(2000+1) parts, and calculate sin cos arctan
+    for (int i = 0; i <= theta_discretization; i++) {
+        // calculate theta on the discretization from 0 to 2Pi
+        double theta = (2 * M_PI * i) / ((double) theta_discretization);
+
+        // calculate sin and cos of that theta value
+        // the reason we precompute all sin and cos is that we can only compute sin and cos for each theta just one time
+        // although we can calculate theta of beam easily and then calculate the sin and cos, imagine there are 1081 beams in one scan,
+        // and in every second there are hundreds scans happened, but a lot of theta actually is calculated over and over again.
+        // hence, better have a copy of all sin and cos, and when we need it, just directly get it from vector.
+        sines[i] = std::sin(theta);
+        cosines[i] = std::cos(theta);
+
+        // this is for calculating slope of beams, so that we will know whether a beam intersects with the opponent car
+        // due to theta actually starts from X axis which is y/x, so we need to calculate tan(theta) first and divided by 1, which will become x/y.
+        // and when theta = 0 or Pi or 2Pi, tan(theta) will be 0, so avoid those number, although no exception will occur if not do this
+        if (theta != 0 or theta != M_PI or theta != 2 * M_PI) {
+            arctanes[i] = 1 / std::tan(theta);
+        }
+    }
+    return tables;
+}
+
+}
+
+std::shared_ptr<const SensorGeometry::AngleTables> SensorGeometry::angle_tables(int theta_discretization) {
+    Key key = {uint64_t(theta_discretization)};
+    return angle_registry().get(key, [theta_discretization]() {return build_angle_tables(theta_discretization);});
+}
+
+std::shared_ptr<const SensorGeometry::BeamTables> SensorGeometry::beam_tables(
+        int scan_beams,
+        double wheelbase,
+        double width,
+        double scan_distance_to_base_link,
+        double angle_min,
+        double scan_ang_incr) {
+    Key key = {uint64_t(scan_beams), bits(wheelbase), bits(width), bits(scan_distance_to_base_link),
+               bits(angle_min), bits(scan_ang_incr)};
+    return beam_registry().get(key, [&]() {
+        std::shared_ptr<BeamTables> tables = std::make_shared<BeamTables>();
+        tables->car_distances = Precompute::get_car_distances(scan_beams, wheelbase, width, scan_distance_to_base_link,
+                                                              angle_min, scan_ang_incr);
+        tables->cosines = Precompute::get_cosines(scan_beams, angle_min, scan_ang_incr);
+        return std::shared_ptr<const BeamTables>(tables);
+    });
+}
@@ -0,0 +1,94 @@
+#include "f1tenth_simulator/thread_pool.hpp"
+
+#include <algorithm>
+
+using namespace racecar_simulator;
+
+ThreadPool::ThreadPool(size_t num_threads)
+  : generation(0),
+    busy_workers(0),
+    stopping(false),
+    body(nullptr),
+    count(0),
+    grain(1),
+    next_chunk(0) {
+    if (num_threads == 0) num_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    for (size_t thread = 1; thread < num_threads; thread++) {
+        workers.emplace_back(&ThreadPool::work, this, thread);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    start_condition.notify_all();
+    for (std::thread & worker : workers) worker.join();
+}
+
+ThreadPool & ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::parallel_for(size_t count_, size_t grain_, const Body & body_) {
+    if (count_ == 0) return;
+    grain_ = std::max(grain_, (size_t) 1);
+
+    // one loop at a time, the fields below describe a single loop. the inline case holds it too, otherwise
+    // two callers could both run a chunk as thread 0 at the same time
+    std::lock_guard<std::mutex> caller_lock(caller_mutex);
+
+    // nothing to share, don't wake anybody up
+    if (workers.empty() or count_ <= grain_) {
+        body_(0, count_, 0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        body = &body_;
+        count = count_;
+        grain = grain_;
+        next_chunk.store(0);
+        busy_workers = workers.size();
+        generation++;
+    }
+    start_condition.notify_all();
+
+    // the calling thread is thread 0
+    run_chunks(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done_condition.wait(lock, [this] {return busy_workers == 0;});
+    body = nullptr;
+}
+
+void ThreadPool::run_chunks(size_t thread) {
+    size_t num_chunks = (count + grain - 1) / grain;
+    for (size_t chunk = next_chunk++; chunk < num_chunks; chunk = next_chunk++) {
+        size_t begin = chunk * grain;
+        (*body)(begin, std::min(begin + grain, count), thread);
+    }
+}
+
+void ThreadPool::work(size_t thread) {
+    size_t seen_generation = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            start_condition.wait(lock, [&] {return stopping or generation != seen_generation;});
+            if (stopping) return;
+            seen_generation = generation;
+        }
+
+        run_chunks(thread);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busy_workers--;
+        }
+        done_condition.notify_one();
+    }
+}
@@ -0,0 +1,269 @@
+#include "f1tenth_simulator/vec_env.hpp"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace racecar_simulator;
+
+const size_t VecEnv::state_size;
+const size_t VecEnv::action_size;
+
+VecEnvConfig::VecEnvConfig()
+  : params(VecEnv::default_car_params()),
+    // the start poses of blue and red in params.yaml
+    start_poses({{18, 31, 3.14}, {22, 30.5, 3.14}}) {
+    // scan_refinement bisection and scan_stop_at_max_range of params.yaml, MarchSettings defaults to the original marcher
+    scan_march.stop_at_max_range = true;
+    scan_march.bisect = true;
+}
+
+CarParams VecEnv::default_car_params() {
+    CarParams p;
+    p.wheelbase = 0.3302;
+    p.friction_coeff = 5.923;
+    p.h_cg = 0.074;
+    p.l_r = 0.139;
+    p.l_f = 0.1912;
+    p.cs_f = 4.718;
+    p.cs_r = 5.4562;
+    p.mass = 3.958;
+    p.Iz = 0.15712;
+    p.Cm1 = 6.097;
+    p.Cm2 = 0.237;
+    p.Cm3 = 0.392;
+    p.B_f = 0.201;
+    p.C_f = 2.114;
+    p.D_f = 28.892;
+    p.B_r = 0.201;
+    p.C_r = 2.114;
+    p.D_r = 28.892;
+    p.max_speed = 27.;
+    p.max_steering_angle = 0.192;
+    p.max_steering_vel = 1.9;
+    p.max_accel = 7.51;
+    p.max_decel = 8.26;
+    return p;
+}
+
+VecEnv::VecEnv(const VecEnvConfig & config_)
+  : config(config_),
+    map_exists(false) {
+
+    config.num_envs = std::max(config.num_envs, (size_t) 1);
+    config.num_agents = std::max(config.num_agents, (size_t) 1);
+    config.scan_beams = std::max(config.scan_beams, 1);
+
+    scan_simulator = ScanSimulator2D(config.scan_beams, config.scan_field_of_view, config.scan_std_dev,
+                                     config.scan_max_range, config.cube_width);
+    scan_simulator.set_march_settings(config.scan_march);
+    scan_simulator.set_distance_pyramid(config.distance_pyramid_levels);
+    collision_checker = CollisionChecker(config.scan_beams, config.params.wheelbase, config.width,
+                                         config.scan_distance_to_base_link, -config.scan_field_of_view / 2.0,
+                                         scan_simulator.get_angle_increment());
+    pool.reset(new ThreadPool(config.num_threads));
+
+    size_t num_cars = config.num_envs * config.num_agents;
+    cars.resize(num_cars);
+    scan_contexts.reserve(num_cars);
+    for (size_t i = 0; i < num_cars; i++) {
+        if (config.scan_noise_seed != 0) {
+            scan_contexts.emplace_back(config.scan_noise_seed + i);
+        } else {
+            scan_contexts.emplace_back();
+        }
+    }
+    opponent_poses.resize(num_cars * (config.num_agents - 1));
+    scans.assign(num_cars * config.scan_beams, 0.f);
+    states.resize(num_cars * state_size);
+    rewards.resize(num_cars);
+    collisions.resize(num_cars);
+    terminated.resize(config.num_envs);
+    truncated.resize(config.num_envs);
+    episode_steps.resize(config.num_envs);
+    resetting.resize(config.num_envs);
+
+    // only the poses change from scan to scan
+    scan_requests.resize(num_cars);
+    for (size_t i = 0; i < num_cars; i++) {
+        scan_requests[i] = {Pose2D(), opponent_poses.data() + i * (config.num_agents - 1), config.num_agents - 1,
+                            scans.data() + i * config.scan_beams, false, &scan_contexts[i]};
+    }
+
+    // a car without a start pose starts 4m behind the car before it, like in the simulator node
+    while (config.start_poses.size() < config.num_agents) {
+        if (config.start_poses.empty()) {
+            config.start_poses.push_back({0, 0, 0});
+            continue;
+        }
+        const Pose2D & previous = config.start_poses.back();
+        config.start_poses.push_back({previous.x - 4 * std::cos(previous.theta),
+                                      previous.y - 4 * std::sin(previous.theta),
+                                      previous.theta});
+    }
+
+    reset();
+}
+
+void VecEnv::set_map(
+        const std::vector<double> & map,
+        size_t height,
+        size_t width,
+        double resolution,
+        const Pose2D & origin,
+        double free_threshold) {
+    scan_simulator.set_map(map, height, width, resolution, origin, free_threshold);
+    map_exists = true;
+    // the cars are where they were, only what they see changed
+    scan_envs(0, config.num_envs);
+}
+
+void VecEnv::reset() {
+    for (size_t env = 0; env < config.num_envs; env++) reset_env(env, nullptr);
+    scan_envs(0, config.num_envs);
+    for (size_t env = 0; env < config.num_envs; env++) write_states(env);
+}
+
+void VecEnv::reset(size_t env, const Pose2D * poses) {
+    if (env >= config.num_envs) return;
+    reset_env(env, poses);
+    scan_envs(env, env + 1);
+    write_states(env);
+}
+
+void VecEnv::step(const double * actions) {
+    size_t num_envs = config.num_envs;
+    // a few chunks per thread, so a thread that got slow envs doesn't hold up the others
+    size_t grain = std::max(num_envs / (4 * pool->size()), (size_t) 1);
+
+    pool->parallel_for(num_envs, grain, [this, actions](size_t begin, size_t end, size_t) {
+        for (size_t env = begin; env < end; env++) {
+            resetting[env] = config.auto_reset and (terminated[env] or truncated[env]);
+            if (resetting[env]) {
+                reset_env(env, nullptr);
+            } else {
+                step_env(env, actions);
+            }
+        }
+    });
+
+    // first move every car, then scan, so the cars of an env see each other at the same time
+    scan_envs(0, num_envs);
+
+    pool->parallel_for(num_envs, grain, [this](size_t begin, size_t end, size_t) {
+        for (size_t env = begin; env < end; env++) {
+            if (not resetting[env]) {
+                check_collisions(env);
+                episode_steps[env]++;
+                truncated[env] = config.max_episode_steps > 0 and episode_steps[env] >= config.max_episode_steps;
+            }
+            write_states(env);
+        }
+    });
+}
+
+void VecEnv::reset_env(size_t env, const Pose2D * poses) {
+    if (poses == nullptr) poses = config.start_poses.data();
+    for (size_t agent = 0; agent < config.num_agents; agent++) {
+        size_t car = env * config.num_agents + agent;
+        cars[car] = {.x=poses[agent].x, .y=poses[agent].y, .theta=poses[agent].theta, .velocity_x=0, .velocity_y=0,
+                     .steer_angle=0.0, .angular_velocity=0.0, .slip_angle=0.0, .st_dyn=false};
+        rewards[car] = 0;
+        collisions[car] = 0;
+    }
+    terminated[env] = 0;
+    truncated[env] = 0;
+    episode_steps[env] = 0;
+}
+
+void VecEnv::step_env(size_t env, const double * actions) {
+    for (size_t agent = 0; agent < config.num_agents; agent++) {
+        size_t car = env * config.num_agents + agent;
+        CarState & state = cars[car];
+        double x = state.x;
+        double y = state.y;
+        state = STKinematics::integrate(
+                state,
+                actions[car * action_size],
+                actions[car * action_size + 1],
+                config.params,
+                config.dt,
+                config.physics_dt,
+                config.integrator);
+        rewards[car] = std::hypot(state.x - x, state.y - y);
+    }
+}
+
+void VecEnv::scan_envs(size_t begin, size_t end) {
+    // no map yet, nothing to scan
+    if (not map_exists) return;
+
+    size_t num_agents = config.num_agents;
+    for (size_t car = begin * num_agents; car < end * num_agents; car++) {
+        const CarState & state = cars[car];
+
+        // the pose of the lidar, given the pose of base link (the center of the rear axle)
+        ScanRequest & request = scan_requests[car];
+        request.pose.x = state.x + config.scan_distance_to_base_link * std::cos(state.theta);
+        request.pose.y = state.y + config.scan_distance_to_base_link * std::sin(state.theta);
+        request.pose.theta = state.theta;
+
+        // the other cars of the same env
+        size_t first = car - car % num_agents;
+        Pose2D * opponent = opponent_poses.data() + car * (num_agents - 1);
+        for (size_t other = first; other < first + num_agents; other++) {
+            if (other == car) continue;
+            *opponent++ = {cars[other].x, cars[other].y, cars[other].theta};
+        }
+    }
+
+    scan_simulator.scan_batch(scan_requests.data() + begin * num_agents, (end - begin) * num_agents, *pool,
+                              config.scan_beams_per_chunk);
+}
+
+void VecEnv::check_collisions(size_t env) {
+    // the same checks as RacecarSimulator::publish_scan()
+    size_t first = env * config.num_agents;
+    bool any_collision = false;
+    for (size_t car = first; car < first + config.num_agents; car++) {
+        const CarState & state = cars[car];
+
+        bool collision = false;
+        if (map_exists) {
+            double ttc = collision_checker.min_ttc(scans.data() + car * config.scan_beams, state.velocity_x);
+            collision = ttc < config.ttc_threshold;
+        }
+
+        if (not collision and state.velocity_x != 0) {
+            OrientedBox box = CollisionChecker::car_box(state, config.params.wheelbase, config.width);
+            double reach = 2 * config.params.wheelbase + config.width;
+            for (size_t other = first; other < first + config.num_agents and not collision; other++) {
+                if (other == car) continue;
+                const CarState & opponent = cars[other];
+                // two cars further apart than their lengths can't touch
+                if (std::abs(opponent.x - state.x) > reach or std::abs(opponent.y - state.y) > reach) continue;
+                collision = CollisionChecker::overlap(box, CollisionChecker::car_box(opponent, config.params.wheelbase,
+                                                                                    config.width));
+            }
+        }
+
+        collisions[car] = collision;
+        if (collision) rewards[car] -= config.collision_penalty;
+        any_collision = any_collision or collision;
+    }
+    terminated[env] = any_collision;
+}
+
+void VecEnv::write_states(size_t env) {
+    for (size_t car = env * config.num_agents; car < (env + 1) * config.num_agents; car++) {
+        const CarState & state = cars[car];
+        double * out = states.data() + car * state_size;
+        out[0] = state.x;
+        out[1] = state.y;
+        out[2] = state.theta;
+        out[3] = state.velocity_x;
+        out[4] = state.velocity_y;
+        out[5] = state.steer_angle;
+        out[6] = state.angular_velocity;
+        out[7] = state.slip_angle;
+    }
+}
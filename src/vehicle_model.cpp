@@ -1,5 +1,5 @@
 #include <cmath>
-#include <ros/ros.h>
+#include <algorithm>
 #include "f1tenth_simulator/car_state.hpp"
 #include "f1tenth_simulator/vehicle_model.hpp"
 #include <iostream>
@@ -152,6 +152,162 @@ CarState STKinematics::update_k(const CarState start, double accel, double steer
     return end;
 }
 
+namespace {
+
+// the part of the state the differential equations of update() and update_k() change
+struct StateDot {
+    double x, y, theta, velocity_x, velocity_y, steer_angle, angular_velocity;
+};
+
+// the derivatives of the dynamic model in update(), accel and steer_angle_vel are fixed over the step
+StateDot dynamic_dot(const CarState & s, double accel, double steer_angle_vel, const CarParams & p) {
+    double d = accel / 7.51;
+    double Fx_fr = p.Cm1 * d / p.Cm2 - s.velocity_x / p.Cm3;
+
+    double alpha_f = -std::atan((s.angular_velocity * p.l_f + s.velocity_y) / s.velocity_x) + s.steer_angle;
+    double alpha_r =  std::atan((s.angular_velocity * p.l_r - s.velocity_y) / s.velocity_x);
+
+    double Fy_f = p.D_f * std::sin(p.C_f * std::atan(p.B_f * alpha_f)) * 25;
+    double Fy_r = p.D_r * std::sin(p.C_r * std::atan(p.B_r * alpha_r)) * 25;
+
+    StateDot dot;
+    dot.x = s.velocity_x * std::cos(s.theta) - s.velocity_y * std::sin(s.theta);
+    dot.y = s.velocity_x * std::sin(s.theta) + s.velocity_y * std::sin(s.theta);
+    dot.theta = s.angular_velocity;
+    dot.velocity_x = (Fx_fr * std::cos(s.steer_angle)
+                    - Fy_f * std::sin(s.steer_angle)
+                    + p.mass * s.velocity_y * s.angular_velocity) / p.mass;
+    dot.velocity_y = (Fy_r + Fy_f * std::sin(s.steer_angle)
+                    + Fx_fr * std::sin(s.steer_angle)
+                    - p.mass * s.velocity_x * s.angular_velocity) / p.mass;
+    dot.steer_angle = steer_angle_vel;
+    dot.angular_velocity = (Fy_f * p.l_f * std::cos(s.steer_angle)  - Fy_r * p.l_r) / p.Iz;
+    return dot;
+}
+
+// the derivatives of the kinematic model in update_k()
+StateDot kinematic_dot(const CarState & s, double accel, double steer_angle_vel, const CarParams & p) {
+    StateDot dot;
+    dot.x = s.velocity_x * std::cos(s.theta);
+    dot.y = s.velocity_x * std::sin(s.theta);
+    dot.theta = s.velocity_x / p.wheelbase * std::tan(s.steer_angle);
+    dot.velocity_x = accel;
+    dot.velocity_y = 0;
+    dot.steer_angle = steer_angle_vel;
+    dot.angular_velocity = 0;
+    return dot;
+}
+
+CarState advance(const CarState & s, const StateDot & dot, double dt) {
+    CarState end = s;
+    end.x                = s.x                + dt * dot.x;
+    end.y                = s.y                + dt * dot.y;
+    end.theta            = s.theta            + dt * dot.theta;
+    end.velocity_x       = s.velocity_x       + dt * dot.velocity_x;
+    end.velocity_y       = s.velocity_y       + dt * dot.velocity_y;
+    end.steer_angle      = s.steer_angle      + dt * dot.steer_angle;
+    end.angular_velocity = s.angular_velocity + dt * dot.angular_velocity;
+    return end;
+}
+
+// update() never lets the angular velocity past 2rad/s, the slopes in the middle of a step mustn't see more either
+CarState limit_turning(CarState s) {
+    s.angular_velocity = std::min(std::max(-2.0, s.angular_velocity), 2.0);
+    return s;
+}
+
+// one classic Runge-Kutta step, the weighted mean of the slopes at the start, twice in the middle and at the end
+template <typename Derivative>
+CarState rk4_step(const CarState & start, double accel, double steer_angle_vel, const CarParams & p, double dt,
+                  Derivative derivative) {
+    StateDot k1 = derivative(start, accel, steer_angle_vel, p);
+    StateDot k2 = derivative(limit_turning(advance(start, k1, dt / 2)), accel, steer_angle_vel, p);
+    StateDot k3 = derivative(limit_turning(advance(start, k2, dt / 2)), accel, steer_angle_vel, p);
+    StateDot k4 = derivative(limit_turning(advance(start, k3, dt)), accel, steer_angle_vel, p);
+
+    StateDot mean;
+    mean.x                = (k1.x                + 2 * k2.x                + 2 * k3.x                + k4.x) / 6;
+    mean.y                = (k1.y                + 2 * k2.y                + 2 * k3.y                + k4.y) / 6;
+    mean.theta            = (k1.theta            + 2 * k2.theta            + 2 * k3.theta            + k4.theta) / 6;
+    mean.velocity_x       = (k1.velocity_x       + 2 * k2.velocity_x       + 2 * k3.velocity_x       + k4.velocity_x) / 6;
+    mean.velocity_y       = (k1.velocity_y       + 2 * k2.velocity_y       + 2 * k3.velocity_y       + k4.velocity_y) / 6;
+    mean.steer_angle      = (k1.steer_angle      + 2 * k2.steer_angle      + 2 * k3.steer_angle      + k4.steer_angle) / 6;
+    mean.angular_velocity = (k1.angular_velocity + 2 * k2.angular_velocity + 2 * k3.angular_velocity + k4.angular_velocity) / 6;
+    return advance(start, mean, dt);
+}
+
+}
+
+CarState STKinematics::update_rk4(const CarState start, double desired_speed, double desired_steer_ang, CarParams p, double dt) {
+    // the same choice of model as update()
+    double thresh = .5;
+    double err = .03;
+    if (!start.st_dyn)
+        thresh += err;
+
+    CarState state = start;
+    double accel = compute_accel(state, desired_speed, p);
+    double steer_angle_vel = compute_steer_vel(state, desired_steer_ang, p);
+
+    CarState end;
+    if (start.velocity_x < thresh) {
+        end = rk4_step(start, accel, steer_angle_vel, p, dt, kinematic_dot);
+        end.velocity_x       = std::min(std::max(end.velocity_x, -2.0), 2.0);
+        end.velocity_y       = 0;
+        end.angular_velocity = 0;
+        end.slip_angle       = 0;
+        end.st_dyn           = false;
+        return end;
+    }
+
+    end = rk4_step(start, accel, steer_angle_vel, p, dt, dynamic_dot);
+
+    // the same limit of the turning as update()
+    if (std::abs(start.steer_angle) < 0.005 and std::abs(end.angular_velocity) < 1) {
+        end.angular_velocity = 0;
+    }else {
+        end.angular_velocity = std::min(std::max(-2.0, end.angular_velocity), 2.0);
+    }
+
+    end.slip_angle = -std::atan((start.angular_velocity * p.l_f + start.velocity_y) / start.velocity_x) + start.steer_angle;
+    end.st_dyn     = true;
+    return end;
+}
+
+CarState STKinematics::integrate(const CarState start, double desired_speed, double desired_steer_ang, CarParams p,
+                                 double dt, double max_step, Integrator integrator) {
+    /**
+     * The explicit Euler step of update() is only stable if dt is small compared to how fast the tires react,
+     * at high speed with a long dt the lateral velocity and the angular velocity start to oscillate and blow up.
+     * Splitting dt in sub-steps keeps every step short, however rarely the caller publishes,
+     * and RK4 is accurate to dt^4 instead of dt, so it gets away with fewer sub-steps for the same error.
+     * The node passes the wall time between two timer ticks, which jitters around update_pose_rate, so dt is
+     * only split once it is clearly longer than max_step: a tick of 0.0051s with max_step 0.005 stays one step
+     * (as without sub-steps), a sub-step is never longer than 1.5 max_step.
+     */
+    int num_steps = 1;
+    if (max_step > 0 and dt > 1.5 * max_step) {
+        num_steps = std::min(static_cast<int>(std::lround(dt / max_step)), max_substeps);
+    }
+    double step = dt / num_steps;
+
+    CarState state = start;
+    for (int i = 0; i < num_steps; i++) {
+        if (integrator == RK4) {
+            state = update_rk4(state, desired_speed, desired_steer_ang, p, step);
+        } else {
+            state = update(state, desired_speed, desired_steer_ang, p, step);
+        }
+        limit_state(state, p);
+    }
+    return state;
+}
+
+void STKinematics::limit_state(CarState & state, const CarParams & p) {
+    state.velocity_x = std::min(std::max(state.velocity_x, -p.max_speed), p.max_speed);
+    state.steer_angle = std::min(std::max(state.steer_angle, -p.max_steering_angle), p.max_steering_angle);
+}
+
 double STKinematics::compute_accel(CarState & state, double desired_speed, CarParams & p) {
     // get difference between current and desired
     double dif = desired_speed - state.velocity_x;
@@ -0,0 +1,48 @@
+#pragma once
+
+/**
+ * The little the tests need: CHECK() prints the failed condition with its line and counts it,
+ * a test ends with return check_result(), which is 1 (a failed ctest) after any failed CHECK().
+ * The maps of maps/ are in F1TENTH_MAPS_DIR, CMake sets it to the source tree.
+ */
+
+#include <cstdio>
+
+namespace racecar_simulator {
+namespace test {
+
+inline int & failures() {
+    static int count = 0;
+    return count;
+}
+
+inline int check_result() {
+    if (failures() == 0) std::printf("all checks passed\n");
+    else std::printf("%d checks failed\n", failures());
+    return failures() == 0 ? 0 : 1;
+}
+
+}
+}
+
+// the message of the first few failures is enough, a broken loop would print millions
+#define CHECK(condition) \
+    do { \
+        if (not (condition)) { \
+            if (racecar_simulator::test::failures()++ < 20) { \
+                std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            } \
+        } \
+    } while (false)
+
+// CHECK() with a printf message, e.g. the index that differs
+#define CHECK_MESSAGE(condition, ...) \
+    do { \
+        if (not (condition)) { \
+            if (racecar_simulator::test::failures()++ < 20) { \
+                std::printf("%s:%d: CHECK(%s) failed: ", __FILE__, __LINE__, #condition); \
+                std::printf(__VA_ARGS__); \
+                std::printf("\n"); \
+            } \
+        } \
+    } while (false)
@@ -0,0 +1,160 @@
+/**
+ * BatchVehicleModel::step() against the simulator's own step, STKinematics::update() followed by limit_state().
+ * The cars of the batch start at speeds of -1 to 10m/s (both sides of the switch between the kinematic and the dynamic
+ * model) and steering angles over the whole range, and follow commands that cross both as well, for 100 steps of 10ms.
+ * EXACT has to give the same states bit for bit, FAST the same within the error of its polynomials.
+ * rollout() has to give the states of step() on any number of threads.
+ */
+
+#include "f1tenth_simulator/batch_vehicle_model.hpp"
+#include "f1tenth_simulator/vehicle_model.hpp"
+#include "check.hpp"
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+using namespace racecar_simulator;
+
+namespace {
+
+// the car of params.yaml
+CarParams car_params() {
+    CarParams p;
+    p.wheelbase = 0.3302;
+    p.friction_coeff = 5.923;
+    p.h_cg = 0.074;
+    p.l_r = 0.139;
+    p.l_f = 0.1912;
+    p.cs_f = 4.718;
+    p.cs_r = 5.4562;
+    p.mass = 3.958;
+    p.Iz = 0.15712;
+    p.Cm1 = 6.097;
+    p.Cm2 = 0.237;
+    p.Cm3 = 0.392;
+    p.B_f = 0.201;
+    p.C_f = 2.114;
+    p.D_f = 28.892;
+    p.B_r = 0.201;
+    p.C_r = 2.114;
+    p.D_r = 28.892;
+    p.max_speed = 27.;
+    p.max_steering_angle = 0.192;
+    p.max_steering_vel = 1.9;
+    p.max_accel = 7.51;
+    p.max_decel = 8.26;
+    return p;
+}
+
+const double dt = 0.01;
+const size_t num_steps = 100;
+
+// every byte of the two states, st_dyn included
+bool same_state(const CarState & a, const CarState & b) {
+    return a.x == b.x and a.y == b.y and a.theta == b.theta and a.velocity_x == b.velocity_x and
+           a.velocity_y == b.velocity_y and a.steer_angle == b.steer_angle and
+           a.angular_velocity == b.angular_velocity and a.slip_angle == b.slip_angle and a.st_dyn == b.st_dyn;
+}
+
+double max_difference(const CarState & a, const CarState & b) {
+    return std::max({std::abs(a.x - b.x), std::abs(a.y - b.y), std::abs(a.theta - b.theta),
+                     std::abs(a.velocity_x - b.velocity_x), std::abs(a.velocity_y - b.velocity_y),
+                     std::abs(a.steer_angle - b.steer_angle), std::abs(a.angular_velocity - b.angular_velocity),
+                     std::abs(a.slip_angle - b.slip_angle)});
+}
+
+}
+
+int main() {
+    const CarParams p = car_params();
+
+    // speeds of -1 to 10m/s in steps of 0.25m/s times 9 steering angles from -max to max
+    std::vector<CarState> starts;
+    for (int speed = -4; speed <= 40; speed++) {
+        for (int steer = -4; steer <= 4; steer++) {
+            double velocity = 0.25 * speed;
+            starts.push_back({.x=0.1 * speed, .y=-0.2 * steer, .theta=0.3 * steer, .velocity_x=velocity,
+                              .velocity_y=0, .steer_angle=p.max_steering_angle * steer / 4,
+                              .angular_velocity=0, .slip_angle=0, .st_dyn=velocity > 0.5});
+        }
+    }
+    size_t num_cars = starts.size();
+
+    // the commands of car i: it speeds up or brakes to a speed of -1 to 10m/s, a hard turn to the other side
+    // of its start and back, so the steering passes through the whole range and hits the limits
+    std::vector<double> speeds(num_steps * num_cars), steers(num_steps * num_cars);
+    for (size_t k = 0; k < num_steps; k++) {
+        for (size_t i = 0; i < num_cars; i++) {
+            speeds[k * num_cars + i] = -1 + 11 * ((i * 7 + k / 25) % num_cars) / double(num_cars - 1);
+            double side = starts[i].steer_angle > 0 ? -1 : 1;
+            steers[k * num_cars + i] = (k < 60 ? side : -side) * 1.5 * p.max_steering_angle * std::sin(0.1 * k + i);
+        }
+    }
+
+    // the simulator, car by car
+    std::vector<CarState> expected(num_steps * num_cars);
+    for (size_t i = 0; i < num_cars; i++) {
+        CarState state = starts[i];
+        for (size_t k = 0; k < num_steps; k++) {
+            state = STKinematics::update(state, speeds[k * num_cars + i], steers[k * num_cars + i], p, dt);
+            STKinematics::limit_state(state, p);
+            expected[k * num_cars + i] = state;
+        }
+    }
+
+    for (BatchVehicleModel::Math math : {BatchVehicleModel::EXACT, BatchVehicleModel::FAST}) {
+        CarStateBatch states(num_cars);
+        for (size_t i = 0; i < num_cars; i++) states.set(i, starts[i]);
+
+        size_t different = 0;
+        double position_error = 0, error = 0;
+        for (size_t k = 0; k < num_steps; k++) {
+            BatchVehicleModel::step(states, speeds.data() + k * num_cars, steers.data() + k * num_cars, p, dt, math);
+            for (size_t i = 0; i < num_cars; i++) {
+                CarState state = states.get(i);
+                const CarState & reference = expected[k * num_cars + i];
+                different += not same_state(state, reference);
+                position_error = std::max({position_error, std::abs(state.x - reference.x),
+                                           std::abs(state.y - reference.y)});
+                error = std::max(error, max_difference(state, reference));
+                // the switch between the models must not depend on the math
+                CHECK(state.st_dyn == reference.st_dyn);
+            }
+        }
+        if (math == BatchVehicleModel::EXACT) {
+            CHECK_MESSAGE(different == 0, "EXACT: %zu of %zu states differ, by up to %g", different,
+                          num_steps * num_cars, error);
+        } else {
+            // a few ulp per step, after 100 steps the positions are about 1e-14m apart
+            CHECK_MESSAGE(position_error < 1e-13, "FAST: the positions differ by up to %g m", position_error);
+            CHECK_MESSAGE(error < 1e-12, "FAST: the states differ by up to %g", error);
+        }
+
+        // rollout() in one go, with the trajectory, on 1 and 3 threads
+        for (size_t threads : {1, 3}) {
+            ThreadPool pool(threads);
+            CarStateBatch rolled(num_cars), trajectory;
+            for (size_t i = 0; i < num_cars; i++) rolled.set(i, starts[i]);
+            BatchVehicleModel::rollout(rolled, speeds.data(), steers.data(), num_steps, p, dt, math, &trajectory, &pool);
+
+            CHECK(trajectory.size() == num_steps * num_cars);
+            size_t different_steps = 0;
+            for (size_t i = 0; i < num_cars; i++) {
+                different_steps += not same_state(rolled.get(i), states.get(i));
+            }
+            // the steps of step() again, for the trajectory
+            CarStateBatch replay(num_cars);
+            for (size_t i = 0; i < num_cars; i++) replay.set(i, starts[i]);
+            for (size_t k = 0; k < num_steps and trajectory.size() == num_steps * num_cars; k++) {
+                BatchVehicleModel::step(replay, speeds.data() + k * num_cars, steers.data() + k * num_cars, p, dt, math);
+                for (size_t i = 0; i < num_cars; i++) {
+                    different_steps += not same_state(trajectory.get(k * num_cars + i), replay.get(i));
+                }
+            }
+            CHECK_MESSAGE(different_steps == 0, "rollout on %zu threads: %zu states differ from step()", threads,
+                          different_steps);
+        }
+    }
+    return test::check_result();
+}
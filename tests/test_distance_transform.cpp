@@ -0,0 +1,92 @@
+/**
+ * DistanceTransform::distance_squared_2d() splits the columns (in transposed tiles) and the rows across a thread pool,
+ * it has to give the same bits as the serial loop it replaced, one distance_squared_1d() per column and then per row.
+ * Checked on random maps of sizes around the column tile, for 1 to 4 threads, and on levine.
+ */
+
+#include "f1tenth_simulator/distance_transform.hpp"
+#include "f1tenth_simulator/map_loader.hpp"
+#include "f1tenth_simulator/thread_pool.hpp"
+#include "check.hpp"
+
+#include <random>
+#include <vector>
+#include <cstring>
+
+using namespace racecar_simulator;
+
+namespace {
+
+// the transform before it was split across threads
+void serial_distance_squared_2d(std::vector<double> & input, size_t width, size_t height, double boundary_value) {
+    std::vector<double> col_vec(height + 2);
+    std::vector<double> col_dt(height + 2);
+    for (size_t col = 0; col < width; col++) {
+        col_vec[0] = boundary_value;
+        col_vec[height + 1] = boundary_value;
+        for (size_t row = 0; row < height; row++) col_vec[row + 1] = input[row * width + col];
+        DistanceTransform::distance_squared_1d(col_vec, col_dt);
+        for (size_t row = 0; row < height; row++) input[row * width + col] = col_dt[row + 1];
+    }
+
+    std::vector<double> row_vec(width + 2);
+    std::vector<double> row_dt(width + 2);
+    for (size_t row = 0; row < height; row++) {
+        row_vec[0] = boundary_value;
+        row_vec[width + 1] = boundary_value;
+        for (size_t col = 0; col < width; col++) row_vec[col + 1] = input[row * width + col];
+        DistanceTransform::distance_squared_1d(row_vec, row_dt);
+        for (size_t col = 0; col < width; col++) input[row * width + col] = row_dt[col + 1];
+    }
+}
+
+// 0 for occupied cells, 99999 for free ones, like ScanSimulator2D::set_map()
+std::vector<double> random_map(size_t width, size_t height, double occupied, std::mt19937 & generator) {
+    std::bernoulli_distribution is_occupied(occupied);
+    std::vector<double> map(width * height);
+    for (double & cell : map) cell = is_occupied(generator) ? 0 : 99999;
+    return map;
+}
+
+void check_same(const std::vector<double> & map, size_t width, size_t height, double boundary_value, ThreadPool & pool) {
+    std::vector<double> expected = map;
+    serial_distance_squared_2d(expected, width, height, boundary_value);
+    std::vector<double> parallel = map;
+    DistanceTransform::distance_squared_2d(parallel, width, height, boundary_value, &pool);
+    CHECK_MESSAGE(std::memcmp(expected.data(), parallel.data(), map.size() * sizeof(double)) == 0,
+                  "%zux%zu, boundary %g, %zu threads", width, height, boundary_value, pool.size());
+}
+
+}
+
+int main() {
+    std::mt19937 generator(1);
+    std::vector<ThreadPool *> pools;
+    for (size_t threads = 1; threads <= 4; threads++) pools.push_back(new ThreadPool(threads));
+
+    // the column tile is 16 columns wide and a thread takes 16 rows, so sizes just around multiples of 16
+    const size_t sizes[][2] = {{1, 1}, {1, 40}, {40, 1}, {15, 17}, {16, 16}, {17, 33}, {33, 15}, {100, 63}, {257, 130}};
+    for (const auto & size : sizes) {
+        for (double occupied : {0.0, 0.01, 0.3, 1.0}) {
+            std::vector<double> map = random_map(size[0], size[1], occupied, generator);
+            for (ThreadPool * pool : pools) {
+                check_same(map, size[0], size[1], 0, *pool);
+                // a window of ScanSimulator2D::update_map() continues into free space
+                check_same(map, size[0], size[1], 99999, *pool);
+            }
+        }
+    }
+
+    OccupancyMap levine;
+    std::string error;
+    CHECK_MESSAGE(MapLoader::load(F1TENTH_MAPS_DIR "/levine.yaml", levine, &error), "%s", error.c_str());
+    if (levine.width > 0) {
+        std::vector<double> values = MapLoader::to_scan_map(levine);
+        std::vector<double> map(values.size());
+        for (size_t i = 0; i < values.size(); i++) map[i] = 0 <= values[i] and values[i] <= 0.5 ? 99999 : 0;
+        for (ThreadPool * pool : pools) check_same(map, levine.width, levine.height, 0, *pool);
+    }
+
+    for (ThreadPool * pool : pools) delete pool;
+    return test::check_result();
+}
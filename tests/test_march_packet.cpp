@@ -0,0 +1,96 @@
+/**
+ * The packet ray marcher (march_packet(), SIMD lanes stepping several beams with a state machine each) has to give
+ * the same ranges as march_ray() marching the beams one by one, and the same can_see_opponent.
+ * Checked on levine and de-espana from poses all over the free space, without other cars and with one or three
+ * next to the car, for the original marcher and for bisection with stop_at_max_range, with and without the pyramid.
+ */
+
+#include "f1tenth_simulator/scan_simulator_2d.hpp"
+#include "f1tenth_simulator/map_loader.hpp"
+#include "check.hpp"
+
+#include <cmath>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstring>
+
+using namespace racecar_simulator;
+
+namespace {
+
+struct Mode {
+    const char * name;
+    MarchSettings march;
+};
+
+void check_map(const std::string & yaml, std::mt19937 & generator) {
+    OccupancyMap map;
+    std::string error;
+    CHECK_MESSAGE(MapLoader::load(yaml, map, &error), "%s", error.c_str());
+    if (map.width == 0) return;
+
+    // the scanner of params.yaml, without noise so the ranges can be compared
+    ScanSimulator2D scanner(1081, 4.71238898038469, 0, 10, 0.2);
+    scanner.set_map(MapLoader::to_scan_map(map), map.height, map.width, map.resolution, map.origin, 0.5);
+
+    // poses in free space, at least 0.3m from the walls like a car on the racetrack
+    std::vector<Pose2D> poses;
+    std::uniform_real_distribution<double> x(map.origin.x, map.origin.x + map.width * map.resolution);
+    std::uniform_real_distribution<double> y(map.origin.y, map.origin.y + map.height * map.resolution);
+    std::uniform_real_distribution<double> angle(-M_PI, M_PI);
+    while (poses.size() < 200) {
+        Pose2D pose = {x(generator), y(generator), angle(generator)};
+        if (scanner.distance_transform(pose.x, pose.y) > 0.3) poses.push_back(pose);
+    }
+
+    Mode original = {"back_off", MarchSettings()};
+    Mode tuned = {"bisection", MarchSettings()};
+    tuned.march.stop_at_max_range = true;
+    tuned.march.bisect = true;
+
+    std::vector<double> scalar(1081), packet(1081);
+    for (const Mode & mode : {original, tuned}) {
+        scanner.set_march_settings(mode.march);
+        for (int pyramid_levels : {0, 4}) {
+            scanner.set_distance_pyramid(pyramid_levels);
+            for (size_t num_opponents : {0, 1, 3}) {
+                size_t different_ranges = 0, different_visibility = 0;
+                for (const Pose2D & pose : poses) {
+                    // the others 1 to 4m around the car, mostly in front where the scanner sees them
+                    std::vector<Pose2D> opponents;
+                    for (size_t i = 0; i < num_opponents; i++) {
+                        double distance = 1 + 3 * std::uniform_real_distribution<double>()(generator);
+                        double direction = pose.theta + std::uniform_real_distribution<double>(-2, 2)(generator);
+                        opponents.push_back({pose.x + distance * std::cos(direction),
+                                             pose.y + distance * std::sin(direction), angle(generator)});
+                    }
+
+                    ScanContext scalar_context(1), packet_context(1);
+                    scanner.set_vectorized(false);
+                    scanner.scan(pose, opponents.data(), opponents.size(), scalar.data(), true, scalar_context);
+                    scanner.set_vectorized(true);
+                    scanner.scan(pose, opponents.data(), opponents.size(), packet.data(), true, packet_context);
+
+                    different_ranges += std::memcmp(scalar.data(), packet.data(), scalar.size() * sizeof(double)) != 0;
+                    different_visibility += scalar_context.can_see_opponent != packet_context.can_see_opponent;
+                }
+                CHECK_MESSAGE(different_ranges == 0, "%zu of %zu scans differ on %s, %s, pyramid %d, %zu opponents",
+                              different_ranges, poses.size(), yaml.c_str(), mode.name, pyramid_levels, num_opponents);
+                CHECK_MESSAGE(different_visibility == 0,
+                              "can_see_opponent differs in %zu of %zu scans on %s, %s, pyramid %d, %zu opponents",
+                              different_visibility, poses.size(), yaml.c_str(), mode.name, pyramid_levels,
+                              num_opponents);
+            }
+        }
+    }
+}
+
+}
+
+int main() {
+    std::mt19937 generator(3);
+    check_map(F1TENTH_MAPS_DIR "/levine.yaml", generator);
+    check_map(F1TENTH_MAPS_DIR "/de-espana.yaml", generator);
+    return test::check_result();
+}
@@ -0,0 +1,104 @@
+/**
+ * cuda/scan_beam.hpp is the beam of the CUDA kernel of GpuScanSimulator, compiled for the host here, no nvcc needed.
+ * gpu::HostScanner::scan_batch() runs it beam by beam on the CPU, it has to give the ranges and can_see_opponent of
+ * ScanSimulator2D::scan_batch() bit for bit. On levine, without other cars and with one or three next to the car,
+ * for the original marcher and for bisection with stop_at_max_range, without noise and with the noise of params.yaml.
+ * (On the device the log and cos of the noise may differ in the last bit, that is not checked here.)
+ */
+
+#include "f1tenth_simulator/scan_simulator_2d.hpp"
+#include "f1tenth_simulator/map_loader.hpp"
+#include "scan_beam.hpp"
+#include "check.hpp"
+
+#include <cmath>
+#include <random>
+#include <vector>
+#include <cstring>
+
+using namespace racecar_simulator;
+
+int main() {
+    OccupancyMap map;
+    std::string error;
+    CHECK_MESSAGE(MapLoader::load(F1TENTH_MAPS_DIR "/levine.yaml", map, &error), "%s", error.c_str());
+    if (map.width == 0) return test::check_result();
+    std::vector<double> scan_map = MapLoader::to_scan_map(map);
+
+    std::mt19937 generator(5);
+    ThreadPool pool(3);
+    const size_t num_scans = 100;
+    const int num_beams = 1081;
+
+    for (double std_dev : {0.0, 0.01}) {
+        // the scanner of params.yaml
+        ScanSimulator2D scanner(num_beams, 4.71238898038469, std_dev, 10, 0.2);
+        scanner.set_map(scan_map, map.height, map.width, map.resolution, map.origin, 0.5);
+
+        // poses in free space, at least 0.3m from the walls like a car on the racetrack
+        std::vector<Pose2D> poses;
+        std::uniform_real_distribution<double> x(map.origin.x, map.origin.x + map.width * map.resolution);
+        std::uniform_real_distribution<double> y(map.origin.y, map.origin.y + map.height * map.resolution);
+        std::uniform_real_distribution<double> angle(-M_PI, M_PI);
+        while (poses.size() < num_scans) {
+            Pose2D pose = {x(generator), y(generator), angle(generator)};
+            if (scanner.distance_transform(pose.x, pose.y) > 0.3) poses.push_back(pose);
+        }
+
+        MarchSettings tuned;
+        tuned.stop_at_max_range = true;
+        tuned.bisect = true;
+        for (const MarchSettings & march : {MarchSettings(), tuned}) {
+            scanner.set_march_settings(march);
+            for (size_t num_opponents : {0, 1, 3}) {
+                // the others 1 to 4m around the car, mostly in front where the scanner sees them
+                std::vector<Pose2D> opponents(num_scans * num_opponents);
+                for (size_t r = 0; r < num_scans; r++) {
+                    for (size_t i = 0; i < num_opponents; i++) {
+                        double distance = 1 + 3 * std::uniform_real_distribution<double>()(generator);
+                        double direction = poses[r].theta + std::uniform_real_distribution<double>(-2, 2)(generator);
+                        opponents[r * num_opponents + i] = {poses[r].x + distance * std::cos(direction),
+                                                            poses[r].y + distance * std::sin(direction),
+                                                            angle(generator)};
+                    }
+                }
+
+                // the same seeds on both sides, so the noise is the same
+                std::vector<float> cpu(num_scans * num_beams), host(num_scans * num_beams);
+                std::vector<ScanContext> cpu_contexts, host_contexts;
+                for (size_t r = 0; r < num_scans; r++) {
+                    cpu_contexts.emplace_back(r + 1);
+                    host_contexts.emplace_back(r + 1);
+                }
+                std::vector<ScanRequest> cpu_requests, host_requests;
+                for (size_t r = 0; r < num_scans; r++) {
+                    const Pose2D * others = num_opponents > 0 ? &opponents[r * num_opponents] : nullptr;
+                    cpu_requests.push_back({poses[r], others, num_opponents, &cpu[r * num_beams], true,
+                                            &cpu_contexts[r]});
+                    host_requests.push_back({poses[r], others, num_opponents, &host[r * num_beams], true,
+                                             &host_contexts[r]});
+                }
+                scanner.scan_batch(cpu_requests.data(), num_scans, pool);
+                gpu::HostScanner::scan_batch(scanner, host_requests.data(), num_scans);
+
+                size_t different_ranges = 0, different_visibility = 0, saw_opponent = 0;
+                for (size_t r = 0; r < num_scans; r++) {
+                    different_ranges += std::memcmp(&cpu[r * num_beams], &host[r * num_beams],
+                                                    num_beams * sizeof(float)) != 0;
+                    different_visibility += cpu_contexts[r].can_see_opponent != host_contexts[r].can_see_opponent;
+                    saw_opponent += cpu_contexts[r].can_see_opponent;
+                }
+                CHECK_MESSAGE(different_ranges == 0, "%zu of %zu scans differ, std_dev %g, %s, %zu opponents",
+                              different_ranges, num_scans, std_dev, march.bisect ? "bisection" : "back_off",
+                              num_opponents);
+                CHECK_MESSAGE(different_visibility == 0,
+                              "can_see_opponent differs in %zu of %zu scans, std_dev %g, %s, %zu opponents",
+                              different_visibility, num_scans, std_dev, march.bisect ? "bisection" : "back_off",
+                              num_opponents);
+                // otherwise the opponents would not be tested at all
+                if (num_opponents > 0) CHECK(saw_opponent > 0);
+            }
+        }
+    }
+    return test::check_result();
+}
@@ -0,0 +1,166 @@
+/**
+ * ScanSimulator2D::update_map() only computes dt again around the changed cells, the result has to be the same as
+ * set_map() of the whole edited map: dt bit for bit, and the DistanceField copy and the DistancePyramid built from it.
+ * Random rectangles are made free or occupied (at the edges of the map too, and as large as the map) through all three
+ * update_map() overloads, and after every edit the map is compared with a fresh set_map() of a second scanner.
+ */
+
+#include "f1tenth_simulator/scan_simulator_2d.hpp"
+#include "f1tenth_simulator/occupancy_bitmap.hpp"
+#include "f1tenth_simulator/map_loader.hpp"
+#include "check.hpp"
+
+#include <cmath>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstring>
+
+using namespace racecar_simulator;
+
+namespace {
+
+const double free_threshold = 0.5;
+
+struct Setup {
+    DistanceField::Format format;
+    DistanceField::Layout layout;
+    int pyramid_levels;
+};
+
+ScanSimulator2D make_scanner(const Setup & setup) {
+    ScanSimulator2D scanner(60, 4.7, 0, 10, 0.2);
+    scanner.set_distance_field(setup.format, setup.layout);
+    scanner.set_distance_pyramid(setup.pyramid_levels);
+    return scanner;
+}
+
+void check_same_map(const ScanMap & updated, const ScanMap & fresh, const std::string & what) {
+    CHECK_MESSAGE(updated.dt.size() == fresh.dt.size() and
+                  std::memcmp(updated.dt.data(), fresh.dt.data(), fresh.dt.size() * sizeof(double)) == 0,
+                  "dt differs after %s", what.c_str());
+
+    if (fresh.field.is_copy()) {
+        size_t different = 0;
+        for (size_t row = 0; row < fresh.height; row++) {
+            for (size_t col = 0; col < fresh.width; col++) {
+                different += updated.field.at(row, col) != fresh.field.at(row, col);
+            }
+        }
+        CHECK_MESSAGE(different == 0, "%zu cells of the %s field differ after %s", different,
+                      DistanceField::format_name(fresh.field.get_format()).c_str(), what.c_str());
+    }
+
+    if (not fresh.pyramid.empty()) {
+        // the step of the pyramid from every cell centre in eight directions reads all the levels
+        size_t different = 0;
+        for (int direction = 0; direction < 8; direction++) {
+            double angle = M_PI / 4 * direction + 0.1;
+            double inv_dir_x = 1 / std::cos(angle), inv_dir_y = 1 / std::sin(angle);
+            for (size_t row = 0; row < fresh.height; row++) {
+                for (size_t col = 0; col < fresh.width; col++) {
+                    different += updated.pyramid.step(col + 0.5, row + 0.5, inv_dir_x, inv_dir_y) !=
+                                 fresh.pyramid.step(col + 0.5, row + 0.5, inv_dir_x, inv_dir_y);
+                }
+            }
+        }
+        CHECK_MESSAGE(different == 0, "%zu pyramid steps differ after %s", different, what.c_str());
+    }
+}
+
+void check_random_edits(std::vector<double> map, size_t width, size_t height, double resolution, int num_edits,
+                        const Setup & setup, std::mt19937 & generator) {
+    const Pose2D origin = {-3, 2, 0.3};
+    ScanSimulator2D updated = make_scanner(setup);
+    updated.set_map(map, height, width, resolution, origin, free_threshold);
+
+    for (int edit = 0; edit < num_edits; edit++) {
+        // mostly small rectangles like a cone or a car, some touching the edges, a few as large as the map
+        size_t rows, cols;
+        int kind = generator() % 8;
+        if (kind == 0) {
+            rows = height;
+            cols = width;
+        } else {
+            rows = 1 + generator() % std::min<size_t>(height, kind < 4 ? 4 : 40);
+            cols = 1 + generator() % std::min<size_t>(width, kind < 4 ? 4 : 40);
+        }
+        size_t row_min = generator() % (height - rows + 1);
+        size_t col_min = generator() % (width - cols + 1);
+        if (kind == 5) row_min = 0;
+        if (kind == 6) col_min = width - cols;
+        size_t row_max = row_min + rows - 1, col_max = col_min + cols - 1;
+
+        // free, occupied or noise
+        int fill = generator() % 3;
+        std::vector<size_t> changed;
+        for (size_t row = row_min; row <= row_max; row++) {
+            for (size_t col = col_min; col <= col_max; col++) {
+                size_t cell = row * width + col;
+                double value = fill == 0 ? 0 : fill == 1 ? 1 : (generator() % 4 == 0 ? 1 : 0);
+                if ((map[cell] <= free_threshold) != (value <= free_threshold)) changed.push_back(cell);
+                map[cell] = value;
+            }
+        }
+
+        int method = generator() % 3;
+        if (method == 0) {
+            updated.update_map(map, row_min, col_min, row_max, col_max, free_threshold);
+        } else if (method == 1) {
+            updated.update_map(map, changed, free_threshold);
+        } else {
+            OccupancyBitmap bitmap;
+            bitmap.resize(width, height);
+            bitmap.resolution = resolution;
+            bitmap.origin = origin;
+            for (size_t cell = 0; cell < map.size(); cell++) {
+                if (0 <= map[cell] and map[cell] <= free_threshold) bitmap.set_free(cell / width, cell % width);
+            }
+            updated.update_map(bitmap, changed);
+        }
+
+        ScanSimulator2D fresh = make_scanner(setup);
+        fresh.set_map(map, height, width, resolution, origin, free_threshold);
+        check_same_map(*updated.get_map(), *fresh.get_map(),
+                       "edit " + std::to_string(edit) + " of [" + std::to_string(row_min) + ", " +
+                       std::to_string(row_max) + "] x [" + std::to_string(col_min) + ", " + std::to_string(col_max) +
+                       "] with update_map() " + std::to_string(method) + " on " + std::to_string(width) + "x" +
+                       std::to_string(height));
+    }
+}
+
+}
+
+int main() {
+    std::mt19937 generator(2);
+    const Setup setups[] = {{DistanceField::FLOAT64, DistanceField::ROW_MAJOR, 0},
+                            {DistanceField::FLOAT32, DistanceField::TILED, 3},
+                            {DistanceField::UINT16, DistanceField::MORTON, 4}};
+
+    // random racetracks: a border of walls, open space and scattered obstacles
+    const size_t sizes[][2] = {{37, 23}, {130, 90}, {200, 201}};
+    for (const auto & size : sizes) {
+        size_t width = size[0], height = size[1];
+        std::vector<double> map(width * height);
+        for (size_t cell = 0; cell < map.size(); cell++) map[cell] = generator() % 20 == 0 ? 1 : 0;
+        for (const Setup & setup : setups) check_random_edits(map, width, height, 0.05, 60, setup, generator);
+    }
+
+    // walls of a real map, a 300x300 window of levine, as a full set_map() of the whole map after every edit is slow
+    OccupancyMap levine;
+    std::string error;
+    CHECK_MESSAGE(MapLoader::load(F1TENTH_MAPS_DIR "/levine.yaml", levine, &error), "%s", error.c_str());
+    if (levine.width >= 300 and levine.height >= 300) {
+        std::vector<double> values = MapLoader::to_scan_map(levine);
+        size_t size = 300, first_row = levine.height / 2 - size / 2, first_col = levine.width / 2 - size / 2;
+        std::vector<double> map(size * size);
+        for (size_t row = 0; row < size; row++) {
+            for (size_t col = 0; col < size; col++) {
+                map[row * size + col] = values[(first_row + row) * levine.width + first_col + col];
+            }
+        }
+        for (const Setup & setup : setups) check_random_edits(map, size, size, levine.resolution, 40, setup, generator);
+    }
+
+    return test::check_result();
+}
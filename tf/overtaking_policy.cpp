@@ -0,0 +1,157 @@
+#include "f1tenth_simulator/overtaking_policy.hpp"
+
+#include <vector>
+#include <cstdint>
+
+#include <tensorflow/c/c_api.h>
+
+using namespace racecar_simulator;
+
+namespace {
+
+bool check(TF_Status * status, const char * what, std::string * error) {
+    if (TF_GetCode(status) == TF_OK) return true;
+    if (error) *error = std::string(what) + ": " + TF_Message(status);
+    return false;
+}
+
+// the tensors point into the buffers of the caller, which outlive the run
+void keep_data(void *, size_t, void *) {}
+
+}
+
+struct OvertakingPolicy::Impl {
+    OvertakingModelConfig config;
+    TF_Status * status = TF_NewStatus();
+    TF_Graph * graph = nullptr;
+    TF_Session * session = nullptr;
+    TF_Output scan_input = {nullptr, 0};
+    TF_Output state_input = {nullptr, 0};
+    TF_Output output = {nullptr, 0};
+
+    void close() {
+        if (session) {
+            TF_CloseSession(session, status);
+            TF_DeleteSession(session, status);
+            session = nullptr;
+        }
+        if (graph) {
+            TF_DeleteGraph(graph);
+            graph = nullptr;
+        }
+    }
+
+    ~Impl() {
+        close();
+        TF_DeleteStatus(status);
+    }
+};
+
+OvertakingPolicy::OvertakingPolicy() : impl(new Impl()) {}
+
+OvertakingPolicy::~OvertakingPolicy() = default;
+
+bool OvertakingPolicy::load(const OvertakingModelConfig & config, std::string * error) {
+    Impl & d = *impl;
+    d.close();
+    if (config.history == 0 or config.num_beams == 0) {
+        if (error) *error = "history and num_beams must not be 0";
+        return false;
+    }
+
+    TF_SessionOptions * options = TF_NewSessionOptions();
+    if (config.num_threads > 0 and config.num_threads < 128) {
+        // a ConfigProto with intra_op_parallelism_threads (field 2) and inter_op_parallelism_threads (field 5),
+        // one byte varints
+        const uint8_t proto[] = {0x10, uint8_t(config.num_threads), 0x28, 1};
+        TF_SetConfig(options, proto, sizeof(proto), d.status);
+        if (not check(d.status, "TF_SetConfig", error)) {
+            TF_DeleteSessionOptions(options);
+            return false;
+        }
+    }
+
+    const char * tags[] = {"serve"};
+    d.graph = TF_NewGraph();
+    d.session = TF_LoadSessionFromSavedModel(options, nullptr, config.saved_model_dir.c_str(), tags, 1, d.graph,
+                                             nullptr, d.status);
+    TF_DeleteSessionOptions(options);
+    if (not check(d.status, config.saved_model_dir.c_str(), error)) {
+        d.session = nullptr;
+        d.close();
+        return false;
+    }
+
+    TF_Operation * scan_op = TF_GraphOperationByName(d.graph, config.scan_input.c_str());
+    TF_Operation * state_op = TF_GraphOperationByName(d.graph, config.state_input.c_str());
+    TF_Operation * output_op = TF_GraphOperationByName(d.graph, config.output.c_str());
+    if (scan_op == nullptr or state_op == nullptr or output_op == nullptr) {
+        if (error) {
+            *error = config.saved_model_dir + " has no operation " +
+                     (scan_op == nullptr ? config.scan_input : state_op == nullptr ? config.state_input : config.output);
+        }
+        d.close();
+        return false;
+    }
+    d.scan_input = {scan_op, 0};
+    d.state_input = {state_op, 0};
+    d.output = {output_op, 0};
+    d.config = config;
+    return true;
+}
+
+bool OvertakingPolicy::is_loaded() const {
+    return impl->session != nullptr;
+}
+
+const OvertakingModelConfig & OvertakingPolicy::get_config() const {
+    return impl->config;
+}
+
+bool OvertakingPolicy::predict(const float * scans, const float * states, size_t batch, double * commands,
+                               std::string * error) {
+    Impl & d = *impl;
+    if (d.session == nullptr) {
+        if (error) *error = "no model loaded";
+        return false;
+    }
+    if (batch == 0) return true;
+
+    const OvertakingModelConfig & config = d.config;
+    const int64_t scan_dims[3] = {int64_t(batch), int64_t(config.history), int64_t(config.num_beams)};
+    const int64_t state_dims[3] = {int64_t(batch), int64_t(config.history), 2};
+    size_t scan_bytes = batch * config.history * config.num_beams * sizeof(float);
+    size_t state_bytes = batch * config.history * 2 * sizeof(float);
+    // TensorFlow copies the data itself if it is not aligned the way it wants
+    TF_Tensor * inputs[2] = {
+        TF_NewTensor(TF_FLOAT, scan_dims, 3, const_cast<float *>(scans), scan_bytes, keep_data, nullptr),
+        TF_NewTensor(TF_FLOAT, state_dims, 3, const_cast<float *>(states), state_bytes, keep_data, nullptr)
+    };
+    TF_Output input_ops[2] = {d.scan_input, d.state_input};
+    TF_Tensor * output = nullptr;
+    TF_SessionRun(d.session, nullptr, input_ops, inputs, 2, &d.output, &output, 1, nullptr, 0, nullptr, d.status);
+    TF_DeleteTensor(inputs[0]);
+    TF_DeleteTensor(inputs[1]);
+    if (not check(d.status, "TF_SessionRun", error)) {
+        if (output) TF_DeleteTensor(output);
+        return false;
+    }
+
+    // [batch, history, 2], one command per step of the history, the last one is for now
+    bool valid = TF_TensorType(output) == TF_FLOAT and TF_NumDims(output) == 3 and TF_Dim(output, 0) == int64_t(batch) and
+                 TF_Dim(output, 2) == 2 and TF_Dim(output, 1) > 0;
+    if (not valid) {
+        TF_DeleteTensor(output);
+        if (error) *error = "the output of the model is not [batch, history, 2] floats";
+        return false;
+    }
+    const float * values = static_cast<const float *>(TF_TensorData(output));
+    size_t steps = TF_Dim(output, 1);
+    for (size_t b = 0; b < batch; b++) {
+        const float * last = values + (b * steps + steps - 1) * 2;
+        commands[2 * b] = last[0] * config.speed_scale;
+        commands[2 * b + 1] = last[1] * config.steer_scale;
+    }
+    TF_DeleteTensor(output);
+    return true;
+}
@@ -0,0 +1,143 @@
+/**
+ * Replays a scenario the simulator node recorded with scenario_record_file, without ROS and as fast as possible,
+ * and checks every step against the checksums of the recording, see ScenarioReplay.
+ *
+ * usage: replay_scenario file.f1scen [--map yaml] [--repeat n] [--threads n] [--dt-cache-dir dir] [--stop-at-mismatch]
+ * --map replaces the map yaml of the recording (needed if the node got its map from map_server),
+ * --repeat runs the whole scenario n times, e.g. under a profiler, every run must give the same.
+ * Exits with 0 if every step matched, 2 if the replay differs from the recording, 1 on errors.
+ */
+
+#include "f1tenth_simulator/scenario.hpp"
+
+#include <chrono>
+#include <string>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+
+using namespace racecar_simulator;
+
+namespace {
+
+struct Options {
+    std::string file;
+    std::string map_yaml;
+    std::string dt_cache_dir;
+    long repeat = 1;
+    long threads = 1;
+    bool stop_at_mismatch = false;
+};
+
+bool parse_options(int argc, char ** argv, Options & options) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--stop-at-mismatch") {
+            options.stop_at_mismatch = true;
+            continue;
+        }
+        if (arg.compare(0, 2, "--") != 0) {
+            if (not options.file.empty()) {
+                std::fprintf(stderr, "only one scenario file, got %s and %s\n", options.file.c_str(), arg.c_str());
+                return false;
+            }
+            options.file = arg;
+            continue;
+        }
+        if (i + 1 == argc) {
+            std::fprintf(stderr, "%s needs a value\n", arg.c_str());
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--map") {
+            options.map_yaml = value;
+        } else if (arg == "--repeat") {
+            options.repeat = std::max(std::atol(value.c_str()), 1L);
+        } else if (arg == "--threads") {
+            options.threads = std::max(std::atol(value.c_str()), 0L);
+        } else if (arg == "--dt-cache-dir") {
+            options.dt_cache_dir = value;
+        } else {
+            std::fprintf(stderr, "unknown option %s\n", arg.c_str());
+            return false;
+        }
+    }
+    if (options.file.empty()) {
+        std::fprintf(stderr, "usage: replay_scenario file.f1scen [--map yaml] [--repeat n] [--threads n] "
+                             "[--dt-cache-dir dir] [--stop-at-mismatch]\n");
+        return false;
+    }
+    return true;
+}
+
+const char * backend_name(uint32_t backend) {
+    switch (backend) {
+        case ScenarioHeader::RAY_MARCHING: return "ray_marching";
+        case ScenarioHeader::RANGE_LUT: return "range_lut";
+        case ScenarioHeader::CUDA: return "cuda";
+        default: return "unknown";
+    }
+}
+
+}
+
+int main(int argc, char ** argv) {
+    Options options;
+    if (not parse_options(argc, argv, options)) return 1;
+
+    ScenarioReplay replay(options.threads);
+    replay.set_cache_directory(options.dt_cache_dir);
+    std::string error;
+    if (not replay.load(options.file, options.map_yaml, &error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+    const ScenarioHeader & header = replay.get_header();
+    std::printf("%s: %zu cars, %zu steps, %zu events, %.3fs simulated from %.3fs\n", options.file.c_str(),
+                replay.get_cars().size(), replay.get_steps(), replay.get_events().size(),
+                replay.get_events().empty() ? 0. : replay.get_events().back().time - header.start_time,
+                header.start_time);
+    if (header.scan_backend != ScenarioHeader::RAY_MARCHING) {
+        std::printf("recorded with scan_backend %s, the replay scans with ray_marching and may differ\n",
+                    backend_name(header.scan_backend));
+    }
+
+    ScenarioResult first;
+    bool repeatable = true;
+    double total_seconds = 0;
+    for (long run = 0; run < options.repeat; run++) {
+        ScenarioResult result;
+        auto begin = std::chrono::steady_clock::now();
+        replay.run(result, options.stop_at_mismatch);
+        total_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        if (run == 0) {
+            first = result;
+        } else if (result.state_checksum != first.state_checksum or result.scan_checksum != first.scan_checksum or
+                   result.steps != first.steps) {
+            std::printf("run %ld differs from the first run\n", run);
+            repeatable = false;
+        }
+    }
+
+    double seconds_per_run = total_seconds / options.repeat;
+    std::printf("%ld runs, %.3fms per run, %.0f steps per second\n", options.repeat, seconds_per_run * 1e3,
+                seconds_per_run > 0 ? first.steps / seconds_per_run : 0.);
+    for (size_t i = 0; i < first.states.size(); i++) {
+        const CarState & state = first.states[i];
+        std::printf("%s: x %.6f y %.6f theta %.6f velocity %.6f\n", replay.get_cars()[i].name, state.x, state.y,
+                    state.theta, state.velocity_x);
+    }
+
+    if (not first.matched()) {
+        std::printf("MISMATCH: %zu of %zu steps differ, the first is step %zu at %.6fs (%s%s%s)\n",
+                    first.mismatched_steps, first.steps, first.first_mismatch, first.first_mismatch_time,
+                    first.state_mismatch ? "cars" : "", first.state_mismatch and first.scan_mismatch ? " and " : "",
+                    first.scan_mismatch ? "scans" : "");
+        return 2;
+    }
+    if (not repeatable) return 2;
+    std::printf("all %zu steps match the recording\n", first.steps);
+    return 0;
+}